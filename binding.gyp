@@ -6,7 +6,18 @@
     ],
     "conditions": [
       ['OS=="mac"', {
-        'sources' : [ "src/macadam.cc", "src/Capture.cc", "src/Playback.cc" ],
+        'sources' : [ "src/macadam.cc", "src/Capture.cc", "src/Playback.cc",
+          "src/Formats.cc", "src/Downscale.cc", "src/Fields.cc",
+          "src/TestPattern.cc", "src/Overlay.cc",
+          "src/AudioConvert.cc", "src/Analysis.cc",
+          "src/AudioMeter.cc", "src/AudioAlarm.cc",
+          "src/Hash.cc", "src/Quality.cc",
+          "src/AudioRing.cc", "src/Resampler.cc",
+          "src/TrickPlay.cc", "src/Playlist.cc",
+          "src/Timeshift.cc", "src/Segments.cc",
+          "src/WaveFile.cc", "src/Y4M.cc",
+          "src/Lossless.cc", "src/SharedFrames.cc",
+          "src/Environment.cc", "src/FrameRing.cc" ],
         'xcode_settings': {
           'GCC_ENABLE_CPP_RTTI': 'YES',
           'MACOSX_DEPLOYMENT_TARGET': '10.7',
@@ -25,7 +36,18 @@
         ]
       }],
       ['OS=="linux"', {
-        'sources' : [ "src/macadam.cc", "src/Capture.cc", "src/Playback.cc" ],
+        'sources' : [ "src/macadam.cc", "src/Capture.cc", "src/Playback.cc",
+          "src/Formats.cc", "src/Downscale.cc", "src/Fields.cc",
+          "src/TestPattern.cc", "src/Overlay.cc",
+          "src/AudioConvert.cc", "src/Analysis.cc",
+          "src/AudioMeter.cc", "src/AudioAlarm.cc",
+          "src/Hash.cc", "src/Quality.cc",
+          "src/AudioRing.cc", "src/Resampler.cc",
+          "src/TrickPlay.cc", "src/Playlist.cc",
+          "src/Timeshift.cc", "src/Segments.cc",
+          "src/WaveFile.cc", "src/Y4M.cc",
+          "src/Lossless.cc", "src/SharedFrames.cc",
+          "src/Environment.cc", "src/FrameRing.cc" ],
         'link_settings' : {
           "libraries": [
             "/usr/lib/libDeckLinkAPI.so"
@@ -40,6 +62,17 @@
       }],
       ['OS=="win"', {
         "sources" : [ "src/macadam.cc", "src/Capture.cc", "src/Playback.cc",
+          "src/Formats.cc", "src/Downscale.cc", "src/Fields.cc",
+          "src/TestPattern.cc", "src/Overlay.cc",
+          "src/AudioConvert.cc", "src/Analysis.cc",
+          "src/AudioMeter.cc", "src/AudioAlarm.cc",
+          "src/Hash.cc", "src/Quality.cc",
+          "src/AudioRing.cc", "src/Resampler.cc",
+          "src/TrickPlay.cc", "src/Playlist.cc",
+          "src/Timeshift.cc", "src/Segments.cc",
+          "src/WaveFile.cc", "src/Y4M.cc",
+          "src/Lossless.cc", "src/SharedFrames.cc",
+          "src/Environment.cc", "src/FrameRing.cc",
           "decklink/Win/include/DeckLinkAPI_i.c" ],
         "configurations": {
           "Release": {
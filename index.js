@@ -50,6 +50,7 @@ var bindings = require('bindings');
 var macadamNative = bindings('macadam');
 const util = require('util');
 const EventEmitter = require('events');
+const { Readable, Writable } = require('stream');
 
 // var SegfaultHandler = require('../node-segfault-handler');
 // SegfaultHandler.registerHandler("crash.log");
@@ -62,7 +63,10 @@ function Capture (deviceIndex, displayMode, pixelFormat) {
   } else {
     this.capture = new macadamNative.Capture(deviceIndex, displayMode, pixelFormat);
   }
+  this.displayMode = displayMode;
+  this.pixelFormat = pixelFormat;
   this.initialised = false;
+  this.streams = 0;
   EventEmitter.call(this);
 }
 
@@ -77,8 +81,10 @@ Capture.prototype.start = function () {
         return 'Cannot start capture when no device is present.';
       }
     }
-    this.capture.doCapture((v, a) => {
-      this.emit('frame', v, a);
+    this.capture.doCapture((v, a, m) => {
+      if (this.frameRing) Atomics.notify(this.frameRing, 0);
+      if (!this.frameRing || this.deliverFrames || this.streams > 0)
+        this.emit('frame', v, a, m);
     });
   } catch (err) {
     this.emit('error', err);
@@ -103,6 +109,8 @@ Capture.prototype.enableAudio = function (sampleRate, sampleType, channelCount)
         return 'Cannot initialise audio when no device is present.';
       }
     }
+    this.audioChannels = typeof channelCount === 'undefined' ? 2 : +channelCount;
+    this.audioSampleType = typeof sampleType === 'undefined' ? 16 : +sampleType;
     return this.capture.enableAudio(
       typeof sampleRate === 'string' ? +sampleRate : sampleRate,
       typeof sampleType === 'string' ? +sampleType: sampleType,
@@ -112,6 +120,306 @@ Capture.prototype.enableAudio = function (sampleRate, sampleType, channelCount)
   }
 }
 
+// Meter every audio packet natively. Returns a Float64Array, laid out as
+// described by macadam.meterFields, that is updated in place with each frame.
+// Optional weights are the BS.1770 loudness weights per channel. Pass false
+// to stop metering.
+Capture.prototype.setMetering = function (weights) {
+  try {
+    if (weights === false) {
+      this.capture.setMetering(null);
+      return null;
+    }
+    var meters = new Float64Array(meterLength(this.audioChannels || 2));
+    meters.fill(-Infinity);
+    meters[meterFields.sampleFrames] = 0;
+    this.capture.setMetering(meters, weights);
+    return meters;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Watch channel pairs, e.g. [ [ 0, 1 ], [ 2, 3 ] ], for silence, mono and
+// phase inversion. An 'audioAlarm' event is emitted only when an alarm is
+// raised or cleared. Options: silenceLevel (dBFS), silenceDuration (s),
+// window (s), monoLevel, phaseLevel and hysteresis. Pass null to stop.
+Capture.prototype.setAudioAlarms = function (pairs, options) {
+  try {
+    return this.capture.setAudioAlarms(pairs, options || {}, (events) => {
+      events.forEach((e) => { this.emit('audioAlarm', e); });
+    });
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Deliver only a downscaled proxy of each frame, scaled on the capture thread.
+// Call with no width or height to go back to full frames.
+Capture.prototype.setProxy = function (width, height, pixelFormat, filter) {
+  try {
+    return this.capture.setProxy(width, height, pixelFormat, filter);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Convert audio natively before it is delivered. Format is 'int16', 'int32'
+// or 'float32', layout 'interleaved' or 'planar', and channelMap optionally
+// selects, reorders, duplicates or mixes channels (see convertAudio). Call
+// with no arguments to receive the card's own samples again.
+Capture.prototype.setAudioFormat = function (format, layout, channelMap) {
+  try {
+    return this.capture.setAudioFormat(format, layout, channelMap);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Compute QC metrics natively for every frame, delivered as the third argument
+// of the frame event. Options: subsample (or stepX and stepY), blackLevel,
+// blackRatio and freezeLevel. Pass false to stop.
+Capture.prototype.setAnalysis = function (options) {
+  try {
+    return this.capture.setAnalysis(options === undefined ? true : options);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Hash the video and audio of every frame as received, 'xxh64' or 'crc32c'.
+// Hashes are added to the frame metadata as videoHash and audioHash.
+Capture.prototype.setHashing = function (type) {
+  try {
+    return this.capture.setHashing(type === undefined ? 'xxh64' : type);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Record every frame received into a macadam.Timeshift ring, or stop with null.
+Capture.prototype.setTimeshift = function (ring) {
+  try {
+    return this.capture.setTimeshift(ring === undefined ? null : ring);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Record frames natively into rotating segment files in options.directory,
+// named prefix, an eight digit index and extension. Segments are options.frames
+// frames long, or options.seconds rounded to a whole frame. Only the newest
+// options.retain segments are kept when set. A 'segmentClosed' event follows
+// each completed file, with its frame range, and 'segmentDeleted' each file
+// removed for retention. With options.lossless, 2vuy and v210 frames are
+// coded losslessly on that many threads (true for half the processors).
+Capture.prototype.startRecording = function (options) {
+  try {
+    options = Object.assign({
+      prefix : '',
+      retain : 0,
+      queue : 16
+    }, typeof options === 'string' ? { directory : options } : options);
+    if (options.lossless === true)
+      options.lossless = Math.max(1, Math.floor(os.cpus().length / 2));
+    if (typeof options.extension !== 'string')
+      options.extension = options.lossless ? '.mlc' :
+        '.' + formatFourCC(this.pixelFormat).toLowerCase();
+    options.width = modeWidth(this.displayMode);
+    options.height = modeHeight(this.displayMode);
+    if (typeof options.frames !== 'number') {
+      var duration = modeGrainDuration(this.displayMode);
+      options.frames = Math.max(1, Math.round(
+        (options.seconds || 60) * duration[1] / duration[0]));
+    }
+    var frameBytes = formatRowBytes(this.pixelFormat, modeWidth(this.displayMode)) *
+      modeHeight(this.displayMode);
+    var result = this.capture.startRecording(options, frameBytes, (events) => {
+      events.forEach((e) => {
+        if (e.type === 'closed') this.emit('segmentClosed', e);
+        else if (e.type === 'deleted') this.emit('segmentDeleted', e);
+        else this.emit('error', new Error('Recording to ' + e.path + ' failed: ' + e.error));
+      });
+    });
+    if (result !== 'Recording started.')
+      throw new Error(result);
+    return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Stops after the queued frames are written. The last segment is shortened
+// to what was recorded and its 'segmentClosed' event follows.
+Capture.prototype.stopRecording = function () {
+  try {
+    return this.capture.stopRecording();
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Frames offered, written and dropped, the segment being written, segments
+// closed and deleted, rotations without a pre-allocated file and queue depth.
+Capture.prototype.recordingStatus = function () {
+  return this.capture.recordingStatus();
+}
+
+// Record the audio natively to Broadcast WAV, as enabled with enableAudio.
+// Options: path, splitMono (one file per channel, _1.wav, _2.wav ...), bits
+// (16, 24 or 32), buffer (bytes gathered per write), description, originator
+// and originatorReference for the bext chunk. The time reference is taken
+// from the timecode of the first frame. Files over 4GB are written as RF64.
+Capture.prototype.startAudioRecording = function (options) {
+  try {
+    var result = this.capture.startAudioRecording(
+      typeof options === 'string' ? { path : options } : options);
+    if (result !== 'Audio recording started.')
+      throw new Error(result);
+    return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Returns the files written, sample frames, bytes, frames dropped, whether
+// any file became RF64 and any error.
+Capture.prototype.stopAudioRecording = function () {
+  try {
+    return this.capture.stopAudioRecording();
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+Capture.prototype.audioRecordingStatus = function () {
+  return this.capture.audioRecordingStatus();
+}
+
+// Stream frames natively as Y4M (YUV4MPEG2, planar 4:2:2 at 8 or 10 bits) to
+// a file, a FIFO or a file descriptor, for an encoder such as ffmpeg to read.
+// A FIFO's reader must already be running. Frames are dropped, not queued
+// without limit, if the encoder falls behind. Options: depth (8 or 10,
+// defaulting to the capture's) and queue (frames). setY4MOutput(null) stops
+// and returns the final status.
+Capture.prototype.setY4MOutput = function (target, options) {
+  try {
+    if (target === undefined || target === null)
+      return this.capture.setY4MOutput(null);
+    var duration = modeGrainDuration(this.displayMode);
+    options = Object.assign({
+      width : modeWidth(this.displayMode),
+      height : modeHeight(this.displayMode),
+      rateNum : duration[1],
+      rateDen : duration[0],
+      interlace : !modeInterlace(this.displayMode) ? 'p' :
+        ((this.displayMode === macadam.bmdModeNTSC ||
+          this.displayMode === macadam.bmdModeNTSC2398) ? 'b' : 't'),
+      queue : 8
+    }, options);
+    var result = this.capture.setY4MOutput(target, options);
+    if (result !== 'Y4M output started.')
+      throw new Error(result);
+    return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Frames written and dropped, frames queued and any write error.
+Capture.prototype.y4mOutputStatus = function () {
+  return this.capture.y4mOutputStatus();
+}
+
+// Sizes of a frame and its audio for the capture's mode, format and audio.
+function slotSizes (capture) {
+  var duration = modeGrainDuration(capture.displayMode);
+  var maxSamples = Math.ceil(48000 * duration[0] / duration[1]) + 16;
+  var width = modeWidth(capture.displayMode);
+  var height = modeHeight(capture.displayMode);
+  var rowBytes = formatRowBytes(capture.pixelFormat, width);
+  return {
+    width : width,
+    height : height,
+    rowBytes : rowBytes,
+    frameBytes : rowBytes * height,
+    audioBytes : capture.audioChannels ?
+      maxSamples * capture.audioChannels * (capture.audioSampleType === 32 ? 4 : 2) : 0
+  };
+}
+
+// Publish every captured frame, with its audio, into a ring in named shared
+// memory for other processes on the same host to read with FrameSubscriber.
+// Each frame is copied once into the ring. Options: frames (slots in the ring,
+// default 8), frameBytes and audioBytes (slot sizes, defaulting to the mode
+// and the audio enabled). setSharedOutput(null) stops and returns the final
+// status.
+Capture.prototype.setSharedOutput = function (name, options) {
+  try {
+    if (name === undefined || name === null)
+      return this.capture.setSharedOutput(null);
+    options = Object.assign({ frames : 8 }, slotSizes(this), options);
+    var result = this.capture.setSharedOutput(name, options);
+    if (result !== 'Shared output started.')
+      throw new Error(result);
+    return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Name, frames published and size in bytes of the shared ring.
+Capture.prototype.sharedOutputStatus = function () {
+  return this.capture.sharedOutputStatus();
+}
+
+// Bytes of SharedArrayBuffer needed for a frame ring of this many frames, for
+// the mode, pixel format and audio of the capture. Enable audio first.
+Capture.prototype.frameRingBytes = function (frames) {
+  var sizes = slotSizes(this);
+  return macadamNative.frameRingBytes(frames, sizes.frameBytes, sizes.audioBytes);
+}
+
+// Write every frame, with its audio, into a SharedArrayBuffer that worker
+// threads read in place with FrameRing, waiting on its Atomics counter. The
+// frame events carry no video or audio, so that this thread does not touch
+// the pixels, unless the deliver option is set. A stream() still takes
+// whole frames on this thread. Options: frames (defaulting to as many as
+// fit) and deliver. setFrameRing(null) closes the ring.
+Capture.prototype.setFrameRing = function (buffer, options) {
+  try {
+    if (buffer === undefined || buffer === null) {
+      var stopped = this.capture.setFrameRing(null);
+      if (this.frameRing) Atomics.notify(this.frameRing, 0);
+      this.frameRing = null;
+      return stopped;
+    }
+    options = Object.assign({ frames : 0, deliver : false }, slotSizes(this), options);
+    var result = this.capture.setFrameRing(buffer, options);
+    if (result !== 'Frame ring started.')
+      throw new Error(result);
+    this.frameRing = new Int32Array(buffer, 0, frameRingHeader);
+    this.deliverFrames = options.deliver === true;
+    return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// A Readable stream of the frames captured from now on - see CaptureStream.
+Capture.prototype.stream = function (options) {
+  return new CaptureStream(this, options);
+}
+
+// Deliver interlaced frames as an array of two field buffers, in temporal order.
+Capture.prototype.setFieldMode = function (enable) {
+  try {
+    return this.capture.setFieldMode(enable === undefined ? true : enable);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
 function Playback (deviceIndex, displayMode, pixelFormat) {
   if (arguments.length !== 3 || typeof deviceIndex !== 'number' ||
       typeof displayMode !== 'number' || typeof pixelFormat !== 'number' ) {
@@ -132,8 +440,16 @@ Playback.prototype.start = function () {
       console.log("*** playback.init", this.playback.init());
       this.initialised = true;
     }
-    console.log("*** playback.doPlayback", this.playback.doPlayback(function (x) {
-      this.emit('played', x);
+    console.log("*** playback.doPlayback", this.playback.doPlayback(function (x, report) {
+      this.emit('played', x, report);
+      if (report && report.item !== undefined) {
+        if (report.item !== this.playlistItem) {
+          if (this.playlistItem !== undefined) this.emit('itemEnd', this.playlistItem);
+          this.playlistItem = report.item;
+          this.emit('itemStart', report.item);
+        }
+        this.emit('progress', report.item, report.itemFrame);
+      }
     }.bind(this)));
   } catch (err) {
     this.emit('error', err);
@@ -157,6 +473,272 @@ Playback.prototype.frame = function (f, a) {
   }
 }
 
+// Schedule a frame at an absolute stream time, in the units of the clock's
+// timeScale, for a splice. Frames sent afterwards follow on from it.
+Playback.prototype.frameAt = function (streamTime, f, a) {
+  try {
+    if (!this.initialised) {
+      this.playback.init();
+      this.initialised = true;
+    }
+    var result = this.playback.scheduleFrame(f, a, streamTime);
+    if (typeof result === 'string')
+      throw new Error("Problem scheduling frame: " + result);
+    else
+      return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Start the next frame sent at an exact time, after start(). The time is a
+// hardware reference clock time as from referenceClock(), a Date or
+// milliseconds since the epoch as { wallClock: ms }, or a time of day
+// timecode 'hh:mm:ss:ff', or 'hh:mm:ss;ff' for drop frame at 29.97 and
+// 59.94. Timecode is counted in real frames since midnight, as for the BWF
+// time reference of an audio recording, and a time already passed today is
+// taken as tomorrow's. Returns the frame number, stream and hardware times of
+// the cue.
+Playback.prototype.cue = function (at) {
+  try {
+    var result;
+    if (typeof at === 'number') {
+      result = this.playback.cue(at, false);
+    } else if (at instanceof Date) {
+      result = this.playback.cue(at.getTime(), true);
+    } else if (typeof at === 'object' && typeof at.wallClock === 'number') {
+      result = this.playback.cue(at.wallClock, true);
+    } else if (typeof at === 'string') {
+      var tc = at.match(/^(\d{2}):(\d{2}):(\d{2})([:;.])(\d{2})$/);
+      var clock = this.playback.referenceClock();
+      if (!tc || !clock)
+        throw new Error('Cue timecode must be hh:mm:ss:ff and playback initialised.');
+      var fps = Math.ceil(clock.timeScale / clock.frameDuration);
+      var dropFrame = tc[4] !== ':';
+      if (dropFrame && clock.timeScale % clock.frameDuration === 0)
+        throw new Error('Drop frame timecode needs a 29.97 or 59.94 mode.');
+      var minutes = +tc[1] * 60 + +tc[2];
+      var frames = (minutes * 60 + +tc[3]) * fps + +tc[5];
+      if (+tc[5] >= fps || +tc[2] > 59 || +tc[3] > 59 || (dropFrame && +tc[3] === 0 &&
+          +tc[5] < fps / 15 && +tc[2] % 10 !== 0))
+        throw new Error('Cue timecode ' + at + ' does not exist.');
+      if (dropFrame)
+        frames -= (fps / 15) * (minutes - Math.floor(minutes / 10));
+      var ms = frames * clock.frameDuration * 1000 / clock.timeScale;
+      var when = new Date();
+      when.setHours(0, 0, 0, ms);
+      if (when.getTime() < Date.now()) {
+        when.setHours(24, 0, 0, 0);
+        when.setHours(0, 0, 0, ms);
+      }
+      result = this.playback.cue(when.getTime(), true);
+    } else {
+      throw new Error('Cue time must be a hardware time, Date, { wallClock } or timecode.');
+    }
+    if (typeof result === 'string')
+      throw new Error("Problem cueing playback: " + result);
+    else
+      return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// What to play natively when frames are not sent in time: 'hold' repeats the
+// last frame, 'slate' plays options.slate (a frame buffer), 'black' plays
+// black and 'none' lets the output run dry. Substitutes are scheduled while
+// fewer than options.threshold (default 2) frames are queued.
+Playback.prototype.setUnderrunPolicy = function (policy, options) {
+  options = options || {};
+  try {
+    if (!this.initialised) {
+      this.playback.init();
+      this.initialised = true;
+    }
+    return this.playback.setUnderrunPolicy(policy || 'none', options.threshold,
+      options.slate);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Counts of underruns and of the frames substituted for them.
+Playback.prototype.underrunStatus = function () {
+  return this.playback.underrunStatus();
+}
+
+// Play a file of raw frames in the playback mode and pixel format natively,
+// for replay. The clip starts paused on its first frame - control it with
+// shuttle(), jog() and seek(). Options header and framePrefix give the bytes
+// before the first frame and before each frame. Returns the number of frames.
+Playback.prototype.openClip = function (path, options) {
+  options = options || {};
+  try {
+    if (!this.initialised) {
+      this.playback.init();
+      this.initialised = true;
+    }
+    var result = this.playback.openClip(path, options.header, options.framePrefix);
+    if (typeof result === 'string')
+      throw new Error("Problem opening clip: " + result);
+    else
+      return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+Playback.prototype.closeClip = function () {
+  return this.playback.closeClip();
+}
+
+// Play the clip at a speed from -8 to 8, where 0 pauses and negative speeds
+// play in reverse. Frames are repeated or skipped and audio is muted.
+Playback.prototype.shuttle = function (speed) {
+  try {
+    return this.playback.shuttle(speed);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Pause the clip and step by a number of frames, 1 by default.
+Playback.prototype.jog = function (frames) {
+  return this.playback.jog(frames);
+}
+
+Playback.prototype.seek = function (frame) {
+  return this.playback.seekClip(frame);
+}
+
+// Play head position, speed and read ahead cache counters of the clip.
+Playback.prototype.clipStatus = function () {
+  return this.playback.clipStatus();
+}
+
+// Replace the playlist with a cue sheet - an array of items, each with one of
+// file (a clip file), directory (one file per frame) or frames (an array of
+// buffers), and optionally in and out frames (out exclusive), dissolve (frames
+// of dissolve from the previous item), header and framePrefix. Returns the
+// item ids used in itemStart, itemEnd and progress events.
+Playback.prototype.cueSheet = function (items) {
+  try {
+    if (!this.initialised) {
+      this.playback.init();
+      this.initialised = true;
+    }
+    this.playback.playlistClear();
+    return this.appendItems(items);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Add items to the end of the playlist, gaplessly if it is still playing.
+Playback.prototype.appendItems = function (items) {
+  try {
+    return (Array.isArray(items) ? items : [ items ]).map(function (item) {
+      var result = this.playback.playlistAdd(item);
+      if (typeof result === 'string')
+        throw new Error("Problem adding to playlist: " + result);
+      return result;
+    }.bind(this));
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Play the playlist natively in place of frames sent from JS.
+Playback.prototype.playPlaylist = function () {
+  var result = this.playback.playlistStart();
+  if (typeof result === 'string')
+    this.emit('error', new Error("Problem playing playlist: " + result));
+  return result;
+}
+
+Playback.prototype.clearPlaylist = function () {
+  return this.playback.playlistClear();
+}
+
+// The item being read ahead, items left, frames queued and miss counts.
+Playback.prototype.playlistStatus = function () {
+  return this.playback.playlistStatus();
+}
+
+// Play frames back from a macadam.Timeshift ring while it is still recording.
+// Start a delay of frames behind the newest, { delay : 250 }, or at an
+// absolute frame number, { frame : 1200 }. Defaults to the oldest frame kept.
+Playback.prototype.playTimeshift = function (ring, at) {
+  try {
+    var result = (at && typeof at.delay === 'number') ?
+      this.playback.playTimeshift(ring, at.delay, true) :
+      this.playback.playTimeshift(ring, (at && at.frame) ? at.frame : 0, false);
+    if (typeof result === 'string')
+      throw new Error("Problem playing timeshift: " + result);
+    return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Move the timeshift play position, with the same arguments as playTimeshift.
+Playback.prototype.timeshiftSeek = function (at) {
+  var result = (at && typeof at.delay === 'number') ?
+    this.playback.timeshiftSeek(at.delay, true) :
+    this.playback.timeshiftSeek((at && at.frame) ? at.frame : 0, false);
+  if (typeof result === 'string')
+    this.emit('error', new Error("Problem seeking timeshift: " + result));
+  return result;
+}
+
+// Play position, frames behind the recording, repeats and skipped frames.
+Playback.prototype.timeshiftStatus = function () {
+  return this.playback.timeshiftStatus();
+}
+
+// Stop playing from the ring and release it, so that frames can be scheduled
+// again. Frames already scheduled play out.
+Playback.prototype.stopTimeshift = function () {
+  return this.playback.stopTimeshift();
+}
+
+// Play a Y4M stream of planar 4:2:2 frames the size of the playback, from a
+// file, a FIFO or a file descriptor - typically a decoder such as ffmpeg
+// writing into a FIFO. Frames are read ahead, { queue : 8 }, and the last
+// frame is held if the decoder falls behind. Stopped by stopY4M or by
+// starting another source.
+Playback.prototype.playY4M = function (source, options) {
+  try {
+    var result = this.playback.playY4M(source,
+      (options && typeof options.queue === 'number') ? options.queue : 8);
+    if (result !== 'Y4M playing.')
+      throw new Error("Problem playing Y4M: " + result);
+    return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+Playback.prototype.stopY4M = function () {
+  return this.playback.stopY4M();
+}
+
+// Frames read and shown, queued, repeated while waiting for the decoder,
+// whether the stream has started or ended, its depth and rate.
+Playback.prototype.y4mStatus = function () {
+  return this.playback.y4mStatus();
+}
+
+// The hardware reference clock, stream time and wall clock read together.
+Playback.prototype.referenceClock = function () {
+  return this.playback.referenceClock();
+}
+
+// A Writable stream of frames to play - see PlaybackStream.
+Playback.prototype.stream = function (options) {
+  return new PlaybackStream(this, options);
+}
+
 Playback.prototype.stop = function () {
   try {
     console.log('*** playback stop', this.playback.stop());
@@ -184,10 +766,460 @@ Playback.prototype.enableAudio = function (sampleRate, sampleType, channelCount)
   }
 }
 
+// Play audio continuously from a native ring buffer rather than with each
+// frame. Audio passed to frame() or writeAudio() is queued and the card is
+// topped up to options.latency sample frames (default 100ms) independently of
+// video. options.capacity sets the size of the ring (default 1 second).
+Playback.prototype.enableAudioRing = function (sampleRate, sampleType, channelCount, options) {
+  options = options || {};
+  try {
+    if (!this.initialised) {
+      this.initialised = this.playback.init() ? true : false;
+      if (!this.initialised) {
+        console.error('Cannot initialise audio when no device is present.');
+        return 'Cannot initialise audio when no device is present.';
+      }
+    }
+    return this.playback.enableAudioRing(
+      typeof sampleRate === 'string' ? +sampleRate : sampleRate,
+      typeof sampleType === 'string' ? +sampleType: sampleType,
+      typeof channelCount === 'string' ? +channelCount : channelCount,
+      options.latency, options.capacity);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Queue audio for the ring. Returns the number of sample frames accepted,
+// fewer than given when the ring is full.
+Playback.prototype.writeAudio = function (buffer) {
+  try {
+    var result = this.playback.writeAudio(buffer);
+    if (typeof result === 'string')
+      throw new Error("Problem writing audio: " + result);
+    else
+      return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Resample ring audio to follow a source running on a different clock. The
+// audio queued is held at the level it settles to, with corrections of up to
+// maxPPM (default 1000) parts per million.
+Playback.prototype.setDriftCompensation = function (enable, maxPPM) {
+  try {
+    return this.playback.setDriftCompensation(enable !== false, maxPPM);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Ring buffer levels and underrun counters, or null without an audio ring.
+Playback.prototype.audioStatus = function () {
+  return this.playback.audioStatus();
+}
+
+// Play a natively generated test pattern. Frames are rendered once into a
+// pool and rescheduled by the native code, so no frames need to be sent.
+// Options: frames (pool size), counter and box (burn-in overlays).
+Playback.prototype.testPattern = function (pattern, options) {
+  options = options || {};
+  try {
+    if (!this.initialised) {
+      this.playback.init();
+      this.initialised = true;
+    }
+    var result = this.playback.setTestPattern(pattern, options.frames,
+      options.counter === true, options.box === true);
+    if (typeof result === 'string')
+      throw new Error("Problem starting test pattern: " + result);
+    else
+      return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Describe the audio passed to frame() when it is not already in the format
+// audio was enabled with. The channel map has one entry per output channel.
+Playback.prototype.setAudioFormat = function (format, layout, channels, channelMap) {
+  try {
+    return this.playback.setAudioFormat(format, layout, channels, channelMap);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Hash the video and audio of every frame as it is scheduled, 'xxh64' or
+// 'crc32c'. Hashes are included in the report passed with each played event.
+Playback.prototype.setHashing = function (type) {
+  try {
+    return this.playback.setHashing(type === undefined ? 'xxh64' : type);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Blend a macadam.Overlay into every frame passed to frame(). Layers 0 to 7
+// are drawn in order; alpha is a global opacity from 0 to 1.
+Playback.prototype.setOverlay = function (layer, overlay, x, y, alpha) {
+  try {
+    return this.playback.setOverlay(layer, overlay, x || 0, y || 0,
+      typeof alpha === 'number' ? alpha : 1.0);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+Playback.prototype.clearOverlay = function (layer) {
+  try {
+    return this.playback.clearOverlay(layer);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
 Playback.prototype.testStuff = function () {
   this.playback.testStuff();
 }
 
+// Measures the quality of a loopback, playing frames out and capturing them
+// back. Frames passed to scheduled() are kept as references and each frame
+// passed to captured() is compared with its reference on the thread pool,
+// emitting a 'quality' event with PSNR and SSIM per plane. Options:
+//   align - 'counter' to burn a frame counter into each scheduled frame and
+//           read it back, or 'frame' to match by capture order
+//   offset - for 'frame' alignment, capture index minus frame number
+//   ssim - set false for PSNR only
+//   window - number of reference frames kept
+function LoopbackTest (mode, pixelFormat, options) {
+  options = options || {};
+  this.width = modeWidth(mode);
+  this.height = modeHeight(mode);
+  this.pixelFormat = pixelFormat;
+  this.align = options.align || 'counter';
+  this.offset = options.offset || 0;
+  this.ssim = options.ssim !== false;
+  this.window = options.window || 100;
+  this.references = new Map();
+  this.captureCount = 0;
+  EventEmitter.call(this);
+}
+
+util.inherits(LoopbackTest, EventEmitter);
+
+// Call before sending a frame to playback. With counter alignment the frame
+// number is written into the top rows of the frame in place.
+LoopbackTest.prototype.scheduled = function (frame, frameNumber) {
+  if (this.align === 'counter')
+    macadamNative.embedFrameCounter(frame, this.width, this.height,
+      this.pixelFormat, frameNumber);
+  this.references.set(frameNumber, frame);
+  if (this.references.size > this.window)
+    this.references.delete(this.references.keys().next().value);
+  return frame;
+}
+
+LoopbackTest.prototype.captured = function (frame) {
+  var index = this.captureCount++;
+  var frameNumber = (this.align === 'counter') ?
+    macadamNative.readFrameCounter(frame, this.width, this.height, this.pixelFormat) :
+    index - this.offset;
+  if (frameNumber === null) {
+    this.emit('unaligned', { captured : index });
+    return;
+  }
+  var reference = this.references.get(frameNumber);
+  if (!reference) {
+    this.emit('missing', { frame : frameNumber, captured : index });
+    return;
+  }
+  macadamNative.compareFrames(reference, frame, this.width, this.height,
+    this.pixelFormat, this.ssim, (err, quality) => {
+      if (err) return this.emit('error', err);
+      quality.frame = frameNumber;
+      quality.captured = index;
+      this.emit('quality', quality);
+    });
+}
+
+// Reads the frames that a Capture in this or another process publishes with
+// setSharedOutput. start() emits 'frame' with {frame, video, audio,
+// audioFrames, streamTime, frameDuration} for every frame as it arrives,
+// 'dropped' with a count when frames were overwritten before they could be
+// read and 'end' when the publisher stops. With zeroCopy, video and audio are
+// read-only views into the ring rather than copies - writing to them crashes
+// the process, and isCurrent(frame) must be checked after using them in case
+// the publisher has since overwritten the slot.
+function FrameSubscriber (name) {
+  EventEmitter.call(this);
+  this.subscriber = new macadamNative.FrameSubscriber(name);
+}
+
+util.inherits(FrameSubscriber, EventEmitter);
+
+FrameSubscriber.prototype.start = function (options) {
+  try {
+    options = options || {};
+    var result = this.subscriber.start((frames, dropped, ended) => {
+      if (dropped > 0) this.emit('dropped', dropped);
+      frames.forEach(f => { this.emit('frame', f); });
+      if (ended) this.emit('end');
+    }, options.zeroCopy === true);
+    if (result !== 'Subscribed.')
+      throw new Error(result);
+    return result;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+FrameSubscriber.prototype.stop = function () {
+  return this.subscriber.stop();
+}
+
+FrameSubscriber.prototype.close = function () {
+  return this.subscriber.close();
+}
+
+// The frame with this number if it is still in the ring, otherwise null.
+FrameSubscriber.prototype.read = function (frame, zeroCopy) {
+  return this.subscriber.read(frame, zeroCopy === true);
+}
+
+FrameSubscriber.prototype.isCurrent = function (frame) {
+  return this.subscriber.isCurrent(frame);
+}
+
+FrameSubscriber.prototype.status = function () {
+  return this.subscriber.status();
+}
+
+// A Readable, in object mode, of whole frames from a capture as { frame,
+// video, audio, audioFrames, streamTime, frameDuration }. Frames are copied
+// into a native queue of slots, sized for the mode and audio, while the
+// stream is not being read. Once highWaterMark frames are waiting, the
+// oldest is dropped - or the one arriving, with drop: 'newest' - and
+// 'dropped' is emitted, so memory stays bounded however slow the consumer.
+// A capture feeds one stream at a time. While streaming, the capture's
+// frame events carry metadata only, and are what wakes the stream, so they
+// are emitted even with a frame ring set without deliver. The stream ends
+// when the capture stops.
+function CaptureStream (capture, options) {
+  if (capture.streams > 0)
+    throw new Error('A capture can only feed one stream at a time.');
+  options = Object.assign({ highWaterMark : 4, drop : 'oldest' }, options);
+  Readable.call(this, { objectMode : true, highWaterMark : options.highWaterMark });
+  this.capture = capture;
+  this.reading = false;
+  this.dropped = 0;
+  this.attached = true;
+  capture.streams++;
+  capture.capture.setFrameQueue(options.highWaterMark, options.drop, slotSizes(capture));
+  this.onFrame = () => {
+    var dropped = capture.capture.frameQueueStatus().dropped;
+    if (dropped > this.dropped) {
+      this.emit('dropped', dropped - this.dropped);
+      this.dropped = dropped;
+    }
+    this.take();
+  };
+  this.onDone = () => {
+    var frame; // what is left, however full the stream's buffer
+    while ((frame = capture.capture.takeFrame()) !== null)
+      this.push(frame);
+    this.push(null);
+    this.detach();
+  };
+  capture.on('frame', this.onFrame);
+  capture.on('done', this.onDone);
+}
+
+util.inherits(CaptureStream, Readable);
+
+CaptureStream.prototype._read = function () {
+  this.reading = true;
+  this.take();
+}
+
+CaptureStream.prototype.take = function () {
+  var frame;
+  while (this.reading && (frame = this.capture.capture.takeFrame()) !== null)
+    this.reading = this.push(frame);
+}
+
+CaptureStream.prototype.detach = function () {
+  if (!this.attached) return;
+  this.attached = false;
+  this.capture.streams--;
+  this.capture.removeListener('frame', this.onFrame);
+  this.capture.removeListener('done', this.onDone);
+  this.capture.capture.setFrameQueue(0);
+}
+
+CaptureStream.prototype._destroy = function (err, cb) {
+  this.detach();
+  cb(err);
+}
+
+// A Writable, in object mode, of frames to play - each a video Buffer or
+// { video, audio }. Playback starts once preroll frames are scheduled, by
+// default highWaterMark. After that, a write only completes while the driver
+// has fewer than highWaterMark frames buffered, so a source faster than real
+// time waits for the card rather than queueing without limit. Ending the
+// stream stops playback once the driver has played everything out.
+function PlaybackStream (playback, options) {
+  options = Object.assign({ highWaterMark : 4 }, options);
+  Writable.call(this, { objectMode : true, highWaterMark : options.highWaterMark });
+  this.playback = playback;
+  this.limit = options.highWaterMark;
+  this.preroll = options.preroll || options.highWaterMark;
+  this.scheduled = 0;
+  this.played = 0;
+  this.waiting = null;
+  this.finishing = null;
+  this.onPlayed = () => {
+    this.played++;
+    this.check();
+  };
+  playback.on('played', this.onPlayed);
+}
+
+util.inherits(PlaybackStream, Writable);
+
+PlaybackStream.prototype._write = function (frame, encoding, cb) {
+  var video = Buffer.isBuffer(frame) ? frame : frame.video;
+  var audio = Buffer.isBuffer(frame) ? null : frame.audio;
+  try {
+    if (!this.playback.initialised) {
+      this.playback.playback.init();
+      this.playback.initialised = true;
+    }
+    var result = audio ? this.playback.playback.scheduleFrame(video, audio) :
+      this.playback.playback.scheduleFrame(video);
+    if (typeof result === 'string')
+      throw new Error('Problem scheduling frame: ' + result);
+  } catch (err) {
+    return cb(err);
+  }
+  if (++this.scheduled === this.preroll) this.playback.start();
+  this.waiting = cb;
+  this.check();
+}
+
+// Frames buffered by the driver. Where the driver cannot count them, the
+// frames scheduled here that have not yet been reported played.
+PlaybackStream.prototype.buffered = function () {
+  var buffered = this.playback.playback.bufferedFrames();
+  if (typeof buffered === 'number') return buffered;
+  return this.scheduled > this.played ? this.scheduled - this.played : 0;
+}
+
+PlaybackStream.prototype.check = function () {
+  if (this.waiting !== null &&
+      (this.scheduled < this.preroll || this.buffered() < this.limit)) {
+    var cb = this.waiting;
+    this.waiting = null;
+    cb();
+  }
+  if (this.finishing !== null && this.buffered() === 0) {
+    var done = this.finishing;
+    this.finishing = null;
+    this.playback.stop();
+    done();
+  }
+}
+
+PlaybackStream.prototype._final = function (cb) {
+  if (this.scheduled === 0) return cb();
+  if (this.scheduled < this.preroll) {
+    this.preroll = this.scheduled;
+    this.playback.start();
+  }
+  this.finishing = cb;
+  this.check();
+}
+
+PlaybackStream.prototype._destroy = function (err, cb) {
+  this.playback.removeListener('played', this.onPlayed);
+  cb(err);
+}
+
+// Reads a frame ring that a Capture writes with setFrameRing, in place, from
+// any thread given the SharedArrayBuffer. The layout is described in
+// src/FrameRing.h. Frames are numbered from 0 and frame n is in slot
+// n % slots until the capture comes round again. Views returned by read() are
+// not copies, so check isCurrent(frame) after using one.
+var frameRingHeader = 16;
+var frameRingEntry = 8; // Int32s per slot
+
+function FrameRing (buffer) {
+  var header = new Int32Array(buffer, 0, frameRingHeader);
+  if (Atomics.load(header, 1) !== 1)
+    throw new Error('Buffer does not hold a started frame ring.');
+  this.buffer = buffer;
+  this.header = header;
+  this.slots = header[2];
+  this.slotBytes = header[3];
+  this.frameBytes = header[4];
+  this.audioBytes = header[5];
+  this.slotsOffset = header[7];
+  this.pixelFormat = header[8] >>> 0;
+  this.width = header[9];
+  this.height = header[10];
+  this.rowBytes = header[11];
+  this.audioChannels = header[13];
+  this.audioSampleBytes = header[14];
+  this.entries = new Int32Array(buffer, header[6], this.slots * frameRingEntry);
+  this.times = new Float64Array(buffer, header[6], this.slots * frameRingEntry / 2);
+}
+
+// Frames written so far, which is the number of the next frame.
+FrameRing.prototype.written = function () {
+  return Atomics.load(this.header, 0) >>> 0;
+}
+
+FrameRing.prototype.closed = function () {
+  return Atomics.load(this.header, 15) !== 0;
+}
+
+FrameRing.prototype.timeScale = function () {
+  return Atomics.load(this.header, 12);
+}
+
+// Blocks until more than written frames have been written, the ring is
+// closed or timeout milliseconds pass, then returns written(). Not on the
+// main thread, where Atomics.wait is not allowed.
+FrameRing.prototype.wait = function (written, timeout) {
+  Atomics.wait(this.header, 0, written | 0, timeout);
+  return this.written();
+}
+
+// The frame with views onto its video and audio, or null if it is not in
+// the ring - not written yet, or overwritten.
+FrameRing.prototype.read = function (frame) {
+  var slot = frame % this.slots;
+  var entry = slot * frameRingEntry;
+  var sequence = (frame + 1) | 0;
+  if (Atomics.load(this.entries, entry) !== sequence) return null;
+  var base = this.slotsOffset + slot * this.slotBytes;
+  var result = {
+    frame : frame,
+    video : new Uint8Array(this.buffer, base, this.entries[entry + 1]),
+    audio : new Uint8Array(this.buffer, base + this.frameBytes, this.entries[entry + 2]),
+    audioFrames : this.entries[entry + 3],
+    streamTime : this.times[entry / 2 + 2],
+    frameDuration : this.times[entry / 2 + 3]
+  };
+  return Atomics.load(this.entries, entry) === sequence ? result : null;
+}
+
+FrameRing.prototype.isCurrent = function (frame) {
+  return Atomics.load(this.entries, (frame % this.slots) * frameRingEntry) ===
+    ((frame + 1) | 0);
+}
+
 function bmCodeToInt (s) {
   return Buffer.from(s.substring(0, 4)).readUInt32BE(0);
 }
@@ -197,6 +1229,114 @@ function intToBMCode(i) {
   return b.toString();
 }
 
+function downscale (buffer, mode, pixelFormat, outWidth, outHeight, outPixelFormat, filter) {
+  return macadamNative.downscale(buffer, modeWidth(mode), modeHeight(mode),
+    pixelFormat, outWidth, outHeight,
+    typeof outPixelFormat === 'number' ? outPixelFormat : macadam.bmdFormat8BitYUV,
+    filter);
+}
+
+// A zero-copy view of one field of a woven frame: rows start at offset and
+// are stride bytes apart. Field 0 is the top field.
+function fieldView (buffer, mode, pixelFormat, field) {
+  var rowBytes = formatRowBytes(pixelFormat, modeWidth(mode));
+  var height = modeHeight(mode);
+  var view = {
+    buffer : buffer,
+    offset : field * rowBytes,
+    stride : 2 * rowBytes,
+    rowBytes : rowBytes,
+    width : modeWidth(mode),
+    height : (height + 1 - field) >> 1,
+    pixelFormat : pixelFormat,
+    field : field
+  };
+  view.row = function (y) {
+    var start = view.offset + y * view.stride;
+    return buffer.slice(start, start + rowBytes);
+  };
+  return view;
+}
+
+function splitFields (buffer, mode, pixelFormat) {
+  return macadamNative.splitFields(buffer, modeWidth(mode), modeHeight(mode), pixelFormat);
+}
+
+function weaveFields (field0, field1, mode, pixelFormat) {
+  return macadamNative.weaveFields(field0, field1, modeWidth(mode), modeHeight(mode), pixelFormat);
+}
+
+function deinterlace (buffer, mode, pixelFormat, field, method) {
+  return macadamNative.deinterlace(buffer, modeWidth(mode), modeHeight(mode),
+    pixelFormat, field, method);
+}
+
+// Render a single test pattern frame, e.g. as a synthetic source for benchmarks.
+function testPattern (mode, pixelFormat, pattern, frameIndex, options) {
+  options = options || {};
+  return macadamNative.testPattern(modeWidth(mode), modeHeight(mode), pixelFormat,
+    pattern, frameIndex || 0, options.counter === true, options.box === true,
+    options.frames);
+}
+
+// QC metrics for a single frame. Pass the previous frame to measure the
+// difference between them.
+function analyseFrame (buffer, mode, pixelFormat, options, previous) {
+  return macadamNative.analyseFrame(buffer, modeWidth(mode), modeHeight(mode),
+    pixelFormat, options, previous);
+}
+
+// Positions of values in a meter array. Channel values for channel c start at
+// meterFields.channelStart + c * meterFields.channelFields.
+const meterFields = {
+  momentary : 0,
+  shortTerm : 1,
+  integrated : 2,
+  sampleFrames : 3,
+  channelStart : 4,
+  peak : 0,
+  peakHold : 1,
+  rms : 2,
+  truePeak : 3,
+  truePeakHold : 4,
+  channelFields : 5
+};
+
+function meterLength (channels) {
+  return meterFields.channelStart + channels * meterFields.channelFields;
+}
+
+// Compare two frames plane by plane on the thread pool. The callback receives
+// (err, { y, cb, cr }), each with mse, psnr and, unless disabled, ssim.
+function compareFrames (a, b, mode, pixelFormat, options, cb) {
+  if (typeof options === 'function') {
+    cb = options;
+    options = {};
+  }
+  options = options || {};
+  macadamNative.compareFrames(a, b, modeWidth(mode), modeHeight(mode),
+    pixelFormat, options.ssim !== false, cb);
+}
+
+function embedFrameCounter (buffer, mode, pixelFormat, counter) {
+  return macadamNative.embedFrameCounter(buffer, modeWidth(mode), modeHeight(mode),
+    pixelFormat, counter);
+}
+
+function readFrameCounter (buffer, mode, pixelFormat) {
+  return macadamNative.readFrameCounter(buffer, modeWidth(mode), modeHeight(mode),
+    pixelFormat);
+}
+
+// Convert a buffer of audio samples between 'int16', 'int32' and 'float32',
+// 'interleaved' and 'planar' layouts. Each entry of channelMap is an output
+// channel: a channel number, an array of channel numbers to mix equally or an
+// array of [ channel, gain ] pairs.
+function convertAudio (buffer, inFormat, inLayout, inChannels, outFormat, outLayout, channelMap) {
+  return macadamNative.convertAudio(buffer, inFormat, inLayout || 'interleaved',
+    inChannels, outFormat, outLayout || 'interleaved', channelMap);
+}
+
 function modeWidth (mode) {
   switch (mode) {
     case macadam.bmdModeNTSC:
@@ -448,6 +1588,27 @@ function formatDepth (format) {
   };
 };
 
+function formatRowBytes (format, width) {
+  switch (format) {
+    case macadam.bmdFormat8BitYUV:
+      return width * 2;
+    case macadam.bmdFormat10BitYUV:
+      return ((width + 47) / 48 | 0) * 128;
+    case macadam.bmdFormat8BitARGB:
+    case macadam.bmdFormat8BitBGRA:
+    case macadam.bmdFormat10BitRGB:
+      return width * 4;
+    case macadam.bmdFormat10BitRGBXLE:
+    case macadam.bmdFormat10BitRGBX:
+      return ((width + 63) / 64 | 0) * 256;
+    case macadam.bmdFormat12BitRGB:
+    case macadam.bmdFormat12BitRGBLE:
+      return width * 36 / 8 | 0;
+    default:
+      return 0;
+  };
+};
+
 function formatFourCC (format) {
   switch (format) {
     case macadam.bmdFormat8BitYUV:
@@ -649,17 +1810,42 @@ var macadam = {
   modeGrainDuration : modeGrainDuration,
   modeInterlace : modeInterlace,
   formatDepth : formatDepth,
+  formatRowBytes : formatRowBytes,
   formatFourCC : formatFourCC,
   fourCCFormat : fourCCFormat,
   formatSampling : formatSampling,
   formatColorimetry : formatColorimetry,
+  // Native video kernels
+  downscale : downscale,
+  fieldView : fieldView,
+  splitFields : splitFields,
+  weaveFields : weaveFields,
+  deinterlace : deinterlace,
+  testPattern : testPattern,
+  analyseFrame : analyseFrame,
+  hashBuffer : macadamNative.hashBuffer,
+  compareFrames : compareFrames,
+  embedFrameCounter : embedFrameCounter,
+  readFrameCounter : readFrameCounter,
+  // Native audio kernels
+  convertAudio : convertAudio,
+  meterFields : meterFields,
+  meterLength : meterLength,
   // access details about the currently connected devices
   deckLinkVersion : macadamNative.deckLinkVersion,
   getFirstDevice : macadamNative.getFirstDevice,
   // Raw access to device classes
   DirectCapture : macadamNative.Capture,
   Capture : Capture,
-  Playback : Playback
+  Playback : Playback,
+  LoopbackTest : LoopbackTest,
+  Overlay : macadamNative.Overlay,
+  Timeshift : macadamNative.Timeshift,
+  FrameSubscriber : FrameSubscriber,
+  FrameRing : FrameRing,
+  CaptureStream : CaptureStream,
+  PlaybackStream : PlaybackStream,
+  frameRingBytes : macadamNative.frameRingBytes
 };
 
 module.exports = macadam;
@@ -0,0 +1,63 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Play a moving test pattern out of one device and capture it back on
+// another, reporting PSNR and SSIM for every frame that comes back.
+
+var macadam = require('../index.js');
+
+var mode = macadam.bmdModeHD1080i50;
+var format = macadam.bmdFormat10BitYUV;
+var outDevice = process.argv[2] ? +process.argv[2] : 0;
+var inDevice = process.argv[3] ? +process.argv[3] : 1;
+
+var test = new macadam.LoopbackTest(mode, format, { align: 'counter' });
+var playback = new macadam.Playback(outDevice, mode, format);
+var capture = new macadam.Capture(inDevice, mode, format);
+
+test.on('quality', q => {
+  console.log(`Frame ${q.frame}: Y ${q.y.psnr.toFixed(2)}dB SSIM ${q.y.ssim.toFixed(4)},` +
+    ` Cb ${q.cb.psnr.toFixed(2)}dB, Cr ${q.cr.psnr.toFixed(2)}dB`);
+});
+test.on('missing', m => { console.log('No reference for frame', m.frame); });
+test.on('unaligned', u => { console.log('No frame counter in capture', u.captured); });
+
+playback.on('error', console.error.bind(null, 'BMD ERROR:'));
+capture.on('error', console.error.bind(null, 'BMD ERROR:'));
+capture.on('frame', v => { if (v) test.captured(v); });
+
+var count = 0;
+var duration = macadam.modeGrainDuration(mode);
+var interval = 1000 * duration[0] / duration[1];
+var baseTime = process.hrtime();
+
+function next () {
+  var frame = macadam.testPattern(mode, format, 'zoneplate', count, { box: true });
+  playback.frame(test.scheduled(frame, count));
+  if (count++ === 4) {
+    playback.start();
+    capture.start();
+  }
+  var diffTime = process.hrtime(baseTime);
+  var wait = count * interval - (diffTime[0] * 1000 + diffTime[1] / 1000000);
+  setTimeout(next, wait > 0 ? wait : 0);
+}
+next();
+
+process.on('SIGINT', () => {
+  playback.stop();
+  capture.stop();
+  process.exit();
+});
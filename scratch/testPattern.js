@@ -0,0 +1,32 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+var macadam = require('../index.js');
+
+var pattern = process.argv[2] ? process.argv[2] : 'smpte';
+
+var playback = new macadam.Playback(0, macadam.bmdModeHD1080i50,
+  macadam.bmdFormat10BitYUV);
+
+playback.on('error', console.error.bind(null, 'BMD ERROR:'));
+
+console.log(playback.testPattern(pattern, { counter: true, box: true }));
+playback.start();
+
+process.on('SIGINT', function () {
+  console.log('Received SIGINT.');
+  playback.stop();
+  process.exit();
+});
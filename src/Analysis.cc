@@ -0,0 +1,214 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Analysis.h"
+#include "Formats.h"
+#include <string.h>
+
+namespace streampunk {
+
+// YCbCr to R'G'B' in 12-bit fixed point, scaled so that both luma (0..876)
+// and the result share the nominal 10-bit video range. Chroma is first
+// rescaled from its 896 code excursion.
+struct GamutCoefficients {
+  int32_t rCr, gCb, gCr, bCb;
+};
+
+static const GamutCoefficients gamut601 = { 5614, -1378, -2860, 7096 };
+static const GamutCoefficients gamut709 = { 6306, -750, -1875, 7431 };
+
+// EBU R103 preferred limits, -5% and 105% of 876
+static const int32_t gamutLow = -(44 << 12);
+static const int32_t gamutHigh = 920 << 12;
+static const uint32_t gamutRange = gamutHigh - gamutLow;
+
+FrameAnalyser::FrameAnalyser() {
+}
+
+void FrameAnalyser::setOptions(const AnalysisOptions& options) {
+  options_ = options;
+  if (options_.stepX == 0) options_.stepX = 1;
+  if (options_.stepY == 0) options_.stepY = 1;
+  previous_.clear();
+}
+
+bool FrameAnalyser::analyse(uint32_t pixelFormat, const uint8_t* data,
+    uint32_t rowBytes, uint32_t width, uint32_t height, FrameMetrics* metrics) {
+  if (!isYUV422Format(pixelFormat) || width == 0 || height == 0)
+    return false;
+
+  uint32_t stepX = options_.stepX, stepY = options_.stepY;
+  uint32_t cols = (width + stepX - 1) / stepX;
+  uint32_t rows = (height + stepY - 1) / stepY;
+  lineY_.resize(cols);
+  lineCb_.resize(cols);
+  lineCr_.resize(cols);
+  current_.resize((size_t) cols * rows);
+  const GamutCoefficients& k = (height < 720) ? gamut601 : gamut709;
+
+  uint64_t sum = 0;
+  uint32_t minLuma = 1023, maxLuma = 0, blacks = 0, outOfGamut = 0;
+  uint32_t blackLevel = options_.blackLevel;
+  memset(metrics->histogram, 0, sizeof(metrics->histogram));
+
+  for (uint32_t r = 0 ; r < rows ; r++) {
+    // Gather just the sampled pixels so that each pass below runs over
+    // contiguous samples.
+    sampleLine(pixelFormat, data + (size_t) r * stepY * rowBytes, width, stepX,
+      &lineY_[0], &lineCb_[0], &lineCr_[0]);
+    const uint16_t* y = &lineY_[0];
+    const uint16_t* cb = &lineCb_[0];
+    const uint16_t* cr = &lineCr_[0];
+    uint16_t* cur = &current_[(size_t) r * cols];
+
+    uint32_t rowSum = 0;
+    for (uint32_t c = 0 ; c < cols ; c++) {
+      uint32_t l = y[c];
+      cur[c] = (uint16_t) l;
+      rowSum += l;
+      minLuma = l < minLuma ? l : minLuma;
+      maxLuma = l > maxLuma ? l : maxLuma;
+      blacks += l <= blackLevel ? 1 : 0;
+    }
+    sum += rowSum;
+
+    for (uint32_t c = 0 ; c < cols ; c++)
+      metrics->histogram[cur[c] >> 4]++;
+
+    for (uint32_t c = 0 ; c < cols ; c++) {
+      int32_t l = ((int32_t) y[c] - 64) * 4096;
+      int32_t u = (int32_t) cb[c] - 512;
+      int32_t v = (int32_t) cr[c] - 512;
+      int32_t red = l + k.rCr * v;
+      int32_t green = l + k.gCb * u + k.gCr * v;
+      int32_t blue = l + k.bCb * u;
+      // One unsigned compare per component checks both limits, and the
+      // results are combined without short-circuiting.
+      outOfGamut += ((uint32_t) (red - gamutLow) > gamutRange) |
+        ((uint32_t) (green - gamutLow) > gamutRange) |
+        ((uint32_t) (blue - gamutLow) > gamutRange);
+    }
+  }
+
+  uint32_t samples = cols * rows;
+  metrics->samples = samples;
+  metrics->averageLuma = (double) sum / samples;
+  metrics->minLuma = minLuma;
+  metrics->maxLuma = maxLuma;
+  metrics->outOfGamut = outOfGamut;
+  metrics->black = blacks >= options_.blackRatio * samples;
+
+  if (previous_.size() == current_.size()) {
+    const uint16_t* prev = &previous_[0];
+    const uint16_t* cur = &current_[0];
+    uint64_t diff = 0;
+    for (uint32_t r = 0 ; r < rows ; r++) {
+      uint32_t rowDiff = 0;
+      for (uint32_t c = 0 ; c < cols ; c++) {
+        int32_t d = (int32_t) cur[c] - (int32_t) prev[c];
+        rowDiff += d < 0 ? -d : d;
+      }
+      diff += rowDiff;
+      prev += cols;
+      cur += cols;
+    }
+    metrics->difference = (double) diff / samples;
+    metrics->frozen = metrics->difference < options_.freezeLevel;
+  } else {
+    metrics->difference = -1.0;
+    metrics->frozen = false;
+  }
+  previous_.swap(current_);
+  return true;
+}
+
+static bool getNumber(v8::Local<v8::Object> obj, const char* name, double* value) {
+  Nan::MaybeLocal<v8::Value> prop = Nan::Get(obj, Nan::New(name).ToLocalChecked());
+  if (prop.IsEmpty() || !prop.ToLocalChecked()->IsNumber())
+    return false;
+  *value = Nan::To<double>(prop.ToLocalChecked()).FromJust();
+  return true;
+}
+
+bool parseAnalysisOptions(v8::Local<v8::Value> value, AnalysisOptions* options) {
+  if (value->IsUndefined() || value->IsNull() || value->IsTrue()) return true;
+  if (!value->IsObject()) return false;
+  v8::Local<v8::Object> obj = Nan::To<v8::Object>(value).ToLocalChecked();
+  double n;
+  if (getNumber(obj, "subsample", &n)) options->stepX = options->stepY = (uint32_t) n;
+  if (getNumber(obj, "stepX", &n)) options->stepX = (uint32_t) n;
+  if (getNumber(obj, "stepY", &n)) options->stepY = (uint32_t) n;
+  if (getNumber(obj, "blackLevel", &n)) options->blackLevel = (uint32_t) n;
+  if (getNumber(obj, "blackRatio", &n)) options->blackRatio = n;
+  if (getNumber(obj, "freezeLevel", &n)) options->freezeLevel = n;
+  if (options->stepX == 0) options->stepX = 1;
+  if (options->stepY == 0) options->stepY = 1;
+  return true;
+}
+
+v8::Local<v8::Object> metricsToObject(const FrameMetrics& metrics) {
+  v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+  Nan::Set(obj, Nan::New("samples").ToLocalChecked(), Nan::New(metrics.samples));
+  Nan::Set(obj, Nan::New("averageLuma").ToLocalChecked(), Nan::New(metrics.averageLuma));
+  Nan::Set(obj, Nan::New("minLuma").ToLocalChecked(), Nan::New(metrics.minLuma));
+  Nan::Set(obj, Nan::New("maxLuma").ToLocalChecked(), Nan::New(metrics.maxLuma));
+  v8::Local<v8::Array> histogram = Nan::New<v8::Array>(histogramBins);
+  for (uint32_t x = 0 ; x < histogramBins ; x++)
+    Nan::Set(histogram, x, Nan::New(metrics.histogram[x]));
+  Nan::Set(obj, Nan::New("histogram").ToLocalChecked(), histogram);
+  Nan::Set(obj, Nan::New("outOfGamut").ToLocalChecked(), Nan::New(metrics.outOfGamut));
+  Nan::Set(obj, Nan::New("difference").ToLocalChecked(), Nan::New(metrics.difference));
+  Nan::Set(obj, Nan::New("black").ToLocalChecked(), Nan::New(metrics.black));
+  Nan::Set(obj, Nan::New("frozen").ToLocalChecked(), Nan::New(metrics.frozen));
+  return obj;
+}
+
+NAN_METHOD(AnalyseFrame) {
+  if (info.Length() < 4 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("AnalyseFrame requires a buffer, width, height and pixel format.");
+    return;
+  }
+  uint32_t width = Nan::To<uint32_t>(info[1]).FromMaybe(0);
+  uint32_t height = Nan::To<uint32_t>(info[2]).FromMaybe(0);
+  uint32_t pixelFormat = Nan::To<uint32_t>(info[3]).FromMaybe(0);
+  AnalysisOptions options;
+  if (!isYUV422Format(pixelFormat)) {
+    Nan::ThrowError("Frame analysis requires 8-bit (2vuy) or 10-bit (v210) YUV.");
+    return;
+  }
+  if (!parseAnalysisOptions(info[4], &options)) {
+    Nan::ThrowTypeError("Analysis options must be an object.");
+    return;
+  }
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat, width);
+  size_t frameBytes = (size_t) rowBytes * height;
+  if (node::Buffer::Length(info[0]) < frameBytes ||
+      (node::Buffer::HasInstance(info[5]) && node::Buffer::Length(info[5]) < frameBytes)) {
+    Nan::ThrowRangeError("Buffer is too small for a frame of the given dimensions.");
+    return;
+  }
+
+  FrameAnalyser analyser;
+  FrameMetrics metrics;
+  analyser.setOptions(options);
+  if (node::Buffer::HasInstance(info[5]))
+    analyser.analyse(pixelFormat, (const uint8_t*) node::Buffer::Data(info[5]),
+      rowBytes, width, height, &metrics);
+  analyser.analyse(pixelFormat, (const uint8_t*) node::Buffer::Data(info[0]),
+    rowBytes, width, height, &metrics);
+  info.GetReturnValue().Set(metricsToObject(metrics));
+}
+
+} // namespace streampunk
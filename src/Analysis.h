@@ -0,0 +1,85 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <nan.h>
+#include <stdint.h>
+#include <vector>
+
+namespace streampunk {
+
+// Histogram of 10-bit luma, 16 code values per bin
+static const uint32_t histogramBins = 64;
+
+struct AnalysisOptions {
+  uint32_t stepX;       // analyse every stepX-th pixel ...
+  uint32_t stepY;       // ... of every stepY-th row
+  uint32_t blackLevel;  // 10-bit luma at or below which a sample is black
+  double blackRatio;    // proportion of black samples for a black frame
+  double freezeLevel;   // mean absolute luma difference below which a frame is frozen
+
+  AnalysisOptions() : stepX(1), stepY(1), blackLevel(100), blackRatio(0.98),
+    freezeLevel(1.0) {}
+};
+
+// All luma values are 10-bit codes, whatever the pixel format.
+struct FrameMetrics {
+  uint32_t samples;
+  double averageLuma;
+  uint32_t minLuma;
+  uint32_t maxLuma;
+  uint32_t histogram[histogramBins];
+  // samples outside the EBU R103 RGB gamut of -5% to 105%
+  uint32_t outOfGamut;
+  // mean absolute luma difference from the previous frame, -1 for the first
+  double difference;
+  bool black;
+  bool frozen;
+};
+
+// Computes QC metrics for a stream of 2vuy or v210 frames, keeping the
+// subsampled luma of the last frame to measure the change between frames.
+class FrameAnalyser {
+public:
+  FrameAnalyser();
+
+  void setOptions(const AnalysisOptions& options);
+  const AnalysisOptions& options() const { return options_; }
+  // Forget the previous frame, e.g. after a format change.
+  void reset() { previous_.clear(); }
+
+  bool analyse(uint32_t pixelFormat, const uint8_t* data, uint32_t rowBytes,
+    uint32_t width, uint32_t height, FrameMetrics* metrics);
+
+private:
+  AnalysisOptions options_;
+  std::vector<uint16_t> lineY_;
+  std::vector<uint16_t> lineCb_;
+  std::vector<uint16_t> lineCr_;
+  std::vector<uint16_t> current_;
+  std::vector<uint16_t> previous_;
+};
+
+bool parseAnalysisOptions(v8::Local<v8::Value> value, AnalysisOptions* options);
+v8::Local<v8::Object> metricsToObject(const FrameMetrics& metrics);
+
+// analyseFrame(buffer, width, height, pixelFormat[, options[, previous]]) -> metrics
+NAN_METHOD(AnalyseFrame);
+
+} // namespace streampunk
+
+#endif
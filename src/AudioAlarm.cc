@@ -0,0 +1,215 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "AudioAlarm.h"
+#include <math.h>
+#include <string.h>
+
+namespace streampunk {
+
+static const char* alarmNames[alarmTypes] = { "silence", "mono", "phase" };
+
+AudioAlarms::AudioAlarms() : channels_(0), bytesPerSample_(2), blockFrames_(4800),
+    blockFill_(0), windowBlocks_(10), ringPos_(0), ringCount_(0),
+    silenceEnergy_(0.0), blockSeconds_(0.1), position_(0) {
+}
+
+void AudioAlarms::configure(uint32_t sampleRate, uint32_t channels,
+    uint32_t bytesPerSample, const std::vector<uint32_t>& pairs,
+    const AudioAlarmOptions& options) {
+  channels_ = channels;
+  bytesPerSample_ = bytesPerSample;
+  options_ = options;
+  pairs_.clear();
+  for (size_t x = 0 ; x + 1 < pairs.size() ; x += 2)
+    if (pairs[x] < channels && pairs[x + 1] < channels) {
+      pairs_.push_back(pairs[x]);
+      pairs_.push_back(pairs[x + 1]);
+    }
+
+  blockFrames_ = sampleRate / 10;
+  blockSeconds_ = (double) blockFrames_ / sampleRate;
+  windowBlocks_ = (uint32_t) (options.window / blockSeconds_ + 0.5);
+  if (windowBlocks_ == 0) windowBlocks_ = 1;
+  // Mean square of one channel at the silence level. As for the RMS meter,
+  // a full scale square wave is 0dB and a full scale sine -3dB.
+  silenceEnergy_ = pow(10.0, options.silenceLevel / 10.0);
+
+  state_.resize(pairCount());
+  for (size_t p = 0 ; p < state_.size() ; p++) {
+    PairState& s = state_[p];
+    memset(s.block, 0, sizeof(s.block));
+    s.ring.assign(windowBlocks_ * 3, 0.0);
+    s.silentFor = 0.0;
+    for (uint32_t t = 0 ; t < alarmTypes ; t++) s.active[t] = false;
+  }
+  blockFill_ = 0;
+  ringPos_ = 0;
+  ringCount_ = 0;
+  position_ = 0;
+}
+
+void AudioAlarms::change(uint32_t pair, AudioAlarmType type, bool active,
+    double value, std::vector<AudioAlarmEvent>& events) {
+  if (state_[pair].active[type] == active) return;
+  state_[pair].active[type] = active;
+  AudioAlarmEvent event = { type, pair, pairs_[pair * 2], pairs_[pair * 2 + 1],
+    active, value, position_ };
+  events.push_back(event);
+}
+
+void AudioAlarms::closeBlock(std::vector<AudioAlarmEvent>& events) {
+  for (uint32_t p = 0 ; p < state_.size() ; p++) {
+    PairState& s = state_[p];
+    double* slot = &s.ring[ringPos_ * 3];
+    for (uint32_t x = 0 ; x < 3 ; x++) {
+      slot[x] = s.block[x];
+      s.block[x] = 0.0;
+    }
+
+    bool silent = slot[0] < silenceEnergy_ * blockFrames_ &&
+      slot[1] < silenceEnergy_ * blockFrames_;
+    s.silentFor = silent ? s.silentFor + blockSeconds_ : 0.0;
+    if (silent && s.silentFor >= options_.silenceDuration)
+      change(p, alarmSilence, true, s.silentFor, events);
+    else if (!silent)
+      change(p, alarmSilence, false, 0.0, events);
+
+    // Correlation over the window, only once it is full and has signal on
+    // both channels
+    if (ringCount_ + 1 < windowBlocks_) continue;
+    double ll = 0.0, rr = 0.0, lr = 0.0;
+    for (uint32_t b = 0 ; b < windowBlocks_ ; b++) {
+      ll += s.ring[b * 3];
+      rr += s.ring[b * 3 + 1];
+      lr += s.ring[b * 3 + 2];
+    }
+    double floor = silenceEnergy_ * blockFrames_ * windowBlocks_;
+    if (ll < floor || rr < floor) {
+      change(p, alarmMono, false, 0.0, events);
+      change(p, alarmPhase, false, 0.0, events);
+      continue;
+    }
+    double correlation = lr / sqrt(ll * rr);
+    if (correlation >= options_.monoLevel)
+      change(p, alarmMono, true, correlation, events);
+    else if (correlation < options_.monoLevel - options_.hysteresis)
+      change(p, alarmMono, false, correlation, events);
+    if (correlation <= options_.phaseLevel)
+      change(p, alarmPhase, true, correlation, events);
+    else if (correlation > options_.phaseLevel + options_.hysteresis)
+      change(p, alarmPhase, false, correlation, events);
+  }
+  ringPos_ = (ringPos_ + 1) % windowBlocks_;
+  if (ringCount_ < windowBlocks_) ringCount_++;
+  blockFill_ = 0;
+}
+
+void AudioAlarms::process(const uint8_t* data, uint32_t frames,
+    std::vector<AudioAlarmEvent>& events) {
+  uint32_t offset = 0;
+  while (offset < frames) {
+    uint32_t n = frames - offset;
+    if (n > blockFrames_ - blockFill_) n = blockFrames_ - blockFill_;
+    for (uint32_t p = 0 ; p < state_.size() ; p++) {
+      double ll = 0.0, rr = 0.0, lr = 0.0;
+      if (bytesPerSample_ == 2) {
+        const int16_t* left = (const int16_t*) data + (size_t) offset * channels_ + pairs_[p * 2];
+        const int16_t* right = (const int16_t*) data + (size_t) offset * channels_ + pairs_[p * 2 + 1];
+        for (uint32_t f = 0 ; f < n ; f++) {
+          double l = left[f * channels_] * (1.0 / 32768.0);
+          double r = right[f * channels_] * (1.0 / 32768.0);
+          ll += l * l;
+          rr += r * r;
+          lr += l * r;
+        }
+      } else {
+        const int32_t* left = (const int32_t*) data + (size_t) offset * channels_ + pairs_[p * 2];
+        const int32_t* right = (const int32_t*) data + (size_t) offset * channels_ + pairs_[p * 2 + 1];
+        for (uint32_t f = 0 ; f < n ; f++) {
+          double l = left[f * channels_] * (1.0 / 2147483648.0);
+          double r = right[f * channels_] * (1.0 / 2147483648.0);
+          ll += l * l;
+          rr += r * r;
+          lr += l * r;
+        }
+      }
+      state_[p].block[0] += ll;
+      state_[p].block[1] += rr;
+      state_[p].block[2] += lr;
+    }
+    blockFill_ += n;
+    offset += n;
+    position_ += n;
+    if (blockFill_ == blockFrames_)
+      closeBlock(events);
+  }
+}
+
+static bool getNumber(v8::Local<v8::Object> obj, const char* name, double* value) {
+  Nan::MaybeLocal<v8::Value> prop = Nan::Get(obj, Nan::New(name).ToLocalChecked());
+  if (prop.IsEmpty() || !prop.ToLocalChecked()->IsNumber())
+    return false;
+  *value = Nan::To<double>(prop.ToLocalChecked()).FromJust();
+  return true;
+}
+
+// Pairs are an array of [ left, right ] channel number arrays.
+bool parseAudioAlarms(v8::Local<v8::Value> pairs, v8::Local<v8::Value> options,
+    std::vector<uint32_t>* channels, AudioAlarmOptions* alarmOptions) {
+  channels->clear();
+  if (!pairs->IsArray()) return false;
+  v8::Local<v8::Array> list = v8::Local<v8::Array>::Cast(pairs);
+  for (uint32_t x = 0 ; x < list->Length() ; x++) {
+    v8::Local<v8::Value> entry = Nan::Get(list, x).ToLocalChecked();
+    if (!entry->IsArray()) return false;
+    v8::Local<v8::Array> pair = v8::Local<v8::Array>::Cast(entry);
+    if (pair->Length() != 2) return false;
+    for (uint32_t side = 0 ; side < 2 ; side++) {
+      v8::Local<v8::Value> channel = Nan::Get(pair, side).ToLocalChecked();
+      if (!channel->IsNumber()) return false;
+      channels->push_back(Nan::To<uint32_t>(channel).FromJust());
+    }
+  }
+
+  if (options->IsUndefined() || options->IsNull()) return true;
+  if (!options->IsObject()) return false;
+  v8::Local<v8::Object> obj = Nan::To<v8::Object>(options).ToLocalChecked();
+  getNumber(obj, "silenceLevel", &alarmOptions->silenceLevel);
+  getNumber(obj, "silenceDuration", &alarmOptions->silenceDuration);
+  getNumber(obj, "window", &alarmOptions->window);
+  getNumber(obj, "monoLevel", &alarmOptions->monoLevel);
+  getNumber(obj, "phaseLevel", &alarmOptions->phaseLevel);
+  getNumber(obj, "hysteresis", &alarmOptions->hysteresis);
+  return true;
+}
+
+v8::Local<v8::Object> alarmToObject(const AudioAlarmEvent& event) {
+  v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+  Nan::Set(obj, Nan::New("type").ToLocalChecked(),
+    Nan::New(alarmNames[event.type]).ToLocalChecked());
+  Nan::Set(obj, Nan::New("pair").ToLocalChecked(), Nan::New(event.pair));
+  v8::Local<v8::Array> channels = Nan::New<v8::Array>(2);
+  Nan::Set(channels, 0, Nan::New(event.left));
+  Nan::Set(channels, 1, Nan::New(event.right));
+  Nan::Set(obj, Nan::New("channels").ToLocalChecked(), channels);
+  Nan::Set(obj, Nan::New("active").ToLocalChecked(), Nan::New(event.active));
+  Nan::Set(obj, Nan::New("value").ToLocalChecked(), Nan::New(event.value));
+  Nan::Set(obj, Nan::New("sampleFrame").ToLocalChecked(),
+    Nan::New((double) event.sampleFrame));
+  return obj;
+}
+
+} // namespace streampunk
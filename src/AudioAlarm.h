@@ -0,0 +1,102 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef AUDIOALARM_H
+#define AUDIOALARM_H
+
+#include <nan.h>
+#include <stdint.h>
+#include <vector>
+
+namespace streampunk {
+
+enum AudioAlarmType {
+  alarmSilence = 0,
+  alarmMono,
+  alarmPhase,
+  alarmTypes
+};
+
+struct AudioAlarmOptions {
+  double silenceLevel;     // dBFS RMS below which a 100ms block is silent
+  double silenceDuration;  // seconds of silence before the alarm is raised
+  double window;           // seconds of audio each correlation is measured over
+  double monoLevel;        // correlation at or above which a pair is mono
+  double phaseLevel;       // correlation at or below which a pair is out of phase
+  double hysteresis;       // correlation change needed to clear an alarm
+
+  AudioAlarmOptions() : silenceLevel(-60.0), silenceDuration(2.0), window(1.0),
+    monoLevel(0.98), phaseLevel(-0.3), hysteresis(0.05) {}
+};
+
+struct AudioAlarmEvent {
+  AudioAlarmType type;
+  uint32_t pair;
+  uint32_t left;
+  uint32_t right;
+  bool active;
+  double value;            // seconds of silence, or the correlation
+  uint64_t sampleFrame;    // position of the block that changed the state
+};
+
+// Watches pairs of channels of interleaved 16 or 32-bit integer audio for
+// silence, mono-in-stereo and phase inversion, reporting only the changes
+// of state.
+class AudioAlarms {
+public:
+  AudioAlarms();
+
+  void configure(uint32_t sampleRate, uint32_t channels, uint32_t bytesPerSample,
+    const std::vector<uint32_t>& pairs, const AudioAlarmOptions& options);
+  bool isConfigured() const { return !pairs_.empty(); }
+  uint32_t pairCount() const { return (uint32_t) pairs_.size() / 2; }
+
+  // Appends any changes of alarm state to events.
+  void process(const uint8_t* data, uint32_t frames, std::vector<AudioAlarmEvent>& events);
+
+private:
+  struct PairState {
+    double block[3];            // sums of l * l, r * r and l * r for this block
+    std::vector<double> ring;   // block sums over the correlation window
+    double silentFor;
+    bool active[alarmTypes];
+  };
+
+  void closeBlock(std::vector<AudioAlarmEvent>& events);
+  void change(uint32_t pair, AudioAlarmType type, bool active, double value,
+    std::vector<AudioAlarmEvent>& events);
+
+  uint32_t channels_;
+  uint32_t bytesPerSample_;
+  AudioAlarmOptions options_;
+  std::vector<uint32_t> pairs_;
+  std::vector<PairState> state_;
+  uint32_t blockFrames_;
+  uint32_t blockFill_;
+  uint32_t windowBlocks_;
+  uint32_t ringPos_;
+  uint32_t ringCount_;
+  double silenceEnergy_;
+  double blockSeconds_;
+  uint64_t position_;
+};
+
+bool parseAudioAlarms(v8::Local<v8::Value> pairs, v8::Local<v8::Value> options,
+  std::vector<uint32_t>* channels, AudioAlarmOptions* alarmOptions);
+v8::Local<v8::Object> alarmToObject(const AudioAlarmEvent& event);
+
+} // namespace streampunk
+
+#endif
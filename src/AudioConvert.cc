@@ -0,0 +1,280 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "AudioConvert.h"
+#include <math.h>
+#include <string.h>
+
+namespace streampunk {
+
+uint32_t sampleBytes(AudioSampleFormat format) {
+  return format == sampleInt16 ? 2 : 4;
+}
+
+AudioConverter::AudioConverter() : configured_(false) {
+}
+
+bool AudioConverter::configure(const AudioLayout& in, const AudioLayout& out,
+    const ChannelMap& map) {
+  configured_ = false;
+  if (in.channels == 0) return false;
+  in_ = in;
+  out_ = out;
+  map_ = map;
+  if (map_.empty()) {
+    // Straight through, dropping or silencing channels to fit
+    if (out_.channels == 0) out_.channels = in_.channels;
+    map_.resize(out_.channels);
+    for (uint32_t c = 0 ; c < out_.channels && c < in_.channels ; c++) {
+      ChannelTap tap = { c, 1.0f };
+      map_[c].push_back(tap);
+    }
+  } else {
+    out_.channels = (uint32_t) map_.size();
+  }
+  for (size_t c = 0 ; c < map_.size() ; c++)
+    for (size_t t = 0 ; t < map_[c].size() ; t++)
+      if (map_[c][t].channel >= in_.channels) return false;
+  configured_ = true;
+  return true;
+}
+
+size_t AudioConverter::inputBytes(uint32_t frames) const {
+  return (size_t) frames * in_.channels * sampleBytes(in_.format);
+}
+
+size_t AudioConverter::outputBytes(uint32_t frames) const {
+  return (size_t) frames * out_.channels * sampleBytes(out_.format);
+}
+
+void AudioConverter::readChannel(const uint8_t* in, uint32_t frames,
+    uint32_t channel, float* dst) const {
+  size_t step = in_.planar ? 1 : in_.channels;
+  size_t first = in_.planar ? (size_t) channel * frames : channel;
+  switch (in_.format) {
+    case sampleInt16: {
+      const int16_t* p = (const int16_t*) in + first;
+      for (uint32_t f = 0 ; f < frames ; f++)
+        dst[f] = p[f * step] * (1.0f / 32768.0f);
+      break;
+    }
+    case sampleInt32: {
+      const int32_t* p = (const int32_t*) in + first;
+      for (uint32_t f = 0 ; f < frames ; f++)
+        dst[f] = (float) (p[f * step] * (1.0 / 2147483648.0));
+      break;
+    }
+    default: {
+      const float* p = (const float*) in + first;
+      for (uint32_t f = 0 ; f < frames ; f++)
+        dst[f] = p[f * step];
+      break;
+    }
+  }
+}
+
+void AudioConverter::writeChannel(const float* src, uint32_t frames,
+    uint32_t channel, uint8_t* out) const {
+  size_t step = out_.planar ? 1 : out_.channels;
+  size_t first = out_.planar ? (size_t) channel * frames : channel;
+  switch (out_.format) {
+    case sampleInt16: {
+      int16_t* p = (int16_t*) out + first;
+      for (uint32_t f = 0 ; f < frames ; f++) {
+        float v = src[f] * 32768.0f;
+        v = v < -32768.0f ? -32768.0f : (v > 32767.0f ? 32767.0f : v);
+        p[f * step] = (int16_t) lrintf(v);
+      }
+      break;
+    }
+    case sampleInt32: {
+      int32_t* p = (int32_t*) out + first;
+      for (uint32_t f = 0 ; f < frames ; f++) {
+        double v = src[f] * 2147483648.0;
+        v = v < -2147483648.0 ? -2147483648.0 : (v > 2147483647.0 ? 2147483647.0 : v);
+        p[f * step] = (int32_t) lrint(v);
+      }
+      break;
+    }
+    default: {
+      float* p = (float*) out + first;
+      for (uint32_t f = 0 ; f < frames ; f++)
+        p[f * step] = src[f];
+      break;
+    }
+  }
+}
+
+// Exact copy of one channel between integer formats, so that selecting and
+// reordering 32-bit channels does not lose precision through float.
+bool AudioConverter::copyChannel(const uint8_t* in, uint32_t frames,
+    uint32_t inChannel, uint32_t outChannel, uint8_t* out) const {
+  if (in_.format == sampleFloat32 || out_.format == sampleFloat32)
+    return false;
+  size_t inStep = in_.planar ? 1 : in_.channels;
+  size_t inFirst = in_.planar ? (size_t) inChannel * frames : inChannel;
+  size_t outStep = out_.planar ? 1 : out_.channels;
+  size_t outFirst = out_.planar ? (size_t) outChannel * frames : outChannel;
+  if (in_.format == sampleInt16 && out_.format == sampleInt16) {
+    const int16_t* s = (const int16_t*) in + inFirst;
+    int16_t* d = (int16_t*) out + outFirst;
+    for (uint32_t f = 0 ; f < frames ; f++) d[f * outStep] = s[f * inStep];
+  } else if (in_.format == sampleInt32 && out_.format == sampleInt32) {
+    const int32_t* s = (const int32_t*) in + inFirst;
+    int32_t* d = (int32_t*) out + outFirst;
+    for (uint32_t f = 0 ; f < frames ; f++) d[f * outStep] = s[f * inStep];
+  } else if (in_.format == sampleInt16) {
+    const int16_t* s = (const int16_t*) in + inFirst;
+    int32_t* d = (int32_t*) out + outFirst;
+    for (uint32_t f = 0 ; f < frames ; f++) d[f * outStep] = (int32_t) s[f * inStep] << 16;
+  } else {
+    const int32_t* s = (const int32_t*) in + inFirst;
+    int16_t* d = (int16_t*) out + outFirst;
+    for (uint32_t f = 0 ; f < frames ; f++) {
+      int64_t v = ((int64_t) s[f * inStep] + 0x8000) >> 16;
+      d[f * outStep] = (int16_t) (v > 32767 ? 32767 : v);
+    }
+  }
+  return true;
+}
+
+void AudioConverter::convert(const uint8_t* in, uint32_t frames, uint8_t* out) {
+  if (!configured_) return;
+  if (channel_.size() < frames) {
+    channel_.resize(frames);
+    mix_.resize(frames);
+  }
+
+  for (uint32_t c = 0 ; c < out_.channels ; c++) {
+    const std::vector<ChannelTap>& taps = map_[c];
+    if (taps.size() == 1 && taps[0].gain == 1.0f &&
+        copyChannel(in, frames, taps[0].channel, c, out))
+      continue;
+
+    float* mix = &mix_[0];
+    if (taps.empty()) {
+      memset(mix, 0, frames * sizeof(float));
+    } else {
+      readChannel(in, frames, taps[0].channel, mix);
+      if (taps[0].gain != 1.0f)
+        for (uint32_t f = 0 ; f < frames ; f++) mix[f] *= taps[0].gain;
+      for (size_t t = 1 ; t < taps.size() ; t++) {
+        float* ch = &channel_[0];
+        float gain = taps[t].gain;
+        readChannel(in, frames, taps[t].channel, ch);
+        for (uint32_t f = 0 ; f < frames ; f++) mix[f] += ch[f] * gain;
+      }
+    }
+    writeChannel(mix, frames, c, out);
+  }
+}
+
+bool parseSampleFormat(v8::Local<v8::Value> value, AudioSampleFormat* format) {
+  if (value->IsNumber()) { // BMD sample types
+    uint32_t bits = Nan::To<uint32_t>(value).FromJust();
+    if (bits == 16) { *format = sampleInt16; return true; }
+    if (bits == 32) { *format = sampleInt32; return true; }
+    return false;
+  }
+  if (!value->IsString()) return false;
+  Nan::Utf8String name(value);
+  if (strcmp(*name, "int16") == 0) *format = sampleInt16;
+  else if (strcmp(*name, "int32") == 0) *format = sampleInt32;
+  else if (strcmp(*name, "float32") == 0) *format = sampleFloat32;
+  else return false;
+  return true;
+}
+
+bool parsePlanar(v8::Local<v8::Value> value, bool* planar) {
+  if (value->IsUndefined()) { *planar = false; return true; }
+  if (!value->IsString()) return false;
+  Nan::Utf8String name(value);
+  if (strcmp(*name, "interleaved") == 0) *planar = false;
+  else if (strcmp(*name, "planar") == 0) *planar = true;
+  else return false;
+  return true;
+}
+
+bool parseChannelMap(v8::Local<v8::Value> value, ChannelMap* map) {
+  map->clear();
+  if (value->IsUndefined() || value->IsNull()) return true;
+  if (!value->IsArray()) return false;
+  v8::Local<v8::Array> outputs = v8::Local<v8::Array>::Cast(value);
+  map->resize(outputs->Length());
+  for (uint32_t o = 0 ; o < outputs->Length() ; o++) {
+    v8::Local<v8::Value> entry = Nan::Get(outputs, o).ToLocalChecked();
+    if (entry->IsNumber()) {
+      ChannelTap tap = { Nan::To<uint32_t>(entry).FromJust(), 1.0f };
+      (*map)[o].push_back(tap);
+      continue;
+    }
+    if (!entry->IsArray()) return false;
+    v8::Local<v8::Array> inputs = v8::Local<v8::Array>::Cast(entry);
+    uint32_t count = inputs->Length();
+    for (uint32_t i = 0 ; i < count ; i++) {
+      v8::Local<v8::Value> input = Nan::Get(inputs, i).ToLocalChecked();
+      ChannelTap tap;
+      if (input->IsNumber()) {
+        tap.channel = Nan::To<uint32_t>(input).FromJust();
+        tap.gain = 1.0f / count;
+      } else if (input->IsArray()) {
+        v8::Local<v8::Array> pair = v8::Local<v8::Array>::Cast(input);
+        tap.channel = Nan::To<uint32_t>(Nan::Get(pair, 0).ToLocalChecked()).FromJust();
+        tap.gain = (float) Nan::To<double>(Nan::Get(pair, 1).ToLocalChecked()).FromJust();
+      } else {
+        return false;
+      }
+      (*map)[o].push_back(tap);
+    }
+  }
+  return true;
+}
+
+NAN_METHOD(ConvertAudio) {
+  if (info.Length() < 6 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("ConvertAudio requires a buffer, input format, layout and channel count, and output format and layout.");
+    return;
+  }
+  AudioLayout in, out;
+  ChannelMap map;
+  if (!parseSampleFormat(info[1], &in.format) || !parseSampleFormat(info[4], &out.format)) {
+    Nan::ThrowError("Sample format must be 'int16', 'int32' or 'float32'.");
+    return;
+  }
+  if (!parsePlanar(info[2], &in.planar) || !parsePlanar(info[5], &out.planar)) {
+    Nan::ThrowError("Audio layout must be 'interleaved' or 'planar'.");
+    return;
+  }
+  in.channels = Nan::To<uint32_t>(info[3]).FromMaybe(0);
+  out.channels = 0;
+  if (!parseChannelMap(info[6], &map)) {
+    Nan::ThrowError("Channel map must be an array of channel numbers, arrays of channel numbers or [ channel, gain ] pairs.");
+    return;
+  }
+
+  AudioConverter converter;
+  if (!converter.configure(in, out, map)) {
+    Nan::ThrowError("Channel map refers to channels that are not in the input.");
+    return;
+  }
+  uint32_t frames = (uint32_t) (node::Buffer::Length(info[0]) / converter.inputBytes(1));
+  v8::Local<v8::Object> result =
+    Nan::NewBuffer(converter.outputBytes(frames)).ToLocalChecked();
+  converter.convert((const uint8_t*) node::Buffer::Data(info[0]), frames,
+    (uint8_t*) node::Buffer::Data(result));
+  info.GetReturnValue().Set(result);
+}
+
+} // namespace streampunk
@@ -0,0 +1,97 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef AUDIOCONVERT_H
+#define AUDIOCONVERT_H
+
+#include <nan.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace streampunk {
+
+enum AudioSampleFormat {
+  sampleInt16 = 0,
+  sampleInt32,
+  sampleFloat32
+};
+
+struct AudioLayout {
+  AudioSampleFormat format;
+  bool planar;       // one block of samples per channel rather than interleaved
+  uint32_t channels;
+};
+
+// One input channel contributing to an output channel
+struct ChannelTap {
+  uint32_t channel;
+  float gain;
+};
+
+// For each output channel, the input channels mixed into it. A single tap
+// with unity gain selects, reorders or duplicates a channel; several taps
+// downmix.
+typedef std::vector<std::vector<ChannelTap> > ChannelMap;
+
+// Converts packets of audio between integer and float samples, interleaved
+// and planar layouts, applying an optional channel map on the way. Planar
+// data is held in one buffer with each channel's samples following the last.
+class AudioConverter {
+public:
+  AudioConverter();
+
+  // An empty map passes channels straight through. Returns false if the map
+  // refers to input channels that do not exist.
+  bool configure(const AudioLayout& in, const AudioLayout& out, const ChannelMap& map);
+  bool isConfigured() const { return configured_; }
+  const AudioLayout& input() const { return in_; }
+  const AudioLayout& output() const { return out_; }
+
+  size_t inputBytes(uint32_t frames) const;
+  size_t outputBytes(uint32_t frames) const;
+  void convert(const uint8_t* in, uint32_t frames, uint8_t* out);
+
+private:
+  void readChannel(const uint8_t* in, uint32_t frames, uint32_t channel, float* dst) const;
+  void writeChannel(const float* src, uint32_t frames, uint32_t channel, uint8_t* out) const;
+  bool copyChannel(const uint8_t* in, uint32_t frames, uint32_t inChannel,
+    uint32_t outChannel, uint8_t* out) const;
+
+  bool configured_;
+  AudioLayout in_;
+  AudioLayout out_;
+  ChannelMap map_;
+  std::vector<float> channel_;
+  std::vector<float> mix_;
+};
+
+uint32_t sampleBytes(AudioSampleFormat format);
+
+// Parse 'int16' / 'int32' / 'float32' and 'interleaved' / 'planar'.
+bool parseSampleFormat(v8::Local<v8::Value> value, AudioSampleFormat* format);
+bool parsePlanar(v8::Local<v8::Value> value, bool* planar);
+// Parse a JS channel map: an array with one entry per output channel, each a
+// channel number, an array of channel numbers to mix equally, or an array of
+// [ channel, gain ] pairs. Undefined or null gives an empty map.
+bool parseChannelMap(v8::Local<v8::Value> value, ChannelMap* map);
+
+// convertAudio(buffer, inFormat, inLayout, inChannels, outFormat, outLayout
+//   [, channelMap]) -> Buffer
+NAN_METHOD(ConvertAudio);
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,305 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "AudioMeter.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+namespace streampunk {
+
+static const double pi = 3.14159265358979323846;
+static const uint32_t truePeakTaps = 12;
+static const uint32_t historyFrames = truePeakTaps - 1;
+static const uint32_t momentaryBlocks = 4;
+static const uint32_t shortTermBlocks = 30;
+
+// Histogram of gating block loudness from -70 LUFS in 0.1 LU steps
+static const double gateFloor = -70.0;
+static const double gateStep = 0.1;
+static const uint32_t gateBins = 800;
+
+static inline double toDecibels(double level) {
+  return level > 0.0 ? 20.0 * log10(level) : -HUGE_VAL;
+}
+
+static inline double toLoudness(double energy) {
+  return energy > 0.0 ? -0.691 + 10.0 * log10(energy) : -HUGE_VAL;
+}
+
+AudioMeter::AudioMeter() : sampleRate_(48000), channels_(0), bytesPerSample_(2),
+    capacity_(0), blockFrames_(4800), blockFill_(0), ringPos_(0), ringCount_(0),
+    momentary_(-HUGE_VAL), shortTerm_(-HUGE_VAL), integrated_(-HUGE_VAL),
+    sampleFrames_(0.0) {
+}
+
+void AudioMeter::configure(uint32_t sampleRate, uint32_t channels,
+    uint32_t bytesPerSample, const std::vector<double>& weights) {
+  sampleRate_ = sampleRate;
+  channels_ = channels;
+  bytesPerSample_ = bytesPerSample;
+  weights_.assign(channels, 1.0);
+  for (uint32_t c = 0 ; c < channels && c < weights.size() ; c++)
+    weights_[c] = weights[c];
+
+  // BS.1770 K-weighting, derived for the sample rate in use
+  double fs = (double) sampleRate;
+  double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+  double K = tan(pi * f0 / fs);
+  double Vh = pow(10.0, G / 20.0);
+  double Vb = pow(Vh, 0.4996667741545416);
+  double a0 = 1.0 + K / Q + K * K;
+  pb_[0] = (Vh + Vb * K / Q + K * K) / a0;
+  pb_[1] = 2.0 * (K * K - Vh) / a0;
+  pb_[2] = (Vh - Vb * K / Q + K * K) / a0;
+  pa_[0] = 1.0;
+  pa_[1] = 2.0 * (K * K - 1.0) / a0;
+  pa_[2] = (1.0 - K / Q + K * K) / a0;
+
+  f0 = 38.13547087602444;
+  Q = 0.5003270373238773;
+  K = tan(pi * f0 / fs);
+  a0 = 1.0 + K / Q + K * K;
+  rb_[0] = 1.0;
+  rb_[1] = -2.0;
+  rb_[2] = 1.0;
+  ra_[0] = 1.0;
+  ra_[1] = 2.0 * (K * K - 1.0) / a0;
+  ra_[2] = (1.0 - K / Q + K * K) / a0;
+
+  // 4x interpolator: Hann windowed sinc, each phase normalised to unity gain
+  uint32_t length = 4 * truePeakTaps;
+  double centre = (length - 1) / 2.0;
+  phases_.resize(length);
+  for (uint32_t p = 0 ; p < 4 ; p++) {
+    double sum = 0.0;
+    std::vector<double> h(truePeakTaps);
+    for (uint32_t k = 0 ; k < truePeakTaps ; k++) {
+      double t = (4 * k + p - centre) / 4.0;
+      double sinc = (t == 0.0) ? 1.0 : sin(pi * t) / (pi * t);
+      double window = 0.5 + 0.5 * cos(pi * (4 * k + p - centre) / (length / 2.0));
+      h[k] = sinc * window;
+      sum += h[k];
+    }
+    for (uint32_t k = 0 ; k < truePeakTaps ; k++)
+      phases_[p * truePeakTaps + k] = (float) (h[k] / sum);
+  }
+
+  blockFrames_ = sampleRate / 10;
+  capacity_ = sampleRate; // one second of audio per packet before growing
+  samples_.assign((size_t) channels * (historyFrames + capacity_), 0.0f);
+  history_.resize((size_t) channels * historyFrames);
+  filterState_.resize(channels * 8);
+  blockK_.resize(channels);
+  blockSquares_.resize(channels);
+  ringK_.resize(channels * shortTermBlocks);
+  ringSquares_.resize(channels * shortTermBlocks);
+  gateCounts_.resize(gateBins);
+  gateEnergy_.resize(gateBins);
+  for (uint32_t i = 0 ; i < gateBins ; i++)
+    gateEnergy_[i] = pow(10.0, (gateFloor + (i + 0.5) * gateStep + 0.691) / 10.0);
+  peak_.resize(channels);
+  truePeak_.resize(channels);
+  peakHold_.resize(channels);
+  truePeakHold_.resize(channels);
+  reset();
+}
+
+void AudioMeter::reset() {
+  std::fill(history_.begin(), history_.end(), 0.0f);
+  std::fill(filterState_.begin(), filterState_.end(), 0.0);
+  std::fill(blockK_.begin(), blockK_.end(), 0.0);
+  std::fill(blockSquares_.begin(), blockSquares_.end(), 0.0);
+  std::fill(gateCounts_.begin(), gateCounts_.end(), 0);
+  std::fill(peak_.begin(), peak_.end(), 0.0);
+  std::fill(truePeak_.begin(), truePeak_.end(), 0.0);
+  std::fill(peakHold_.begin(), peakHold_.end(), 0.0);
+  std::fill(truePeakHold_.begin(), truePeakHold_.end(), 0.0);
+  blockFill_ = 0;
+  ringPos_ = 0;
+  ringCount_ = 0;
+  momentary_ = shortTerm_ = integrated_ = -HUGE_VAL;
+  sampleFrames_ = 0.0;
+}
+
+void AudioMeter::readChannel(const uint8_t* data, uint32_t frames, uint32_t channel) {
+  float* dst = &samples_[(size_t) channel * (historyFrames + capacity_) + historyFrames];
+  if (bytesPerSample_ == 2) {
+    const int16_t* src = (const int16_t*) data + channel;
+    for (uint32_t f = 0 ; f < frames ; f++)
+      dst[f] = src[f * channels_] * (1.0f / 32768.0f);
+  } else {
+    const int32_t* src = (const int32_t*) data + channel;
+    for (uint32_t f = 0 ; f < frames ; f++)
+      dst[f] = (float) (src[f * channels_] * (1.0 / 2147483648.0));
+  }
+}
+
+double AudioMeter::blockLoudness(uint32_t blocks) const {
+  if (blocks == 0) return -HUGE_VAL;
+  double energy = 0.0;
+  for (uint32_t c = 0 ; c < channels_ ; c++) {
+    const double* ring = &ringK_[c * shortTermBlocks];
+    double sum = 0.0;
+    for (uint32_t b = 0 ; b < blocks ; b++)
+      sum += ring[(ringPos_ + shortTermBlocks - 1 - b) % shortTermBlocks];
+    energy += weights_[c] * sum / blocks;
+  }
+  return toLoudness(energy);
+}
+
+// BS.1770-4 two stage gating, absolute at -70 LUFS then relative at 10 LU
+// below the loudness of the blocks passing the absolute gate.
+double AudioMeter::integratedLoudness() const {
+  double energy = 0.0;
+  uint64_t count = 0;
+  for (uint32_t i = 0 ; i < gateBins ; i++) {
+    energy += gateCounts_[i] * gateEnergy_[i];
+    count += gateCounts_[i];
+  }
+  if (count == 0) return -HUGE_VAL;
+  double relative = toLoudness(energy / count) - 10.0;
+  int32_t first = (int32_t) ceil((relative - gateFloor) / gateStep - 0.5);
+  if (first < 0) first = 0;
+  energy = 0.0;
+  count = 0;
+  for (uint32_t i = first ; i < gateBins ; i++) {
+    energy += gateCounts_[i] * gateEnergy_[i];
+    count += gateCounts_[i];
+  }
+  return count > 0 ? toLoudness(energy / count) : -HUGE_VAL;
+}
+
+void AudioMeter::closeBlock() {
+  for (uint32_t c = 0 ; c < channels_ ; c++) {
+    ringK_[c * shortTermBlocks + ringPos_] = blockK_[c] / blockFrames_;
+    ringSquares_[c * shortTermBlocks + ringPos_] = blockSquares_[c] / blockFrames_;
+    blockK_[c] = 0.0;
+    blockSquares_[c] = 0.0;
+  }
+  blockFill_ = 0;
+  ringPos_ = (ringPos_ + 1) % shortTermBlocks;
+  if (ringCount_ < shortTermBlocks) ringCount_++;
+
+  uint32_t momentaryCount = ringCount_ < momentaryBlocks ? ringCount_ : momentaryBlocks;
+  momentary_ = blockLoudness(momentaryCount);
+  shortTerm_ = blockLoudness(ringCount_);
+
+  // Gating blocks are 400ms, overlapping by 75%
+  if (ringCount_ >= momentaryBlocks && momentary_ >= gateFloor) {
+    uint32_t bin = (uint32_t) ((momentary_ - gateFloor) / gateStep);
+    gateCounts_[bin < gateBins ? bin : gateBins - 1]++;
+    integrated_ = integratedLoudness();
+  }
+}
+
+void AudioMeter::process(const uint8_t* data, uint32_t frames, double* meters) {
+  if (channels_ == 0) return;
+  if (frames > capacity_) {
+    // Only when packets are longer than expected
+    capacity_ = frames;
+    samples_.resize((size_t) channels_ * (historyFrames + capacity_));
+  }
+  size_t stride = historyFrames + capacity_;
+
+  for (uint32_t c = 0 ; c < channels_ ; c++) {
+    float* s = &samples_[c * stride];
+    memcpy(s, &history_[c * historyFrames], historyFrames * sizeof(float));
+    readChannel(data, frames, c);
+
+    const float* x = s + historyFrames;
+    float peak = 0.0f;
+    for (uint32_t f = 0 ; f < frames ; f++) {
+      float a = fabsf(x[f]);
+      peak = a > peak ? a : peak;
+    }
+
+    float truePeak = peak;
+    for (uint32_t p = 0 ; p < 4 ; p++) {
+      const float* h = &phases_[p * truePeakTaps];
+      for (uint32_t f = 0 ; f < frames ; f++) {
+        const float* w = s + f; // oldest of the taps ending at x[f]
+        float acc = 0.0f;
+        for (uint32_t k = 0 ; k < truePeakTaps ; k++)
+          acc += h[k] * w[historyFrames - k];
+        acc = fabsf(acc);
+        truePeak = acc > truePeak ? acc : truePeak;
+      }
+    }
+    memcpy(&history_[c * historyFrames], s + frames, historyFrames * sizeof(float));
+
+    peak_[c] = peak;
+    truePeak_[c] = truePeak;
+    if (peak > peakHold_[c]) peakHold_[c] = peak;
+    if (truePeak > truePeakHold_[c]) truePeakHold_[c] = truePeak;
+  }
+
+  // K-weighted energy in 100ms blocks, closing blocks as they fill
+  uint32_t offset = 0;
+  while (offset < frames) {
+    uint32_t n = frames - offset;
+    if (n > blockFrames_ - blockFill_) n = blockFrames_ - blockFill_;
+    for (uint32_t c = 0 ; c < channels_ ; c++) {
+      const float* x = &samples_[c * stride + historyFrames + offset];
+      double* st = &filterState_[c * 8];
+      double x1 = st[0], x2 = st[1], y1 = st[2], y2 = st[3];
+      double z1 = st[4], z2 = st[5], w1 = st[6], w2 = st[7];
+      double k = 0.0, squares = 0.0;
+      for (uint32_t f = 0 ; f < n ; f++) {
+        double in = x[f];
+        double y = pb_[0] * in + pb_[1] * x1 + pb_[2] * x2 - pa_[1] * y1 - pa_[2] * y2;
+        x2 = x1; x1 = in; y2 = y1; y1 = y;
+        double w = rb_[0] * y + rb_[1] * z1 + rb_[2] * z2 - ra_[1] * w1 - ra_[2] * w2;
+        z2 = z1; z1 = y; w2 = w1; w1 = w;
+        k += w * w;
+        squares += in * in;
+      }
+      st[0] = x1; st[1] = x2; st[2] = y1; st[3] = y2;
+      st[4] = z1; st[5] = z2; st[6] = w1; st[7] = w2;
+      blockK_[c] += k;
+      blockSquares_[c] += squares;
+    }
+    blockFill_ += n;
+    offset += n;
+    if (blockFill_ == blockFrames_)
+      closeBlock();
+  }
+  sampleFrames_ += frames;
+
+  meters[meterMomentary] = momentary_;
+  meters[meterShortTerm] = shortTerm_;
+  meters[meterIntegrated] = integrated_;
+  meters[meterSampleFrames] = sampleFrames_;
+  uint32_t rmsBlocks = ringCount_ < momentaryBlocks ? ringCount_ : momentaryBlocks;
+  for (uint32_t c = 0 ; c < channels_ ; c++) {
+    double meanSquare = 0.0;
+    if (rmsBlocks > 0) {
+      const double* ring = &ringSquares_[c * shortTermBlocks];
+      for (uint32_t b = 0 ; b < rmsBlocks ; b++)
+        meanSquare += ring[(ringPos_ + shortTermBlocks - 1 - b) % shortTermBlocks];
+      meanSquare /= rmsBlocks;
+    } else if (blockFill_ > 0) {
+      meanSquare = blockSquares_[c] / blockFill_;
+    }
+    double* m = meters + meterGlobalFields + c * meterChannelFields;
+    m[meterPeak] = toDecibels(peak_[c]);
+    m[meterPeakHold] = toDecibels(peakHold_[c]);
+    m[meterRMS] = toDecibels(sqrt(meanSquare));
+    m[meterTruePeak] = toDecibels(truePeak_[c]);
+    m[meterTruePeakHold] = toDecibels(truePeakHold_[c]);
+  }
+}
+
+} // namespace streampunk
@@ -0,0 +1,112 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef AUDIOMETER_H
+#define AUDIOMETER_H
+
+#include <stdint.h>
+#include <vector>
+
+namespace streampunk {
+
+// Layout of the published meter values. Levels are in dBFS and loudness in
+// LUFS, -Infinity when there is nothing to measure.
+enum MeterField {
+  meterMomentary = 0,   // 400ms loudness
+  meterShortTerm,       // 3s loudness
+  meterIntegrated,      // gated programme loudness since the last reset
+  meterSampleFrames,    // sample frames metered since the last reset
+  meterGlobalFields
+};
+
+enum ChannelMeterField {
+  meterPeak = 0,        // sample peak of the last packet
+  meterPeakHold,        // highest sample peak since the last reset
+  meterRMS,             // over the last 400ms
+  meterTruePeak,        // 4x oversampled peak of the last packet, dBTP
+  meterTruePeakHold,
+  meterChannelFields
+};
+
+inline uint32_t meterLength(uint32_t channels) {
+  return meterGlobalFields + channels * meterChannelFields;
+}
+
+// Level and BS.1770 / EBU R128 loudness meter for interleaved 16 or 32-bit
+// integer audio. All buffers are sized when the meter is configured so that
+// metering a packet does not allocate.
+class AudioMeter {
+public:
+  AudioMeter();
+
+  // Weights are the BS.1770 channel weights, 1.0 for channels not given.
+  void configure(uint32_t sampleRate, uint32_t channels, uint32_t bytesPerSample,
+    const std::vector<double>& weights);
+  bool isConfigured() const { return channels_ > 0; }
+  uint32_t channels() const { return channels_; }
+  void reset();
+
+  // Meter a packet and write meterLength(channels) values to meters.
+  void process(const uint8_t* data, uint32_t frames, double* meters);
+
+private:
+  void readChannel(const uint8_t* data, uint32_t frames, uint32_t channel);
+  void closeBlock();
+  double blockLoudness(uint32_t blocks) const;
+  double integratedLoudness() const;
+
+  uint32_t sampleRate_;
+  uint32_t channels_;
+  uint32_t bytesPerSample_;
+  std::vector<double> weights_;
+
+  // K-weighting pre-filter and RLB high-pass biquads
+  double pb_[3], pa_[3], rb_[3], ra_[3];
+  std::vector<double> filterState_;   // 4 values per biquad per channel
+
+  // 4x oversampling interpolator, truePeakTaps taps per phase
+  std::vector<float> phases_;
+  std::vector<float> samples_;        // per channel, history then the packet
+  uint32_t capacity_;                 // packet frames samples_ can hold
+  std::vector<float> history_;        // per channel
+
+  // 100ms sub-blocks of K-weighted and unweighted energy per channel
+  uint32_t blockFrames_;
+  uint32_t blockFill_;
+  std::vector<double> blockK_;        // current block, per channel
+  std::vector<double> blockSquares_;
+  std::vector<double> ringK_;         // last shortTermBlocks blocks, per channel
+  std::vector<double> ringSquares_;
+  uint32_t ringPos_;
+  uint32_t ringCount_;
+
+  // gating block loudness histogram for integrated loudness, with the
+  // mean square energy at the centre of each bin
+  std::vector<uint32_t> gateCounts_;
+  std::vector<double> gateEnergy_;
+
+  std::vector<double> peakHold_;
+  std::vector<double> truePeakHold_;
+  std::vector<double> peak_;
+  std::vector<double> truePeak_;
+  double momentary_;
+  double shortTerm_;
+  double integrated_;
+  double sampleFrames_;
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,63 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "AudioRing.h"
+#include <string.h>
+
+namespace streampunk {
+
+AudioRing::AudioRing() : frameBytes_(0), capacity_(0), readPos_(0), fill_(0) {}
+
+void AudioRing::configure(uint32_t frameBytes, uint32_t capacityFrames) {
+  frameBytes_ = frameBytes;
+  capacity_ = capacityFrames;
+  data_.assign((size_t) frameBytes * capacityFrames, 0);
+  clear();
+}
+
+void AudioRing::clear() {
+  readPos_ = 0;
+  fill_ = 0;
+}
+
+uint32_t AudioRing::write(const uint8_t* data, uint32_t frames) {
+  if (frames > space()) frames = space();
+  if (frames == 0) return 0;
+  uint32_t writePos = (readPos_ + fill_) % capacity_;
+  uint32_t first = capacity_ - writePos;
+  if (first > frames) first = frames;
+  memcpy(&data_[0] + (size_t) writePos * frameBytes_, data, (size_t) first * frameBytes_);
+  if (frames > first)
+    memcpy(&data_[0], data + (size_t) first * frameBytes_,
+      (size_t) (frames - first) * frameBytes_);
+  fill_ += frames;
+  return frames;
+}
+
+uint32_t AudioRing::read(uint8_t* data, uint32_t frames) {
+  if (frames > fill_) frames = fill_;
+  if (frames == 0) return 0;
+  uint32_t first = capacity_ - readPos_;
+  if (first > frames) first = frames;
+  memcpy(data, &data_[0] + (size_t) readPos_ * frameBytes_, (size_t) first * frameBytes_);
+  if (frames > first)
+    memcpy(data + (size_t) first * frameBytes_, &data_[0],
+      (size_t) (frames - first) * frameBytes_);
+  readPos_ = (readPos_ + frames) % capacity_;
+  fill_ -= frames;
+  return frames;
+}
+
+} // namespace streampunk
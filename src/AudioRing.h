@@ -0,0 +1,56 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef AUDIORING_H
+#define AUDIORING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace streampunk {
+
+// A fixed size FIFO of whole sample frames, sitting between JS, which writes
+// audio whenever it has some, and the driver's audio callback, which drains
+// it. Not thread safe - callers hold the owner's lock.
+class AudioRing {
+public:
+  AudioRing();
+
+  // Discards any buffered audio.
+  void configure(uint32_t frameBytes, uint32_t capacityFrames);
+  void clear();
+
+  uint32_t frameBytes() const { return frameBytes_; }
+  uint32_t capacity() const { return capacity_; }
+  uint32_t available() const { return fill_; }
+  uint32_t space() const { return capacity_ - fill_; }
+
+  // Both return the number of sample frames actually copied, which is less
+  // than asked for when the ring is full or runs dry.
+  uint32_t write(const uint8_t* data, uint32_t frames);
+  uint32_t read(uint8_t* data, uint32_t frames);
+
+private:
+  std::vector<uint8_t> data_;
+  uint32_t frameBytes_;
+  uint32_t capacity_;
+  uint32_t readPos_;
+  uint32_t fill_;
+};
+
+} // namespace streampunk
+
+#endif
@@ -41,26 +41,69 @@
  */
 
 #include "Capture.h"
+#include "Formats.h"
+#include <time.h>
 
 namespace streampunk {
 
 inline Nan::Persistent<v8::Function> &Capture::constructor() {
-  static Nan::Persistent<v8::Function> myConstructor;
+  static thread_local Nan::Persistent<v8::Function> myConstructor;
   return myConstructor;
 }
 
 Capture::Capture(uint32_t deviceIndex, uint32_t displayMode,
-    uint32_t pixelFormat) : deviceIndex_(deviceIndex),
-    displayMode_(displayMode), pixelFormat_(pixelFormat), latestFrame_(NULL) {
+    uint32_t pixelFormat) : m_deckLink(NULL), m_deckLinkInput(NULL),
+    deviceIndex_(deviceIndex),
+    displayMode_(displayMode), pixelFormat_(pixelFormat), latestFrame_(NULL),
+    latestAudio_(NULL), proxyWidth_(0), proxyHeight_(0),
+    proxyFormat_(bmdFormat8BitYUV), proxyFilter_(downscaleBox),
+    proxyScaler_(NULL), hasProxy_(false), deliverFields_(false),
+    audioSampleRate_(bmdAudioSampleRate48kHz),
+    audioSampleType_(bmdAudioSampleType16bitInteger), audioChannels_(2),
+    convertAudio_(false), audioConfigSerial_(0), converterSerial_(0),
+    hasConverted_(false), analyse_(false), analysisSerial_(0),
+    analyserSerial_(0), hasMetrics_(false), meter_(false), meterSerial_(0),
+    meterConfiguredSerial_(0), hasMeters_(false), alarms_(false),
+    alarmSerial_(0), alarmConfiguredSerial_(0), hashType_(hashNone),
+    latestVideoHash_(0), latestAudioHash_(0), hasVideoHash_(false),
+    hasAudioHash_(false), timeshift_(NULL), segments_(NULL),
+    audioRecorder_(NULL), y4m_(NULL), shared_(NULL), ringDeliver_(true),
+    queueLimit_(0), queueDropNewest_(false), queueArrived_(0), queueDropped_(0),
+    queueTaken_(0) {
   async = new uv_async_t;
-  uv_async_init(uv_default_loop(), async, FrameCallback);
+  uv_async_init(currentLoop(), async, FrameCallback);
   uv_mutex_init(&padlock);
+  uv_mutex_init(&timeshiftLock_);
   async->data = this;
+  segmentAsync_ = new uv_async_t;
+  uv_async_init(currentLoop(), segmentAsync_, SegmentCallback);
+  uv_mutex_init(&segmentLock_);
+  segmentAsync_->data = this;
+  uv_mutex_init(&audioRecordLock_);
+  uv_mutex_init(&y4mLock_);
+  uv_mutex_init(&sharedLock_);
+  uv_mutex_init(&ringLock_);
+  uv_mutex_init(&queueLock_);
+  addCleanupHook(cleanup, this);
 }
 
 Capture::~Capture() {
+  if (async != NULL) {
+    removeCleanupHook(cleanup, this);
+    shutdown();
+  }
   if (!captureCB_.IsEmpty())
     captureCB_.Reset();
+  meterArray_.Reset();
+  alarmCB_.Reset();
+  timeshiftHandle_.Reset();
+  segmentCB_.Reset();
+  delete segments_;
+  delete audioRecorder_;
+  delete y4m_;
+  delete shared_;
+  ringHandle_.Reset();
+  delete proxyScaler_;
 }
 
 NAN_MODULE_INIT(Capture::Init) {
@@ -83,8 +126,31 @@ NAN_MODULE_INIT(Capture::Init) {
   Nan::SetPrototypeMethod(tpl, "doCapture", DoCapture);
   Nan::SetPrototypeMethod(tpl, "stop", StopCapture);
   Nan::SetPrototypeMethod(tpl, "enableAudio", EnableAudio);
+  Nan::SetPrototypeMethod(tpl, "setProxy", SetProxy);
+  Nan::SetPrototypeMethod(tpl, "setFieldMode", SetFieldMode);
+  Nan::SetPrototypeMethod(tpl, "setAudioFormat", SetAudioFormat);
+  Nan::SetPrototypeMethod(tpl, "setAnalysis", SetAnalysis);
+  Nan::SetPrototypeMethod(tpl, "setMetering", SetMetering);
+  Nan::SetPrototypeMethod(tpl, "setAudioAlarms", SetAudioAlarms);
+  Nan::SetPrototypeMethod(tpl, "setHashing", SetHashing);
+  Nan::SetPrototypeMethod(tpl, "setTimeshift", SetTimeshift);
+  Nan::SetPrototypeMethod(tpl, "startRecording", StartRecording);
+  Nan::SetPrototypeMethod(tpl, "stopRecording", StopRecording);
+  Nan::SetPrototypeMethod(tpl, "recordingStatus", RecordingStatus);
+  Nan::SetPrototypeMethod(tpl, "startAudioRecording", StartAudioRecording);
+  Nan::SetPrototypeMethod(tpl, "stopAudioRecording", StopAudioRecording);
+  Nan::SetPrototypeMethod(tpl, "audioRecordingStatus", AudioRecordingStatus);
+  Nan::SetPrototypeMethod(tpl, "setY4MOutput", SetY4MOutput);
+  Nan::SetPrototypeMethod(tpl, "y4mOutputStatus", Y4MOutputStatus);
+  Nan::SetPrototypeMethod(tpl, "setSharedOutput", SetSharedOutput);
+  Nan::SetPrototypeMethod(tpl, "sharedOutputStatus", SharedOutputStatus);
+  Nan::SetPrototypeMethod(tpl, "setFrameRing", SetFrameRing);
+  Nan::SetPrototypeMethod(tpl, "setFrameQueue", SetFrameQueue);
+  Nan::SetPrototypeMethod(tpl, "takeFrame", TakeFrame);
+  Nan::SetPrototypeMethod(tpl, "frameQueueStatus", FrameQueueStatus);
 
   constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  resetOnCleanup(&constructor());
   Nan::Set(target, Nan::New("Capture").ToLocalChecked(),
                Nan::GetFunction(tpl).ToLocalChecked());
 }
@@ -170,6 +236,787 @@ NAN_METHOD(Capture::EnableAudio) {
   }
 }
 
+NAN_METHOD(Capture::SetProxy) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uint32_t width = info[0]->IsNumber() ? Nan::To<uint32_t>(info[0]).FromJust() : 0;
+  uint32_t height = info[1]->IsNumber() ? Nan::To<uint32_t>(info[1]).FromJust() : 0;
+  uint32_t format = info[2]->IsNumber() ?
+    Nan::To<uint32_t>(info[2]).FromJust() : (uint32_t) bmdFormat8BitYUV;
+  DownscaleFilter filter = downscaleBox;
+  if (!parseDownscaleFilter(info[3], &filter)) {
+    Nan::ThrowError("Proxy filter must be 'box' or 'bilinear'.");
+    return;
+  }
+  if (!isYUV422Format(format)) {
+    Nan::ThrowError("Proxy pixel format must be 8-bit (2vuy) or 10-bit (v210) YUV.");
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->proxyWidth_ = width;
+  obj->proxyHeight_ = height;
+  obj->proxyFormat_ = format;
+  obj->proxyFilter_ = filter;
+  uv_mutex_unlock(&obj->padlock);
+
+  if (width == 0 || height == 0)
+    info.GetReturnValue().Set(Nan::New("Proxy disabled.").ToLocalChecked());
+  else
+    info.GetReturnValue().Set(Nan::New("Proxy enabled.").ToLocalChecked());
+}
+
+NAN_METHOD(Capture::SetFieldMode) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  bool enable = Nan::To<bool>(info[0]).FromMaybe(false);
+
+  uv_mutex_lock(&obj->padlock);
+  obj->deliverFields_ = enable;
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(Nan::New(enable ? "Field mode enabled." :
+    "Field mode disabled.").ToLocalChecked());
+}
+
+NAN_METHOD(Capture::SetAudioFormat) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  AudioLayout layout;
+  ChannelMap map;
+  bool enable = !info[0]->IsUndefined() && !info[0]->IsNull();
+  layout.channels = 0;
+  if (enable && !parseSampleFormat(info[0], &layout.format)) {
+    Nan::ThrowError("Sample format must be 'int16', 'int32' or 'float32'.");
+    return;
+  }
+  if (enable && !parsePlanar(info[1], &layout.planar)) {
+    Nan::ThrowError("Audio layout must be 'interleaved' or 'planar'.");
+    return;
+  }
+  if (enable && !parseChannelMap(info[2], &map)) {
+    Nan::ThrowError("Channel map must be an array of channel numbers, arrays of channel numbers or [ channel, gain ] pairs.");
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->convertAudio_ = enable;
+  if (enable) {
+    obj->audioLayout_ = layout;
+    obj->audioMap_ = map;
+  }
+  obj->audioConfigSerial_++;
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(Nan::New(enable ? "Audio conversion enabled." :
+    "Audio conversion disabled.").ToLocalChecked());
+}
+
+NAN_METHOD(Capture::SetAnalysis) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  AnalysisOptions options;
+  bool enable = !info[0]->IsUndefined() && !info[0]->IsNull() && !info[0]->IsFalse();
+  if (enable && !parseAnalysisOptions(info[0], &options)) {
+    Nan::ThrowTypeError("Analysis options must be an object.");
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->analyse_ = enable;
+  obj->analysisOptions_ = options;
+  obj->analysisSerial_++;
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(Nan::New(enable ? "Analysis enabled." :
+    "Analysis disabled.").ToLocalChecked());
+}
+
+// Meters are written into a Float64Array of meterLength(channels) values
+// owned by JS. Setting the array again resets the holds and loudness.
+NAN_METHOD(Capture::SetMetering) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  bool enable = info[0]->IsFloat64Array();
+  if (!enable && !info[0]->IsUndefined() && !info[0]->IsNull()) {
+    Nan::ThrowTypeError("Meters must be published into a Float64Array.");
+    return;
+  }
+  if (enable) {
+    Nan::TypedArrayContents<double> meters(info[0]);
+    if (meters.length() < meterLength(obj->audioChannels_)) {
+      Nan::ThrowRangeError("Meter array is too short for the number of audio channels.");
+      return;
+    }
+  }
+  std::vector<double> weights;
+  if (info[1]->IsArray()) {
+    v8::Local<v8::Array> list = v8::Local<v8::Array>::Cast(info[1]);
+    for (uint32_t x = 0 ; x < list->Length() ; x++)
+      weights.push_back(Nan::To<double>(Nan::Get(list, x).ToLocalChecked()).FromMaybe(1.0));
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->meter_ = enable;
+  obj->meterWeights_ = weights;
+  obj->meterSerial_++;
+  obj->hasMeters_ = false;
+  uv_mutex_unlock(&obj->padlock);
+
+  if (enable)
+    obj->meterArray_.Reset(Nan::To<v8::Object>(info[0]).ToLocalChecked());
+  else
+    obj->meterArray_.Reset();
+
+  info.GetReturnValue().Set(Nan::New(enable ? "Metering enabled." :
+    "Metering disabled.").ToLocalChecked());
+}
+
+NAN_METHOD(Capture::SetAudioAlarms) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  std::vector<uint32_t> pairs;
+  AudioAlarmOptions options;
+  bool enable = !info[0]->IsUndefined() && !info[0]->IsNull();
+  if (enable && (!parseAudioAlarms(info[0], info[1], &pairs, &options) ||
+      !info[2]->IsFunction())) {
+    Nan::ThrowTypeError("Audio alarms require an array of [ left, right ] channel pairs, options and a callback.");
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->alarms_ = enable;
+  obj->alarmPairs_ = pairs;
+  obj->alarmOptions_ = options;
+  obj->alarmSerial_++;
+  obj->pendingAlarms_.clear();
+  uv_mutex_unlock(&obj->padlock);
+
+  if (enable)
+    obj->alarmCB_.Reset(v8::Local<v8::Function>::Cast(info[2]));
+  else
+    obj->alarmCB_.Reset();
+
+  info.GetReturnValue().Set(Nan::New(enable ? "Audio alarms enabled." :
+    "Audio alarms disabled.").ToLocalChecked());
+}
+
+static v8::Local<v8::Object> segmentToObject(const SegmentEvent& event) {
+  static const char* types[] = { "closed", "deleted", "failed" };
+  v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+  Nan::Set(obj, Nan::New("type").ToLocalChecked(), Nan::New(types[event.type]).ToLocalChecked());
+  Nan::Set(obj, Nan::New("index").ToLocalChecked(), Nan::New((double) event.index));
+  Nan::Set(obj, Nan::New("path").ToLocalChecked(), Nan::New(event.path).ToLocalChecked());
+  if (event.type == segmentFailed) {
+    Nan::Set(obj, Nan::New("error").ToLocalChecked(), Nan::New(event.error).ToLocalChecked());
+    return obj;
+  }
+  Nan::Set(obj, Nan::New("firstFrame").ToLocalChecked(), Nan::New((double) event.firstFrame));
+  Nan::Set(obj, Nan::New("lastFrame").ToLocalChecked(), Nan::New((double) event.lastFrame));
+  Nan::Set(obj, Nan::New("frames").ToLocalChecked(), Nan::New(event.frames));
+  Nan::Set(obj, Nan::New("bytes").ToLocalChecked(), Nan::New((double) event.bytes));
+  Nan::Set(obj, Nan::New("streamTime").ToLocalChecked(), Nan::New((double) event.streamTime));
+  return obj;
+}
+
+static std::string optionString(v8::Local<v8::Object> options, const char* name) {
+  v8::Local<v8::Value> value = Nan::Get(options,
+    Nan::New(name).ToLocalChecked()).ToLocalChecked();
+  return value->IsString() ? std::string(*Nan::Utf8String(value)) : std::string();
+}
+
+static uint32_t optionNumber(v8::Local<v8::Object> options, const char* name, uint32_t fallback) {
+  v8::Local<v8::Value> value = Nan::Get(options,
+    Nan::New(name).ToLocalChecked()).ToLocalChecked();
+  return value->IsNumber() ? Nan::To<uint32_t>(value).FromJust() : fallback;
+}
+
+// startRecording({ directory, prefix, extension, frames, retain, queue,
+//   lossless, width, height }, frameBytes, callback) - lossless is the number
+//   of threads to code frames with, 0 for raw. The callback receives arrays
+//   of segment events.
+NAN_METHOD(Capture::StartRecording) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  if (!info[0]->IsObject() || !info[2]->IsFunction()) {
+    Nan::ThrowTypeError("Recording requires options, a frame size and a callback.");
+    return;
+  }
+  v8::Local<v8::Object> options = Nan::To<v8::Object>(info[0]).ToLocalChecked();
+  SegmentOptions segmentOptions;
+  segmentOptions.directory = optionString(options, "directory");
+  segmentOptions.prefix = optionString(options, "prefix");
+  segmentOptions.extension = optionString(options, "extension");
+  segmentOptions.segmentFrames = optionNumber(options, "frames", 0);
+  segmentOptions.retain = optionNumber(options, "retain", 0);
+  segmentOptions.queueFrames = optionNumber(options, "queue", 16);
+  segmentOptions.losslessThreads = optionNumber(options, "lossless", 0);
+  segmentOptions.pixelFormat = obj->pixelFormat_;
+  segmentOptions.width = optionNumber(options, "width", 0);
+  segmentOptions.height = optionNumber(options, "height", 0);
+  uint32_t frameBytes = Nan::To<uint32_t>(info[1]).FromMaybe(0);
+  if (segmentOptions.directory.empty() || segmentOptions.segmentFrames == 0 ||
+      segmentOptions.queueFrames < 2 || frameBytes == 0) {
+    Nan::ThrowRangeError("Recording requires a directory, frames per segment, a queue of at least two and a frame size.");
+    return;
+  }
+  if (segmentOptions.losslessThreads > 0 && !LosslessCodec::canCode(obj->pixelFormat_)) {
+    info.GetReturnValue().Set(Nan::New("Lossless recording needs a 2vuy or v210 capture.").ToLocalChecked());
+    return;
+  }
+
+  uv_mutex_lock(&obj->segmentLock_);
+  SegmentRecorder* previous = obj->segments_;
+  obj->segments_ = NULL;
+  uv_mutex_unlock(&obj->segmentLock_);
+  if (previous != NULL) {
+    previous->stop();
+    uv_mutex_lock(&obj->segmentLock_);
+    previous->takeEvents(obj->segmentEvents_);
+    uv_mutex_unlock(&obj->segmentLock_);
+    delete previous;
+  }
+
+  SegmentRecorder* recorder = new SegmentRecorder;
+  if (!recorder->start(segmentOptions, frameBytes, segmentNotify, obj)) {
+    delete recorder;
+    info.GetReturnValue().Set(Nan::New("Could not start the recorder.").ToLocalChecked());
+    return;
+  }
+  obj->segmentCB_.Reset(v8::Local<v8::Function>::Cast(info[2]));
+  uv_mutex_lock(&obj->segmentLock_);
+  obj->segments_ = recorder;
+  uv_mutex_unlock(&obj->segmentLock_);
+
+  info.GetReturnValue().Set(Nan::New("Recording started.").ToLocalChecked());
+}
+
+// Waits for the queue to be written out. The last segment's events follow.
+NAN_METHOD(Capture::StopRecording) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->segmentLock_);
+  SegmentRecorder* recorder = obj->segments_;
+  obj->segments_ = NULL;
+  uv_mutex_unlock(&obj->segmentLock_);
+  if (recorder == NULL) {
+    info.GetReturnValue().Set(Nan::New("Not recording.").ToLocalChecked());
+    return;
+  }
+  recorder->stop();
+  uv_mutex_lock(&obj->segmentLock_);
+  recorder->takeEvents(obj->segmentEvents_);
+  uv_mutex_unlock(&obj->segmentLock_);
+  delete recorder;
+  uv_async_send(obj->segmentAsync_);
+
+  info.GetReturnValue().Set(Nan::New("Recording stopped.").ToLocalChecked());
+}
+
+NAN_METHOD(Capture::RecordingStatus) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->segmentLock_);
+  if (obj->segments_ == NULL) {
+    uv_mutex_unlock(&obj->segmentLock_);
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  SegmentRecorder::Status status = obj->segments_->status();
+  uv_mutex_unlock(&obj->segmentLock_);
+
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("offered").ToLocalChecked(), Nan::New((double) status.offered));
+  Nan::Set(result, Nan::New("written").ToLocalChecked(), Nan::New((double) status.written));
+  Nan::Set(result, Nan::New("dropped").ToLocalChecked(), Nan::New((double) status.dropped));
+  Nan::Set(result, Nan::New("segment").ToLocalChecked(), Nan::New((double) status.index));
+  Nan::Set(result, Nan::New("closed").ToLocalChecked(), Nan::New((double) status.closed));
+  Nan::Set(result, Nan::New("deleted").ToLocalChecked(), Nan::New((double) status.deleted));
+  Nan::Set(result, Nan::New("unprepared").ToLocalChecked(), Nan::New((double) status.unprepared));
+  Nan::Set(result, Nan::New("bytes").ToLocalChecked(), Nan::New((double) status.bytes));
+  Nan::Set(result, Nan::New("queued").ToLocalChecked(), Nan::New(status.queued));
+  info.GetReturnValue().Set(result);
+}
+
+// startAudioRecording({ path, splitMono, bits, buffer, maxPending,
+//   description, originator, originatorReference })
+NAN_METHOD(Capture::StartAudioRecording) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  if (!info[0]->IsObject()) {
+    Nan::ThrowTypeError("Audio recording requires options with a path.");
+    return;
+  }
+  v8::Local<v8::Object> options = Nan::To<v8::Object>(info[0]).ToLocalChecked();
+  uv_mutex_lock(&obj->padlock);
+  uint32_t sampleRate = (uint32_t) obj->audioSampleRate_;
+  uint32_t inputBytes = (uint32_t) obj->audioSampleType_ / 8;
+  uint32_t channels = obj->audioChannels_;
+  uv_mutex_unlock(&obj->padlock);
+
+  AudioRecordOptions record;
+  record.path = optionString(options, "path");
+  record.splitMono = Nan::To<bool>(Nan::Get(options,
+    Nan::New("splitMono").ToLocalChecked()).ToLocalChecked()).FromMaybe(false);
+  record.bits = optionNumber(options, "bits", inputBytes == 2 ? 16 : 24);
+  record.bufferBytes = optionNumber(options, "buffer", 4 * 1024 * 1024);
+  record.maxPending = optionNumber(options, "maxPending", sampleRate * 5);
+  record.bext.description = optionString(options, "description");
+  record.bext.originator = optionString(options, "originator");
+  if (record.bext.originator.empty()) record.bext.originator = "macadam";
+  record.bext.originatorReference = optionString(options, "originatorReference");
+
+  // Origination is when recording started, with the time of day as the time
+  // reference until the first frame's timecode is seen
+  time_t now = time(NULL);
+  struct tm local;
+#ifdef WIN32
+  localtime_s(&local, &now);
+#else
+  localtime_r(&now, &local);
+#endif
+  char date[16], clock[16];
+  strftime(date, sizeof(date), "%Y-%m-%d", &local);
+  strftime(clock, sizeof(clock), "%H:%M:%S", &local);
+  record.bext.date = date;
+  record.bext.time = clock;
+  record.bext.timeReference = (uint64_t) (local.tm_hour * 3600 + local.tm_min * 60 +
+    local.tm_sec) * sampleRate;
+  char history[96];
+  snprintf(history, sizeof(history), "A=PCM,F=%u,W=%u,M=%s,T=macadam\r\n",
+    sampleRate, record.bits, record.splitMono || channels == 1 ? "mono" :
+    channels == 2 ? "stereo" : "multitrack");
+  record.bext.codingHistory = history;
+
+  uv_mutex_lock(&obj->audioRecordLock_);
+  AudioRecorder* previous = obj->audioRecorder_;
+  obj->audioRecorder_ = NULL;
+  uv_mutex_unlock(&obj->audioRecordLock_);
+  delete previous;
+
+  AudioRecorder* recorder = new AudioRecorder;
+  if (!recorder->start(record, sampleRate, channels, inputBytes)) {
+    delete recorder;
+    info.GetReturnValue().Set(Nan::New("Audio recording needs a path and 16, 24 or 32 bits.").ToLocalChecked());
+    return;
+  }
+  uv_mutex_lock(&obj->audioRecordLock_);
+  obj->audioRecorder_ = recorder;
+  uv_mutex_unlock(&obj->audioRecordLock_);
+
+  info.GetReturnValue().Set(Nan::New("Audio recording started.").ToLocalChecked());
+}
+
+static v8::Local<v8::Object> audioStatusToObject(const AudioRecorder::Status& status) {
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("sampleFrames").ToLocalChecked(), Nan::New((double) status.sampleFrames));
+  Nan::Set(result, Nan::New("dropped").ToLocalChecked(), Nan::New((double) status.dropped));
+  Nan::Set(result, Nan::New("bytes").ToLocalChecked(), Nan::New((double) status.bytes));
+  Nan::Set(result, Nan::New("pending").ToLocalChecked(), Nan::New(status.pending));
+  Nan::Set(result, Nan::New("rf64").ToLocalChecked(), Nan::New(status.rf64));
+  if (status.failed)
+    Nan::Set(result, Nan::New("error").ToLocalChecked(), Nan::New(status.error).ToLocalChecked());
+  return result;
+}
+
+// Waits for pending audio to be written and the headers completed. Returns
+// the final status with the paths of the files written.
+NAN_METHOD(Capture::StopAudioRecording) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->audioRecordLock_);
+  AudioRecorder* recorder = obj->audioRecorder_;
+  obj->audioRecorder_ = NULL;
+  uv_mutex_unlock(&obj->audioRecordLock_);
+  if (recorder == NULL) {
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  recorder->stop();
+  v8::Local<v8::Object> result = audioStatusToObject(recorder->status());
+  const std::vector<std::string>& paths = recorder->paths();
+  v8::Local<v8::Array> files = Nan::New<v8::Array>((uint32_t) paths.size());
+  for (uint32_t x = 0 ; x < paths.size() ; x++)
+    Nan::Set(files, x, Nan::New(paths[x]).ToLocalChecked());
+  Nan::Set(result, Nan::New("files").ToLocalChecked(), files);
+  delete recorder;
+  info.GetReturnValue().Set(result);
+}
+
+NAN_METHOD(Capture::AudioRecordingStatus) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->audioRecordLock_);
+  if (obj->audioRecorder_ == NULL) {
+    uv_mutex_unlock(&obj->audioRecordLock_);
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  AudioRecorder::Status status = obj->audioRecorder_->status();
+  uv_mutex_unlock(&obj->audioRecordLock_);
+  info.GetReturnValue().Set(audioStatusToObject(status));
+}
+
+static v8::Local<v8::Object> y4mStatusToObject(const Y4MWriter::Status& status) {
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("written").ToLocalChecked(), Nan::New((double) status.written));
+  Nan::Set(result, Nan::New("dropped").ToLocalChecked(), Nan::New((double) status.dropped));
+  Nan::Set(result, Nan::New("queued").ToLocalChecked(), Nan::New(status.queued));
+  if (status.failed)
+    Nan::Set(result, Nan::New("error").ToLocalChecked(), Nan::New(status.error).ToLocalChecked());
+  return result;
+}
+
+// setY4MOutput(path | fd, { width, height, rateNum, rateDen, interlace, depth,
+//   queue }) streams frames as Y4M, setY4MOutput(null) stops and returns the
+// final status. A descriptor passed in is left open.
+NAN_METHOD(Capture::SetY4MOutput) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->y4mLock_);
+  Y4MWriter* previous = obj->y4m_;
+  obj->y4m_ = NULL;
+  uv_mutex_unlock(&obj->y4mLock_);
+  v8::Local<v8::Value> last = Nan::Null();
+  if (previous != NULL) {
+    previous->close();
+    last = y4mStatusToObject(previous->status());
+    delete previous;
+  }
+  if (info[0]->IsUndefined() || info[0]->IsNull()) {
+    info.GetReturnValue().Set(last);
+    return;
+  }
+  if ((!info[0]->IsString() && !info[0]->IsNumber()) || !info[1]->IsObject()) {
+    Nan::ThrowTypeError("Y4M output requires a path or file descriptor and options.");
+    return;
+  }
+
+  v8::Local<v8::Object> options = Nan::To<v8::Object>(info[1]).ToLocalChecked();
+  Y4MFormat format;
+  format.width = optionNumber(options, "width", 0);
+  format.height = optionNumber(options, "height", 0);
+  format.rateNum = optionNumber(options, "rateNum", 25);
+  format.rateDen = optionNumber(options, "rateDen", 1);
+  std::string interlace = optionString(options, "interlace");
+  format.interlace = interlace.empty() ? 'p' : interlace[0];
+  format.depth = optionNumber(options, "depth",
+    obj->pixelFormat_ == bmdFormat10BitYUV ? 10 : 8);
+  uint32_t queue = optionNumber(options, "queue", 8);
+
+  int fd = -1;
+  bool own = info[0]->IsString();
+  std::string error = "Y4M output needs a 4:2:2 capture, a size and a depth of 8 or 10.";
+  if (own)
+    fd = openY4MPath(*Nan::Utf8String(info[0]), true, error);
+  else
+    fd = Nan::To<int32_t>(info[0]).FromJust();
+  Y4MWriter* writer = new Y4MWriter;
+  if (fd < 0 || !writer->open(fd, own, format, obj->pixelFormat_, queue)) {
+    delete writer;
+    info.GetReturnValue().Set(Nan::New(error).ToLocalChecked());
+    return;
+  }
+  uv_mutex_lock(&obj->y4mLock_);
+  obj->y4m_ = writer;
+  uv_mutex_unlock(&obj->y4mLock_);
+
+  info.GetReturnValue().Set(Nan::New("Y4M output started.").ToLocalChecked());
+}
+
+NAN_METHOD(Capture::Y4MOutputStatus) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->y4mLock_);
+  if (obj->y4m_ == NULL) {
+    uv_mutex_unlock(&obj->y4mLock_);
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  Y4MWriter::Status status = obj->y4m_->status();
+  uv_mutex_unlock(&obj->y4mLock_);
+  info.GetReturnValue().Set(y4mStatusToObject(status));
+}
+
+static v8::Local<v8::Object> sharedStatusToObject(const FramePublisher& publisher) {
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("name").ToLocalChecked(), Nan::New(publisher.name()).ToLocalChecked());
+  Nan::Set(result, Nan::New("published").ToLocalChecked(), Nan::New((double) publisher.published()));
+  Nan::Set(result, Nan::New("bytes").ToLocalChecked(), Nan::New((double) publisher.bytes()));
+  return result;
+}
+
+// setSharedOutput(name, { frames, frameBytes, audioBytes, width, height })
+// publishes every frame into a shared memory ring for FrameSubscribers in
+// other processes. setSharedOutput(null) stops and returns the final status.
+NAN_METHOD(Capture::SetSharedOutput) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->sharedLock_);
+  FramePublisher* previous = obj->shared_;
+  obj->shared_ = NULL;
+  uv_mutex_unlock(&obj->sharedLock_);
+  v8::Local<v8::Value> last = Nan::Null();
+  if (previous != NULL) {
+    last = sharedStatusToObject(*previous);
+    delete previous;
+  }
+  if (info[0]->IsUndefined() || info[0]->IsNull()) {
+    info.GetReturnValue().Set(last);
+    return;
+  }
+  if (!info[0]->IsString() || !info[1]->IsObject()) {
+    Nan::ThrowTypeError("Shared output requires a name and options.");
+    return;
+  }
+
+  v8::Local<v8::Object> options = Nan::To<v8::Object>(info[1]).ToLocalChecked();
+  SharedFormat format;
+  format.slots = optionNumber(options, "frames", 8);
+  format.frameBytes = optionNumber(options, "frameBytes", 0);
+  format.audioBytes = optionNumber(options, "audioBytes", 0);
+  format.pixelFormat = obj->pixelFormat_;
+  format.width = optionNumber(options, "width", 0);
+  format.height = optionNumber(options, "height", 0);
+  uv_mutex_lock(&obj->padlock);
+  format.audioChannels = obj->audioChannels_;
+  format.audioSampleBytes = obj->audioSampleType_ / 8;
+  format.audioSampleRate = obj->audioSampleRate_;
+  uv_mutex_unlock(&obj->padlock);
+
+  std::string error;
+  FramePublisher* publisher = new FramePublisher;
+  if (!publisher->open(*Nan::Utf8String(info[0]), format, error)) {
+    delete publisher;
+    info.GetReturnValue().Set(Nan::New(error).ToLocalChecked());
+    return;
+  }
+  uv_mutex_lock(&obj->sharedLock_);
+  obj->shared_ = publisher;
+  uv_mutex_unlock(&obj->sharedLock_);
+
+  info.GetReturnValue().Set(Nan::New("Shared output started.").ToLocalChecked());
+}
+
+NAN_METHOD(Capture::SharedOutputStatus) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->sharedLock_);
+  if (obj->shared_ == NULL) {
+    uv_mutex_unlock(&obj->sharedLock_);
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  v8::Local<v8::Object> status = sharedStatusToObject(*obj->shared_);
+  uv_mutex_unlock(&obj->sharedLock_);
+  info.GetReturnValue().Set(status);
+}
+
+// setFrameRing(sharedArrayBuffer, { frames, frameBytes, audioBytes, rowBytes,
+// width, height, deliver }) writes every frame into the buffer, laid out as
+// described in FrameRing.h. frames defaults to as many as fit. Unless deliver
+// is set, the frame callback gets no video or audio. setFrameRing(null)
+// marks the ring closed and stops writing to it.
+NAN_METHOD(Capture::SetFrameRing) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->ringLock_);
+  obj->ring_.detach();
+  uv_mutex_unlock(&obj->ringLock_);
+  obj->ringHandle_.Reset();
+  obj->ringDeliver_ = true;
+  if (info[0]->IsUndefined() || info[0]->IsNull()) {
+    info.GetReturnValue().Set(Nan::New("Frame ring stopped.").ToLocalChecked());
+    return;
+  }
+  if (!info[0]->IsSharedArrayBuffer() || !info[1]->IsObject()) {
+    Nan::ThrowTypeError("A frame ring requires a SharedArrayBuffer and options.");
+    return;
+  }
+
+  v8::Local<v8::SharedArrayBuffer> sab = info[0].As<v8::SharedArrayBuffer>();
+#if NODE_MAJOR_VERSION >= 14
+  uint8_t* base = (uint8_t*) sab->GetBackingStore()->Data();
+  size_t bytes = sab->ByteLength();
+#else
+  v8::SharedArrayBuffer::Contents contents = sab->GetContents();
+  uint8_t* base = (uint8_t*) contents.Data();
+  size_t bytes = contents.ByteLength();
+#endif
+  v8::Local<v8::Object> options = Nan::To<v8::Object>(info[1]).ToLocalChecked();
+  FrameRing::Format format;
+  format.frameBytes = optionNumber(options, "frameBytes", 0);
+  format.audioBytes = optionNumber(options, "audioBytes", 0);
+  format.pixelFormat = obj->pixelFormat_;
+  format.width = optionNumber(options, "width", 0);
+  format.height = optionNumber(options, "height", 0);
+  format.rowBytes = optionNumber(options, "rowBytes", 0);
+  uv_mutex_lock(&obj->padlock);
+  format.audioChannels = obj->audioChannels_;
+  format.audioSampleBytes = obj->audioSampleType_ / 8;
+  uv_mutex_unlock(&obj->padlock);
+
+  std::string error;
+  uv_mutex_lock(&obj->ringLock_);
+  bool attached = obj->ring_.attach(base, bytes, optionNumber(options, "frames", 0),
+    format, error);
+  uv_mutex_unlock(&obj->ringLock_);
+  if (!attached) {
+    info.GetReturnValue().Set(Nan::New(error).ToLocalChecked());
+    return;
+  }
+  obj->ringHandle_.Reset(Nan::To<v8::Object>(info[0]).ToLocalChecked());
+  obj->ringDeliver_ = Nan::To<bool>(
+    Nan::Get(options, Nan::New("deliver").ToLocalChecked()).ToLocalChecked()).FromMaybe(false);
+  info.GetReturnValue().Set(Nan::New("Frame ring started.").ToLocalChecked());
+}
+
+// setFrameQueue(limit[, policy[, { frameBytes, audioBytes }]]) queues up to
+// limit whole frames, each with its audio, to be taken one by one with
+// takeFrame() - for a Readable stream - rather than delivered with the frame
+// callback. Frames are copied into slots of the given sizes, allocated here.
+// Once the queue is full the 'oldest' frame waiting is dropped, or the
+// 'newest' arrival. A limit of 0 goes back to the frame callback. Frames
+// still queued are discarded.
+NAN_METHOD(Capture::SetFrameQueue) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uint32_t limit = Nan::To<uint32_t>(info[0]).FromMaybe(0);
+  v8::Local<v8::Object> options = info[2]->IsObject() ?
+    Nan::To<v8::Object>(info[2]).ToLocalChecked() : Nan::New<v8::Object>();
+  uint32_t frameBytes = optionNumber(options, "frameBytes", 0);
+  uint32_t audioBytes = optionNumber(options, "audioBytes", 0);
+  if (limit > 0 && frameBytes == 0) {
+    Nan::ThrowRangeError("A frame queue needs the size of a frame.");
+    return;
+  }
+  bool dropNewest = false;
+  if (info[1]->IsString()) {
+    std::string policy = *Nan::Utf8String(info[1]);
+    if (policy == "newest") dropNewest = true;
+    else if (policy != "oldest") {
+      Nan::ThrowError("Drop policy must be 'oldest' or 'newest'.");
+      return;
+    }
+  }
+  std::vector<QueuedFrame> slots(limit);
+  std::vector<uint32_t> free;
+  for (uint32_t x = 0 ; x < limit ; x++) {
+    slots[x].video.resize(frameBytes);
+    slots[x].audio.resize(audioBytes);
+    free.push_back(limit - 1 - x);
+  }
+  uv_mutex_lock(&obj->queueLock_);
+  obj->queueLimit_ = limit;
+  obj->queueDropNewest_ = dropNewest;
+  obj->queueSlots_.swap(slots);
+  obj->queueFree_.swap(free);
+  obj->queue_.clear();
+  uv_mutex_unlock(&obj->queueLock_);
+  info.GetReturnValue().Set(Nan::New(limit > 0 ?
+    "Frame queue set." : "Frame queue off.").ToLocalChecked());
+}
+
+// The oldest frame queued as { frame, video, audio, audioFrames, streamTime,
+// frameDuration }, copied out of its slot, or null if none is.
+NAN_METHOD(Capture::TakeFrame) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  uv_mutex_lock(&obj->queueLock_);
+  if (obj->queue_.empty()) {
+    uv_mutex_unlock(&obj->queueLock_);
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  uint32_t index = obj->queue_.front();
+  obj->queue_.pop_front();
+  obj->queueTaken_++;
+  uv_mutex_unlock(&obj->queueLock_);
+
+  // The slot is neither queued nor free, so the capture thread leaves it be
+  const QueuedFrame& queued = obj->queueSlots_[index];
+  uint32_t audioBytes = queued.audioFrames * obj->sampleByteFactor_;
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("frame").ToLocalChecked(), Nan::New((double) queued.sequence));
+  Nan::Set(result, Nan::New("video").ToLocalChecked(),
+    Nan::CopyBuffer((const char*) &queued.video[0], queued.videoBytes).ToLocalChecked());
+  if (audioBytes > 0)
+    Nan::Set(result, Nan::New("audio").ToLocalChecked(),
+      Nan::CopyBuffer((const char*) &queued.audio[0], audioBytes).ToLocalChecked());
+  else
+    Nan::Set(result, Nan::New("audio").ToLocalChecked(), Nan::Null());
+  Nan::Set(result, Nan::New("audioFrames").ToLocalChecked(), Nan::New(queued.audioFrames));
+  Nan::Set(result, Nan::New("streamTime").ToLocalChecked(), Nan::New((double) queued.streamTime));
+  Nan::Set(result, Nan::New("frameDuration").ToLocalChecked(), Nan::New((double) queued.frameDuration));
+  uv_mutex_lock(&obj->queueLock_);
+  obj->queueFree_.push_back(index);
+  uv_mutex_unlock(&obj->queueLock_);
+  info.GetReturnValue().Set(result);
+}
+
+// Frames queued, the limit and policy, and frames arrived, dropped and taken.
+NAN_METHOD(Capture::FrameQueueStatus) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  v8::Local<v8::Object> status = Nan::New<v8::Object>();
+  uv_mutex_lock(&obj->queueLock_);
+  Nan::Set(status, Nan::New("queued").ToLocalChecked(), Nan::New((uint32_t) obj->queue_.size()));
+  Nan::Set(status, Nan::New("limit").ToLocalChecked(), Nan::New(obj->queueLimit_));
+  Nan::Set(status, Nan::New("policy").ToLocalChecked(),
+    Nan::New(obj->queueDropNewest_ ? "newest" : "oldest").ToLocalChecked());
+  Nan::Set(status, Nan::New("arrived").ToLocalChecked(), Nan::New((double) obj->queueArrived_));
+  Nan::Set(status, Nan::New("dropped").ToLocalChecked(), Nan::New((double) obj->queueDropped_));
+  Nan::Set(status, Nan::New("taken").ToLocalChecked(), Nan::New((double) obj->queueTaken_));
+  uv_mutex_unlock(&obj->queueLock_);
+  info.GetReturnValue().Set(status);
+}
+
+// On a recorder thread
+void Capture::segmentNotify(void* data) {
+  uv_async_send(static_cast<Capture*>(data)->segmentAsync_);
+}
+
+NAUV_WORK_CB(Capture::SegmentCallback) {
+  Nan::HandleScope scope;
+  Capture *capture = static_cast<Capture*>(async->data);
+  std::vector<SegmentEvent> events;
+  uv_mutex_lock(&capture->segmentLock_);
+  if (capture->segments_ != NULL)
+    capture->segments_->takeEvents(capture->segmentEvents_);
+  events.swap(capture->segmentEvents_);
+  uv_mutex_unlock(&capture->segmentLock_);
+  if (events.empty() || capture->segmentCB_.IsEmpty()) return;
+
+  v8::Local<v8::Array> result = Nan::New<v8::Array>((uint32_t) events.size());
+  for (uint32_t x = 0 ; x < events.size() ; x++)
+    Nan::Set(result, x, segmentToObject(events[x]));
+  Nan::Callback cb(Nan::New(capture->segmentCB_));
+  v8::Local<v8::Value> argv[1] = { result };
+  cb.Call(1, argv);
+}
+
+// setTimeshift(ring) records into a Timeshift ring, setTimeshift(null) stops
+NAN_METHOD(Capture::SetTimeshift) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  bool enable = !info[0]->IsUndefined() && !info[0]->IsNull();
+  if (enable && !Timeshift::IsTimeshift(info[0])) {
+    Nan::ThrowTypeError("Argument must be a Timeshift ring or null.");
+    return;
+  }
+  Timeshift* ring = enable ?
+    ObjectWrap::Unwrap<Timeshift>(Nan::To<v8::Object>(info[0]).ToLocalChecked()) : NULL;
+
+  uv_mutex_lock(&obj->timeshiftLock_);
+  obj->timeshift_ = ring;
+  uv_mutex_unlock(&obj->timeshiftLock_);
+  // Only released once the capture thread can no longer be writing to it
+  if (enable)
+    obj->timeshiftHandle_.Reset(Nan::To<v8::Object>(info[0]).ToLocalChecked());
+  else
+    obj->timeshiftHandle_.Reset();
+
+  info.GetReturnValue().Set(Nan::New(enable ? "Timeshift recording enabled." :
+    "Timeshift recording disabled.").ToLocalChecked());
+}
+
+NAN_METHOD(Capture::SetHashing) {
+  Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
+  HashType type = hashNone;
+  if (!parseHashType(info[0], &type)) {
+    Nan::ThrowError("Hash type must be 'crc32c' or 'xxh64'.");
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->hashType_ = type;
+  obj->hasVideoHash_ = false;
+  obj->hasAudioHash_ = false;
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(Nan::New(type != hashNone ? "Hashing enabled." :
+    "Hashing disabled.").ToLocalChecked());
+}
+
 NAN_METHOD(Capture::DoCapture) {
   v8::Local<v8::Function> cb = v8::Local<v8::Function>::Cast(info[0]);
   Capture* obj = ObjectWrap::Unwrap<Capture>(info.Holder());
@@ -192,6 +1039,14 @@ HRESULT Capture::setupAudioInput(BMDAudioSampleRate sampleRate,
   BMDAudioSampleType sampleType, uint32_t channelCount) {
 
   sampleByteFactor_ = channelCount * (sampleType / 8);
+  uv_mutex_lock(&padlock);
+  audioSampleRate_ = sampleRate;
+  audioSampleType_ = sampleType;
+  audioChannels_ = channelCount;
+  audioConfigSerial_++;
+  meterSerial_++;
+  alarmSerial_++;
+  uv_mutex_unlock(&padlock);
   HRESULT result = m_deckLinkInput->EnableAudioInput(sampleRate, sampleType, channelCount);
 
   return result;
@@ -205,12 +1060,62 @@ void Capture::cleanupDeckLinkInput()
 	m_deckLinkInput->SetCallback(NULL);
 }
 
+void Capture::cleanup(void* arg) {
+  static_cast<Capture*>(arg)->shutdown();
+}
+
+void Capture::shutdown() {
+  if (m_deckLinkInput != NULL)
+    cleanupDeckLinkInput();
+
+  uv_mutex_lock(&segmentLock_);
+  SegmentRecorder* segments = segments_;
+  segments_ = NULL;
+  uv_mutex_unlock(&segmentLock_);
+  delete segments;
+  uv_mutex_lock(&audioRecordLock_);
+  AudioRecorder* audioRecorder = audioRecorder_;
+  audioRecorder_ = NULL;
+  uv_mutex_unlock(&audioRecordLock_);
+  delete audioRecorder;
+  uv_mutex_lock(&y4mLock_);
+  Y4MWriter* y4m = y4m_;
+  y4m_ = NULL;
+  uv_mutex_unlock(&y4mLock_);
+  delete y4m;
+  uv_mutex_lock(&sharedLock_);
+  FramePublisher* shared = shared_;
+  shared_ = NULL;
+  uv_mutex_unlock(&sharedLock_);
+  delete shared;
+  uv_mutex_lock(&ringLock_);
+  ring_.detach();
+  uv_mutex_unlock(&ringLock_);
+
+  uv_mutex_lock(&padlock);
+  if (latestFrame_ != NULL) latestFrame_->Release();
+  if (latestAudio_ != NULL) latestAudio_->Release();
+  latestFrame_ = NULL;
+  latestAudio_ = NULL;
+  uv_mutex_unlock(&padlock);
+  uv_mutex_lock(&queueLock_);
+  queue_.clear();
+  queueLimit_ = 0;
+  uv_mutex_unlock(&queueLock_);
+
+  closeAndDelete(async);
+  async = NULL;
+  closeAndDelete(segmentAsync_);
+  segmentAsync_ = NULL;
+}
+
 bool Capture::setupDeckLinkInput() {
   // bool result = false;
   IDeckLinkDisplayModeIterator*	displayModeIterator = NULL;
   IDeckLinkDisplayMode*			deckLinkDisplayMode = NULL;
 
   m_width = -1;
+  m_fieldDominance = bmdProgressiveFrame;
 
   // get frame scale and duration for the video mode
   if (m_deckLinkInput->GetDisplayModeIterator(&displayModeIterator) != S_OK)
@@ -223,6 +1128,7 @@ bool Capture::setupDeckLinkInput() {
       m_width = deckLinkDisplayMode->GetWidth();
       m_height = deckLinkDisplayMode->GetHeight();
       deckLinkDisplayMode->GetFrameRate(&m_frameDuration, &m_timeScale);
+      m_fieldDominance = deckLinkDisplayMode->GetFieldDominance();
       deckLinkDisplayMode->Release();
 
       break;
@@ -252,13 +1158,74 @@ bool Capture::setupDeckLinkInput() {
 HRESULT	Capture::VideoInputFrameArrived (IDeckLinkVideoInputFrame* arrivedFrame, IDeckLinkAudioInputPacket* arrivedAudio)
 {
   // printf("Arrived video %i audio %i", arrivedFrame == NULL, arrivedAudio == NULL);
+  if (arrivedFrame != NULL) recordTimeshift(arrivedFrame, arrivedAudio);
+  if (arrivedFrame != NULL) recordSegment(arrivedFrame);
+  if (arrivedFrame != NULL) encodeY4M(arrivedFrame);
+  if (arrivedFrame != NULL) publishFrame(arrivedFrame, arrivedAudio);
+  if (arrivedFrame != NULL) writeFrameRing(arrivedFrame, arrivedAudio);
+  bool queued = arrivedFrame != NULL && queueFrame(arrivedFrame, arrivedAudio);
+  if (arrivedAudio != NULL) recordAudio(arrivedFrame, arrivedAudio);
+  bool analysed = arrivedFrame != NULL && analyseFrame(arrivedFrame);
+  bool proxied = arrivedFrame != NULL && makeProxy(arrivedFrame);
+  bool metered = arrivedAudio != NULL && meterAudio(arrivedAudio);
+  if (arrivedAudio != NULL) checkAlarms(arrivedAudio);
+  bool converted = arrivedAudio != NULL && makeConvertedAudio(arrivedAudio);
+
+  // Hash the payloads exactly as the card delivered them
   uv_mutex_lock(&padlock);
-  if (arrivedFrame != NULL) {
+  HashType hashType = hashType_;
+  uv_mutex_unlock(&padlock);
+  uint64_t videoHash = 0, audioHash = 0;
+  uint8_t* payload = NULL;
+  bool videoHashed = hashType != hashNone && arrivedFrame != NULL &&
+    arrivedFrame->GetBytes((void**) &payload) == S_OK;
+  if (videoHashed)
+    videoHash = hashBytes(hashType, payload,
+      (size_t) arrivedFrame->GetRowBytes() * arrivedFrame->GetHeight());
+  bool audioHashed = hashType != hashNone && arrivedAudio != NULL &&
+    arrivedAudio->GetBytes((void**) &payload) == S_OK;
+  if (audioHashed)
+    audioHash = hashBytes(hashType, payload,
+      (size_t) arrivedAudio->GetSampleFrameCount() * sampleByteFactor_);
+
+  uv_mutex_lock(&padlock);
+  if (hashType == hashType_) {
+    latestVideoHash_ = videoHash;
+    hasVideoHash_ = videoHashed;
+    latestAudioHash_ = audioHash;
+    hasAudioHash_ = audioHashed;
+  }
+  if (analysed) {
+    latestMetrics_ = metrics_;
+    hasMetrics_ = true;
+  }
+  // A frame not yet taken by the frame callback is superseded
+  if (latestFrame_ != NULL) latestFrame_->Release();
+  if (latestAudio_ != NULL) latestAudio_->Release();
+  if (proxied) {
+    latestProxy_.swap(proxyFrame_);
+    hasProxy_ = true;
+    latestFrame_ = NULL;
+  }
+  else if (arrivedFrame != NULL && !queued) {
     arrivedFrame->AddRef();
     latestFrame_ = arrivedFrame;
   }
   else latestFrame_ = NULL;
-  if (arrivedAudio != NULL) {
+  if (metered) {
+    latestMeters_.swap(meterValues_);
+    hasMeters_ = true;
+  }
+  if (!alarmEvents_.empty()) {
+    pendingAlarms_.insert(pendingAlarms_.end(), alarmEvents_.begin(), alarmEvents_.end());
+    alarmEvents_.clear();
+  }
+  if (converted) {
+    latestConverted_.swap(convertedAudio_);
+    hasConverted_ = true;
+    latestAudio_ = NULL;
+  }
+  else if (arrivedAudio != NULL && !queued) {
     arrivedAudio->AddRef();
     latestAudio_ = arrivedAudio;
   }
@@ -268,6 +1235,285 @@ HRESULT	Capture::VideoInputFrameArrived (IDeckLinkVideoInputFrame* arrivedFrame,
   return S_OK;
 }
 
+// Runs on the capture thread. Copies the frame and its audio into a free
+// slot, or the oldest queued, so nothing of the driver's is kept. Returns
+// false when no frame queue is set.
+bool Capture::queueFrame(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet) {
+  uv_mutex_lock(&queueLock_);
+  if (queueLimit_ == 0) {
+    uv_mutex_unlock(&queueLock_);
+    return false;
+  }
+  queueArrived_++;
+  uint32_t index;
+  if (!queueFree_.empty()) {
+    index = queueFree_.back();
+    queueFree_.pop_back();
+  } else if (!queueDropNewest_ && !queue_.empty()) {
+    queueDropped_++;
+    index = queue_.front();
+    queue_.pop_front();
+  } else {
+    queueDropped_++;
+    uv_mutex_unlock(&queueLock_);
+    return true;
+  }
+  QueuedFrame& queued = queueSlots_[index];
+  uint8_t* data = NULL;
+  queued.videoBytes = 0;
+  if (frame->GetBytes((void**) &data) == S_OK) {
+    size_t bytes = (size_t) frame->GetRowBytes() * frame->GetHeight();
+    if (bytes > queued.video.size()) bytes = queued.video.size();
+    memcpy(&queued.video[0], data, bytes);
+    queued.videoBytes = (uint32_t) bytes;
+  }
+  queued.audioFrames = 0;
+  if (packet != NULL && sampleByteFactor_ > 0 && !queued.audio.empty() &&
+      packet->GetBytes((void**) &data) == S_OK) {
+    uint32_t frames = (uint32_t) packet->GetSampleFrameCount();
+    uint32_t room = (uint32_t) (queued.audio.size() / sampleByteFactor_);
+    queued.audioFrames = frames < room ? frames : room;
+    memcpy(&queued.audio[0], data, (size_t) queued.audioFrames * sampleByteFactor_);
+  }
+  queued.sequence = queueArrived_ - 1;
+  queued.streamTime = 0;
+  queued.frameDuration = 0;
+  frame->GetStreamTime(&queued.streamTime, &queued.frameDuration, m_timeScale);
+  queue_.push_back(index);
+  uv_mutex_unlock(&queueLock_);
+  return true;
+}
+
+// Runs on the capture thread. Copies the frame into the recorder's queue.
+void Capture::recordSegment(IDeckLinkVideoInputFrame* frame) {
+  uv_mutex_lock(&segmentLock_);
+  if (segments_ != NULL) {
+    uint8_t* video = NULL;
+    BMDTimeValue frameTime = 0, frameDuration = 0;
+    frame->GetStreamTime(&frameTime, &frameDuration, m_timeScale);
+    if (frame->GetBytes((void**) &video) == S_OK)
+      segments_->push(video, (uint32_t) (frame->GetRowBytes() * frame->GetHeight()),
+        frameTime);
+  }
+  uv_mutex_unlock(&segmentLock_);
+}
+
+// Runs on the capture thread. Copies the frame into the Y4M writer's queue.
+void Capture::encodeY4M(IDeckLinkVideoInputFrame* frame) {
+  uv_mutex_lock(&y4mLock_);
+  uint8_t* video = NULL;
+  if (y4m_ != NULL && frame->GetBytes((void**) &video) == S_OK)
+    y4m_->push(video, (uint32_t) frame->GetRowBytes(), (uint32_t) frame->GetHeight());
+  uv_mutex_unlock(&y4mLock_);
+}
+
+// Runs on the capture thread, publishing the payloads as the card delivered them.
+void Capture::publishFrame(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet) {
+  uv_mutex_lock(&sharedLock_);
+  uint8_t* video = NULL;
+  if (shared_ != NULL && frame->GetBytes((void**) &video) == S_OK) {
+    uint8_t* audio = NULL;
+    uint32_t audioFrames = 0;
+    if (packet != NULL && packet->GetBytes((void**) &audio) == S_OK)
+      audioFrames = (uint32_t) packet->GetSampleFrameCount();
+    BMDTimeValue frameTime = 0, frameDuration = 0;
+    frame->GetStreamTime(&frameTime, &frameDuration, m_timeScale);
+    shared_->write(video, (uint32_t) (frame->GetRowBytes() * frame->GetHeight()),
+      audio, audioFrames * sampleByteFactor_, audioFrames, frameTime, frameDuration,
+      m_timeScale);
+  }
+  uv_mutex_unlock(&sharedLock_);
+}
+
+void Capture::writeFrameRing(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet) {
+  uv_mutex_lock(&ringLock_);
+  uint8_t* video = NULL;
+  if (ring_.attached() && frame->GetBytes((void**) &video) == S_OK) {
+    uint8_t* audio = NULL;
+    uint32_t audioFrames = 0;
+    if (packet != NULL && packet->GetBytes((void**) &audio) == S_OK)
+      audioFrames = (uint32_t) packet->GetSampleFrameCount();
+    BMDTimeValue frameTime = 0, frameDuration = 0;
+    frame->GetStreamTime(&frameTime, &frameDuration, m_timeScale);
+    ring_.write(video, (uint32_t) (frame->GetRowBytes() * frame->GetHeight()),
+      audio, audioFrames * sampleByteFactor_, audioFrames, frameTime, frameDuration,
+      m_timeScale);
+  }
+  uv_mutex_unlock(&ringLock_);
+}
+
+// Runs on the capture thread. Only the first packet's frame is asked for its
+// timecode, which becomes the BWF time reference - counted in real samples
+// since midnight, so drop frame timecode is corrected for. Without timecode
+// the time of day is used.
+void Capture::recordAudio(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet) {
+  uv_mutex_lock(&audioRecordLock_);
+  uint8_t* audio = NULL;
+  if (audioRecorder_ == NULL || packet->GetBytes((void**) &audio) != S_OK) {
+    uv_mutex_unlock(&audioRecordLock_);
+    return;
+  }
+  int64_t timeReference = -1;
+  std::string timecode;
+  IDeckLinkTimecode* tc = NULL;
+  if (!audioRecorder_->hasStarted() && frame != NULL && m_frameDuration > 0 &&
+      (frame->GetTimecode(bmdTimecodeRP188Any, &tc) == S_OK ||
+       frame->GetTimecode(bmdTimecodeVITC, &tc) == S_OK) && tc != NULL) {
+    uint8_t hours = 0, minutes = 0, seconds = 0, frames = 0;
+    tc->GetComponents(&hours, &minutes, &seconds, &frames);
+    bool dropFrame = (tc->GetFlags() & bmdTimecodeIsDropFrame) != 0;
+    tc->Release();
+    int64_t fps = (m_timeScale + m_frameDuration - 1) / m_frameDuration;
+    int64_t totalMinutes = hours * 60 + minutes;
+    int64_t frameCount = (totalMinutes * 60 + seconds) * fps + frames;
+    if (dropFrame)
+      frameCount -= (fps / 15) * (totalMinutes - totalMinutes / 10);
+    timeReference = frameCount * m_frameDuration * (int64_t) audioSampleRate_ / m_timeScale;
+    char text[16];
+    snprintf(text, sizeof(text), "%02u:%02u:%02u%c%02u", hours, minutes, seconds,
+      dropFrame ? ';' : ':', frames);
+    timecode = text;
+  }
+  audioRecorder_->push(audio, (uint32_t) packet->GetSampleFrameCount(),
+    timeReference, timecode);
+  uv_mutex_unlock(&audioRecordLock_);
+}
+
+// Runs on the capture thread, recording the payloads as the card delivered them.
+void Capture::recordTimeshift(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet) {
+  uv_mutex_lock(&timeshiftLock_);
+  if (timeshift_ != NULL) {
+    uint8_t* video = NULL;
+    uint8_t* audio = NULL;
+    uint32_t audioBytes = 0;
+    if (packet != NULL && packet->GetBytes((void**) &audio) == S_OK)
+      audioBytes = (uint32_t) packet->GetSampleFrameCount() * sampleByteFactor_;
+    BMDTimeValue frameTime = 0, frameDuration = 0;
+    frame->GetStreamTime(&frameTime, &frameDuration, m_timeScale);
+    if (frame->GetBytes((void**) &video) == S_OK)
+      timeshift_->write(video, (uint32_t) (frame->GetRowBytes() * frame->GetHeight()),
+        audio, audioBytes, frameTime);
+  }
+  uv_mutex_unlock(&timeshiftLock_);
+}
+
+// Runs on the capture thread. The scaler is only ever created and used here,
+// so JS changing the proxy settings just takes effect on the next frame.
+bool Capture::makeProxy(IDeckLinkVideoInputFrame* frame) {
+  uv_mutex_lock(&padlock);
+  uint32_t width = proxyWidth_, height = proxyHeight_, format = proxyFormat_;
+  DownscaleFilter filter = proxyFilter_;
+  uv_mutex_unlock(&padlock);
+
+  uint32_t srcFormat = frame->GetPixelFormat();
+  if (width == 0 || height == 0 || !isYUV422Format(srcFormat))
+    return false;
+
+  uint32_t srcWidth = frame->GetWidth(), srcHeight = frame->GetHeight();
+  if (proxyScaler_ == NULL || !proxyScaler_->matches(srcWidth, srcHeight,
+      srcFormat, width, height, format, filter)) {
+    delete proxyScaler_;
+    proxyScaler_ = new Downscaler(srcWidth, srcHeight, srcFormat,
+      width, height, format, filter);
+  }
+  if (!proxyScaler_->isValid())
+    return false;
+
+  uint8_t* data = NULL;
+  if (frame->GetBytes((void**) &data) != S_OK)
+    return false;
+  proxyFrame_.resize(proxyScaler_->dstSize());
+  proxyScaler_->scale(data, frame->GetRowBytes(), &proxyFrame_[0]);
+  return true;
+}
+
+// Runs on the capture thread on the full frame, before any proxy is made.
+bool Capture::analyseFrame(IDeckLinkVideoInputFrame* frame) {
+  uv_mutex_lock(&padlock);
+  bool enabled = analyse_;
+  if (enabled && analyserSerial_ != analysisSerial_) {
+    analyser_.setOptions(analysisOptions_);
+    analyserSerial_ = analysisSerial_;
+  }
+  uv_mutex_unlock(&padlock);
+
+  if (!enabled || (frame->GetFlags() & bmdFrameHasNoInputSource))
+    return false;
+
+  uint8_t* data = NULL;
+  if (frame->GetBytes((void**) &data) != S_OK)
+    return false;
+  return analyser_.analyse(frame->GetPixelFormat(), data, frame->GetRowBytes(),
+    frame->GetWidth(), frame->GetHeight(), &metrics_);
+}
+
+// Runs on the capture thread for every packet, whether or not JS keeps up.
+bool Capture::meterAudio(IDeckLinkAudioInputPacket* packet) {
+  uv_mutex_lock(&padlock);
+  bool enabled = meter_;
+  if (enabled && meterConfiguredSerial_ != meterSerial_) {
+    audioMeter_.configure(audioSampleRate_, audioChannels_, audioSampleType_ / 8,
+      meterWeights_);
+    meterValues_.assign(meterLength(audioChannels_), 0.0);
+    latestMeters_.assign(meterLength(audioChannels_), 0.0);
+    meterConfiguredSerial_ = meterSerial_;
+  }
+  uv_mutex_unlock(&padlock);
+
+  uint8_t* data = NULL;
+  if (!enabled || packet->GetBytes((void**) &data) != S_OK)
+    return false;
+  audioMeter_.process(data, (uint32_t) packet->GetSampleFrameCount(), &meterValues_[0]);
+  return true;
+}
+
+// Runs on the capture thread. Any changes of state are left in alarmEvents_.
+void Capture::checkAlarms(IDeckLinkAudioInputPacket* packet) {
+  uv_mutex_lock(&padlock);
+  bool enabled = alarms_;
+  if (enabled && alarmConfiguredSerial_ != alarmSerial_) {
+    audioAlarms_.configure(audioSampleRate_, audioChannels_, audioSampleType_ / 8,
+      alarmPairs_, alarmOptions_);
+    alarmConfiguredSerial_ = alarmSerial_;
+  }
+  uv_mutex_unlock(&padlock);
+
+  uint8_t* data = NULL;
+  if (!enabled || !audioAlarms_.isConfigured() ||
+      packet->GetBytes((void**) &data) != S_OK)
+    return;
+  audioAlarms_.process(data, (uint32_t) packet->GetSampleFrameCount(), alarmEvents_);
+}
+
+// Runs on the capture thread, like makeProxy. The converter is rebuilt
+// whenever JS changes the requested format or audio is re-enabled.
+bool Capture::makeConvertedAudio(IDeckLinkAudioInputPacket* packet) {
+  uv_mutex_lock(&padlock);
+  bool enabled = convertAudio_;
+  if (enabled && converterSerial_ != audioConfigSerial_) {
+    AudioLayout in;
+    in.format = (audioSampleType_ == bmdAudioSampleType32bitInteger) ?
+      sampleInt32 : sampleInt16;
+    in.planar = false;
+    in.channels = audioChannels_;
+    audioConverter_.configure(in, audioLayout_, audioMap_);
+    converterSerial_ = audioConfigSerial_;
+  }
+  uv_mutex_unlock(&padlock);
+
+  if (!enabled || !audioConverter_.isConfigured())
+    return false;
+
+  uint8_t* data = NULL;
+  if (packet->GetBytes((void**) &data) != S_OK)
+    return false;
+  uint32_t frames = (uint32_t) packet->GetSampleFrameCount();
+  convertedAudio_.resize(audioConverter_.outputBytes(frames));
+  if (frames > 0)
+    audioConverter_.convert(data, frames, &convertedAudio_[0]);
+  return true;
+}
+
 HRESULT	Capture::VideoInputFormatChanged (BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode* newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags) {
   return S_OK;
 };
@@ -291,22 +1537,96 @@ NAUV_WORK_CB(Capture::FrameCallback) {
   char* new_audio;
   v8::Local<v8::Value> bv = Nan::Null();
   v8::Local<v8::Value> ba = Nan::Null();
+  v8::Local<v8::Value> bm = Nan::Undefined();
+  v8::Local<v8::Array> alarms;
   uv_mutex_lock(&capture->padlock);
-  if (capture->latestFrame_ != NULL) {
+  if (!capture->ringDeliver_) {
+    // Frames go to the SharedArrayBuffer ring only
+    if (capture->latestFrame_ != NULL) capture->latestFrame_->Release();
+    if (capture->latestAudio_ != NULL) capture->latestAudio_->Release();
+    capture->latestFrame_ = NULL;
+    capture->latestAudio_ = NULL;
+    capture->hasProxy_ = false;
+    capture->hasConverted_ = false;
+  }
+  if (!capture->pendingAlarms_.empty() && !capture->alarmCB_.IsEmpty()) {
+    alarms = Nan::New<v8::Array>((uint32_t) capture->pendingAlarms_.size());
+    for (uint32_t x = 0 ; x < capture->pendingAlarms_.size() ; x++)
+      Nan::Set(alarms, x, alarmToObject(capture->pendingAlarms_[x]));
+  }
+  capture->pendingAlarms_.clear();
+  if (capture->hasMeters_ && !capture->meterArray_.IsEmpty()) {
+    Nan::TypedArrayContents<double> meters(Nan::New(capture->meterArray_));
+    size_t count = capture->latestMeters_.size();
+    if (count > meters.length()) count = meters.length();
+    if (*meters != NULL)
+      memcpy(*meters, capture->latestMeters_.data(), count * sizeof(double));
+    capture->hasMeters_ = false;
+  }
+  if (capture->hasMetrics_) {
+    bm = metricsToObject(capture->latestMetrics_);
+    capture->hasMetrics_ = false;
+  }
+  if (capture->hasVideoHash_ || capture->hasAudioHash_) {
+    if (!bm->IsObject()) bm = Nan::New<v8::Object>();
+    v8::Local<v8::Object> meta = Nan::To<v8::Object>(bm).ToLocalChecked();
+    if (capture->hasVideoHash_)
+      Nan::Set(meta, Nan::New("videoHash").ToLocalChecked(), Nan::New(
+        hashToHex(capture->hashType_, capture->latestVideoHash_)).ToLocalChecked());
+    if (capture->hasAudioHash_)
+      Nan::Set(meta, Nan::New("audioHash").ToLocalChecked(), Nan::New(
+        hashToHex(capture->hashType_, capture->latestAudioHash_)).ToLocalChecked());
+    capture->hasVideoHash_ = false;
+    capture->hasAudioHash_ = false;
+  }
+  if (capture->hasProxy_) {
+    bv = Nan::CopyBuffer((char*) &capture->latestProxy_[0],
+      capture->latestProxy_.size()).ToLocalChecked();
+    capture->hasProxy_ = false;
+  }
+  else if (capture->latestFrame_ != NULL && capture->deliverFields_ &&
+      (capture->m_fieldDominance == bmdUpperFieldFirst ||
+       capture->m_fieldDominance == bmdLowerFieldFirst)) {
+    // Separate the fields as part of the copy out of the driver's frame
+    capture->latestFrame_->GetBytes((void**) &new_data);
+    long rowBytes = capture->latestFrame_->GetRowBytes();
+    uint32_t height = capture->latestFrame_->GetHeight();
+    uint32_t first = (capture->m_fieldDominance == bmdLowerFieldFirst) ? 1 : 0;
+    v8::Local<v8::Array> fields = Nan::New<v8::Array>(2);
+    for (uint32_t i = 0 ; i < 2 ; i++) {
+      uint32_t field = first ^ i;
+      v8::Local<v8::Object> fb =
+        Nan::NewBuffer(rowBytes * fieldHeight(height, field)).ToLocalChecked();
+      extractField((uint8_t*) new_data, rowBytes, height, field,
+        (uint8_t*) node::Buffer::Data(fb));
+      Nan::Set(fields, i, fb);
+    }
+    bv = fields;
+    capture->latestFrame_->Release();
+    capture->latestFrame_ = NULL;
+  }
+  else if (capture->latestFrame_ != NULL) {
     capture->latestFrame_->GetBytes((void**) &new_data);
     long new_data_size = capture->latestFrame_->GetRowBytes() * capture->latestFrame_->GetHeight();
     // Local<Object> b = node::Buffer::New(isolate, new_data, new_data_size,
     //   FreeCallback, capture->latestFrame_).ToLocalChecked();
     bv = Nan::CopyBuffer(new_data, new_data_size).ToLocalChecked();
     capture->latestFrame_->Release();
+    capture->latestFrame_ = NULL;
   }
-  if (capture->latestAudio_ != NULL) {
+  if (capture->hasConverted_) {
+    ba = Nan::CopyBuffer((char*) capture->latestConverted_.data(),
+      capture->latestConverted_.size()).ToLocalChecked();
+    capture->hasConverted_ = false;
+  }
+  else if (capture->latestAudio_ != NULL) {
     capture->latestAudio_->GetBytes((void**) &new_audio);
     long new_audio_size = capture->latestAudio_->GetSampleFrameCount() * capture->sampleByteFactor_;
     // Local<Object> b = node::Buffer::New(isolate, new_data, new_data_size,
     //   FreeCallback, capture->latestFrame_).ToLocalChecked();
     ba = Nan::CopyBuffer(new_audio, new_audio_size).ToLocalChecked();
     capture->latestAudio_->Release();
+    capture->latestAudio_ = NULL;
   }
   uv_mutex_unlock(&capture->padlock);
   // long extSize = isolate->AdjustAmountOfExternalAllocatedMemory(new_data_size);
@@ -314,8 +1634,13 @@ NAUV_WORK_CB(Capture::FrameCallback) {
   //   isolate->LowMemoryNotification();
   //   printf("Requesting bin collection.\n");
   // }
-  v8::Local<v8::Value> argv[2] = { bv, ba };
-  cb.Call(2, argv);
+  if (!alarms.IsEmpty()) {
+    Nan::Callback alarmCB(Nan::New(capture->alarmCB_));
+    v8::Local<v8::Value> alarmArgv[1] = { alarms };
+    alarmCB.Call(1, alarmArgv);
+  }
+  v8::Local<v8::Value> argv[3] = { bv, ba, bm };
+  cb.Call(3, argv);
 }
 
 }
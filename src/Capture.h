@@ -50,6 +50,22 @@
 #include <nan.h>
 
 #include "DeckLinkAPI.h"
+#include "Downscale.h"
+#include "Fields.h"
+#include "AudioConvert.h"
+#include "Analysis.h"
+#include "AudioMeter.h"
+#include "AudioAlarm.h"
+#include "Hash.h"
+#include "Timeshift.h"
+#include "Segments.h"
+#include "WaveFile.h"
+#include "Y4M.h"
+#include "SharedFrames.h"
+#include "FrameRing.h"
+#include "Environment.h"
+#include <vector>
+#include <deque>
 
 namespace streampunk {
 
@@ -81,6 +97,7 @@ private:
   long						m_height;
   BMDTimeScale				m_timeScale;
   BMDTimeValue				m_frameDuration;
+  BMDFieldDominance			m_fieldDominance;
 
   // frame count values for the capture in- and out-points
   // uint32_t					m_inPointFrameCount;
@@ -106,8 +123,54 @@ private:
 
   static NAN_METHOD(EnableAudio);
 
+  static NAN_METHOD(SetProxy);
+
+  static NAN_METHOD(SetFieldMode);
+
+  static NAN_METHOD(SetAudioFormat);
+
+  static NAN_METHOD(SetAnalysis);
+
+  static NAN_METHOD(SetMetering);
+
+  static NAN_METHOD(SetAudioAlarms);
+
+  static NAN_METHOD(SetHashing);
+
+  static NAN_METHOD(SetTimeshift);
+
+  static NAN_METHOD(StartRecording);
+
+  static NAN_METHOD(StopRecording);
+
+  static NAN_METHOD(RecordingStatus);
+
+  static NAN_METHOD(StartAudioRecording);
+
+  static NAN_METHOD(StopAudioRecording);
+
+  static NAN_METHOD(AudioRecordingStatus);
+
+  static NAN_METHOD(SetY4MOutput);
+
+  static NAN_METHOD(Y4MOutputStatus);
+
+  static NAN_METHOD(SetSharedOutput);
+
+  static NAN_METHOD(SharedOutputStatus);
+
+  static NAN_METHOD(SetFrameRing);
+
+  static NAN_METHOD(SetFrameQueue);
+
+  static NAN_METHOD(TakeFrame);
+
+  static NAN_METHOD(FrameQueueStatus);
+
   static NAUV_WORK_CB(FrameCallback);
 
+  static NAUV_WORK_CB(SegmentCallback);
+
   uint32_t deviceIndex_;
   uint32_t displayMode_;
   uint32_t pixelFormat_;
@@ -115,6 +178,167 @@ private:
   Nan::Persistent<v8::Function> captureCB_;
   IDeckLinkVideoInputFrame* latestFrame_;
   IDeckLinkAudioInputPacket* latestAudio_;
+
+  // proxy-only mode - frames are downscaled on the capture thread and only
+  // the proxy is handed to JS
+  uint32_t proxyWidth_;
+  uint32_t proxyHeight_;
+  uint32_t proxyFormat_;
+  DownscaleFilter proxyFilter_;
+  Downscaler* proxyScaler_;
+  std::vector<uint8_t> proxyFrame_;
+  std::vector<uint8_t> latestProxy_;
+  bool hasProxy_;
+
+  bool makeProxy(IDeckLinkVideoInputFrame* frame);
+
+  // deliver interlaced frames as an array of two fields in temporal order
+  bool deliverFields_;
+
+  // audio sample format conversion - requested from JS, applied to each
+  // packet on the capture thread
+  BMDAudioSampleRate audioSampleRate_;
+  BMDAudioSampleType audioSampleType_;
+  uint32_t audioChannels_;
+  bool convertAudio_;
+  AudioLayout audioLayout_;
+  ChannelMap audioMap_;
+  uint32_t audioConfigSerial_;
+  uint32_t converterSerial_;
+  AudioConverter audioConverter_;
+  std::vector<uint8_t> convertedAudio_;
+  std::vector<uint8_t> latestConverted_;
+  bool hasConverted_;
+
+  bool makeConvertedAudio(IDeckLinkAudioInputPacket* packet);
+
+  // per-frame QC metrics, computed on the capture thread and delivered
+  // alongside each frame
+  bool analyse_;
+  AnalysisOptions analysisOptions_;
+  uint32_t analysisSerial_;
+  uint32_t analyserSerial_;
+  FrameAnalyser analyser_;
+  FrameMetrics metrics_;
+  FrameMetrics latestMetrics_;
+  bool hasMetrics_;
+
+  bool analyseFrame(IDeckLinkVideoInputFrame* frame);
+
+  // level and loudness metering of every packet on the capture thread,
+  // copied into a JS Float64Array by FrameCallback
+  bool meter_;
+  std::vector<double> meterWeights_;
+  uint32_t meterSerial_;
+  uint32_t meterConfiguredSerial_;
+  AudioMeter audioMeter_;
+  std::vector<double> meterValues_;
+  std::vector<double> latestMeters_;
+  bool hasMeters_;
+  Nan::Persistent<v8::Object> meterArray_;
+
+  bool meterAudio(IDeckLinkAudioInputPacket* packet);
+
+  // silence and phase alarms on channel pairs, checked on the capture thread
+  // with only changes of state passed to JS
+  bool alarms_;
+  std::vector<uint32_t> alarmPairs_;
+  AudioAlarmOptions alarmOptions_;
+  uint32_t alarmSerial_;
+  uint32_t alarmConfiguredSerial_;
+  AudioAlarms audioAlarms_;
+  std::vector<AudioAlarmEvent> alarmEvents_;
+  std::vector<AudioAlarmEvent> pendingAlarms_;
+  Nan::Persistent<v8::Function> alarmCB_;
+
+  void checkAlarms(IDeckLinkAudioInputPacket* packet);
+
+  // content hashes of the payloads as received from the card
+  HashType hashType_;
+  uint64_t latestVideoHash_;
+  uint64_t latestAudioHash_;
+  bool hasVideoHash_;
+  bool hasAudioHash_;
+
+  // every frame and its audio recorded into a ring, on the capture thread.
+  // timeshiftLock_ is held while writing so the ring is never swapped out
+  // from under the writer.
+  uv_mutex_t timeshiftLock_;
+  Timeshift* timeshift_;
+  Nan::Persistent<v8::Object> timeshiftHandle_;
+
+  void recordTimeshift(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet);
+
+  // frames recorded natively into rotating segment files. Segment events come
+  // from the recorder's threads through their own async handle.
+  uv_mutex_t segmentLock_;
+  SegmentRecorder* segments_;
+  uv_async_t* segmentAsync_;
+  std::vector<SegmentEvent> segmentEvents_;
+  Nan::Persistent<v8::Function> segmentCB_;
+
+  static void segmentNotify(void* data);
+  void recordSegment(IDeckLinkVideoInputFrame* frame);
+
+  // audio written natively to Broadcast WAV files, stamped with the timecode
+  // of the first frame
+  uv_mutex_t audioRecordLock_;
+  AudioRecorder* audioRecorder_;
+
+  void recordAudio(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet);
+
+  // every frame streamed as Y4M to an encoder's pipe or FIFO
+  uv_mutex_t y4mLock_;
+  Y4MWriter* y4m_;
+
+  void encodeY4M(IDeckLinkVideoInputFrame* frame);
+
+  // every frame and its audio published to other processes through a ring
+  // in shared memory
+  uv_mutex_t sharedLock_;
+  FramePublisher* shared_;
+
+  void publishFrame(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet);
+
+  // every frame and its audio written into a SharedArrayBuffer for worker
+  // threads to read in place. Unless ringDeliver_, frames are not also copied
+  // out for the frame callback.
+  uv_mutex_t ringLock_;
+  FrameRing ring_;
+  Nan::Persistent<v8::Object> ringHandle_;
+  bool ringDeliver_;
+
+  void writeFrameRing(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet);
+
+  // whole frames queued for a Readable stream to take. Each is copied into a
+  // slot allocated by setFrameQueue, so the driver's frames go straight back
+  // to the card however slow the stream.
+  struct QueuedFrame {
+    std::vector<uint8_t> video;
+    std::vector<uint8_t> audio;
+    uint32_t videoBytes;
+    uint32_t audioFrames;
+    uint64_t sequence;
+    BMDTimeValue streamTime;
+    BMDTimeValue frameDuration;
+  };
+  uv_mutex_t queueLock_;
+  std::vector<QueuedFrame> queueSlots_;
+  std::vector<uint32_t> queueFree_;
+  std::deque<uint32_t> queue_;
+  uint32_t queueLimit_;
+  bool queueDropNewest_;
+  uint64_t queueArrived_;
+  uint64_t queueDropped_;
+  uint64_t queueTaken_;
+
+  bool queueFrame(IDeckLinkVideoInputFrame* frame, IDeckLinkAudioInputPacket* packet);
+
+  // Stops the device and everything else calling back into JS, and closes
+  // the async handles, when the object is collected or its environment is
+  // torn down (a worker exiting), whichever comes first.
+  static void cleanup(void* arg);
+  void shutdown();
 public:
   static NAN_MODULE_INIT(Init);
 
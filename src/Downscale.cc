@@ -0,0 +1,249 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Downscale.h"
+#include "Formats.h"
+#include <math.h>
+#include <string.h>
+
+namespace streampunk {
+
+static const uint32_t weightBits = 14;
+static const uint32_t weightOne = 1 << weightBits;
+
+Downscaler::Downscaler(uint32_t srcWidth, uint32_t srcHeight, uint32_t srcFormat,
+    uint32_t dstWidth, uint32_t dstHeight, uint32_t dstFormat,
+    DownscaleFilter filter) : srcWidth_(srcWidth), srcHeight_(srcHeight),
+    srcFormat_(srcFormat), dstWidth_(dstWidth), dstHeight_(dstHeight),
+    dstFormat_(dstFormat), filter_(filter), dstRowBytes_(0), valid_(false) {
+  if (!isYUV422Format(srcFormat) || !isYUV422Format(dstFormat) ||
+      srcWidth < 2 || srcHeight == 0 || dstWidth < 2 || dstHeight == 0)
+    return;
+
+  uint32_t srcChroma = (srcWidth + 1) / 2;
+  uint32_t dstChroma = (dstWidth + 1) / 2;
+  buildTaps(srcWidth, dstWidth, filter, lumaTaps_);
+  buildTaps(srcChroma, dstChroma, filter, chromaTaps_);
+  buildTaps(srcHeight, dstHeight, filter, rowTaps_);
+
+  // v210 unpacks whole groups of six, so allow for the padding
+  uint32_t lineWidth = srcWidth + 6;
+  lineY_.resize(lineWidth); lineCb_.resize(lineWidth); lineCr_.resize(lineWidth);
+  accY_.resize(srcWidth); accCb_.resize(srcChroma); accCr_.resize(srcChroma);
+  vertY_.resize(srcWidth); vertCb_.resize(srcChroma); vertCr_.resize(srcChroma);
+  outY_.resize(dstWidth + 6); outCb_.resize(dstChroma + 3); outCr_.resize(dstChroma + 3);
+
+  dstRowBytes_ = rowBytesForFormat(dstFormat, dstWidth);
+  valid_ = true;
+}
+
+bool Downscaler::matches(uint32_t srcWidth, uint32_t srcHeight, uint32_t srcFormat,
+    uint32_t dstWidth, uint32_t dstHeight, uint32_t dstFormat,
+    DownscaleFilter filter) const {
+  return srcWidth == srcWidth_ && srcHeight == srcHeight_ &&
+    srcFormat == srcFormat_ && dstWidth == dstWidth_ &&
+    dstHeight == dstHeight_ && dstFormat == dstFormat_ && filter == filter_;
+}
+
+void Downscaler::buildTaps(uint32_t srcSize, uint32_t dstSize,
+    DownscaleFilter filter, Taps& taps) {
+  double scale = (double) srcSize / dstSize;
+
+  taps.shift = 0;
+  if (filter == downscaleBox && srcSize % dstSize == 0) {
+    uint32_t ratio = srcSize / dstSize;
+    if (ratio > 1 && (ratio & (ratio - 1)) == 0)
+      while ((1U << taps.shift) < ratio) taps.shift++;
+  }
+
+  taps.maxTaps = (filter == downscaleBox) ? (uint32_t) ceil(scale) + 1 : 2;
+  taps.start.assign(dstSize, 0);
+  taps.count.assign(dstSize, 0);
+  taps.weights.assign((size_t) dstSize * taps.maxTaps, 0);
+
+  std::vector<double> w(taps.maxTaps);
+  for (uint32_t x = 0 ; x < dstSize ; x++) {
+    uint32_t first, n;
+    if (filter == downscaleBox) {
+      // Area coverage of each source sample by the destination sample
+      double left = x * scale;
+      double right = left + scale;
+      first = (uint32_t) floor(left);
+      uint32_t end = (uint32_t) ceil(right);
+      if (end > srcSize) end = srcSize;
+      n = end - first;
+      for (uint32_t i = 0 ; i < n ; i++) {
+        double lo = left > first + i ? left : first + i;
+        double hi = right < first + i + 1 ? right : first + i + 1;
+        w[i] = (hi - lo) / scale;
+      }
+    } else {
+      double centre = (x + 0.5) * scale - 0.5;
+      if (centre < 0.0) centre = 0.0;
+      first = (uint32_t) floor(centre);
+      if (first >= srcSize - 1) {
+        first = srcSize - 1;
+        n = 1;
+        w[0] = 1.0;
+      } else {
+        double frac = centre - first;
+        n = 2;
+        w[0] = 1.0 - frac;
+        w[1] = frac;
+      }
+    }
+
+    // Quantise, then push any rounding error onto the largest tap so that
+    // flat areas stay exactly flat
+    uint16_t* q = &taps.weights[(size_t) x * taps.maxTaps];
+    uint32_t sum = 0, largest = 0;
+    for (uint32_t i = 0 ; i < n ; i++) {
+      q[i] = (uint16_t) floor(w[i] * weightOne + 0.5);
+      sum += q[i];
+      if (q[i] > q[largest]) largest = i;
+    }
+    q[largest] = (uint16_t) (q[largest] + weightOne - sum);
+    taps.start[x] = first;
+    taps.count[x] = n;
+  }
+}
+
+void Downscaler::horizontal(const uint16_t* in, const Taps& taps,
+    uint32_t outCount, uint16_t* out) {
+  if (taps.shift > 0) {
+    uint32_t ratio = 1 << taps.shift;
+    uint32_t half = ratio >> 1;
+    for (uint32_t x = 0 ; x < outCount ; x++) {
+      const uint16_t* p = in + x * ratio;
+      uint32_t sum = 0;
+      for (uint32_t i = 0 ; i < ratio ; i++)
+        sum += p[i];
+      out[x] = (uint16_t) ((sum + half) >> taps.shift);
+    }
+    return;
+  }
+  for (uint32_t x = 0 ; x < outCount ; x++) {
+    const uint16_t* p = in + taps.start[x];
+    const uint16_t* w = &taps.weights[(size_t) x * taps.maxTaps];
+    uint32_t n = taps.count[x];
+    uint32_t sum = 0;
+    for (uint32_t i = 0 ; i < n ; i++)
+      sum += w[i] * p[i];
+    out[x] = (uint16_t) ((sum + (weightOne >> 1)) >> weightBits);
+  }
+}
+
+static inline void accumulate(uint32_t* acc, const uint16_t* line,
+    uint32_t weight, uint32_t count) {
+  for (uint32_t x = 0 ; x < count ; x++)
+    acc[x] += weight * line[x];
+}
+
+static inline void normalise(const uint32_t* acc, uint16_t* out, uint32_t count) {
+  for (uint32_t x = 0 ; x < count ; x++)
+    out[x] = (uint16_t) ((acc[x] + (weightOne >> 1)) >> weightBits);
+}
+
+void Downscaler::scale(const uint8_t* src, size_t srcStride, uint8_t* dst) {
+  if (!valid_) return;
+
+  uint32_t srcChroma = (srcWidth_ + 1) / 2;
+  uint32_t dstChroma = (dstWidth_ + 1) / 2;
+
+  for (uint32_t y = 0 ; y < dstHeight_ ; y++) {
+    const uint16_t* w = &rowTaps_.weights[(size_t) y * rowTaps_.maxTaps];
+    uint32_t first = rowTaps_.start[y];
+    uint32_t n = rowTaps_.count[y];
+
+    memset(&accY_[0], 0, srcWidth_ * sizeof(uint32_t));
+    memset(&accCb_[0], 0, srcChroma * sizeof(uint32_t));
+    memset(&accCr_[0], 0, srcChroma * sizeof(uint32_t));
+    for (uint32_t i = 0 ; i < n ; i++) {
+      if (w[i] == 0) continue;
+      unpackLine(srcFormat_, src + (first + i) * srcStride, srcWidth_,
+        &lineY_[0], &lineCb_[0], &lineCr_[0]);
+      accumulate(&accY_[0], &lineY_[0], w[i], srcWidth_);
+      accumulate(&accCb_[0], &lineCb_[0], w[i], srcChroma);
+      accumulate(&accCr_[0], &lineCr_[0], w[i], srcChroma);
+    }
+    normalise(&accY_[0], &vertY_[0], srcWidth_);
+    normalise(&accCb_[0], &vertCb_[0], srcChroma);
+    normalise(&accCr_[0], &vertCr_[0], srcChroma);
+
+    horizontal(&vertY_[0], lumaTaps_, dstWidth_, &outY_[0]);
+    horizontal(&vertCb_[0], chromaTaps_, dstChroma, &outCb_[0]);
+    horizontal(&vertCr_[0], chromaTaps_, dstChroma, &outCr_[0]);
+
+    packLine(dstFormat_, &outY_[0], &outCb_[0], &outCr_[0], dstWidth_,
+      dst + (size_t) y * dstRowBytes_);
+  }
+}
+
+bool parseDownscaleFilter(v8::Local<v8::Value> value, DownscaleFilter* filter) {
+  if (value->IsUndefined()) return true;
+  if (value->IsNumber()) {
+    uint32_t f = Nan::To<uint32_t>(value).FromJust();
+    if (f > downscaleBilinear) return false;
+    *filter = (DownscaleFilter) f;
+    return true;
+  }
+  if (value->IsString()) {
+    Nan::Utf8String name(value);
+    if (strcmp(*name, "box") == 0) { *filter = downscaleBox; return true; }
+    if (strcmp(*name, "bilinear") == 0) { *filter = downscaleBilinear; return true; }
+  }
+  return false;
+}
+
+NAN_METHOD(Downscale) {
+  if (info.Length() < 6 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("Downscale requires a buffer, width, height, pixel format, output width and output height.");
+    return;
+  }
+  uint32_t width = Nan::To<uint32_t>(info[1]).FromJust();
+  uint32_t height = Nan::To<uint32_t>(info[2]).FromJust();
+  uint32_t pixelFormat = Nan::To<uint32_t>(info[3]).FromJust();
+  uint32_t outWidth = Nan::To<uint32_t>(info[4]).FromJust();
+  uint32_t outHeight = Nan::To<uint32_t>(info[5]).FromJust();
+  uint32_t outFormat = info[6]->IsNumber() ?
+    Nan::To<uint32_t>(info[6]).FromJust() : (uint32_t) bmdFormat8BitYUV;
+  DownscaleFilter filter = downscaleBox;
+  if (!parseDownscaleFilter(info[7], &filter)) {
+    Nan::ThrowError("Downscale filter must be 'box' or 'bilinear'.");
+    return;
+  }
+  if (!isYUV422Format(pixelFormat) || !isYUV422Format(outFormat)) {
+    Nan::ThrowError("Downscale only supports 8-bit (2vuy) and 10-bit (v210) YUV.");
+    return;
+  }
+
+  size_t srcRowBytes = rowBytesForFormat(pixelFormat, width);
+  if (node::Buffer::Length(info[0]) < srcRowBytes * height) {
+    Nan::ThrowError("Buffer is too small for the given width, height and pixel format.");
+    return;
+  }
+
+  Downscaler scaler(width, height, pixelFormat, outWidth, outHeight, outFormat, filter);
+  if (!scaler.isValid()) {
+    Nan::ThrowError("Invalid dimensions for downscale.");
+    return;
+  }
+  v8::Local<v8::Object> result = Nan::NewBuffer(scaler.dstSize()).ToLocalChecked();
+  scaler.scale((const uint8_t*) node::Buffer::Data(info[0]), srcRowBytes,
+    (uint8_t*) node::Buffer::Data(result));
+  info.GetReturnValue().Set(result);
+}
+
+} // namespace streampunk
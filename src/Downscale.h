@@ -0,0 +1,87 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef DOWNSCALE_H
+#define DOWNSCALE_H
+
+#include <nan.h>
+#include <stdint.h>
+#include <vector>
+
+namespace streampunk {
+
+enum DownscaleFilter {
+  downscaleBox = 0,
+  downscaleBilinear = 1
+};
+
+// Separable downscaler working directly on 2vuy and v210 frames. Source rows
+// are unpacked to 10-bit planar, filtered vertically then horizontally with
+// fixed-point weights, and packed into the destination format. Tables are
+// built once per geometry, so an instance can be reused for every frame of a
+// stream. Not thread safe - keep one instance per capture thread.
+class Downscaler {
+public:
+  Downscaler(uint32_t srcWidth, uint32_t srcHeight, uint32_t srcFormat,
+    uint32_t dstWidth, uint32_t dstHeight, uint32_t dstFormat,
+    DownscaleFilter filter);
+
+  bool matches(uint32_t srcWidth, uint32_t srcHeight, uint32_t srcFormat,
+    uint32_t dstWidth, uint32_t dstHeight, uint32_t dstFormat,
+    DownscaleFilter filter) const;
+  bool isValid() const { return valid_; }
+  uint32_t dstRowBytes() const { return dstRowBytes_; }
+  size_t dstSize() const { return (size_t) dstRowBytes_ * dstHeight_; }
+
+  // Scale a whole frame. srcStride is the distance in bytes between source
+  // rows, allowing interlaced fields to be scaled from a woven frame.
+  void scale(const uint8_t* src, size_t srcStride, uint8_t* dst);
+
+private:
+  struct Taps {
+    std::vector<uint32_t> start;
+    std::vector<uint32_t> count;
+    std::vector<uint16_t> weights; // maxTaps per output sample
+    uint32_t maxTaps;
+    uint32_t shift; // non-zero for power-of-two box reduction
+  };
+
+  static void buildTaps(uint32_t srcSize, uint32_t dstSize,
+    DownscaleFilter filter, Taps& taps);
+  static void horizontal(const uint16_t* in, const Taps& taps,
+    uint32_t outCount, uint16_t* out);
+
+  uint32_t srcWidth_, srcHeight_, srcFormat_;
+  uint32_t dstWidth_, dstHeight_, dstFormat_;
+  DownscaleFilter filter_;
+  uint32_t dstRowBytes_;
+  bool valid_;
+
+  Taps lumaTaps_, chromaTaps_, rowTaps_;
+  std::vector<uint16_t> lineY_, lineCb_, lineCr_;
+  std::vector<uint32_t> accY_, accCb_, accCr_;
+  std::vector<uint16_t> vertY_, vertCb_, vertCr_;
+  std::vector<uint16_t> outY_, outCb_, outCr_;
+};
+
+bool parseDownscaleFilter(v8::Local<v8::Value> value, DownscaleFilter* filter);
+
+// downscale(buffer, width, height, pixelFormat, outWidth, outHeight
+//   [, outPixelFormat [, filter]]) -> Buffer
+NAN_METHOD(Downscale);
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,53 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Environment.h"
+
+namespace streampunk {
+
+uv_loop_t* currentLoop() {
+  return Nan::GetCurrentEventLoop();
+}
+
+// Before Node 10 there is only the main thread, torn down with the process.
+void addCleanupHook(CleanupHook hook, void* arg) {
+#if NODE_MAJOR_VERSION >= 10
+  node::AddEnvironmentCleanupHook(v8::Isolate::GetCurrent(), hook, arg);
+#endif
+}
+
+void removeCleanupHook(CleanupHook hook, void* arg) {
+#if NODE_MAJOR_VERSION >= 10
+  node::RemoveEnvironmentCleanupHook(v8::Isolate::GetCurrent(), hook, arg);
+#endif
+}
+
+static void resetConstructor(void* arg) {
+  static_cast<Nan::Persistent<v8::Function>*>(arg)->Reset();
+}
+
+void resetOnCleanup(Nan::Persistent<v8::Function>* constructor) {
+  addCleanupHook(resetConstructor, constructor);
+}
+
+static void deleteHandle(uv_handle_t* handle) {
+  delete (uv_async_t*) handle;
+}
+
+void closeAndDelete(uv_async_t* handle) {
+  uv_close((uv_handle_t*) handle, deleteHandle);
+}
+
+} // namespace streampunk
@@ -0,0 +1,49 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <node.h>
+#include <nan.h>
+#include <uv.h>
+
+namespace streampunk {
+
+// The addon may be loaded by the main thread and by any number of worker
+// threads, each a Node environment with its own isolate and event loop. Class
+// constructors are kept per thread, async handles are put on the loop of the
+// environment creating them, and whatever is still running when an
+// environment is torn down is stopped by a cleanup hook, before its loop is
+// closed.
+
+// The event loop of the environment on the calling thread.
+uv_loop_t* currentLoop();
+
+typedef void (*CleanupHook)(void* arg);
+// Calls hook(arg) when the environment on the calling thread is torn down.
+// A hook must be removed, on the same thread, if arg goes first.
+void addCleanupHook(CleanupHook hook, void* arg);
+void removeCleanupHook(CleanupHook hook, void* arg);
+
+// Resets a per-thread constructor when its environment is torn down.
+void resetOnCleanup(Nan::Persistent<v8::Function>* constructor);
+
+// Closes a heap allocated handle and deletes it once closed.
+void closeAndDelete(uv_async_t* handle);
+
+} // namespace streampunk
+
+#endif
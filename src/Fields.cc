@@ -0,0 +1,187 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Fields.h"
+#include "Formats.h"
+#include <string.h>
+
+namespace streampunk {
+
+void extractField(const uint8_t* frame, size_t rowBytes, uint32_t frameHeight,
+    uint32_t field, uint8_t* dst) {
+  uint32_t rows = fieldHeight(frameHeight, field);
+  const uint8_t* src = frame + field * rowBytes;
+  for (uint32_t y = 0 ; y < rows ; y++)
+    memcpy(dst + y * rowBytes, src + y * 2 * rowBytes, rowBytes);
+}
+
+void insertField(const uint8_t* fieldData, size_t rowBytes, uint32_t frameHeight,
+    uint32_t field, uint8_t* frame) {
+  uint32_t rows = fieldHeight(frameHeight, field);
+  uint8_t* dst = frame + field * rowBytes;
+  for (uint32_t y = 0 ; y < rows ; y++)
+    memcpy(dst + y * 2 * rowBytes, fieldData + y * rowBytes, rowBytes);
+}
+
+void averageRows(uint32_t pixelFormat, const uint8_t* a, const uint8_t* b,
+    size_t rowBytes, uint8_t* dst) {
+  // Rounded average of packed lanes: (a | b) - ((a ^ b) >> 1), with the bit
+  // shifted in from the neighbouring lane masked off.
+  const uint32_t laneMask = (pixelFormat == bmdFormat10BitYUV) ?
+    0x1ff7fdffU : 0x7f7f7f7fU;
+  size_t words = rowBytes / 4;
+  for (size_t i = 0 ; i < words ; i++) {
+    uint32_t wa, wb;
+    memcpy(&wa, a + i * 4, 4);
+    memcpy(&wb, b + i * 4, 4);
+    uint32_t avg = (wa | wb) - (((wa ^ wb) >> 1) & laneMask);
+    memcpy(dst + i * 4, &avg, 4);
+  }
+  for (size_t i = words * 4 ; i < rowBytes ; i++)
+    dst[i] = (uint8_t) ((a[i] + b[i] + 1) >> 1);
+}
+
+void deinterlaceField(uint32_t pixelFormat, const uint8_t* src, size_t srcStride,
+    size_t rowBytes, uint32_t frameHeight, uint32_t field,
+    DeinterlaceMethod method, uint8_t* dst) {
+  uint32_t rows = fieldHeight(frameHeight, field);
+  for (uint32_t y = 0 ; y < frameHeight ; y++) {
+    uint8_t* out = dst + y * rowBytes;
+    if (y >= field && ((y - field) & 1) == 0) {
+      memcpy(out, src + ((y - field) / 2) * srcStride, rowBytes);
+      continue;
+    }
+    // Missing line - field lines either side, where they exist
+    bool hasAbove = y > field;
+    uint32_t above = hasAbove ? (y - field - 1) / 2 : 0;
+    uint32_t below = hasAbove ? above + 1 : 0;
+    bool hasBelow = below < rows;
+    if (method == deinterlaceLinear && hasAbove && hasBelow)
+      averageRows(pixelFormat, src + above * srcStride, src + below * srcStride,
+        rowBytes, out);
+    else
+      memcpy(out, src + (hasAbove ? above : below) * srcStride, rowBytes);
+  }
+}
+
+static bool fieldArgs(const Nan::FunctionCallbackInfo<v8::Value>& info, int first,
+    uint32_t* width, uint32_t* height, uint32_t* pixelFormat, size_t* rowBytes) {
+  *width = Nan::To<uint32_t>(info[first]).FromJust();
+  *height = Nan::To<uint32_t>(info[first + 1]).FromJust();
+  *pixelFormat = Nan::To<uint32_t>(info[first + 2]).FromJust();
+  if (!isYUV422Format(*pixelFormat)) {
+    Nan::ThrowError("Field operations only support 8-bit (2vuy) and 10-bit (v210) YUV.");
+    return false;
+  }
+  *rowBytes = rowBytesForFormat(*pixelFormat, *width);
+  if (*height < 2) {
+    Nan::ThrowError("Frame height must be at least two rows.");
+    return false;
+  }
+  return true;
+}
+
+NAN_METHOD(SplitFields) {
+  if (info.Length() < 4 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("SplitFields requires a buffer, width, height and pixel format.");
+    return;
+  }
+  uint32_t width, height, pixelFormat;
+  size_t rowBytes;
+  if (!fieldArgs(info, 1, &width, &height, &pixelFormat, &rowBytes)) return;
+  if (node::Buffer::Length(info[0]) < rowBytes * height) {
+    Nan::ThrowError("Buffer is too small for the given width, height and pixel format.");
+    return;
+  }
+  const uint8_t* frame = (const uint8_t*) node::Buffer::Data(info[0]);
+
+  v8::Local<v8::Array> fields = Nan::New<v8::Array>(2);
+  for (uint32_t f = 0 ; f < 2 ; f++) {
+    v8::Local<v8::Object> b =
+      Nan::NewBuffer(rowBytes * fieldHeight(height, f)).ToLocalChecked();
+    extractField(frame, rowBytes, height, f, (uint8_t*) node::Buffer::Data(b));
+    Nan::Set(fields, f, b);
+  }
+  info.GetReturnValue().Set(fields);
+}
+
+NAN_METHOD(WeaveFields) {
+  if (info.Length() < 5 || !node::Buffer::HasInstance(info[0]) ||
+      !node::Buffer::HasInstance(info[1])) {
+    Nan::ThrowTypeError("WeaveFields requires two field buffers, width, height and pixel format.");
+    return;
+  }
+  uint32_t width, height, pixelFormat;
+  size_t rowBytes;
+  if (!fieldArgs(info, 2, &width, &height, &pixelFormat, &rowBytes)) return;
+  for (uint32_t f = 0 ; f < 2 ; f++) {
+    if (node::Buffer::Length(info[f]) < rowBytes * fieldHeight(height, f)) {
+      Nan::ThrowError("Field buffer is too small for the given width, height and pixel format.");
+      return;
+    }
+  }
+
+  v8::Local<v8::Object> frame = Nan::NewBuffer(rowBytes * height).ToLocalChecked();
+  uint8_t* frameData = (uint8_t*) node::Buffer::Data(frame);
+  for (uint32_t f = 0 ; f < 2 ; f++)
+    insertField((const uint8_t*) node::Buffer::Data(info[f]), rowBytes, height,
+      f, frameData);
+  info.GetReturnValue().Set(frame);
+}
+
+NAN_METHOD(Deinterlace) {
+  if (info.Length() < 5 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("Deinterlace requires a buffer, width, height, pixel format and field.");
+    return;
+  }
+  uint32_t width, height, pixelFormat;
+  size_t rowBytes;
+  if (!fieldArgs(info, 1, &width, &height, &pixelFormat, &rowBytes)) return;
+  uint32_t field = Nan::To<uint32_t>(info[4]).FromJust();
+  if (field > 1) {
+    Nan::ThrowRangeError("Field must be 0 (top) or 1 (bottom).");
+    return;
+  }
+  DeinterlaceMethod method = deinterlaceLinear;
+  if (info[5]->IsString()) {
+    Nan::Utf8String name(info[5]);
+    if (strcmp(*name, "bob") == 0) method = deinterlaceBob;
+    else if (strcmp(*name, "linear") != 0) {
+      Nan::ThrowError("Deinterlace method must be 'bob' or 'linear'.");
+      return;
+    }
+  }
+
+  // Accept either a woven frame or a single contiguous field
+  size_t length = node::Buffer::Length(info[0]);
+  const uint8_t* src = (const uint8_t*) node::Buffer::Data(info[0]);
+  size_t srcStride;
+  if (length >= rowBytes * height) {
+    src += field * rowBytes;
+    srcStride = 2 * rowBytes;
+  } else if (length >= rowBytes * fieldHeight(height, field)) {
+    srcStride = rowBytes;
+  } else {
+    Nan::ThrowError("Buffer is too small for the given width, height and pixel format.");
+    return;
+  }
+
+  v8::Local<v8::Object> frame = Nan::NewBuffer(rowBytes * height).ToLocalChecked();
+  deinterlaceField(pixelFormat, src, srcStride, rowBytes, height, field, method,
+    (uint8_t*) node::Buffer::Data(frame));
+  info.GetReturnValue().Set(frame);
+}
+
+} // namespace streampunk
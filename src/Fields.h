@@ -0,0 +1,69 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef FIELDS_H
+#define FIELDS_H
+
+#include <nan.h>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace streampunk {
+
+// Fields are numbered from the top of the woven frame: field 0 holds rows
+// 0, 2, 4 ... and field 1 holds rows 1, 3, 5 ... A field is addressed inside
+// a woven frame as a view starting at field * rowBytes with a stride of
+// 2 * rowBytes, so none of the kernels below need the fields to be copied
+// out first.
+
+enum DeinterlaceMethod {
+  deinterlaceBob = 0,   // repeat the nearest line of the field
+  deinterlaceLinear = 1 // average the lines above and below
+};
+
+inline uint32_t fieldHeight(uint32_t frameHeight, uint32_t field) {
+  return (frameHeight + 1 - field) / 2;
+}
+
+// Copy one field out of a woven frame into contiguous rows.
+void extractField(const uint8_t* frame, size_t rowBytes, uint32_t frameHeight,
+  uint32_t field, uint8_t* dst);
+
+// Copy contiguous field rows into every second row of a woven frame.
+void insertField(const uint8_t* fieldData, size_t rowBytes, uint32_t frameHeight,
+  uint32_t field, uint8_t* frame);
+
+// Average two packed rows sample by sample without unpacking them. Works on
+// 32-bit words holding three 10-bit (v210) or four 8-bit (2vuy) samples.
+void averageRows(uint32_t pixelFormat, const uint8_t* a, const uint8_t* b,
+  size_t rowBytes, uint8_t* dst);
+
+// Build a full height frame from a single field. The field is read from src
+// with srcStride bytes between its rows, so it may be a view into a woven
+// frame (src = frame + field * rowBytes, srcStride = 2 * rowBytes).
+void deinterlaceField(uint32_t pixelFormat, const uint8_t* src, size_t srcStride,
+  size_t rowBytes, uint32_t frameHeight, uint32_t field,
+  DeinterlaceMethod method, uint8_t* dst);
+
+// splitFields(buffer, width, height, pixelFormat) -> [ field0, field1 ]
+NAN_METHOD(SplitFields);
+// weaveFields(field0, field1, width, height, pixelFormat) -> Buffer
+NAN_METHOD(WeaveFields);
+// deinterlace(buffer, width, height, pixelFormat, field [, method]) -> Buffer
+NAN_METHOD(Deinterlace);
+
+} // namespace streampunk
+
+#endif
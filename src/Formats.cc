@@ -0,0 +1,218 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Formats.h"
+#include <string.h>
+
+namespace streampunk {
+
+uint32_t rowBytesForFormat(uint32_t pixelFormat, uint32_t width) {
+  switch (pixelFormat) {
+    case bmdFormat8BitYUV:
+      return width * 2;
+    case bmdFormat10BitYUV:
+      // 48 pixels are packed into 128 bytes, rows padded to a whole block
+      return ((width + 47) / 48) * 128;
+    case bmdFormat8BitARGB:
+    case bmdFormat8BitBGRA:
+    case bmdFormat10BitRGB:
+      return width * 4;
+    case bmdFormat10BitRGBXLE:
+    case bmdFormat10BitRGBX:
+      return ((width + 63) / 64) * 256;
+    case bmdFormat12BitRGB:
+    case bmdFormat12BitRGBLE:
+      return (width * 36) / 8;
+    default:
+      return 0;
+  }
+}
+
+bool isYUV422Format(uint32_t pixelFormat) {
+  return pixelFormat == bmdFormat8BitYUV || pixelFormat == bmdFormat10BitYUV;
+}
+
+static inline uint32_t readLE32(const uint8_t* p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+    ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void writeLE32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+  p[2] = (uint8_t) (v >> 16);
+  p[3] = (uint8_t) (v >> 24);
+}
+
+void unpackV210Line(const uint8_t* src, uint32_t width,
+    uint16_t* y, uint16_t* cb, uint16_t* cr) {
+  uint32_t x = 0;
+  // Whole groups of six pixels in four words
+  for ( ; x + 6 <= width ; x += 6, src += 16) {
+    uint32_t w0 = readLE32(src), w1 = readLE32(src + 4);
+    uint32_t w2 = readLE32(src + 8), w3 = readLE32(src + 12);
+    uint32_t c = x / 2;
+    cb[c]     = w0 & 0x3ff; y[x]     = (w0 >> 10) & 0x3ff; cr[c]     = (w0 >> 20) & 0x3ff;
+    y[x + 1]  = w1 & 0x3ff; cb[c + 1] = (w1 >> 10) & 0x3ff; y[x + 2]  = (w1 >> 20) & 0x3ff;
+    cr[c + 1] = w2 & 0x3ff; y[x + 3]  = (w2 >> 10) & 0x3ff; cb[c + 2] = (w2 >> 20) & 0x3ff;
+    y[x + 4]  = w3 & 0x3ff; cr[c + 2] = (w3 >> 10) & 0x3ff; y[x + 5]  = (w3 >> 20) & 0x3ff;
+  }
+  if (x < width) { // Partial trailing group
+    uint16_t ty[6], tcb[3], tcr[3];
+    uint32_t w0 = readLE32(src), w1 = readLE32(src + 4);
+    uint32_t w2 = readLE32(src + 8), w3 = readLE32(src + 12);
+    tcb[0] = w0 & 0x3ff; ty[0] = (w0 >> 10) & 0x3ff; tcr[0] = (w0 >> 20) & 0x3ff;
+    ty[1] = w1 & 0x3ff; tcb[1] = (w1 >> 10) & 0x3ff; ty[2] = (w1 >> 20) & 0x3ff;
+    tcr[1] = w2 & 0x3ff; ty[3] = (w2 >> 10) & 0x3ff; tcb[2] = (w2 >> 20) & 0x3ff;
+    ty[4] = w3 & 0x3ff; tcr[2] = (w3 >> 10) & 0x3ff; ty[5] = (w3 >> 20) & 0x3ff;
+    for (uint32_t i = 0 ; x + i < width ; i++) {
+      y[x + i] = ty[i];
+      if ((i & 1) == 0) {
+        cb[(x + i) / 2] = tcb[i / 2];
+        cr[(x + i) / 2] = tcr[i / 2];
+      }
+    }
+  }
+}
+
+// Returns the number of bytes written.
+static uint32_t packV210Groups(const uint16_t* y, const uint16_t* cb,
+    const uint16_t* cr, uint32_t width, uint8_t* dst) {
+  uint8_t* start = dst;
+  uint32_t x = 0;
+  for ( ; x + 6 <= width ; x += 6, dst += 16) {
+    uint32_t c = x / 2;
+    writeLE32(dst,      cb[c]     | (y[x] << 10)      | (cr[c] << 20));
+    writeLE32(dst + 4,  y[x + 1]  | (cb[c + 1] << 10) | (y[x + 2] << 20));
+    writeLE32(dst + 8,  cr[c + 1] | (y[x + 3] << 10)  | (cb[c + 2] << 20));
+    writeLE32(dst + 12, y[x + 4]  | (cr[c + 2] << 10) | (y[x + 5] << 20));
+  }
+  if (x < width) {
+    // Repeat the last sample into the unused slots of the trailing group
+    uint16_t ty[6], tcb[3], tcr[3];
+    for (uint32_t i = 0 ; i < 6 ; i++) {
+      uint32_t sx = (x + i < width) ? x + i : width - 1;
+      ty[i] = y[sx];
+      if ((i & 1) == 0) {
+        tcb[i / 2] = cb[sx / 2];
+        tcr[i / 2] = cr[sx / 2];
+      }
+    }
+    writeLE32(dst,      tcb[0] | (ty[0] << 10)  | (tcr[0] << 20));
+    writeLE32(dst + 4,  ty[1]  | (tcb[1] << 10) | (ty[2] << 20));
+    writeLE32(dst + 8,  tcr[1] | (ty[3] << 10)  | (tcb[2] << 20));
+    writeLE32(dst + 12, ty[4]  | (tcr[2] << 10) | (ty[5] << 20));
+    dst += 16;
+  }
+  return (uint32_t) (dst - start);
+}
+
+void packV210Span(const uint16_t* y, const uint16_t* cb, const uint16_t* cr,
+    uint32_t width, uint8_t* dst) {
+  packV210Groups(y, cb, cr, width, dst);
+}
+
+void packV210Line(const uint16_t* y, const uint16_t* cb, const uint16_t* cr,
+    uint32_t width, uint8_t* dst) {
+  uint32_t used = packV210Groups(y, cb, cr, width, dst);
+  uint32_t rowBytes = rowBytesForFormat(bmdFormat10BitYUV, width);
+  if (used < rowBytes)
+    memset(dst + used, 0, rowBytes - used);
+}
+
+void unpack2vuyLine(const uint8_t* src, uint32_t width,
+    uint16_t* y, uint16_t* cb, uint16_t* cr) {
+  uint32_t pairs = width / 2;
+  for (uint32_t c = 0 ; c < pairs ; c++) {
+    cb[c]        = (uint16_t) (src[c * 4] << 2);
+    y[c * 2]     = (uint16_t) (src[c * 4 + 1] << 2);
+    cr[c]        = (uint16_t) (src[c * 4 + 2] << 2);
+    y[c * 2 + 1] = (uint16_t) (src[c * 4 + 3] << 2);
+  }
+  if (width & 1) {
+    cb[pairs]    = (uint16_t) (src[pairs * 4] << 2);
+    y[width - 1] = (uint16_t) (src[pairs * 4 + 1] << 2);
+    cr[pairs]    = 512;
+  }
+}
+
+static inline uint8_t to8Bit(uint16_t v) {
+  uint32_t r = ((uint32_t) v + 2) >> 2;
+  return (uint8_t) (r > 255 ? 255 : r);
+}
+
+void pack2vuyLine(const uint16_t* y, const uint16_t* cb, const uint16_t* cr,
+    uint32_t width, uint8_t* dst) {
+  uint32_t pairs = width / 2;
+  for (uint32_t c = 0 ; c < pairs ; c++) {
+    dst[c * 4]     = to8Bit(cb[c]);
+    dst[c * 4 + 1] = to8Bit(y[c * 2]);
+    dst[c * 4 + 2] = to8Bit(cr[c]);
+    dst[c * 4 + 3] = to8Bit(y[c * 2 + 1]);
+  }
+  if (width & 1) {
+    dst[pairs * 4]     = to8Bit(cb[pairs]);
+    dst[pairs * 4 + 1] = to8Bit(y[width - 1]);
+  }
+}
+
+void unpackLine(uint32_t pixelFormat, const uint8_t* src, uint32_t width,
+    uint16_t* y, uint16_t* cb, uint16_t* cr) {
+  if (pixelFormat == bmdFormat10BitYUV)
+    unpackV210Line(src, width, y, cb, cr);
+  else
+    unpack2vuyLine(src, width, y, cb, cr);
+}
+
+// Word and shift of each sample within a v210 group, by pixel for luma and
+// by pair for chroma.
+static const uint8_t v210YWord[6] = { 0, 1, 1, 2, 3, 3 };
+static const uint8_t v210YShift[6] = { 10, 0, 20, 10, 0, 20 };
+static const uint8_t v210CbWord[3] = { 0, 1, 2 };
+static const uint8_t v210CbShift[3] = { 0, 10, 20 };
+static const uint8_t v210CrWord[3] = { 0, 2, 3 };
+static const uint8_t v210CrShift[3] = { 20, 0, 10 };
+
+void sampleLine(uint32_t pixelFormat, const uint8_t* src, uint32_t width,
+    uint32_t step, uint16_t* y, uint16_t* cb, uint16_t* cr) {
+  uint32_t n = 0;
+  if (pixelFormat == bmdFormat10BitYUV) {
+    for (uint32_t x = 0 ; x < width ; x += step, n++) {
+      const uint8_t* group = src + (x / 6) * 16;
+      uint32_t i = x % 6, c = i / 2;
+      y[n] = (readLE32(group + v210YWord[i] * 4) >> v210YShift[i]) & 0x3ff;
+      cb[n] = (readLE32(group + v210CbWord[c] * 4) >> v210CbShift[c]) & 0x3ff;
+      cr[n] = (readLE32(group + v210CrWord[c] * 4) >> v210CrShift[c]) & 0x3ff;
+    }
+  } else {
+    uint32_t pairs = width / 2;
+    for (uint32_t x = 0 ; x < width ; x += step, n++) {
+      const uint8_t* pair = src + (x / 2) * 4;
+      y[n] = (uint16_t) (pair[1 + (x & 1) * 2] << 2);
+      cb[n] = (uint16_t) (pair[0] << 2);
+      cr[n] = (x / 2 < pairs) ? (uint16_t) (pair[2] << 2) : 512;
+    }
+  }
+}
+
+void packLine(uint32_t pixelFormat, const uint16_t* y, const uint16_t* cb,
+    const uint16_t* cr, uint32_t width, uint8_t* dst) {
+  if (pixelFormat == bmdFormat10BitYUV)
+    packV210Line(y, cb, cr, width, dst);
+  else
+    pack2vuyLine(y, cb, cr, width, dst);
+}
+
+} // namespace streampunk
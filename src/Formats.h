@@ -0,0 +1,66 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef FORMATS_H
+#define FORMATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "DeckLinkAPI.h"
+
+namespace streampunk {
+
+// Bytes per row for a frame of the given pixel format and width, as laid out
+// by the DeckLink driver. Returns 0 for formats macadam does not handle.
+uint32_t rowBytesForFormat(uint32_t pixelFormat, uint32_t width);
+
+// True for the two YCbCr 4:2:2 formats (2vuy and v210) that the native
+// video kernels operate on.
+bool isYUV422Format(uint32_t pixelFormat);
+
+// Unpack one row of 2vuy or v210 into 10-bit planar 4:2:2 samples. The
+// chroma rows hold (width + 1) / 2 samples each. 8-bit input is shifted up
+// by two bits so that every kernel works on a single sample range.
+void unpackLine(uint32_t pixelFormat, const uint8_t* src, uint32_t width,
+  uint16_t* y, uint16_t* cb, uint16_t* cr);
+
+// Read every step-th pixel of a row of 2vuy or v210, with the chroma of the
+// pair it belongs to, into (width + step - 1) / step samples of each of y, cb
+// and cr. Only the pixels read are unpacked.
+void sampleLine(uint32_t pixelFormat, const uint8_t* src, uint32_t width,
+  uint32_t step, uint16_t* y, uint16_t* cb, uint16_t* cr);
+
+// Pack one row of 10-bit planar 4:2:2 samples into 2vuy or v210. Padding
+// at the end of a v210 row is written as zero.
+void packLine(uint32_t pixelFormat, const uint16_t* y, const uint16_t* cb,
+  const uint16_t* cr, uint32_t width, uint8_t* dst);
+
+void unpackV210Line(const uint8_t* src, uint32_t width,
+  uint16_t* y, uint16_t* cb, uint16_t* cr);
+void packV210Line(const uint16_t* y, const uint16_t* cb, const uint16_t* cr,
+  uint32_t width, uint8_t* dst);
+// Pack whole six pixel groups starting at a group boundary, leaving the rest
+// of the row untouched. Used to rewrite part of a row in place.
+void packV210Span(const uint16_t* y, const uint16_t* cb, const uint16_t* cr,
+  uint32_t width, uint8_t* dst);
+void unpack2vuyLine(const uint8_t* src, uint32_t width,
+  uint16_t* y, uint16_t* cb, uint16_t* cr);
+void pack2vuyLine(const uint16_t* y, const uint16_t* cb, const uint16_t* cr,
+  uint32_t width, uint8_t* dst);
+
+} // namespace streampunk
+
+#endif
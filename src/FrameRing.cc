@@ -0,0 +1,167 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "FrameRing.h"
+#include <atomic>
+#include <string.h>
+
+namespace streampunk {
+
+// Slots, and the audio within them, start on cache lines
+static const uint64_t ringAlign = 64;
+
+static uint64_t alignUp(uint64_t bytes) {
+  return (bytes + ringAlign - 1) & ~(ringAlign - 1);
+}
+
+// The Int32 counters are shared with Atomics in Javascript, which use the
+// same plain 4 byte representation.
+static std::atomic<int32_t>* counter(uint8_t* base, size_t offset) {
+  return reinterpret_cast<std::atomic<int32_t>*>(base + offset);
+}
+
+static uint64_t entriesOffset() {
+  return FrameRing::headerFields * sizeof(int32_t);
+}
+
+static uint64_t slotsOffset(uint32_t slots) {
+  return alignUp(entriesOffset() + (uint64_t) slots * FrameRing::entryBytes);
+}
+
+static uint64_t slotBytes(uint32_t frameBytes, uint32_t audioBytes) {
+  return alignUp(alignUp(frameBytes) + audioBytes);
+}
+
+FrameRing::FrameRing() : base_(NULL), slots_(0), frameBytes_(0),
+    audioBytes_(0), slotBytes_(0), entriesOffset_(0), slotsOffset_(0) {
+}
+
+size_t FrameRing::bytesNeeded(uint32_t slots, uint32_t frameBytes, uint32_t audioBytes) {
+  uint64_t bytes = slotsOffset(slots) + (uint64_t) slots * slotBytes(frameBytes, audioBytes);
+  return bytes > INT32_MAX ? 0 : (size_t) bytes;
+}
+
+uint32_t FrameRing::slotsFitting(size_t bytes, uint32_t frameBytes, uint32_t audioBytes) {
+  uint64_t slot = slotBytes(frameBytes, audioBytes) + entryBytes;
+  uint32_t slots = (uint32_t) (bytes / slot);
+  while (slots > 0 && (bytesNeeded(slots, frameBytes, audioBytes) == 0 ||
+         bytesNeeded(slots, frameBytes, audioBytes) > bytes))
+    slots--;
+  return slots;
+}
+
+bool FrameRing::attach(uint8_t* base, size_t bytes, uint32_t slots,
+    const Format& format, std::string& error) {
+  if (format.frameBytes == 0) {
+    error = "Frame ring needs the size of a frame.";
+    return false;
+  }
+  if (slots == 0)
+    slots = slotsFitting(bytes, format.frameBytes, format.audioBytes);
+  size_t needed = bytesNeeded(slots, format.frameBytes, format.audioBytes);
+  if (slots < 2 || needed == 0 || needed > bytes) {
+    error = "Frame ring buffer is too small for two frames, or over 2GB.";
+    return false;
+  }
+  if (((uintptr_t) base & 7) != 0) {
+    error = "Frame ring buffer is not aligned.";
+    return false;
+  }
+
+  slots_ = slots;
+  frameBytes_ = (uint32_t) alignUp(format.frameBytes);
+  audioBytes_ = format.audioBytes;
+  slotBytes_ = (uint32_t) slotBytes(format.frameBytes, format.audioBytes);
+  entriesOffset_ = (uint32_t) entriesOffset();
+  slotsOffset_ = (uint32_t) slotsOffset(slots);
+
+  // Entries start cleared, so no slot reads as holding a frame
+  memset(base + entriesOffset_, 0, (size_t) slots * entryBytes);
+  int32_t fields[headerFields] = { 0 };
+  fields[fieldVersion] = version;
+  fields[fieldSlots] = slots_;
+  fields[fieldSlotBytes] = slotBytes_;
+  fields[fieldFrameBytes] = frameBytes_;
+  fields[fieldAudioBytes] = audioBytes_;
+  fields[fieldEntriesOffset] = entriesOffset_;
+  fields[fieldSlotsOffset] = slotsOffset_;
+  fields[fieldPixelFormat] = (int32_t) format.pixelFormat;
+  fields[fieldWidth] = format.width;
+  fields[fieldHeight] = format.height;
+  fields[fieldRowBytes] = format.rowBytes;
+  fields[fieldAudioChannels] = format.audioChannels;
+  fields[fieldAudioSampleBytes] = format.audioSampleBytes;
+  for (uint32_t x = 0 ; x < headerFields ; x++)
+    counter(base, x * sizeof(int32_t))->store(fields[x], std::memory_order_release);
+  base_ = base;
+  return true;
+}
+
+void FrameRing::detach() {
+  if (base_ == NULL) return;
+  counter(base_, fieldClosed * sizeof(int32_t))->store(1, std::memory_order_release);
+  base_ = NULL;
+}
+
+uint32_t FrameRing::written() const {
+  if (base_ == NULL) return 0;
+  return (uint32_t) counter(base_, fieldWritten * sizeof(int32_t))->load(
+    std::memory_order_acquire);
+}
+
+void FrameRing::write(const uint8_t* video, uint32_t videoBytes,
+    const uint8_t* audio, uint32_t audioBytes, uint32_t audioFrames,
+    int64_t streamTime, int64_t frameDuration, int64_t timeScale) {
+  if (base_ == NULL) return;
+  std::atomic<int32_t>* writtenCount = counter(base_, fieldWritten * sizeof(int32_t));
+  uint32_t frame = (uint32_t) writtenCount->load(std::memory_order_relaxed);
+  uint32_t index = frame % slots_;
+  size_t entry = entriesOffset_ + (size_t) index * entryBytes;
+  uint8_t* slot = base_ + slotsOffset_ + (size_t) index * slotBytes_;
+  if (videoBytes > frameBytes_) videoBytes = frameBytes_;
+  if (audioBytes > audioBytes_) {
+    audioFrames = (uint32_t) ((uint64_t) audioFrames * audioBytes_ / audioBytes);
+    audioBytes = audioBytes_;
+  }
+
+  std::atomic<int32_t>* sequence = counter(base_, entry);
+  sequence->store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  if (video != NULL) memcpy(slot, video, videoBytes);
+  if (audio != NULL) memcpy(slot + frameBytes_, audio, audioBytes);
+  counter(base_, entry + 4)->store(video != NULL ? videoBytes : 0, std::memory_order_relaxed);
+  counter(base_, entry + 8)->store(audio != NULL ? audioBytes : 0, std::memory_order_relaxed);
+  counter(base_, entry + 12)->store(audio != NULL ? audioFrames : 0, std::memory_order_relaxed);
+  double times[2] = { (double) streamTime, (double) frameDuration };
+  memcpy(base_ + entry + 16, times, sizeof(times));
+  counter(base_, fieldTimeScale * sizeof(int32_t))->store(
+    (int32_t) timeScale, std::memory_order_relaxed);
+  sequence->store((int32_t) (frame + 1), std::memory_order_release);
+  writtenCount->store((int32_t) (frame + 1), std::memory_order_release);
+}
+
+NAN_METHOD(FrameRingBytes) {
+  uint32_t slots = Nan::To<uint32_t>(info[0]).FromMaybe(0);
+  uint32_t frameBytes = Nan::To<uint32_t>(info[1]).FromMaybe(0);
+  uint32_t audioBytes = Nan::To<uint32_t>(info[2]).FromMaybe(0);
+  size_t bytes = FrameRing::bytesNeeded(slots, frameBytes, audioBytes);
+  if (slots < 2 || frameBytes == 0 || bytes == 0) {
+    Nan::ThrowRangeError("A frame ring needs two or more frames, and must be under 2GB.");
+    return;
+  }
+  info.GetReturnValue().Set(Nan::New((double) bytes));
+}
+
+} // namespace streampunk
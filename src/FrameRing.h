@@ -0,0 +1,113 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <nan.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace streampunk {
+
+// A ring of frame slots laid out in memory provided by Javascript, a
+// SharedArrayBuffer, so that worker threads can read captured frames in
+// place. Every counter is an Int32 at a 4 byte boundary, for Atomics.
+//
+//   header   16 Int32, indexed by FrameRing::Field
+//   entries  per slot: Int32 sequence (frame number + 1, 0 while the slot is
+//            being written), videoBytes, audioBytes, audioFrames, then
+//            Float64 streamTime and frameDuration
+//   slots    slotBytes each, the video at the start and the audio after
+//            frameBytes
+//
+// Frame n goes in slot n % slots. The written count in the header is stored,
+// and Atomics.notify called on it from the event loop, after each frame.
+// Counts wrap at 2^32 frames, over two years at 60Hz.
+class FrameRing {
+public:
+  enum Field {
+    fieldWritten = 0,
+    fieldVersion,
+    fieldSlots,
+    fieldSlotBytes,
+    fieldFrameBytes,
+    fieldAudioBytes,
+    fieldEntriesOffset,
+    fieldSlotsOffset,
+    fieldPixelFormat,
+    fieldWidth,
+    fieldHeight,
+    fieldRowBytes,
+    fieldTimeScale,
+    fieldAudioChannels,
+    fieldAudioSampleBytes,
+    fieldClosed,
+    headerFields
+  };
+  static const uint32_t version = 1;
+  static const uint32_t entryBytes = 32;
+
+  struct Format {
+    uint32_t frameBytes;
+    uint32_t audioBytes;
+    uint32_t pixelFormat;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowBytes;
+    uint32_t audioChannels;
+    uint32_t audioSampleBytes;
+  };
+
+  FrameRing();
+
+  // Bytes for a ring of slots. 0 if too big for an Int32 offset.
+  static size_t bytesNeeded(uint32_t slots, uint32_t frameBytes, uint32_t audioBytes);
+  // As many slots as fit in bytes.
+  static uint32_t slotsFitting(size_t bytes, uint32_t frameBytes, uint32_t audioBytes);
+
+  // Writes the header into memory, which must stay valid until detached.
+  bool attach(uint8_t* base, size_t bytes, uint32_t slots, const Format& format,
+    std::string& error);
+  // Marks the ring closed. The memory is no longer written.
+  void detach();
+  bool attached() const { return base_ != NULL; }
+
+  // On the capture thread. Video or audio beyond their slot size is cut short.
+  void write(const uint8_t* video, uint32_t videoBytes, const uint8_t* audio,
+    uint32_t audioBytes, uint32_t audioFrames, int64_t streamTime,
+    int64_t frameDuration, int64_t timeScale);
+
+  uint32_t written() const;
+  uint32_t slots() const { return slots_; }
+
+private:
+  uint8_t* base_;
+  uint32_t slots_;
+  uint32_t frameBytes_;
+  uint32_t audioBytes_;
+  uint32_t slotBytes_;
+  uint32_t entriesOffset_;
+  uint32_t slotsOffset_;
+};
+
+// frameRingBytes(frames, frameBytes, audioBytes) - the size of
+// SharedArrayBuffer to allocate for a ring
+NAN_METHOD(FrameRingBytes);
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,256 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Hash.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <nmmintrin.h>
+#endif
+#define HASH_CRC32C_X86 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HASH_CRC32C_ARM 1
+#endif
+
+namespace streampunk {
+
+static inline uint64_t read64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// CRC32C
+
+struct CRC32CTables {
+  uint32_t t[8][256];
+  CRC32CTables() {
+    for (uint32_t n = 0 ; n < 256 ; n++) {
+      uint32_t c = n;
+      for (int k = 0 ; k < 8 ; k++)
+        c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+      t[0][n] = c;
+    }
+    for (uint32_t n = 0 ; n < 256 ; n++)
+      for (int k = 1 ; k < 8 ; k++)
+        t[k][n] = (t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xff];
+  }
+};
+
+// Slicing-by-8, for CPUs without a CRC32C instruction. Assumes little-endian,
+// as do all platforms with DeckLink drivers.
+static uint32_t crc32cSoftware(uint32_t crc, const uint8_t* p, size_t length) {
+  static const CRC32CTables tables;
+  const uint32_t (*t)[256] = tables.t;
+  while (length >= 8) {
+    uint64_t v = read64(p) ^ crc;
+    crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^
+      t[4][(v >> 24) & 0xff] ^ t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^
+      t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+    p += 8;
+    length -= 8;
+  }
+  while (length--)
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+  return crc;
+}
+
+#if defined(HASH_CRC32C_X86) && defined(_MSC_VER)
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t length) {
+  uint64_t c = crc;
+  for ( ; length >= 8 ; p += 8, length -= 8)
+    c = _mm_crc32_u64(c, read64(p));
+  uint32_t c32 = (uint32_t) c;
+  while (length--)
+    c32 = _mm_crc32_u8(c32, *p++);
+  return c32;
+}
+
+static bool hasHardwareCRC32C() {
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 20)) != 0; // SSE4.2
+}
+#elif defined(HASH_CRC32C_X86)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t length) {
+  uint64_t c = crc;
+  for ( ; length >= 8 ; p += 8, length -= 8)
+    c = __builtin_ia32_crc32di(c, read64(p));
+  uint32_t c32 = (uint32_t) c;
+  while (length--)
+    c32 = __builtin_ia32_crc32qi(c32, *p++);
+  return c32;
+}
+
+static bool hasHardwareCRC32C() {
+  return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(HASH_CRC32C_ARM)
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t length) {
+  for ( ; length >= 8 ; p += 8, length -= 8)
+    crc = __crc32cd(crc, read64(p));
+  while (length--)
+    crc = __crc32cb(crc, *p++);
+  return crc;
+}
+
+static bool hasHardwareCRC32C() {
+  return true;
+}
+#else
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t length) {
+  return crc32cSoftware(crc, p, length);
+}
+
+static bool hasHardwareCRC32C() {
+  return false;
+}
+#endif
+
+static uint32_t crc32c(const uint8_t* p, size_t length) {
+  static const bool hardware = hasHardwareCRC32C();
+  uint32_t crc = 0xffffffff;
+  crc = hardware ? crc32cHardware(crc, p, length) : crc32cSoftware(crc, p, length);
+  return ~crc;
+}
+
+// xxHash64
+
+static const uint64_t prime1 = 11400714785074694791ULL;
+static const uint64_t prime2 = 14029467366897019727ULL;
+static const uint64_t prime3 = 1609587929392839161ULL;
+static const uint64_t prime4 = 9650029242287828579ULL;
+static const uint64_t prime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+  acc += input * prime2;
+  acc = rotl64(acc, 31);
+  return acc * prime1;
+}
+
+static inline uint64_t xxhMerge(uint64_t acc, uint64_t val) {
+  acc ^= xxhRound(0, val);
+  return acc * prime1 + prime4;
+}
+
+static uint64_t xxh64(const uint8_t* p, size_t length) {
+  const uint8_t* end = p + length;
+  uint64_t h;
+  if (length >= 32) {
+    uint64_t v1 = prime1 + prime2, v2 = prime2, v3 = 0, v4 = 0 - prime1;
+    const uint8_t* limit = end - 32;
+    do {
+      v1 = xxhRound(v1, read64(p));
+      v2 = xxhRound(v2, read64(p + 8));
+      v3 = xxhRound(v3, read64(p + 16));
+      v4 = xxhRound(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = xxhMerge(h, v1);
+    h = xxhMerge(h, v2);
+    h = xxhMerge(h, v3);
+    h = xxhMerge(h, v4);
+  } else {
+    h = prime5;
+  }
+  h += (uint64_t) length;
+
+  for ( ; p + 8 <= end ; p += 8) {
+    h ^= xxhRound(0, read64(p));
+    h = rotl64(h, 27) * prime1 + prime4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t) read32(p) * prime1;
+    h = rotl64(h, 23) * prime2 + prime3;
+    p += 4;
+  }
+  for ( ; p < end ; p++) {
+    h ^= (*p) * prime5;
+    h = rotl64(h, 11) * prime1;
+  }
+
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t hashBytes(HashType type, const void* data, size_t length) {
+  switch (type) {
+    case hashCRC32C:
+      return crc32c((const uint8_t*) data, length);
+    case hashXXH64:
+      return xxh64((const uint8_t*) data, length);
+    default:
+      return 0;
+  }
+}
+
+std::string hashToHex(HashType type, uint64_t hash) {
+  static const char digits[] = "0123456789abcdef";
+  int count = (type == hashCRC32C) ? 8 : 16;
+  std::string hex(count, '0');
+  for (int x = count - 1 ; x >= 0 ; x--, hash >>= 4)
+    hex[x] = digits[hash & 0xf];
+  return hex;
+}
+
+bool parseHashType(v8::Local<v8::Value> value, HashType* type) {
+  if (value->IsUndefined() || value->IsNull() || value->IsFalse()) {
+    *type = hashNone;
+    return true;
+  }
+  if (!value->IsString()) return false;
+  Nan::Utf8String name(value);
+  if (strcmp(*name, "crc32c") == 0) *type = hashCRC32C;
+  else if (strcmp(*name, "xxh64") == 0) *type = hashXXH64;
+  else return false;
+  return true;
+}
+
+NAN_METHOD(HashBuffer) {
+  if (info.Length() < 1 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("HashBuffer requires a buffer.");
+    return;
+  }
+  HashType type = hashXXH64;
+  if (info.Length() > 1 && !info[1]->IsUndefined() &&
+      (!parseHashType(info[1], &type) || type == hashNone)) {
+    Nan::ThrowError("Hash type must be 'crc32c' or 'xxh64'.");
+    return;
+  }
+  uint64_t hash = hashBytes(type, node::Buffer::Data(info[0]),
+    node::Buffer::Length(info[0]));
+  info.GetReturnValue().Set(Nan::New(hashToHex(type, hash)).ToLocalChecked());
+}
+
+} // namespace streampunk
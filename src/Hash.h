@@ -0,0 +1,44 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <nan.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace streampunk {
+
+enum HashType {
+  hashNone = 0,
+  hashCRC32C,   // Castagnoli CRC, using the CPU's CRC32 instruction where present
+  hashXXH64     // xxHash64, seed 0
+};
+
+// Hash a block of memory. CRC32C results are in the low 32 bits.
+uint64_t hashBytes(HashType type, const void* data, size_t length);
+// Hash as fixed-width lower case hex, 8 digits for CRC32C and 16 for xxHash64.
+std::string hashToHex(HashType type, uint64_t hash);
+// Parse 'crc32c', 'xxh64' or a falsy value for no hashing.
+bool parseHashType(v8::Local<v8::Value> value, HashType* type);
+
+// hashBuffer(buffer[, type]) -> hex string, xxh64 by default
+NAN_METHOD(HashBuffer);
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,558 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Lossless.h"
+#include "Formats.h"
+#include <string.h>
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifdef WIN32
+#define losslessSeek _fseeki64
+#define losslessTell _ftelli64
+#else
+#define losslessSeek fseeko
+#define losslessTell ftello
+#endif
+
+namespace streampunk {
+
+// Frame header, all little endian: magic, length of the whole frame, pixel
+// format, width, height, slices and rows per slice, then a word per slice
+// with its length and the top bit set if it is stored rather than coded.
+static const uint8_t frameMagic[4] = { 'M', 'L', 'C', '1' };
+static const uint32_t storedFlag = 0x80000000;
+static const uint32_t maxSlices = 64;
+static const uint32_t minSliceRows = 16;
+// Longest unary prefix before a residual is written out in full
+static const uint32_t riceLimit = 20;
+
+static inline void put32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+  p[2] = (uint8_t) (v >> 16);
+  p[3] = (uint8_t) (v >> 24);
+}
+
+static inline uint32_t get32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t swap64(uint64_t v) {
+#if defined(_MSC_VER)
+  return _byteswap_uint64(v);
+#else
+  return __builtin_bswap64(v);
+#endif
+}
+
+static inline uint32_t leadingZeros(uint64_t v) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, v);
+  return 63 - index;
+#else
+  return __builtin_clzll(v);
+#endif
+}
+
+// Most significant bit first, a 32-bit word at a time.
+class BitWriter {
+public:
+  BitWriter(uint8_t* data, size_t capacity) : start_(data), p_(data),
+    end_(data + capacity), acc_(0), bits_(0), overflow_(false) {}
+
+  // n up to 32
+  inline void put(uint32_t value, uint32_t n) {
+    acc_ = (acc_ << n) | value;
+    bits_ += n;
+    if (bits_ >= 32) {
+      bits_ -= 32;
+      uint32_t word = (uint32_t) (acc_ >> bits_);
+      if (end_ - p_ < 4) {
+        overflow_ = true;
+        return;
+      }
+      p_[0] = (uint8_t) (word >> 24);
+      p_[1] = (uint8_t) (word >> 16);
+      p_[2] = (uint8_t) (word >> 8);
+      p_[3] = (uint8_t) word;
+      p_ += 4;
+    }
+  }
+  void flush() { if (bits_ > 0) put(0, 32 - bits_); }
+  bool overflow() const { return overflow_; }
+  size_t bytes() const { return p_ - start_; }
+
+private:
+  uint8_t* start_;
+  uint8_t* p_;
+  uint8_t* end_;
+  uint64_t acc_;
+  uint32_t bits_;
+  bool overflow_;
+};
+
+// Keeps at least 57 bits to hand after refill(), reading zeros past the end.
+class BitReader {
+public:
+  BitReader(const uint8_t* data, size_t bytes) : start_(data), p_(data),
+    end_(data + bytes), cache_(0), bits_(0), over_(0) {}
+
+  inline void refill() {
+    if (end_ - p_ >= 8) {
+      uint64_t v;
+      memcpy(&v, p_, sizeof(v));
+      cache_ |= swap64(v) >> bits_;
+      p_ += (63 - bits_) >> 3;
+      bits_ |= 56;
+      return;
+    }
+    while (bits_ <= 56) {
+      uint64_t b = 0;
+      if (p_ < end_) b = *p_++;
+      else over_++;
+      cache_ |= b << (56 - bits_);
+      bits_ += 8;
+    }
+  }
+  inline uint64_t peek() const { return cache_; }
+  inline void skip(uint32_t n) {
+    cache_ <<= n;
+    bits_ -= n;
+  }
+  // n from 1 to 32
+  inline uint32_t get(uint32_t n) {
+    uint32_t v = (uint32_t) (cache_ >> (64 - n));
+    skip(n);
+    return v;
+  }
+  bool overrun() const {
+    return (uint64_t) (p_ - start_ + over_) * 8 - bits_ > (uint64_t) (end_ - start_) * 8;
+  }
+
+private:
+  const uint8_t* start_;
+  const uint8_t* p_;
+  const uint8_t* end_;
+  uint64_t cache_;
+  uint32_t bits_;
+  uint64_t over_;
+};
+
+// Adaptive Rice parameter, as in LOCO-I: the mean of recent residuals.
+struct RiceState {
+  uint32_t sum;
+  uint32_t count;
+
+  void reset(uint32_t depth) {
+    sum = 1 << (depth - 6);
+    count = 1;
+  }
+  inline uint32_t k() const {
+    uint32_t k = 0;
+    while ((count << k) < sum) k++;
+    return k;
+  }
+  inline void update(uint32_t residual) {
+    sum += residual;
+    if (++count == 64) {
+      sum >>= 1;
+      count >>= 1;
+    }
+  }
+};
+
+// Residuals from the median predictor, wrapped to the sample range and
+// folded to unsigned. Free of branches in the loop, for the vectoriser.
+// The first row of a slice has nothing above it and uses the left sample.
+static void predictRow(const uint16_t* s, const uint16_t* above, uint32_t n,
+    uint32_t depth, uint16_t* out) {
+  int mask = (1 << depth) - 1;
+  int half = 1 << (depth - 1);
+  if (n == 0) return;
+  if (above == NULL) {
+    int e = s[0] - half;
+    out[0] = (uint16_t) (((uint32_t) e << 1) ^ (uint32_t) (e >> 31));
+    for (uint32_t x = 1 ; x < n ; x++) {
+      e = ((s[x] - s[x - 1] + half) & mask) - half;
+      out[x] = (uint16_t) (((uint32_t) e << 1) ^ (uint32_t) (e >> 31));
+    }
+    return;
+  }
+  int e = ((s[0] - above[0] + half) & mask) - half;
+  out[0] = (uint16_t) (((uint32_t) e << 1) ^ (uint32_t) (e >> 31));
+  for (uint32_t x = 1 ; x < n ; x++) {
+    int a = s[x - 1], b = above[x], c = above[x - 1];
+    int lo = std::min(a, b), hi = std::max(a, b);
+    int p = std::min(std::max(a + b - c, lo), hi);
+    e = ((s[x] - p + half) & mask) - half;
+    out[x] = (uint16_t) (((uint32_t) e << 1) ^ (uint32_t) (e >> 31));
+  }
+}
+
+static inline void putResidual(BitWriter& out, RiceState& state, uint32_t u,
+    uint32_t depth) {
+  uint32_t k = state.k();
+  uint32_t q = u >> k;
+  if (q < riceLimit)
+    out.put((1 << k) | (u & ((1 << k) - 1)), q + 1 + k);
+  else {
+    out.put(1, riceLimit + 1);
+    out.put(u, depth);
+  }
+  state.update(u);
+}
+
+static inline bool getResidual(BitReader& in, RiceState& state, uint32_t depth,
+    uint32_t* u) {
+  in.refill();
+  uint64_t cache = in.peek();
+  if (cache == 0) return false;
+  uint32_t zeros = leadingZeros(cache);
+  uint32_t k = state.k();
+  if (zeros < riceLimit) {
+    in.skip(zeros + 1);
+    *u = (zeros << k) | (k > 0 ? in.get(k) : 0);
+  } else if (zeros == riceLimit) {
+    in.skip(riceLimit + 1);
+    *u = in.get(depth);
+  } else {
+    return false;
+  }
+  // Only damaged data goes out of range, which would run away with k
+  if (*u >> depth) return false;
+  state.update(*u);
+  return true;
+}
+
+LosslessCodec::LosslessCodec(uint32_t threads) : pixelFormat_(0), width_(0),
+    height_(0), rowBytes_(0), depth_(10), source_(NULL), dest_(NULL),
+    quit_(false), work_(NULL), next_(0), count_(0), remaining_(0) {
+  uv_mutex_init(&lock_);
+  uv_cond_init(&start_);
+  uv_cond_init(&done_);
+  threads_.resize(threads > 1 ? threads - 1 : 0);
+  for (size_t x = 0 ; x < threads_.size() ; x++)
+    uv_thread_create(&threads_[x], workLoop, this);
+}
+
+LosslessCodec::~LosslessCodec() {
+  uv_mutex_lock(&lock_);
+  quit_ = true;
+  uv_cond_broadcast(&start_);
+  uv_mutex_unlock(&lock_);
+  for (size_t x = 0 ; x < threads_.size() ; x++)
+    uv_thread_join(&threads_[x]);
+  uv_cond_destroy(&done_);
+  uv_cond_destroy(&start_);
+  uv_mutex_destroy(&lock_);
+}
+
+bool LosslessCodec::canCode(uint32_t pixelFormat) {
+  return isYUV422Format(pixelFormat);
+}
+
+uint32_t LosslessCodec::defaultThreads() {
+  uv_cpu_info_t* cpus;
+  int count = 0;
+  if (uv_cpu_info(&cpus, &count) == 0)
+    uv_free_cpu_info(cpus, count);
+  return count > 2 ? (uint32_t) count / 2 : 1;
+}
+
+uint32_t LosslessCodec::frameLength(const uint8_t* header) {
+  if (memcmp(header, frameMagic, sizeof(frameMagic)) != 0) return 0;
+  uint32_t length = get32(header + 4);
+  return length >= headerBytes ? length : 0;
+}
+
+size_t LosslessCodec::maxFrameBytes(uint32_t pixelFormat, uint32_t width, uint32_t height) {
+  return headerBytes + 4 * maxSlices +
+    (size_t) rowBytesForFormat(pixelFormat, width) * height;
+}
+
+void LosslessCodec::setFormat(uint32_t pixelFormat, uint32_t width, uint32_t height) {
+  pixelFormat_ = pixelFormat;
+  width_ = width;
+  height_ = height;
+  rowBytes_ = rowBytesForFormat(pixelFormat, width);
+  // 2vuy unpacks shifted up to 10 bits and is coded at 8
+  depth_ = pixelFormat == bmdFormat10BitYUV ? 10 : 8;
+}
+
+void LosslessCodec::run(Work work) {
+  uv_mutex_lock(&lock_);
+  work_ = work;
+  next_ = 0;
+  count_ = (uint32_t) slices_.size();
+  remaining_ = count_;
+  uv_cond_broadcast(&start_);
+  uv_mutex_unlock(&lock_);
+
+  runSlices();
+
+  uv_mutex_lock(&lock_);
+  while (remaining_ > 0)
+    uv_cond_wait(&done_, &lock_);
+  uv_mutex_unlock(&lock_);
+}
+
+void LosslessCodec::runSlices() {
+  uv_mutex_lock(&lock_);
+  while (next_ < count_) {
+    Slice& slice = slices_[next_++];
+    Work work = work_;
+    uv_mutex_unlock(&lock_);
+    work(this, slice);
+    uv_mutex_lock(&lock_);
+    if (--remaining_ == 0)
+      uv_cond_signal(&done_);
+  }
+  uv_mutex_unlock(&lock_);
+}
+
+void LosslessCodec::workLoop(void* arg) {
+  LosslessCodec* codec = static_cast<LosslessCodec*>(arg);
+  uv_mutex_lock(&codec->lock_);
+  for (;;) {
+    while (!codec->quit_ && codec->next_ >= codec->count_)
+      uv_cond_wait(&codec->start_, &codec->lock_);
+    if (codec->quit_) break;
+    uv_mutex_unlock(&codec->lock_);
+    codec->runSlices();
+    uv_mutex_lock(&codec->lock_);
+  }
+  uv_mutex_unlock(&codec->lock_);
+}
+
+bool LosslessCodec::encode(uint32_t pixelFormat, uint32_t width, uint32_t height,
+    const uint8_t* frame, std::vector<uint8_t>& out) {
+  if (!canCode(pixelFormat) || width == 0 || height == 0) return false;
+  setFormat(pixelFormat, width, height);
+  uint32_t slices = std::min(maxSlices, (height + minSliceRows - 1) / minSliceRows);
+  uint32_t sliceRows = (height + slices - 1) / slices;
+  slices = (height + sliceRows - 1) / sliceRows;
+  slices_.resize(slices);
+  for (uint32_t x = 0 ; x < slices ; x++) {
+    slices_[x].firstRow = x * sliceRows;
+    slices_[x].rows = std::min(sliceRows, height - x * sliceRows);
+  }
+  source_ = frame;
+  run(encodeSlice);
+
+  size_t length = headerBytes + 4 * slices;
+  for (uint32_t x = 0 ; x < slices ; x++)
+    length += slices_[x].codedBytes;
+  out.resize(length);
+  uint8_t* p = &out[0];
+  memcpy(p, frameMagic, sizeof(frameMagic));
+  put32(p + 4, (uint32_t) length);
+  put32(p + 8, pixelFormat);
+  put32(p + 12, width);
+  put32(p + 16, height);
+  put32(p + 20, slices);
+  put32(p + 24, sliceRows);
+  p += headerBytes;
+  for (uint32_t x = 0 ; x < slices ; x++, p += 4)
+    put32(p, (uint32_t) slices_[x].codedBytes | (slices_[x].stored ? storedFlag : 0));
+  for (uint32_t x = 0 ; x < slices ; x++) {
+    const Slice& slice = slices_[x];
+    memcpy(p, slice.stored ? frame + (size_t) slice.firstRow * rowBytes_ :
+      &slice.coded[0], slice.codedBytes);
+    p += slice.codedBytes;
+  }
+  return true;
+}
+
+void LosslessCodec::encodeSlice(LosslessCodec* codec, Slice& slice) {
+  uint32_t width = codec->width_;
+  uint32_t chromaWidth = (width + 1) / 2;
+  uint32_t stride = width + 2 * chromaWidth;
+  uint32_t depth = codec->depth_;
+  const uint32_t offsets[3] = { 0, width, width + chromaWidth };
+  const uint32_t widths[3] = { width, chromaWidth, chromaWidth };
+
+  slice.samples.resize(3 * stride);
+  uint16_t* current = &slice.samples[0];
+  uint16_t* above = current + stride;
+  uint16_t* residuals = above + stride;
+  size_t rawBytes = (size_t) slice.rows * codec->rowBytes_;
+  slice.coded.resize(rawBytes);
+
+  BitWriter out(&slice.coded[0], rawBytes);
+  RiceState states[3];
+  for (uint32_t c = 0 ; c < 3 ; c++)
+    states[c].reset(depth);
+  for (uint32_t row = 0 ; row < slice.rows && !out.overflow() ; row++) {
+    unpackLine(codec->pixelFormat_,
+      codec->source_ + (size_t) (slice.firstRow + row) * codec->rowBytes_, width,
+      current, current + offsets[1], current + offsets[2]);
+    if (depth == 8)
+      for (uint32_t x = 0 ; x < stride ; x++)
+        current[x] >>= 2;
+    for (uint32_t c = 0 ; c < 3 ; c++) {
+      uint16_t* r = residuals + offsets[c];
+      predictRow(current + offsets[c], row == 0 ? NULL : above + offsets[c],
+        widths[c], depth, r);
+      for (uint32_t x = 0 ; x < widths[c] ; x++)
+        putResidual(out, states[c], r[x], depth);
+    }
+    std::swap(current, above);
+  }
+  out.flush();
+
+  slice.stored = out.overflow() || out.bytes() >= rawBytes;
+  slice.codedBytes = slice.stored ? rawBytes : out.bytes();
+}
+
+bool LosslessCodec::decode(const uint8_t* data, size_t bytes, uint8_t* frame,
+    uint32_t frameBytes) {
+  if (bytes < headerBytes || frameLength(data) == 0 || frameLength(data) > bytes)
+    return false;
+  uint32_t length = frameLength(data);
+  uint32_t pixelFormat = get32(data + 8);
+  uint32_t width = get32(data + 12);
+  uint32_t height = get32(data + 16);
+  uint32_t slices = get32(data + 20);
+  uint32_t sliceRows = get32(data + 24);
+  if (!canCode(pixelFormat) || width == 0 || height == 0 ||
+      (uint64_t) rowBytesForFormat(pixelFormat, width) * height != frameBytes ||
+      slices == 0 || slices > maxSlices || sliceRows == 0 ||
+      (uint64_t) slices * sliceRows < height || (uint64_t) (slices - 1) * sliceRows >= height ||
+      length < headerBytes + 4 * slices)
+    return false;
+
+  setFormat(pixelFormat, width, height);
+  slices_.resize(slices);
+  const uint8_t* table = data + headerBytes;
+  size_t offset = headerBytes + 4 * slices;
+  for (uint32_t x = 0 ; x < slices ; x++) {
+    Slice& slice = slices_[x];
+    uint32_t entry = get32(table + 4 * x);
+    slice.firstRow = x * sliceRows;
+    slice.rows = std::min(sliceRows, height - x * sliceRows);
+    slice.stored = (entry & storedFlag) != 0;
+    slice.inputBytes = entry & ~storedFlag;
+    slice.input = data + offset;
+    offset += slice.inputBytes;
+    if (offset > length ||
+        (slice.stored && slice.inputBytes != (size_t) slice.rows * rowBytes_))
+      return false;
+  }
+  dest_ = frame;
+  run(decodeSlice);
+
+  for (uint32_t x = 0 ; x < slices ; x++)
+    if (!slices_[x].ok) return false;
+  return true;
+}
+
+void LosslessCodec::decodeSlice(LosslessCodec* codec, Slice& slice) {
+  uint32_t rowBytes = codec->rowBytes_;
+  uint8_t* dest = codec->dest_ + (size_t) slice.firstRow * rowBytes;
+  if (slice.stored) {
+    memcpy(dest, slice.input, slice.inputBytes);
+    slice.ok = true;
+    return;
+  }
+
+  uint32_t width = codec->width_;
+  uint32_t chromaWidth = (width + 1) / 2;
+  uint32_t stride = width + 2 * chromaWidth;
+  uint32_t depth = codec->depth_;
+  int mask = (1 << depth) - 1;
+  int half = 1 << (depth - 1);
+  const uint32_t offsets[3] = { 0, width, width + chromaWidth };
+  const uint32_t widths[3] = { width, chromaWidth, chromaWidth };
+
+  slice.samples.resize(3 * stride);
+  uint16_t* current = &slice.samples[0];
+  uint16_t* above = current + stride;
+  uint16_t* packing = above + stride;
+
+  BitReader in(slice.input, slice.inputBytes);
+  RiceState states[3];
+  for (uint32_t c = 0 ; c < 3 ; c++)
+    states[c].reset(depth);
+  slice.ok = false;
+  for (uint32_t row = 0 ; row < slice.rows ; row++, dest += rowBytes) {
+    for (uint32_t c = 0 ; c < 3 ; c++) {
+      uint16_t* s = current + offsets[c];
+      const uint16_t* b = above + offsets[c];
+      uint32_t u;
+      for (uint32_t x = 0 ; x < widths[c] ; x++) {
+        if (!getResidual(in, states[c], depth, &u)) return;
+        int e = (int) (u >> 1) ^ -(int) (u & 1);
+        int p;
+        if (row == 0)
+          p = x == 0 ? half : s[x - 1];
+        else if (x == 0)
+          p = b[0];
+        else {
+          int lo = std::min<int>(s[x - 1], b[x]), hi = std::max<int>(s[x - 1], b[x]);
+          p = std::min(std::max(s[x - 1] + b[x] - b[x - 1], lo), hi);
+        }
+        s[x] = (uint16_t) ((p + e) & mask);
+      }
+    }
+    const uint16_t* samples = current;
+    if (depth == 8) {
+      for (uint32_t x = 0 ; x < stride ; x++)
+        packing[x] = current[x] << 2;
+      samples = packing;
+    }
+    packLine(codec->pixelFormat_, samples, samples + offsets[1],
+      samples + offsets[2], width, dest);
+    std::swap(current, above);
+  }
+  slice.ok = !in.overrun();
+}
+
+bool LosslessClip::open(FILE* file, uint64_t start) {
+  offsets_.clear();
+  if (losslessSeek(file, 0, SEEK_END) != 0) return false;
+  int64_t size = losslessTell(file);
+  uint8_t header[LosslessCodec::headerBytes];
+  uint64_t offset = start;
+  while (size > 0 && offset + LosslessCodec::headerBytes <= (uint64_t) size) {
+    if (losslessSeek(file, (int64_t) offset, SEEK_SET) != 0 ||
+        fread(header, 1, sizeof(header), file) != sizeof(header))
+      break;
+    uint32_t length = LosslessCodec::frameLength(header);
+    // A pre-allocated file still being recorded reads as zeros past the end
+    if (length == 0 || offset + length > (uint64_t) size) break;
+    offsets_.push_back(offset);
+    offset += length;
+  }
+  if (offsets_.empty()) return false;
+  offsets_.push_back(offset);
+  return true;
+}
+
+bool LosslessClip::read(FILE* file, uint64_t frame, LosslessCodec& codec,
+    uint8_t* dest, uint32_t frameBytes) {
+  if (frame >= frames()) return false;
+  size_t length = (size_t) (offsets_[frame + 1] - offsets_[frame]);
+  input_.resize(length);
+  return losslessSeek(file, (int64_t) offsets_[frame], SEEK_SET) == 0 &&
+    fread(&input_[0], 1, length, file) == length &&
+    codec.decode(&input_[0], length, dest, frameBytes);
+}
+
+} // namespace streampunk
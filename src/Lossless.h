@@ -0,0 +1,120 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef LOSSLESS_H
+#define LOSSLESS_H
+
+#include <uv.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+namespace streampunk {
+
+// A lossless intra-frame codec for 2vuy and v210. Each frame is cut into
+// horizontal slices that are coded independently, on a pool of threads. Every
+// sample is predicted from its neighbours to the left, above and above left
+// (the median predictor of LOCO-I) and the residual is Rice coded with a
+// parameter that adapts to each plane. Slices that would not get smaller are
+// stored as they are. Only the samples are kept, not the padding at the end of
+// a v210 row or the two spare bits of each v210 word, which decode as zero.
+//
+// A coded frame is a header, a table of slice sizes and the slices, so that
+// files of them can be walked frame by frame (see LosslessClip).
+class LosslessCodec {
+public:
+  // Threads in total, including the caller's.
+  explicit LosslessCodec(uint32_t threads);
+  ~LosslessCodec();
+
+  static bool canCode(uint32_t pixelFormat);
+  // Half the processors, for a decoder or encoder to keep up in real time
+  // while leaving room for the rest of the process.
+  static uint32_t defaultThreads();
+
+  // Replaces the contents of out with the coded frame.
+  bool encode(uint32_t pixelFormat, uint32_t width, uint32_t height,
+    const uint8_t* frame, std::vector<uint8_t>& out);
+  // Decodes into a frame of frameBytes, which must be the size the coded
+  // frame decodes to. False if the data is damaged or the wrong size.
+  bool decode(const uint8_t* data, size_t bytes, uint8_t* frame, uint32_t frameBytes);
+
+  // The fixed part of the header, enough to find the length of a frame.
+  static const uint32_t headerBytes = 28;
+  // The length of the coded frame starting with header, or 0 if it is not one.
+  static uint32_t frameLength(const uint8_t* header);
+  // The largest a coded frame of this format can be.
+  static size_t maxFrameBytes(uint32_t pixelFormat, uint32_t width, uint32_t height);
+
+private:
+  struct Slice {
+    uint32_t firstRow;
+    uint32_t rows;
+    const uint8_t* input;    // coded slice, when decoding
+    uint32_t inputBytes;
+    bool stored;
+    std::vector<uint8_t> coded;
+    size_t codedBytes;
+    std::vector<uint16_t> samples;
+    bool ok;
+  };
+
+  typedef void (*Work)(LosslessCodec* codec, Slice& slice);
+  static void encodeSlice(LosslessCodec* codec, Slice& slice);
+  static void decodeSlice(LosslessCodec* codec, Slice& slice);
+  static void workLoop(void* arg);
+  void setFormat(uint32_t pixelFormat, uint32_t width, uint32_t height);
+  void run(Work work);
+  void runSlices();
+
+  uint32_t pixelFormat_;
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t rowBytes_;
+  uint32_t depth_;           // of the samples as coded
+  std::vector<Slice> slices_;
+  const uint8_t* source_;
+  uint8_t* dest_;
+
+  std::vector<uv_thread_t> threads_;
+  uv_mutex_t lock_;
+  uv_cond_t start_;
+  uv_cond_t done_;
+  bool quit_;
+  Work work_;
+  uint32_t next_;            // slice to start
+  uint32_t count_;           // slices in the job
+  uint32_t remaining_;       // not yet finished
+};
+
+// Where the frames are in a file of coded frames, found by walking the frame
+// headers. A frame cut short at the end of the file, as after a crash, is
+// left out. Used by the file sources of the TrickPlayer and the Playlist.
+class LosslessClip {
+public:
+  // False if the file does not start with a coded frame at start.
+  bool open(FILE* file, uint64_t start);
+  uint64_t frames() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+  bool read(FILE* file, uint64_t frame, LosslessCodec& codec, uint8_t* dest,
+    uint32_t frameBytes);
+
+private:
+  std::vector<uint64_t> offsets_;
+  std::vector<uint8_t> input_;
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,280 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Overlay.h"
+#include "Formats.h"
+#include <math.h>
+#include <string.h>
+
+namespace streampunk {
+
+inline Nan::Persistent<v8::Function> &Overlay::constructor() {
+  static thread_local Nan::Persistent<v8::Function> myConstructor;
+  return myConstructor;
+}
+
+Overlay::Overlay(const uint8_t* bgra, uint32_t width, uint32_t height,
+    size_t stride) : converted_(false), rec601_(false) {
+  setPixels(bgra, width, height, stride);
+}
+
+Overlay::~Overlay() {
+}
+
+NAN_MODULE_INIT(Overlay::Init) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+  tpl->SetClassName(Nan::New("Overlay").ToLocalChecked());
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  Nan::SetPrototypeMethod(tpl, "update", Update);
+  Nan::SetPrototypeMethod(tpl, "composite", Composite);
+
+  constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  resetOnCleanup(&constructor());
+  Nan::Set(target, Nan::New("Overlay").ToLocalChecked(),
+               Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+bool Overlay::IsOverlay(v8::Local<v8::Value> value) {
+  if (!value->IsObject()) return false;
+  v8::Local<v8::Function> cons = Nan::New(constructor());
+  return Nan::To<v8::Object>(value).ToLocalChecked()->InstanceOf(
+    Nan::GetCurrentContext(), cons).FromMaybe(false);
+}
+
+static bool overlayArgs(const Nan::FunctionCallbackInfo<v8::Value>& info,
+    uint32_t* width, uint32_t* height, size_t* stride) {
+  if (info.Length() < 3 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("Overlay requires a BGRA buffer, width and height.");
+    return false;
+  }
+  *width = Nan::To<uint32_t>(info[1]).FromJust();
+  *height = Nan::To<uint32_t>(info[2]).FromJust();
+  *stride = info[3]->IsNumber() ? Nan::To<uint32_t>(info[3]).FromJust() : *width * 4;
+  if (*width == 0 || *height == 0 || *stride < *width * 4 ||
+      node::Buffer::Length(info[0]) < *stride * (*height - 1) + *width * 4) {
+    Nan::ThrowError("Overlay buffer is too small for the given width, height and stride.");
+    return false;
+  }
+  return true;
+}
+
+NAN_METHOD(Overlay::New) {
+  if (info.IsConstructCall()) {
+    // Invoked as constructor: `new Overlay(bgra, width, height [, stride])`
+    uint32_t width, height;
+    size_t stride;
+    if (!overlayArgs(info, &width, &height, &stride)) return;
+    Overlay* obj = new Overlay((const uint8_t*) node::Buffer::Data(info[0]),
+      width, height, stride);
+    obj->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+  } else {
+    // Invoked as plain function `Overlay(...)`, turn into construct call.
+    const int argc = 4;
+    v8::Local<v8::Value> argv[argc] = { info[0], info[1], info[2], info[3] };
+    v8::Local<v8::Function> cons = Nan::New(constructor());
+    info.GetReturnValue().Set(Nan::NewInstance(cons, argc, argv).ToLocalChecked());
+  }
+}
+
+NAN_METHOD(Overlay::Update) {
+  Overlay* obj = ObjectWrap::Unwrap<Overlay>(info.Holder());
+  uint32_t width, height;
+  size_t stride;
+  if (!overlayArgs(info, &width, &height, &stride)) return;
+  obj->setPixels((const uint8_t*) node::Buffer::Data(info[0]), width, height, stride);
+  info.GetReturnValue().Set(info.This());
+}
+
+// composite(frame, width, height, pixelFormat, x, y [, alpha])
+NAN_METHOD(Overlay::Composite) {
+  Overlay* obj = ObjectWrap::Unwrap<Overlay>(info.Holder());
+  if (info.Length() < 6 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("Composite requires a frame buffer, width, height, pixel format and position.");
+    return;
+  }
+  uint32_t width = Nan::To<uint32_t>(info[1]).FromJust();
+  uint32_t height = Nan::To<uint32_t>(info[2]).FromJust();
+  uint32_t pixelFormat = Nan::To<uint32_t>(info[3]).FromJust();
+  int32_t x = Nan::To<int32_t>(info[4]).FromJust();
+  int32_t y = Nan::To<int32_t>(info[5]).FromJust();
+  double alpha = info[6]->IsNumber() ? Nan::To<double>(info[6]).FromJust() : 1.0;
+  if (!isYUV422Format(pixelFormat)) {
+    Nan::ThrowError("Overlays can only be composited onto 8-bit (2vuy) and 10-bit (v210) YUV.");
+    return;
+  }
+  size_t rowBytes = rowBytesForFormat(pixelFormat, width);
+  if (node::Buffer::Length(info[0]) < rowBytes * height) {
+    Nan::ThrowError("Buffer is too small for the given width, height and pixel format.");
+    return;
+  }
+  obj->composite(pixelFormat, (uint8_t*) node::Buffer::Data(info[0]), rowBytes,
+    width, height, x, y, (uint32_t) (alpha < 0.0 ? 0 : (alpha > 1.0 ? 256 : alpha * 256.0 + 0.5)));
+  info.GetReturnValue().Set(info[0]);
+}
+
+void Overlay::setPixels(const uint8_t* bgra, uint32_t width, uint32_t height,
+    size_t stride) {
+  width_ = width;
+  height_ = height;
+  bgra_.resize((size_t) width * height * 4);
+  for (uint32_t row = 0 ; row < height ; row++)
+    memcpy(&bgra_[(size_t) row * width * 4], bgra + row * stride, width * 4);
+  converted_ = false;
+}
+
+void Overlay::convert(bool rec601) {
+  double kr = rec601 ? 0.299 : 0.2126;
+  double kb = rec601 ? 0.114 : 0.0722;
+  double kg = 1.0 - kr - kb;
+  size_t count = (size_t) width_ * height_;
+  y_.resize(count); cb_.resize(count); cr_.resize(count); alpha_.resize(count);
+  for (size_t i = 0 ; i < count ; i++) {
+    const uint8_t* p = &bgra_[i * 4];
+    double b = p[0] / 255.0, g = p[1] / 255.0, r = p[2] / 255.0;
+    double luma = kr * r + kg * g + kb * b;
+    y_[i] = (int16_t) lround(876.0 * luma);
+    cb_[i] = (int16_t) lround(896.0 * (b - luma) / (2.0 * (1.0 - kb)));
+    cr_[i] = (int16_t) lround(896.0 * (r - luma) / (2.0 * (1.0 - kr)));
+    alpha_[i] = p[3] + (p[3] >> 7);
+  }
+  lineY_.resize(width_ + 12);
+  lineCb_.resize(width_ / 2 + 8);
+  lineCr_.resize(width_ / 2 + 8);
+  rec601_ = rec601;
+  converted_ = true;
+}
+
+static inline uint16_t clampSample(int32_t v) {
+  return (uint16_t) (v < 4 ? 4 : (v > 1019 ? 1019 : v));
+}
+
+// Blend one overlay row into unpacked samples covering frame pixels
+// [spanStart, spanStart + spanWidth). spanStart is even. The loops have no
+// branches, other than at the overlay's edges, so that the compiler can
+// vectorise them.
+void Overlay::blendRow(uint16_t* y, uint16_t* cb, uint16_t* cr,
+    uint32_t spanStart, uint32_t spanWidth, uint32_t overlayRow, int32_t x,
+    uint32_t globalAlpha) const {
+  size_t rowOffset = (size_t) overlayRow * width_;
+  const int16_t* oy = &y_[rowOffset];
+  const int16_t* ocb = &cb_[rowOffset];
+  const int16_t* ocr = &cr_[rowOffset];
+  const uint16_t* oa = &alpha_[rowOffset];
+  int32_t ga = (int32_t) globalAlpha;
+
+  int32_t first = x > 0 ? x : 0;
+  int32_t last = x + (int32_t) width_;
+  if (last > (int32_t) (spanStart + spanWidth)) last = spanStart + spanWidth;
+
+  for (int32_t fx = first ; fx < last ; fx++) {
+    int32_t ox = fx - x;
+    int32_t a = (oa[ox] * ga) >> 8;
+    uint16_t& s = y[fx - spanStart];
+    s = clampSample(64 + ((oy[ox] * ga + 128) >> 8) +
+      (((s - 64) * (256 - a) + 128) >> 8));
+  }
+
+  // Each chroma site is shared by a pixel pair; pixels outside the overlay
+  // count as transparent. Only the sites at either edge can have one, so
+  // those are blended apart from the rest, skipping over the inner sites.
+  int32_t siteBegin = first / 2;
+  int32_t siteEnd = (last + 1) / 2;
+  int32_t innerBegin = siteBegin + (siteBegin * 2 < x ? 1 : 0);
+  int32_t innerEnd = siteEnd - (last & 1);
+  if (innerEnd < innerBegin) innerEnd = innerBegin;
+
+  for (int32_t c = innerBegin ; c < innerEnd ; c++) {
+    int32_t ox = c * 2 - x;
+    int32_t a = ((oa[ox] + oa[ox + 1]) * ga) >> 8; // 0 to 512
+    uint16_t& u = cb[c - spanStart / 2];
+    uint16_t& v = cr[c - spanStart / 2];
+    u = clampSample(512 + (((ocb[ox] + ocb[ox + 1]) * ga + 256) >> 9) +
+      (((u - 512) * (512 - a) + 256) >> 9));
+    v = clampSample(512 + (((ocr[ox] + ocr[ox + 1]) * ga + 256) >> 9) +
+      (((v - 512) * (512 - a) + 256) >> 9));
+  }
+
+  for (int32_t c = siteBegin ; c < siteEnd ; c++) {
+    if (c == innerBegin) c = innerEnd;
+    if (c >= siteEnd) break;
+    int32_t sumCb = 0, sumCr = 0, sumA = 0;
+    for (int32_t p = 0 ; p < 2 ; p++) {
+      int32_t ox = c * 2 + p - x;
+      if (ox < 0 || ox >= (int32_t) width_) continue;
+      sumCb += ocb[ox];
+      sumCr += ocr[ox];
+      sumA += oa[ox];
+    }
+    int32_t a = (sumA * ga) >> 8; // 0 to 512
+    uint16_t& u = cb[c - spanStart / 2];
+    uint16_t& v = cr[c - spanStart / 2];
+    u = clampSample(512 + ((sumCb * ga + 256) >> 9) + (((u - 512) * (512 - a) + 256) >> 9));
+    v = clampSample(512 + ((sumCr * ga + 256) >> 9) + (((v - 512) * (512 - a) + 256) >> 9));
+  }
+}
+
+void Overlay::composite(uint32_t pixelFormat, uint8_t* frame, size_t rowBytes,
+    uint32_t frameWidth, uint32_t frameHeight, int32_t x, int32_t y,
+    uint32_t globalAlpha) {
+  if (globalAlpha == 0 || x >= (int32_t) frameWidth || y >= (int32_t) frameHeight ||
+      x + (int32_t) width_ <= 0 || y + (int32_t) height_ <= 0)
+    return;
+
+  bool rec601 = frameHeight < 720;
+  if (!converted_ || rec601 != rec601_)
+    convert(rec601);
+
+  int32_t firstPixel = x > 0 ? x : 0;
+  int32_t lastPixel = x + (int32_t) width_;
+  if (lastPixel > (int32_t) frameWidth) lastPixel = frameWidth;
+
+  // Only the packed groups the overlay touches are unpacked and repacked
+  uint32_t spanStart, spanEnd;
+  size_t spanOffset;
+  if (pixelFormat == bmdFormat10BitYUV) {
+    spanStart = (firstPixel / 6) * 6;
+    spanEnd = ((lastPixel + 5) / 6) * 6;
+    spanOffset = (spanStart / 6) * 16;
+  } else {
+    spanStart = firstPixel & ~1;
+    spanEnd = (lastPixel + 1) & ~1;
+    spanOffset = spanStart * 2;
+  }
+  if (spanEnd > frameWidth) spanEnd = frameWidth;
+  uint32_t spanWidth = spanEnd - spanStart;
+  if (lineY_.size() < spanWidth + 6) {
+    lineY_.resize(spanWidth + 6);
+    lineCb_.resize(spanWidth / 2 + 4);
+    lineCr_.resize(spanWidth / 2 + 4);
+  }
+
+  int32_t firstRow = y > 0 ? y : 0;
+  int32_t lastRow = y + (int32_t) height_;
+  if (lastRow > (int32_t) frameHeight) lastRow = frameHeight;
+  for (int32_t row = firstRow ; row < lastRow ; row++) {
+    uint8_t* span = frame + row * rowBytes + spanOffset;
+    unpackLine(pixelFormat, span, spanWidth, &lineY_[0], &lineCb_[0], &lineCr_[0]);
+    blendRow(&lineY_[0], &lineCb_[0], &lineCr_[0], spanStart, spanWidth,
+      row - y, x, globalAlpha);
+    if (pixelFormat == bmdFormat10BitYUV)
+      packV210Span(&lineY_[0], &lineCb_[0], &lineCr_[0], spanWidth, span);
+    else
+      pack2vuyLine(&lineY_[0], &lineCb_[0], &lineCr_[0], spanWidth, span);
+  }
+}
+
+} // namespace streampunk
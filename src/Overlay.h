@@ -0,0 +1,73 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <node_buffer.h>
+#include <nan.h>
+#include <stdint.h>
+#include <vector>
+#include "Environment.h"
+
+namespace streampunk {
+
+// A premultiplied BGRA graphic that can be blended into 2vuy or v210 frames.
+// The graphic is converted to premultiplied YCbCr once and cached, so
+// compositing a static logo or lower-third only costs the blend itself, and
+// only for the rows and columns the graphic covers.
+class Overlay : public Nan::ObjectWrap
+{
+private:
+  explicit Overlay(const uint8_t* bgra, uint32_t width, uint32_t height, size_t stride);
+  ~Overlay();
+
+  static NAN_METHOD(New);
+  static inline Nan::Persistent<v8::Function> &constructor();
+
+  static NAN_METHOD(Update);
+  static NAN_METHOD(Composite);
+
+  void setPixels(const uint8_t* bgra, uint32_t width, uint32_t height, size_t stride);
+  void convert(bool rec601);
+  void blendRow(uint16_t* y, uint16_t* cb, uint16_t* cr, uint32_t spanStart,
+    uint32_t spanWidth, uint32_t overlayRow, int32_t x, uint32_t globalAlpha) const;
+
+  uint32_t width_;
+  uint32_t height_;
+  std::vector<uint8_t> bgra_;
+  // cached premultiplied YCbCr with the black / zero chroma offsets removed
+  bool converted_;
+  bool rec601_;
+  std::vector<int16_t> y_, cb_, cr_;
+  std::vector<uint16_t> alpha_; // 0 to 256
+  std::vector<uint16_t> lineY_, lineCb_, lineCr_;
+
+public:
+  static NAN_MODULE_INIT(Init);
+  static bool IsOverlay(v8::Local<v8::Value> value);
+
+  // Blend into a frame at (x, y), which may be partly off frame. globalAlpha
+  // runs from 0 (invisible) to 256 (opaque as drawn).
+  void composite(uint32_t pixelFormat, uint8_t* frame, size_t rowBytes,
+    uint32_t frameWidth, uint32_t frameHeight, int32_t x, int32_t y,
+    uint32_t globalAlpha);
+};
+
+} // namespace streampunk
+
+#endif
@@ -41,27 +41,82 @@
  */
 
 #include "Playback.h"
+#include "Formats.h"
 #include <string.h>
+#include <chrono>
 
 namespace streampunk {
 
+// Pool frames kept queued ahead of the output while generating a test pattern
+static const uint32_t testPatternPreroll = 5;
+
+// Frames kept queued while playing a clip - few, so shuttle and jog respond
+// quickly - and the frames cached ahead of the play head
+static const uint32_t clipPreroll = 3;
+static const uint32_t clipCacheFrames = 24;
+
+// Finished output frames a playlist reads ahead
+static const uint32_t playlistQueue = 8;
+
+// Frames of notice needed between now and a cue
+static const BMDTimeValue cueLeadFrames = 2;
+
+// Drift compensation: seconds over which the audio queued is averaged, before
+// its level is taken as the setpoint, and the gains of the controller
+// steering the resampling ratio from the error in seconds.
+static const double driftSmoothing = 1.0;
+static const double driftSettle = 2.0;
+static const double driftGainP = 0.05;
+static const double driftGainI = 0.001;
+
 inline Nan::Persistent<v8::Function> &Playback::constructor() {
-  static Nan::Persistent<v8::Function> myConstructor;
+  static thread_local Nan::Persistent<v8::Function> myConstructor;
   return myConstructor;
 }
 
 Playback::Playback(uint32_t deviceIndex, uint32_t displayMode,
-    uint32_t pixelFormat) : m_totalFrameScheduled(0), deviceIndex_(deviceIndex),
-    displayMode_(displayMode), pixelFormat_(pixelFormat), result_(0) {
+    uint32_t pixelFormat) : m_deckLink(NULL), m_deckLinkOutput(NULL),
+    m_videoFrames(NULL), m_frameCount(0),
+    m_nextFrameIndex(0), m_generating(false), m_totalFrameScheduled(0),
+    m_running(false), m_streamBase(0), m_width(-1), deviceIndex_(deviceIndex), displayMode_(displayMode),
+    pixelFormat_(pixelFormat), result_(0),
+    audioSampleType_(bmdAudioSampleType16bitInteger), audioChannels_(2),
+    convertAudio_(false), audioRingMode_(false), audioTarget_(0),
+    audioStarved_(false), audioRendered_(0), audioUnderruns_(0),
+    audioSilence_(0), audioOverflow_(0), driftCompensation_(false),
+    driftMaxRatio_(0.001), driftLevel_(0.0), driftSetpoint_(-1.0),
+    driftIntegral_(0.0), driftStart_(-1), driftLast_(-1), hashType_(hashNone),
+    underrunPolicy_(underrunNone), underrunThreshold_(2), lastFrame_(NULL),
+    fillFrame_(NULL), inUnderrun_(false), underruns_(0), substituted_(0),
+    clip_(NULL), clipPlaying_(false), playlist_(NULL), listPlaying_(false),
+    shift_(NULL), shiftPlaying_(false), shiftPosition_(0), shiftRepeats_(0),
+    shiftSkips_(0), y4m_(NULL), y4mPlaying_(false), y4mHasLast_(false),
+    y4mRepeats_(0) {
+  for (uint32_t x = 0 ; x < maxOverlays ; x++)
+    overlays_[x] = NULL;
   async = new uv_async_t;
-  uv_async_init(uv_default_loop(), async, FrameCallback);
+  uv_async_init(currentLoop(), async, FrameCallback);
   uv_mutex_init(&padlock);
   async->data = this;
+  addCleanupHook(cleanup, this);
 }
 
 Playback::~Playback() {
+  if (async != NULL) {
+    removeCleanupHook(cleanup, this);
+    shutdown();
+  }
   if (!playbackCB_.IsEmpty())
     playbackCB_.Reset();
+  releaseFrames();
+  if (lastFrame_ != NULL) lastFrame_->Release();
+  if (fillFrame_ != NULL) fillFrame_->Release();
+  delete clip_;
+  delete playlist_;
+  for (uint32_t x = 0 ; x < maxOverlays ; x++)
+    overlayHandles_[x].Reset();
+  shiftHandle_.Reset();
+  delete y4m_;
 }
 
 NAN_MODULE_INIT(Playback::Init) {
@@ -86,8 +141,40 @@ NAN_MODULE_INIT(Playback::Init) {
   Nan::SetPrototypeMethod(tpl, "stop", StopPlayback);
   Nan::SetPrototypeMethod(tpl, "enableAudio", EnableAudio);
   Nan::SetPrototypeMethod(tpl, "testStuff", TestStuff);
+  Nan::SetPrototypeMethod(tpl, "setTestPattern", SetTestPattern);
+  Nan::SetPrototypeMethod(tpl, "setOverlay", SetOverlay);
+  Nan::SetPrototypeMethod(tpl, "clearOverlay", ClearOverlay);
+  Nan::SetPrototypeMethod(tpl, "setAudioFormat", SetAudioFormat);
+  Nan::SetPrototypeMethod(tpl, "setHashing", SetHashing);
+  Nan::SetPrototypeMethod(tpl, "enableAudioRing", EnableAudioRing);
+  Nan::SetPrototypeMethod(tpl, "writeAudio", WriteAudio);
+  Nan::SetPrototypeMethod(tpl, "audioStatus", AudioStatus);
+  Nan::SetPrototypeMethod(tpl, "setDriftCompensation", SetDriftCompensation);
+  Nan::SetPrototypeMethod(tpl, "cue", Cue);
+  Nan::SetPrototypeMethod(tpl, "referenceClock", ReferenceClock);
+  Nan::SetPrototypeMethod(tpl, "setUnderrunPolicy", SetUnderrunPolicy);
+  Nan::SetPrototypeMethod(tpl, "underrunStatus", UnderrunStatus);
+  Nan::SetPrototypeMethod(tpl, "openClip", OpenClip);
+  Nan::SetPrototypeMethod(tpl, "closeClip", CloseClip);
+  Nan::SetPrototypeMethod(tpl, "shuttle", Shuttle);
+  Nan::SetPrototypeMethod(tpl, "jog", Jog);
+  Nan::SetPrototypeMethod(tpl, "seekClip", SeekClip);
+  Nan::SetPrototypeMethod(tpl, "clipStatus", ClipStatus);
+  Nan::SetPrototypeMethod(tpl, "playlistAdd", PlaylistAdd);
+  Nan::SetPrototypeMethod(tpl, "playlistClear", PlaylistClear);
+  Nan::SetPrototypeMethod(tpl, "playlistStart", PlaylistStart);
+  Nan::SetPrototypeMethod(tpl, "playlistStatus", PlaylistStatus);
+  Nan::SetPrototypeMethod(tpl, "playTimeshift", PlayTimeshift);
+  Nan::SetPrototypeMethod(tpl, "timeshiftSeek", TimeshiftSeek);
+  Nan::SetPrototypeMethod(tpl, "timeshiftStatus", TimeshiftStatus);
+  Nan::SetPrototypeMethod(tpl, "stopTimeshift", StopTimeshift);
+  Nan::SetPrototypeMethod(tpl, "playY4M", PlayY4M);
+  Nan::SetPrototypeMethod(tpl, "stopY4M", StopY4M);
+  Nan::SetPrototypeMethod(tpl, "y4mStatus", Y4MStatus);
+  Nan::SetPrototypeMethod(tpl, "bufferedFrames", BufferedFrames);
 
   constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  resetOnCleanup(&constructor());
   Nan::Set(target, Nan::New("Playback").ToLocalChecked(),
                Nan::GetFunction(tpl).ToLocalChecked());
 }
@@ -162,6 +249,7 @@ NAN_METHOD(Playback::DoPlayback) {
   // printf("Playback result code %i and timescale %I64d.\n", result, obj->m_timeScale);
 
   if (result == S_OK) {
+    obj->m_running = true;
     info.GetReturnValue().Set(Nan::New("Playback started.").ToLocalChecked());
   }
   else {
@@ -172,7 +260,16 @@ NAN_METHOD(Playback::DoPlayback) {
 NAN_METHOD(Playback::StopPlayback) {
   Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
 
+  uv_mutex_lock(&obj->padlock);
+  obj->m_generating = false;
+  obj->clipPlaying_ = false;
+  obj->listPlaying_ = false;
+  obj->shiftPlaying_ = false;
+  obj->y4mPlaying_ = false;
+  uv_mutex_unlock(&obj->padlock);
+
   obj->cleanupDeckLinkOutput();
+  obj->m_running = false;
 
   obj->playbackCB_.Reset();
 
@@ -192,54 +289,113 @@ NAN_METHOD(Playback::ScheduleFrame) {
   if (info.Length() >= 2) audBufObj = Nan::To<v8::Object>(info[1]);
   bool processAudio = obj->hasAudio_ && !audBufObj.IsEmpty();
 
-  uint32_t rowBytePixelRatioN = 1, rowBytePixelRatioD = 1;
-  switch (obj->pixelFormat_) { // TODO expand to other pixel formats
-    case bmdFormat10BitYUV:
-      rowBytePixelRatioN = 8; rowBytePixelRatioD = 3;
-      break;
-    default:
-      rowBytePixelRatioN = 2; rowBytePixelRatioD = 1;
-      break;
+  if (obj->m_generating) {
+    info.GetReturnValue().Set(Nan::New("Test pattern is playing.").ToLocalChecked());
+    return;
+  }
+  if (obj->clipPlaying_) {
+    info.GetReturnValue().Set(Nan::New("Clip is playing.").ToLocalChecked());
+    return;
+  }
+  if (obj->listPlaying_) {
+    info.GetReturnValue().Set(Nan::New("Playlist is playing.").ToLocalChecked());
+    return;
+  }
+  if (obj->shiftPlaying_) {
+    info.GetReturnValue().Set(Nan::New("Timeshift is playing.").ToLocalChecked());
+    return;
   }
+  if (obj->y4mPlaying_) {
+    info.GetReturnValue().Set(Nan::New("Y4M is playing.").ToLocalChecked());
+    return;
+  }
+
+  uint32_t rowBytes = rowBytesForFormat(obj->pixelFormat_, obj->m_width);
 
   IDeckLinkMutableVideoFrame* frame;
   if (obj->m_deckLinkOutput->CreateVideoFrame(obj->m_width, obj->m_height,
-      obj->m_width * rowBytePixelRatioN / rowBytePixelRatioD,
-      (BMDPixelFormat) obj->pixelFormat_, bmdFrameFlagDefault, &frame) != S_OK) {
+      rowBytes, (BMDPixelFormat) obj->pixelFormat_, bmdFrameFlagDefault, &frame) != S_OK) {
     info.GetReturnValue().Set(Nan::New("Failed to create frame.").ToLocalChecked());
     return;
   };
   char* bufData = node::Buffer::Data(bufObj);
   size_t bufLength = node::Buffer::Length(bufObj);
+  if (bufLength > (size_t) rowBytes * obj->m_height)
+    bufLength = (size_t) rowBytes * obj->m_height;
   char* frameData = NULL;
   if (frame->GetBytes((void**) &frameData) != S_OK) {
+    frame->Release();
     info.GetReturnValue().Set(Nan::New("Failed to get new frame bytes.").ToLocalChecked());
     return;
   };
   memcpy(frameData, bufData, bufLength);
 
-  // printf("Frame duration %I64d/%I64d.\n", obj->m_frameDuration, obj->m_timeScale);
+  if (isYUV422Format(obj->pixelFormat_)) {
+    for (uint32_t x = 0 ; x < maxOverlays ; x++)
+      if (obj->overlays_[x] != NULL)
+        obj->overlays_[x]->composite(obj->pixelFormat_, (uint8_t*) frameData,
+          rowBytes, obj->m_width, obj->m_height, obj->overlayX_[x],
+          obj->overlayY_[x], obj->overlayAlpha_[x]);
+  }
+
+  // Hash what will be played, after any overlays. The hash type is only
+  // changed from JS, so it can be read here without the lock.
+  FrameReport report = { 0, 0, false, false, 0, 0, obj->hashType_, false, -1, 0 };
+  if (obj->hashType_ != hashNone) {
+    report.videoHash = hashBytes(obj->hashType_, frameData, (size_t) rowBytes * obj->m_height);
+    report.hasVideoHash = true;
+  }
+
   uv_mutex_lock(&obj->padlock);
+  // A splice - this frame, and those that follow, from the given stream time
+  if (info[2]->IsNumber())
+    obj->rebase((BMDTimeValue) Nan::To<int64_t>(info[2]).FromJust());
+  report.frame = obj->m_totalFrameScheduled;
   HRESULT sfr = obj->m_deckLinkOutput->ScheduleVideoFrame(frame,
-      (obj->m_totalFrameScheduled * obj->m_frameDuration),
+      obj->streamTime(obj->m_totalFrameScheduled),
       obj->m_frameDuration, obj->m_timeScale);
   if (sfr != S_OK) {
-    printf("Failed to schedule frame. Code is %i.\n", sfr);
+    frame->Release();
     info.GetReturnValue().Set(Nan::New("Failed to schedule frame.").ToLocalChecked());
     uv_mutex_unlock(&obj->padlock);
     return;
   };
+  obj->scheduled_.push_back(report);
+  if (obj->underrunPolicy_ == underrunHold) {
+    frame->AddRef();
+    if (obj->lastFrame_ != NULL) obj->lastFrame_->Release();
+    obj->lastFrame_ = frame;
+  }
 
   if (processAudio) {
     uint32_t sampleFramesWritten = NULL;
-    HRESULT saud = obj->m_deckLinkOutput->ScheduleAudioSamples(
+    uint32_t sampleFrames = 0;
+    const char* audioData = obj->prepareAudio(
       node::Buffer::Data(audBufObj.ToLocalChecked()),
-      node::Buffer::Length(audBufObj.ToLocalChecked()) / obj->sampleByteFactor_,
+      node::Buffer::Length(audBufObj.ToLocalChecked()), &sampleFrames);
+    if (obj->hashType_ != hashNone) {
+      obj->scheduled_.back().audioHash = hashBytes(obj->hashType_, audioData,
+        (size_t) sampleFrames * obj->sampleByteFactor_);
+      obj->scheduled_.back().hasAudioHash = true;
+    }
+    if (obj->audioRingMode_) {
+      // Played out by RenderAudioSamples, independently of the video timeline
+      uint32_t accepted = obj->audioRing_.write((const uint8_t*) audioData, sampleFrames);
+      obj->audioOverflow_ += sampleFrames - accepted;
+      obj->m_totalFrameScheduled++;
+      uv_mutex_unlock(&obj->padlock);
+      info.GetReturnValue().Set(obj->m_totalFrameScheduled);
+      return;
+    }
+    HRESULT saud = obj->m_deckLinkOutput->ScheduleAudioSamples(
+      (void*) audioData, sampleFrames,
       obj->m_totalSampleScheduled,
       obj->audioSampleRate_, &sampleFramesWritten);
     obj->m_totalSampleScheduled += sampleFramesWritten;
     if (saud != S_OK) {
-      printf("Failed to schedule audio. Code is %i.\n", saud);
+      // The video is scheduled, and released when it completes, so it still
+      // takes its place in the timeline
+      obj->m_totalFrameScheduled++;
       info.GetReturnValue().Set(Nan::New("Failed to schedule audio.").ToLocalChecked());
       uv_mutex_unlock(&obj->padlock);
       return;
@@ -251,18 +407,150 @@ NAN_METHOD(Playback::ScheduleFrame) {
   info.GetReturnValue().Set(obj->m_totalFrameScheduled);
 }
 
-NAN_METHOD(Playback::EnableAudio) {
+NAN_METHOD(Playback::SetTestPattern) {
   Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
-  HRESULT result;
-  BMDAudioSampleRate sampleRate = info[0]->IsNumber() ?
-      (BMDAudioSampleRate) Nan::To<uint32_t>(info[0]).FromJust() : bmdAudioSampleRate48kHz;
-  BMDAudioSampleType sampleType = info[1]->IsNumber() ?
-      (BMDAudioSampleType) Nan::To<uint32_t>(info[1]).FromJust() : bmdAudioSampleType16bitInteger;
-  uint32_t channelCount = info[2]->IsNumber() ? Nan::To<uint32_t>(info[2]).FromJust() : 2;
+  if (!info[0]->IsString()) {
+    Nan::ThrowTypeError("Test pattern name must be a string.");
+    return;
+  }
+  TestPatternOptions options;
+  Nan::Utf8String name(info[0]);
+  if (!parseTestPattern(*name, &options.type)) {
+    Nan::ThrowError("Unknown test pattern. Use black, ebu, smpte, ramp or zoneplate.");
+    return;
+  }
+  if (obj->m_width <= 0) {
+    info.GetReturnValue().Set(Nan::New("Playback is not initialised.").ToLocalChecked());
+    return;
+  }
+  options.counter = Nan::To<bool>(info[2]).FromMaybe(false);
+  options.movingBox = Nan::To<bool>(info[3]).FromMaybe(false);
 
-  // Setting stream type as timestamped - should be good enough
-  result = obj->setupAudioOutput(sampleRate, sampleType, channelCount, bmdAudioOutputStreamTimestamped);
+  // Animated patterns default to one second of distinct frames
+  uint32_t frames = info[1]->IsNumber() ? Nan::To<uint32_t>(info[1]).FromJust() : 0;
+  if (frames == 0)
+    frames = (options.counter || options.movingBox || options.type == patternZonePlate) ?
+      (uint32_t) ((obj->m_timeScale + obj->m_frameDuration / 2) / obj->m_frameDuration) : 1;
+  options.cycle = frames;
+
+  uv_mutex_lock(&obj->padlock);
+  if (obj->m_generating) {
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().Set(Nan::New("Test pattern is already playing.").ToLocalChecked());
+    return;
+  }
+  obj->releaseFrames();
+  obj->m_pattern = options;
+  obj->m_frameCount = frames;
+  if (!obj->createFrames()) {
+    obj->releaseFrames();
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().Set(Nan::New("Failed to create test pattern frames.").ToLocalChecked());
+    return;
+  }
+  obj->m_nextFrameIndex = 0;
+  obj->m_generating = true;
+  for (uint32_t x = 0 ; x < testPatternPreroll ; x++)
+    obj->scheduleNextFrame(true);
+  uv_mutex_unlock(&obj->padlock);
 
+  info.GetReturnValue().Set(obj->m_totalFrameScheduled);
+}
+
+// setOverlay(layer, overlay, x, y [, alpha])
+NAN_METHOD(Playback::SetOverlay) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  uint32_t layer = Nan::To<uint32_t>(info[0]).FromMaybe(maxOverlays);
+  if (layer >= maxOverlays) {
+    Nan::ThrowRangeError("Overlay layer must be from 0 to 7.");
+    return;
+  }
+  if (!Overlay::IsOverlay(info[1])) {
+    Nan::ThrowTypeError("Second argument must be an Overlay.");
+    return;
+  }
+  if (!isYUV422Format(obj->pixelFormat_)) {
+    info.GetReturnValue().Set(Nan::New("Overlays require 8-bit or 10-bit YUV playback.").ToLocalChecked());
+    return;
+  }
+  v8::Local<v8::Object> handle = Nan::To<v8::Object>(info[1]).ToLocalChecked();
+  double alpha = info[4]->IsNumber() ? Nan::To<double>(info[4]).FromJust() : 1.0;
+
+  obj->overlayHandles_[layer].Reset(handle);
+  obj->overlays_[layer] = ObjectWrap::Unwrap<Overlay>(handle);
+  obj->overlayX_[layer] = Nan::To<int32_t>(info[2]).FromMaybe(0);
+  obj->overlayY_[layer] = Nan::To<int32_t>(info[3]).FromMaybe(0);
+  obj->overlayAlpha_[layer] = (uint32_t) (alpha < 0.0 ? 0 :
+    (alpha > 1.0 ? 256 : alpha * 256.0 + 0.5));
+  info.GetReturnValue().Set(Nan::New("Overlay set.").ToLocalChecked());
+}
+
+NAN_METHOD(Playback::ClearOverlay) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  uint32_t first = 0, last = maxOverlays;
+  if (info[0]->IsNumber()) {
+    first = Nan::To<uint32_t>(info[0]).FromJust();
+    last = first + 1;
+  }
+  for (uint32_t x = first ; x < last && x < maxOverlays ; x++) {
+    obj->overlays_[x] = NULL;
+    obj->overlayHandles_[x].Reset();
+  }
+  info.GetReturnValue().Set(Nan::New("Overlay cleared.").ToLocalChecked());
+}
+
+NAN_METHOD(Playback::SetAudioFormat) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  AudioLayout layout;
+  ChannelMap map;
+  bool enable = !info[0]->IsUndefined() && !info[0]->IsNull();
+  if (enable && !parseSampleFormat(info[0], &layout.format)) {
+    Nan::ThrowError("Sample format must be 'int16', 'int32' or 'float32'.");
+    return;
+  }
+  if (enable && !parsePlanar(info[1], &layout.planar)) {
+    Nan::ThrowError("Audio layout must be 'interleaved' or 'planar'.");
+    return;
+  }
+  layout.channels = info[2]->IsNumber() ?
+    Nan::To<uint32_t>(info[2]).FromJust() : obj->audioChannels_;
+  if (enable && !parseChannelMap(info[3], &map)) {
+    Nan::ThrowError("Channel map must be an array of channel numbers, arrays of channel numbers or [ channel, gain ] pairs.");
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->convertAudio_ = enable;
+  obj->audioInput_ = layout;
+  obj->audioMap_ = map;
+  bool valid = obj->configureAudioConverter();
+  uv_mutex_unlock(&obj->padlock);
+
+  if (!valid) {
+    Nan::ThrowError("Channel map must have one entry per output channel and only refer to input channels.");
+    return;
+  }
+  info.GetReturnValue().Set(Nan::New(enable ? "Audio conversion enabled." :
+    "Audio conversion disabled.").ToLocalChecked());
+}
+
+NAN_METHOD(Playback::SetHashing) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  HashType type = hashNone;
+  if (!parseHashType(info[0], &type)) {
+    Nan::ThrowError("Hash type must be 'crc32c' or 'xxh64'.");
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->hashType_ = type;
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(Nan::New(type != hashNone ? "Hashing enabled." :
+    "Hashing disabled.").ToLocalChecked());
+}
+
+static void setAudioResult(const Nan::FunctionCallbackInfo<v8::Value>& info, HRESULT result) {
   switch (result) {
     case E_INVALIDARG:
       info.GetReturnValue().Set(
@@ -281,6 +569,117 @@ NAN_METHOD(Playback::EnableAudio) {
   }
 }
 
+NAN_METHOD(Playback::EnableAudio) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  HRESULT result;
+  BMDAudioSampleRate sampleRate = info[0]->IsNumber() ?
+      (BMDAudioSampleRate) Nan::To<uint32_t>(info[0]).FromJust() : bmdAudioSampleRate48kHz;
+  BMDAudioSampleType sampleType = info[1]->IsNumber() ?
+      (BMDAudioSampleType) Nan::To<uint32_t>(info[1]).FromJust() : bmdAudioSampleType16bitInteger;
+  uint32_t channelCount = info[2]->IsNumber() ? Nan::To<uint32_t>(info[2]).FromJust() : 2;
+
+  // Setting stream type as timestamped - should be good enough
+  result = obj->setupAudioOutput(sampleRate, sampleType, channelCount, bmdAudioOutputStreamTimestamped);
+
+  setAudioResult(info, result);
+}
+
+// enableAudioRing(sampleRate, sampleType, channels, targetFrames, capacityFrames)
+NAN_METHOD(Playback::EnableAudioRing) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  BMDAudioSampleRate sampleRate = info[0]->IsNumber() ?
+      (BMDAudioSampleRate) Nan::To<uint32_t>(info[0]).FromJust() : bmdAudioSampleRate48kHz;
+  BMDAudioSampleType sampleType = info[1]->IsNumber() ?
+      (BMDAudioSampleType) Nan::To<uint32_t>(info[1]).FromJust() : bmdAudioSampleType16bitInteger;
+  uint32_t channelCount = info[2]->IsNumber() ? Nan::To<uint32_t>(info[2]).FromJust() : 2;
+  uint32_t target = info[3]->IsNumber() ? Nan::To<uint32_t>(info[3]).FromJust() : sampleRate / 10;
+  uint32_t capacity = info[4]->IsNumber() ? Nan::To<uint32_t>(info[4]).FromJust() : sampleRate;
+  if (target == 0 || capacity < target) {
+    Nan::ThrowRangeError("Audio ring capacity must be at least the target latency.");
+    return;
+  }
+  if (obj->audioRingMode_) {
+    info.GetReturnValue().Set(Nan::New("Audio ring is already enabled.").ToLocalChecked());
+    return;
+  }
+
+  uint32_t frameBytes = channelCount * (sampleType / 8);
+  uv_mutex_lock(&obj->padlock);
+  obj->audioRing_.configure(frameBytes, capacity);
+  obj->audioTarget_ = target;
+  obj->audioStarved_ = false;
+  obj->audioRendered_ = 0;
+  obj->audioUnderruns_ = 0;
+  obj->audioSilence_ = 0;
+  obj->audioOverflow_ = 0;
+  uv_mutex_unlock(&obj->padlock);
+  obj->renderBuffer_.assign((size_t) target * frameBytes, 0);
+  obj->audioRingMode_ = true;
+
+  // Stream time is ignored for continuous output - samples play back to back
+  HRESULT result = obj->setupAudioOutput(sampleRate, sampleType, channelCount,
+    bmdAudioOutputStreamContinuous);
+  if (result != S_OK) {
+    obj->audioRingMode_ = false;
+    obj->m_deckLinkOutput->SetAudioCallback(NULL);
+  }
+
+  setAudioResult(info, result);
+}
+
+// writeAudio(buffer) -> sample frames accepted, fewer than given when full
+NAN_METHOD(Playback::WriteAudio) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (!node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("Audio must be a buffer.");
+    return;
+  }
+  if (!obj->audioRingMode_) {
+    info.GetReturnValue().Set(Nan::New("Audio ring is not enabled.").ToLocalChecked());
+    return;
+  }
+  v8::Local<v8::Object> bufObj = Nan::To<v8::Object>(info[0]).ToLocalChecked();
+
+  uv_mutex_lock(&obj->padlock);
+  uint32_t sampleFrames = 0;
+  const char* audioData = obj->prepareAudio(node::Buffer::Data(bufObj),
+    node::Buffer::Length(bufObj), &sampleFrames);
+  uint32_t accepted = obj->audioRing_.write((const uint8_t*) audioData, sampleFrames);
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(accepted);
+}
+
+NAN_METHOD(Playback::AudioStatus) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (!obj->audioRingMode_) {
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  uint32_t buffered = 0;
+  obj->m_deckLinkOutput->GetBufferedAudioSampleFrameCount(&buffered);
+
+  v8::Local<v8::Object> status = Nan::New<v8::Object>();
+  uv_mutex_lock(&obj->padlock);
+  Nan::Set(status, Nan::New("buffered").ToLocalChecked(), Nan::New(buffered));
+  Nan::Set(status, Nan::New("queued").ToLocalChecked(), Nan::New(obj->audioRing_.available()));
+  Nan::Set(status, Nan::New("target").ToLocalChecked(), Nan::New(obj->audioTarget_));
+  Nan::Set(status, Nan::New("capacity").ToLocalChecked(), Nan::New(obj->audioRing_.capacity()));
+  Nan::Set(status, Nan::New("rendered").ToLocalChecked(), Nan::New((double) obj->audioRendered_));
+  Nan::Set(status, Nan::New("underruns").ToLocalChecked(), Nan::New(obj->audioUnderruns_));
+  Nan::Set(status, Nan::New("silence").ToLocalChecked(), Nan::New((double) obj->audioSilence_));
+  Nan::Set(status, Nan::New("overflow").ToLocalChecked(), Nan::New((double) obj->audioOverflow_));
+  if (obj->driftCompensation_) {
+    Nan::Set(status, Nan::New("ratio").ToLocalChecked(), Nan::New(obj->resampler_.ratio()));
+    Nan::Set(status, Nan::New("level").ToLocalChecked(), Nan::New(obj->driftLevel_));
+    if (obj->driftSetpoint_ >= 0.0)
+      Nan::Set(status, Nan::New("setpoint").ToLocalChecked(), Nan::New(obj->driftSetpoint_));
+  }
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(status);
+}
+
 bool Playback::setupDeckLinkOutput() {
   // bool							result = false;
   IDeckLinkDisplayModeIterator*	displayModeIterator = NULL;
@@ -321,21 +720,1084 @@ bool Playback::setupDeckLinkOutput() {
   return true;
 }
 
+// Render every frame of the pattern once into the pool. Playback then just
+// reschedules pool frames, with no per-frame rendering.
+bool Playback::createFrames() {
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat_, m_width);
+  m_videoFrames = new IDeckLinkMutableVideoFrame*[m_frameCount];
+  for (uint32_t x = 0 ; x < m_frameCount ; x++)
+    m_videoFrames[x] = NULL;
+
+  for (uint32_t x = 0 ; x < m_frameCount ; x++) {
+    if (m_deckLinkOutput->CreateVideoFrame(m_width, m_height, rowBytes,
+        (BMDPixelFormat) pixelFormat_, bmdFrameFlagDefault, &m_videoFrames[x]) != S_OK)
+      return false;
+    if (!fillFrame(x))
+      return false;
+  }
+  return true;
+}
+
+bool Playback::fillFrame(int index) {
+  uint8_t* frameData = NULL;
+  IDeckLinkMutableVideoFrame* frame = m_videoFrames[index];
+  if (frame->GetBytes((void**) &frameData) != S_OK)
+    return false;
+  return renderTestPattern(m_pattern, m_width, m_height, pixelFormat_, index,
+    frameData, frame->GetRowBytes());
+}
+
+// Drops the pool's references. Frames still queued in the driver hold their
+// own reference, taken in scheduleNextFrame(), so this is safe mid-playback.
+void Playback::releaseFrames() {
+  if (m_videoFrames == NULL) return;
+  for (uint32_t x = 0 ; x < m_frameCount ; x++)
+    if (m_videoFrames[x] != NULL)
+      m_videoFrames[x]->Release();
+  delete[] m_videoFrames;
+  m_videoFrames = NULL;
+}
+
+// Call with padlock held.
+bool Playback::scheduleNextFrame(bool preroll) {
+  if ((!preroll && !m_generating) || m_videoFrames == NULL)
+    return false;
+
+  IDeckLinkMutableVideoFrame* frame = m_videoFrames[m_nextFrameIndex];
+  frame->AddRef(); // Released in ScheduledFrameCompleted
+  if (m_deckLinkOutput->ScheduleVideoFrame(frame,
+      streamTime(m_totalFrameScheduled),
+      m_frameDuration, m_timeScale) != S_OK) {
+    frame->Release();
+    return false;
+  }
+  FrameReport report = { m_totalFrameScheduled, 0, false, false, 0, 0, hashType_, false, -1, 0 };
+  uint8_t* frameData = NULL;
+  if (hashType_ != hashNone && frame->GetBytes((void**) &frameData) == S_OK) {
+    report.videoHash = hashBytes(hashType_, frameData,
+      (size_t) frame->GetRowBytes() * frame->GetHeight());
+    report.hasVideoHash = true;
+  }
+  scheduled_.push_back(report);
+  m_nextFrameIndex = (m_nextFrameIndex + 1) % m_frameCount;
+  m_totalFrameScheduled++;
+  return true;
+}
+
 HRESULT	Playback::ScheduledFrameCompleted (IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
 {
   uv_mutex_lock(&padlock);
   result_ = result;
   completedFrame->Release(); // Assume you should do this
+  // Frames complete in the order they were scheduled
+  if (!scheduled_.empty()) {
+    FrameReport report = scheduled_.front();
+    scheduled_.pop_front();
+    report.result = result;
+    completed_.push_back(report);
+  }
+  if (m_generating && result != bmdOutputFrameFlushed) {
+    scheduleNextFrame(false);
+  } else if (clipPlaying_ && result != bmdOutputFrameFlushed) {
+    scheduleClipFrame();
+  } else if (listPlaying_ && result != bmdOutputFrameFlushed) {
+    scheduleListFrame();
+  } else if (shiftPlaying_ && result != bmdOutputFrameFlushed) {
+    scheduleShiftFrame();
+  } else if (y4mPlaying_ && result != bmdOutputFrameFlushed) {
+    scheduleY4MFrame();
+  } else if (underrunPolicy_ != underrunNone && m_running &&
+      result != bmdOutputFrameFlushed) {
+    uint32_t buffered = 0;
+    m_deckLinkOutput->GetBufferedVideoFrameCount(&buffered);
+    bool starved = buffered < underrunThreshold_;
+    if (starved && !inUnderrun_) underruns_++;
+    inUnderrun_ = starved;
+    for ( ; buffered < underrunThreshold_ ; buffered++)
+      if (!scheduleSubstitute()) break;
+  }
   uv_mutex_unlock(&padlock);
   uv_async_send(async);
 	return S_OK;
 }
 
+// Called by the driver whenever it wants more audio, including during preroll.
+// Tops the driver up to the target from the ring, padding with silence only
+// once fewer than half the target's frames would be left to play.
+HRESULT	Playback::RenderAudioSamples (bool preroll)
+{
+  uint32_t buffered = 0;
+  if (m_deckLinkOutput->GetBufferedAudioSampleFrameCount(&buffered) != S_OK)
+    return S_OK;
+  BMDTimeValue now = -1, timeInFrame, ticksPerFrame;
+  if (driftCompensation_ && m_deckLinkOutput->GetHardwareReferenceClock(
+      audioSampleRate_, &now, &timeInFrame, &ticksPerFrame) != S_OK)
+    now = -1;
+
+  uv_mutex_lock(&padlock);
+  if (driftCompensation_ && !preroll && now >= 0)
+    steerResampler(buffered, now);
+  if (!audioRingMode_ || buffered >= audioTarget_) {
+    uv_mutex_unlock(&padlock);
+    return S_OK;
+  }
+  uint32_t frameBytes = audioRing_.frameBytes();
+  uint32_t wanted = audioTarget_ - buffered;
+  uint32_t frames;
+  if (driftCompensation_) {
+    uint32_t needed = resampler_.inputNeeded(wanted);
+    uint32_t room = (uint32_t) (driftInput_.size() / frameBytes);
+    uint32_t got = audioRing_.read(&driftInput_[0], needed < room ? needed : room);
+    resampler_.push(&driftInput_[0], got);
+    frames = resampler_.pull(&renderBuffer_[0], wanted);
+  } else {
+    frames = audioRing_.read(&renderBuffer_[0], wanted);
+  }
+  uint32_t low = audioTarget_ / 2;
+  if (frames == wanted) {
+    audioStarved_ = false;
+  } else if (!preroll && buffered + frames < low) {
+    uint32_t silence = low - buffered - frames;
+    memset(&renderBuffer_[0] + (size_t) frames * frameBytes, 0, (size_t) silence * frameBytes);
+    frames += silence;
+    audioSilence_ += silence;
+    if (!audioStarved_) audioUnderruns_++;
+    audioStarved_ = true;
+  }
+  uv_mutex_unlock(&padlock);
+
+  uint32_t written = 0;
+  if (frames > 0)
+    m_deckLinkOutput->ScheduleAudioSamples(&renderBuffer_[0], frames, 0, 0, &written);
+
+  uv_mutex_lock(&padlock);
+  audioRendered_ += written;
+  uv_mutex_unlock(&padlock);
+  return S_OK;
+}
+
+// setDriftCompensation(enable[, maxPPM])
+NAN_METHOD(Playback::SetDriftCompensation) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  bool enable = Nan::To<bool>(info[0]).FromMaybe(false);
+  double maxPPM = info[1]->IsNumber() ? Nan::To<double>(info[1]).FromJust() : 1000.0;
+  if (maxPPM <= 0.0 || maxPPM > 50000.0) {
+    Nan::ThrowRangeError("Maximum drift correction must be between 0 and 50000ppm.");
+    return;
+  }
+  if (enable && !obj->audioRingMode_) {
+    info.GetReturnValue().Set(Nan::New("Drift compensation requires an audio ring.").ToLocalChecked());
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->driftCompensation_ = enable;
+  if (enable) {
+    obj->driftMaxRatio_ = maxPPM / 1000000.0;
+    uint32_t maxInput = (uint32_t) (obj->audioTarget_ * (1.0 + obj->driftMaxRatio_)) +
+      2 * AudioResampler::halfTaps + 2;
+    obj->driftInput_.resize((size_t) obj->audioRing_.frameBytes() * maxInput);
+    obj->resampler_.configure(obj->audioChannels_, obj->audioSampleType_ / 8, maxInput);
+    obj->resampler_.setRatio(1.0);
+    obj->driftSetpoint_ = -1.0;
+    obj->driftIntegral_ = 0.0;
+    obj->driftStart_ = -1;
+    obj->driftLast_ = -1;
+  }
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(Nan::New(enable ? "Drift compensation enabled." :
+    "Drift compensation disabled.").ToLocalChecked());
+}
+
+// Call with padlock held. A PI controller holding the audio queued across
+// the card, the ring and the resampler at the level it settled to, with time
+// measured in samples of the hardware reference clock.
+void Playback::steerResampler(uint32_t buffered, BMDTimeValue now) {
+  double level = buffered + audioRing_.available() + resampler_.held();
+  if (driftLast_ < 0) {
+    driftStart_ = driftLast_ = now;
+    driftLevel_ = level;
+    return;
+  }
+  double dt = (double) (now - driftLast_) / audioSampleRate_;
+  if (dt <= 0.0) return;
+  driftLast_ = now;
+  double alpha = dt / driftSmoothing;
+  driftLevel_ += (level - driftLevel_) * (alpha > 1.0 ? 1.0 : alpha);
+  if (audioStarved_) return; // the source stalled - this is not drift
+
+  if (driftSetpoint_ < 0.0) {
+    if ((double) (now - driftStart_) >= driftSettle * audioSampleRate_)
+      driftSetpoint_ = driftLevel_;
+    return;
+  }
+  double error = (driftLevel_ - driftSetpoint_) / audioSampleRate_;
+  double integral = driftIntegral_ + error * dt;
+  double offset = driftGainP * error + driftGainI * integral;
+  if (offset > driftMaxRatio_) offset = driftMaxRatio_;
+  else if (offset < -driftMaxRatio_) offset = -driftMaxRatio_;
+  else driftIntegral_ = integral; // no wind up while limited
+  resampler_.setRatio(1.0 + offset);
+}
+
+static double wallClockMillis() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+// Call with padlock held. Moves the stream so the next frame scheduled plays
+// at the given stream time, with timestamped audio following it.
+void Playback::rebase(BMDTimeValue time) {
+  m_streamBase = time - (BMDTimeValue) m_totalFrameScheduled * m_frameDuration;
+  if (hasAudio_ && !audioRingMode_)
+    m_totalSampleScheduled = (uint64_t) (time < 0 ? 0 :
+      time * (BMDTimeValue) audioSampleRate_ / m_timeScale);
+}
+
+// cue(time[, wallClock]) - play the next frame scheduled at a hardware
+// reference clock time, in the video mode's time scale, or at a wall clock
+// time in milliseconds since the epoch. Rounds to the nearest frame.
+NAN_METHOD(Playback::Cue) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (!info[0]->IsNumber()) {
+    Nan::ThrowTypeError("Cue time must be a number.");
+    return;
+  }
+  double at = Nan::To<double>(info[0]).FromJust();
+  bool wallClock = Nan::To<bool>(info[1]).FromMaybe(false);
+  if (!obj->m_running) {
+    info.GetReturnValue().Set(Nan::New("Playback is not running.").ToLocalChecked());
+    return;
+  }
+
+  BMDTimeValue hardwareTime, timeInFrame, ticksPerFrame, streamNow;
+  double speed;
+  if (obj->m_deckLinkOutput->GetHardwareReferenceClock(obj->m_timeScale,
+        &hardwareTime, &timeInFrame, &ticksPerFrame) != S_OK ||
+      obj->m_deckLinkOutput->GetScheduledStreamTime(obj->m_timeScale,
+        &streamNow, &speed) != S_OK) {
+    info.GetReturnValue().Set(Nan::New("Unable to read the hardware clock.").ToLocalChecked());
+    return;
+  }
+  double target = wallClock ?
+    hardwareTime + (at - wallClockMillis()) * obj->m_timeScale / 1000.0 : at;
+
+  // Stream time runs with the hardware clock from when playback started
+  BMDTimeValue offset = hardwareTime - streamNow;
+  double frames = (target - offset) / obj->m_frameDuration;
+  BMDTimeValue cueTime = (BMDTimeValue) (frames + 0.5) * obj->m_frameDuration;
+  if (frames < 0.0 || cueTime < streamNow + cueLeadFrames * obj->m_frameDuration) {
+    info.GetReturnValue().Set(Nan::New("Cue time has passed or is too soon.").ToLocalChecked());
+    return;
+  }
+
+  // Frames already scheduled keep their times, so the cue cannot go back
+  // into them
+  uv_mutex_lock(&obj->padlock);
+  if (cueTime < obj->streamTime(obj->m_totalFrameScheduled)) {
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().Set(Nan::New("Cue time is before the end of the frames already scheduled.").ToLocalChecked());
+    return;
+  }
+  obj->rebase(cueTime);
+  uint32_t frame = obj->m_totalFrameScheduled;
+  uv_mutex_unlock(&obj->padlock);
+
+  v8::Local<v8::Object> cue = Nan::New<v8::Object>();
+  Nan::Set(cue, Nan::New("frame").ToLocalChecked(), Nan::New(frame));
+  Nan::Set(cue, Nan::New("streamTime").ToLocalChecked(), Nan::New((double) cueTime));
+  Nan::Set(cue, Nan::New("hardwareTime").ToLocalChecked(), Nan::New((double) (cueTime + offset)));
+  info.GetReturnValue().Set(cue);
+}
+
+// Hardware reference clock, stream time and wall clock sampled together
+NAN_METHOD(Playback::ReferenceClock) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  BMDTimeValue hardwareTime, timeInFrame, ticksPerFrame;
+  if (obj->m_width <= 0 || obj->m_deckLinkOutput->GetHardwareReferenceClock(
+      obj->m_timeScale, &hardwareTime, &timeInFrame, &ticksPerFrame) != S_OK) {
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  double wallClock = wallClockMillis();
+
+  v8::Local<v8::Object> clock = Nan::New<v8::Object>();
+  Nan::Set(clock, Nan::New("hardwareTime").ToLocalChecked(), Nan::New((double) hardwareTime));
+  Nan::Set(clock, Nan::New("timeInFrame").ToLocalChecked(), Nan::New((double) timeInFrame));
+  Nan::Set(clock, Nan::New("ticksPerFrame").ToLocalChecked(), Nan::New((double) ticksPerFrame));
+  Nan::Set(clock, Nan::New("wallClock").ToLocalChecked(), Nan::New(wallClock));
+  Nan::Set(clock, Nan::New("timeScale").ToLocalChecked(), Nan::New((double) obj->m_timeScale));
+  Nan::Set(clock, Nan::New("frameDuration").ToLocalChecked(), Nan::New((double) obj->m_frameDuration));
+  BMDTimeValue streamNow;
+  double speed;
+  if (obj->m_running && obj->m_deckLinkOutput->GetScheduledStreamTime(
+      obj->m_timeScale, &streamNow, &speed) == S_OK)
+    Nan::Set(clock, Nan::New("streamTime").ToLocalChecked(), Nan::New((double) streamNow));
+  info.GetReturnValue().Set(clock);
+}
+
+// Call with padlock held. Timestamped audio skips over the substitute, so that
+// audio sent with later frames stays in sync with them.
+bool Playback::scheduleSubstitute() {
+  IDeckLinkMutableVideoFrame* frame =
+    (underrunPolicy_ == underrunHold) ? lastFrame_ : fillFrame_;
+  if (frame == NULL) return false;
+  frame->AddRef(); // Released in ScheduledFrameCompleted
+  if (m_deckLinkOutput->ScheduleVideoFrame(frame, streamTime(m_totalFrameScheduled),
+      m_frameDuration, m_timeScale) != S_OK) {
+    frame->Release();
+    return false;
+  }
+  FrameReport report = { m_totalFrameScheduled, 0, false, false, 0, 0, hashType_, true, -1, 0 };
+  scheduled_.push_back(report);
+  m_totalFrameScheduled++;
+  substituted_++;
+  skipAudio();
+  return true;
+}
+
+// Call with padlock held. Schedules audio after the last, or queues it in the
+// audio ring.
+void Playback::queueAudio(const uint8_t* data, uint32_t sampleFrames) {
+  if (audioRingMode_) {
+    uint32_t accepted = audioRing_.write(data, sampleFrames);
+    audioOverflow_ += sampleFrames - accepted;
+    return;
+  }
+  uint32_t written = 0;
+  m_deckLinkOutput->ScheduleAudioSamples((void*) data, sampleFrames,
+    m_totalSampleScheduled, audioSampleRate_, &written);
+  m_totalSampleScheduled += written;
+}
+
+// Call with padlock held, after scheduling a frame with no audio. Moves
+// timestamped audio on to the next frame so later audio stays in sync.
+void Playback::skipAudio() {
+  if (!hasAudio_ || audioRingMode_) return;
+  BMDTimeValue next = streamTime(m_totalFrameScheduled);
+  uint64_t sample = (uint64_t) (next < 0 ? 0 : next * (BMDTimeValue) audioSampleRate_ / m_timeScale);
+  if (sample > m_totalSampleScheduled)
+    m_totalSampleScheduled = sample;
+}
+
+// setUnderrunPolicy(policy[, threshold[, slate]]) with policy 'none', 'hold',
+// 'slate' or 'black'
+NAN_METHOD(Playback::SetUnderrunPolicy) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  UnderrunPolicy policy = underrunNone;
+  if (info[0]->IsString()) {
+    Nan::Utf8String name(info[0]);
+    std::string n(*name);
+    if (n == "hold") policy = underrunHold;
+    else if (n == "slate") policy = underrunSlate;
+    else if (n == "black") policy = underrunBlack;
+    else if (n != "none") {
+      Nan::ThrowError("Underrun policy must be 'none', 'hold', 'slate' or 'black'.");
+      return;
+    }
+  }
+  uint32_t threshold = info[1]->IsNumber() ? Nan::To<uint32_t>(info[1]).FromJust() : 2;
+  if (threshold == 0) threshold = 1;
+  if (policy == underrunSlate && !node::Buffer::HasInstance(info[2])) {
+    Nan::ThrowTypeError("A slate policy needs a frame buffer.");
+    return;
+  }
+  if (obj->m_width <= 0) {
+    info.GetReturnValue().Set(Nan::New("Playback is not initialised.").ToLocalChecked());
+    return;
+  }
+
+  // Slate and black frames are made once, here, and rescheduled as needed
+  IDeckLinkMutableVideoFrame* fill = NULL;
+  if (policy == underrunSlate || policy == underrunBlack) {
+    uint32_t rowBytes = rowBytesForFormat(obj->pixelFormat_, obj->m_width);
+    uint8_t* frameData = NULL;
+    if (obj->m_deckLinkOutput->CreateVideoFrame(obj->m_width, obj->m_height, rowBytes,
+          (BMDPixelFormat) obj->pixelFormat_, bmdFrameFlagDefault, &fill) != S_OK ||
+        fill->GetBytes((void**) &frameData) != S_OK) {
+      if (fill != NULL) fill->Release();
+      info.GetReturnValue().Set(Nan::New("Failed to create underrun frame.").ToLocalChecked());
+      return;
+    }
+    if (policy == underrunSlate) {
+      v8::Local<v8::Object> slate = Nan::To<v8::Object>(info[2]).ToLocalChecked();
+      size_t length = node::Buffer::Length(slate);
+      if (length > (size_t) rowBytes * obj->m_height)
+        length = (size_t) rowBytes * obj->m_height;
+      memset(frameData, 0, (size_t) rowBytes * obj->m_height);
+      memcpy(frameData, node::Buffer::Data(slate), length);
+    } else {
+      TestPatternOptions black = { patternBlack, false, false, 1 };
+      if (!renderTestPattern(black, obj->m_width, obj->m_height, obj->pixelFormat_,
+          0, frameData, rowBytes)) {
+        fill->Release();
+        info.GetReturnValue().Set(Nan::New("Cannot generate black in this pixel format.").ToLocalChecked());
+        return;
+      }
+    }
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->underrunPolicy_ = policy;
+  obj->underrunThreshold_ = threshold;
+  if (obj->fillFrame_ != NULL) obj->fillFrame_->Release();
+  obj->fillFrame_ = fill;
+  if (policy != underrunHold && obj->lastFrame_ != NULL) {
+    obj->lastFrame_->Release();
+    obj->lastFrame_ = NULL;
+  }
+  obj->inUnderrun_ = false;
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(Nan::New(policy != underrunNone ? "Underrun policy set." :
+    "Underrun policy cleared.").ToLocalChecked());
+}
+
+NAN_METHOD(Playback::UnderrunStatus) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  static const char* names[] = { "none", "hold", "slate", "black" };
+  v8::Local<v8::Object> status = Nan::New<v8::Object>();
+  uv_mutex_lock(&obj->padlock);
+  Nan::Set(status, Nan::New("policy").ToLocalChecked(),
+    Nan::New(names[obj->underrunPolicy_]).ToLocalChecked());
+  Nan::Set(status, Nan::New("threshold").ToLocalChecked(), Nan::New(obj->underrunThreshold_));
+  Nan::Set(status, Nan::New("underruns").ToLocalChecked(), Nan::New(obj->underruns_));
+  Nan::Set(status, Nan::New("substituted").ToLocalChecked(), Nan::New((double) obj->substituted_));
+  Nan::Set(status, Nan::New("active").ToLocalChecked(), Nan::New(obj->inUnderrun_));
+  uv_mutex_unlock(&obj->padlock);
+  info.GetReturnValue().Set(status);
+}
+
+// Call with padlock held. Clip frames have no audio - trick play is silent.
+bool Playback::scheduleClipFrame() {
+  if (!clipPlaying_ || clip_ == NULL) return false;
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat_, m_width);
+  IDeckLinkMutableVideoFrame* frame;
+  uint8_t* frameData = NULL;
+  if (m_deckLinkOutput->CreateVideoFrame(m_width, m_height, rowBytes,
+      (BMDPixelFormat) pixelFormat_, bmdFrameFlagDefault, &frame) != S_OK)
+    return false;
+  if (frame->GetBytes((void**) &frameData) != S_OK) {
+    frame->Release();
+    return false;
+  }
+  clip_->next(frameData);
+  if (m_deckLinkOutput->ScheduleVideoFrame(frame, streamTime(m_totalFrameScheduled),
+      m_frameDuration, m_timeScale) != S_OK) {
+    frame->Release();
+    return false;
+  }
+  FrameReport report = { m_totalFrameScheduled, 0, false, false, 0, 0, hashType_, false, -1, 0 };
+  if (hashType_ != hashNone) {
+    report.videoHash = hashBytes(hashType_, frameData, (size_t) rowBytes * m_height);
+    report.hasVideoHash = true;
+  }
+  scheduled_.push_back(report);
+  m_totalFrameScheduled++;
+  return true;
+}
+
+// openClip(path[, headerBytes[, framePrefix]]) - a file of frames in the
+// playback mode and pixel format, played paused on the first frame
+NAN_METHOD(Playback::OpenClip) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (!info[0]->IsString()) {
+    Nan::ThrowTypeError("Clip path must be a string.");
+    return;
+  }
+  if (obj->m_width <= 0) {
+    info.GetReturnValue().Set(Nan::New("Playback is not initialised.").ToLocalChecked());
+    return;
+  }
+  ClipLayout layout;
+  layout.headerBytes = info[1]->IsNumber() ? (uint64_t) Nan::To<int64_t>(info[1]).FromJust() : 0;
+  layout.framePrefix = info[2]->IsNumber() ? Nan::To<uint32_t>(info[2]).FromJust() : 0;
+  layout.frameBytes = rowBytesForFormat(obj->pixelFormat_, obj->m_width) * obj->m_height;
+
+  uv_mutex_lock(&obj->padlock);
+  if (obj->m_generating) {
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().Set(Nan::New("Test pattern is playing.").ToLocalChecked());
+    return;
+  }
+  obj->clipPlaying_ = false;
+  obj->listPlaying_ = false;
+  obj->shiftPlaying_ = false;
+  obj->y4mPlaying_ = false;
+  uv_mutex_unlock(&obj->padlock);
+
+  TrickPlayer* clip = new TrickPlayer;
+  Nan::Utf8String path(info[0]);
+  if (!clip->open(*path, layout, clipCacheFrames)) {
+    delete clip;
+    info.GetReturnValue().Set(Nan::New("Unable to read clip file.").ToLocalChecked());
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  TrickPlayer* old = obj->clip_;
+  obj->clip_ = clip;
+  obj->clipPlaying_ = true;
+  for (uint32_t x = 0 ; x < clipPreroll ; x++)
+    obj->scheduleClipFrame();
+  uv_mutex_unlock(&obj->padlock);
+  delete old;
+
+  info.GetReturnValue().Set(Nan::New((double) clip->frames()));
+}
+
+NAN_METHOD(Playback::CloseClip) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  uv_mutex_lock(&obj->padlock);
+  TrickPlayer* clip = obj->clip_;
+  obj->clip_ = NULL;
+  obj->clipPlaying_ = false;
+  uv_mutex_unlock(&obj->padlock);
+  delete clip;
+  info.GetReturnValue().Set(Nan::New("Clip closed.").ToLocalChecked());
+}
+
+// shuttle(speed) - from -8 to 8 times normal speed, 0 pauses
+NAN_METHOD(Playback::Shuttle) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  double speed = Nan::To<double>(info[0]).FromMaybe(0.0);
+  if (!(speed >= -TrickPlayer::maxSpeed && speed <= TrickPlayer::maxSpeed)) {
+    Nan::ThrowRangeError("Shuttle speed must be from -8 to 8.");
+    return;
+  }
+  if (obj->clip_ == NULL) {
+    info.GetReturnValue().Set(Nan::New("No clip is open.").ToLocalChecked());
+    return;
+  }
+  obj->clip_->setSpeed(speed);
+  info.GetReturnValue().Set(speed);
+}
+
+// jog(frames) - pause and step by a number of frames, negative for reverse
+NAN_METHOD(Playback::Jog) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (obj->clip_ == NULL) {
+    info.GetReturnValue().Set(Nan::New("No clip is open.").ToLocalChecked());
+    return;
+  }
+  obj->clip_->step(info[0]->IsNumber() ? Nan::To<int32_t>(info[0]).FromJust() : 1);
+  info.GetReturnValue().Set(obj->clip_->status().position);
+}
+
+NAN_METHOD(Playback::SeekClip) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (obj->clip_ == NULL) {
+    info.GetReturnValue().Set(Nan::New("No clip is open.").ToLocalChecked());
+    return;
+  }
+  obj->clip_->seek(Nan::To<double>(info[0]).FromMaybe(0.0));
+  info.GetReturnValue().Set(obj->clip_->status().position);
+}
+
+NAN_METHOD(Playback::ClipStatus) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (obj->clip_ == NULL) {
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  TrickPlayer::Status s = obj->clip_->status();
+  v8::Local<v8::Object> status = Nan::New<v8::Object>();
+  Nan::Set(status, Nan::New("frames").ToLocalChecked(), Nan::New((double) obj->clip_->frames()));
+  Nan::Set(status, Nan::New("position").ToLocalChecked(), Nan::New(s.position));
+  Nan::Set(status, Nan::New("speed").ToLocalChecked(), Nan::New(s.speed));
+  Nan::Set(status, Nan::New("shown").ToLocalChecked(), Nan::New((double) s.shown));
+  Nan::Set(status, Nan::New("hits").ToLocalChecked(), Nan::New((double) s.hits));
+  Nan::Set(status, Nan::New("misses").ToLocalChecked(), Nan::New((double) s.misses));
+  Nan::Set(status, Nan::New("reads").ToLocalChecked(), Nan::New((double) s.reads));
+  info.GetReturnValue().Set(status);
+}
+
+// Call with padlock held. Black is played until the first item is read.
+bool Playback::scheduleListFrame() {
+  if (!listPlaying_ || playlist_ == NULL) return false;
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat_, m_width);
+  IDeckLinkMutableVideoFrame* frame;
+  uint8_t* frameData = NULL;
+  if (m_deckLinkOutput->CreateVideoFrame(m_width, m_height, rowBytes,
+      (BMDPixelFormat) pixelFormat_, bmdFrameFlagDefault, &frame) != S_OK)
+    return false;
+  if (frame->GetBytes((void**) &frameData) != S_OK) {
+    frame->Release();
+    return false;
+  }
+  PlaylistFrame source;
+  if (!playlist_->next(frameData, &source)) {
+    TestPatternOptions black = { patternBlack, false, false, 1 };
+    if (!renderTestPattern(black, m_width, m_height, pixelFormat_, 0, frameData, rowBytes))
+      memset(frameData, 0, (size_t) rowBytes * m_height);
+  }
+  if (m_deckLinkOutput->ScheduleVideoFrame(frame, streamTime(m_totalFrameScheduled),
+      m_frameDuration, m_timeScale) != S_OK) {
+    frame->Release();
+    return false;
+  }
+  FrameReport report = { m_totalFrameScheduled, 0, false, false, 0, 0, hashType_, false,
+    source.item, source.frame };
+  if (hashType_ != hashNone) {
+    report.videoHash = hashBytes(hashType_, frameData, (size_t) rowBytes * m_height);
+    report.hasVideoHash = true;
+  }
+  scheduled_.push_back(report);
+  m_totalFrameScheduled++;
+  return true;
+}
+
+// playlistAdd({ file | directory | frames, in, out, dissolve, header,
+// framePrefix }) -> item id
+NAN_METHOD(Playback::PlaylistAdd) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (!info[0]->IsObject()) {
+    Nan::ThrowTypeError("Playlist item must be an object.");
+    return;
+  }
+  if (obj->m_width <= 0) {
+    info.GetReturnValue().Set(Nan::New("Playback is not initialised.").ToLocalChecked());
+    return;
+  }
+  v8::Local<v8::Object> spec = Nan::To<v8::Object>(info[0]).ToLocalChecked();
+  v8::Local<v8::Value> file = Nan::Get(spec, Nan::New("file").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> directory = Nan::Get(spec, Nan::New("directory").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> frames = Nan::Get(spec, Nan::New("frames").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> in = Nan::Get(spec, Nan::New("in").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> out = Nan::Get(spec, Nan::New("out").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> dissolve = Nan::Get(spec, Nan::New("dissolve").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> header = Nan::Get(spec, Nan::New("header").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> prefix = Nan::Get(spec, Nan::New("framePrefix").ToLocalChecked()).ToLocalChecked();
+
+  PlaylistItem item;
+  item.layout.headerBytes = header->IsNumber() ? (uint64_t) Nan::To<int64_t>(header).FromJust() : 0;
+  item.layout.framePrefix = prefix->IsNumber() ? Nan::To<uint32_t>(prefix).FromJust() : 0;
+  item.layout.frameBytes = rowBytesForFormat(obj->pixelFormat_, obj->m_width) * obj->m_height;
+  item.in = in->IsNumber() ? (uint64_t) Nan::To<int64_t>(in).FromJust() : 0;
+  item.out = out->IsNumber() ? (uint64_t) Nan::To<int64_t>(out).FromJust() : 0;
+  item.dissolve = dissolve->IsNumber() ? Nan::To<uint32_t>(dissolve).FromJust() : 0;
+  if (file->IsString()) {
+    item.type = sourceFile;
+    item.path = *Nan::Utf8String(file);
+  } else if (directory->IsString()) {
+    item.type = sourceDirectory;
+    item.path = *Nan::Utf8String(directory);
+  } else if (frames->IsArray()) {
+    item.type = sourceBuffers;
+    v8::Local<v8::Array> list = v8::Local<v8::Array>::Cast(frames);
+    item.frames.resize(list->Length());
+    for (uint32_t x = 0 ; x < list->Length() ; x++) {
+      v8::Local<v8::Value> buf = Nan::Get(list, x).ToLocalChecked();
+      if (!node::Buffer::HasInstance(buf)) {
+        Nan::ThrowTypeError("Playlist frames must be buffers.");
+        return;
+      }
+      const uint8_t* data = (const uint8_t*) node::Buffer::Data(buf);
+      item.frames[x].assign(data, data + node::Buffer::Length(buf));
+    }
+  } else {
+    Nan::ThrowError("Playlist item needs a file, directory or array of frames.");
+    return;
+  }
+
+  if (obj->playlist_ == NULL)
+    obj->playlist_ = new Playlist(obj->pixelFormat_, item.layout.frameBytes, playlistQueue);
+  info.GetReturnValue().Set(obj->playlist_->add(item));
+}
+
+NAN_METHOD(Playback::PlaylistClear) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (obj->playlist_ != NULL)
+    obj->playlist_->clear();
+  info.GetReturnValue().Set(Nan::New("Playlist cleared.").ToLocalChecked());
+}
+
+// Play the list natively from the next frame, instead of frames from JS
+NAN_METHOD(Playback::PlaylistStart) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (obj->playlist_ == NULL) {
+    info.GetReturnValue().Set(Nan::New("Playlist is empty.").ToLocalChecked());
+    return;
+  }
+  uv_mutex_lock(&obj->padlock);
+  if (obj->m_generating) {
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().Set(Nan::New("Test pattern is playing.").ToLocalChecked());
+    return;
+  }
+  obj->clipPlaying_ = false;
+  obj->shiftPlaying_ = false;
+  obj->y4mPlaying_ = false;
+  if (!obj->listPlaying_) {
+    obj->listPlaying_ = true;
+    for (uint32_t x = 0 ; x < testPatternPreroll ; x++)
+      obj->scheduleListFrame();
+  }
+  uv_mutex_unlock(&obj->padlock);
+  info.GetReturnValue().Set(obj->m_totalFrameScheduled);
+}
+
+NAN_METHOD(Playback::PlaylistStatus) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (obj->playlist_ == NULL) {
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  Playlist::Status s = obj->playlist_->status();
+  v8::Local<v8::Object> status = Nan::New<v8::Object>();
+  Nan::Set(status, Nan::New("reading").ToLocalChecked(), Nan::New((double) s.item));
+  Nan::Set(status, Nan::New("items").ToLocalChecked(), Nan::New(s.items));
+  Nan::Set(status, Nan::New("queued").ToLocalChecked(), Nan::New(s.queued));
+  Nan::Set(status, Nan::New("played").ToLocalChecked(), Nan::New((double) s.played));
+  Nan::Set(status, Nan::New("misses").ToLocalChecked(), Nan::New((double) s.misses));
+  Nan::Set(status, Nan::New("failed").ToLocalChecked(), Nan::New(s.failed));
+  Nan::Set(status, Nan::New("unread").ToLocalChecked(), Nan::New((double) s.unread));
+  info.GetReturnValue().Set(status);
+}
+
+// Call with padlock held. Plays the frame at the position and moves on, or,
+// when the position has caught up with recording, repeats the newest frame.
+// A position the recording has lapped jumps to the oldest frame kept.
+bool Playback::scheduleShiftFrame() {
+  if (!shiftPlaying_ || shift_ == NULL) return false;
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat_, m_width);
+  IDeckLinkMutableVideoFrame* frame;
+  uint8_t* frameData = NULL;
+  if (m_deckLinkOutput->CreateVideoFrame(m_width, m_height, rowBytes,
+      (BMDPixelFormat) pixelFormat_, bmdFrameFlagDefault, &frame) != S_OK)
+    return false;
+  if (frame->GetBytes((void**) &frameData) != S_OK) {
+    frame->Release();
+    return false;
+  }
+
+  uint64_t oldest = shift_->oldest(), next = shift_->next();
+  if (shiftPosition_ < oldest) {
+    shiftSkips_ += oldest - shiftPosition_;
+    shiftPosition_ = oldest;
+  }
+  bool fresh = shiftPosition_ < next;
+  uint64_t shown = fresh ? shiftPosition_ : (next > 0 ? next - 1 : 0);
+  bool withAudio = fresh && hasAudio_ && !shiftAudio_.empty();
+  uint32_t videoBytes = 0, audioBytes = 0;
+  int64_t recorded = 0;
+  bool ok = next > 0 && shift_->read(shown, frameData, rowBytes * m_height, &videoBytes,
+    withAudio ? &shiftAudio_[0] : NULL, &audioBytes, &recorded);
+  if (!ok) {
+    TestPatternOptions black = { patternBlack, false, false, 1 };
+    if (!renderTestPattern(black, m_width, m_height, pixelFormat_, 0, frameData, rowBytes))
+      memset(frameData, 0, (size_t) rowBytes * m_height);
+  }
+  if (ok && fresh) shiftPosition_++;
+  else shiftRepeats_++;
+
+  if (m_deckLinkOutput->ScheduleVideoFrame(frame, streamTime(m_totalFrameScheduled),
+      m_frameDuration, m_timeScale) != S_OK) {
+    frame->Release();
+    return false;
+  }
+  FrameReport report = { m_totalFrameScheduled, 0, false, false, 0, 0, hashType_,
+    !(ok && fresh), -1, 0 };
+  scheduled_.push_back(report);
+  m_totalFrameScheduled++;
+  if (ok && withAudio && audioBytes > 0)
+    queueAudio(&shiftAudio_[0], audioBytes / sampleByteFactor_);
+  else
+    skipAudio();
+  return true;
+}
+
+// playTimeshift(ring, position, fromNewest) - play from a frame number, or
+// from that many frames before the newest when fromNewest is true
+NAN_METHOD(Playback::PlayTimeshift) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (!Timeshift::IsTimeshift(info[0])) {
+    Nan::ThrowTypeError("First argument must be a Timeshift ring.");
+    return;
+  }
+  if (obj->m_width <= 0) {
+    info.GetReturnValue().Set(Nan::New("Playback is not initialised.").ToLocalChecked());
+    return;
+  }
+  v8::Local<v8::Object> handle = Nan::To<v8::Object>(info[0]).ToLocalChecked();
+  Timeshift* ring = ObjectWrap::Unwrap<Timeshift>(handle);
+  double position = Nan::To<double>(info[1]).FromMaybe(0.0);
+  bool fromNewest = Nan::To<bool>(info[2]).FromMaybe(false);
+
+  uv_mutex_lock(&obj->padlock);
+  if (obj->m_generating) {
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().Set(Nan::New("Test pattern is playing.").ToLocalChecked());
+    return;
+  }
+  obj->clipPlaying_ = false;
+  obj->listPlaying_ = false;
+  obj->y4mPlaying_ = false;
+  obj->shift_ = ring;
+  obj->shiftAudio_.resize(ring->audioBytes());
+  uint64_t next = ring->next();
+  obj->shiftPosition_ = fromNewest ?
+    (next > position ? next - (uint64_t) position : 0) : (uint64_t) position;
+  obj->shiftRepeats_ = 0;
+  obj->shiftSkips_ = 0;
+  if (!obj->shiftPlaying_) {
+    obj->shiftPlaying_ = true;
+    for (uint32_t x = 0 ; x < clipPreroll ; x++)
+      obj->scheduleShiftFrame();
+  }
+  uint64_t from = obj->shiftPosition_;
+  uv_mutex_unlock(&obj->padlock);
+  obj->shiftHandle_.Reset(handle);
+
+  info.GetReturnValue().Set(Nan::New((double) from));
+}
+
+// timeshiftSeek(position, fromNewest) - takes effect from the next frame
+NAN_METHOD(Playback::TimeshiftSeek) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  double position = Nan::To<double>(info[0]).FromMaybe(0.0);
+  bool fromNewest = Nan::To<bool>(info[1]).FromMaybe(false);
+  uv_mutex_lock(&obj->padlock);
+  if (obj->shift_ == NULL) {
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().Set(Nan::New("No timeshift ring is playing.").ToLocalChecked());
+    return;
+  }
+  uint64_t next = obj->shift_->next();
+  obj->shiftPosition_ = fromNewest ?
+    (next > position ? next - (uint64_t) position : 0) : (uint64_t) position;
+  uint64_t from = obj->shiftPosition_;
+  uv_mutex_unlock(&obj->padlock);
+  info.GetReturnValue().Set(Nan::New((double) from));
+}
+
+// Frames already scheduled still play out. The ring is let go, so it can be
+// collected once nothing else holds it, and scheduleFrame works again.
+NAN_METHOD(Playback::StopTimeshift) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  uv_mutex_lock(&obj->padlock);
+  obj->shift_ = NULL;
+  obj->shiftPlaying_ = false;
+  uv_mutex_unlock(&obj->padlock);
+  obj->shiftHandle_.Reset();
+  info.GetReturnValue().Set(Nan::New("Timeshift stopped.").ToLocalChecked());
+}
+
+NAN_METHOD(Playback::TimeshiftStatus) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  uv_mutex_lock(&obj->padlock);
+  if (obj->shift_ == NULL) {
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  uint64_t next = obj->shift_->next();
+  v8::Local<v8::Object> status = Nan::New<v8::Object>();
+  Nan::Set(status, Nan::New("playing").ToLocalChecked(), Nan::New(obj->shiftPlaying_));
+  Nan::Set(status, Nan::New("position").ToLocalChecked(), Nan::New((double) obj->shiftPosition_));
+  Nan::Set(status, Nan::New("behind").ToLocalChecked(), Nan::New((double)
+    (next > obj->shiftPosition_ ? next - obj->shiftPosition_ : 0)));
+  Nan::Set(status, Nan::New("repeats").ToLocalChecked(), Nan::New((double) obj->shiftRepeats_));
+  Nan::Set(status, Nan::New("skips").ToLocalChecked(), Nan::New((double) obj->shiftSkips_));
+  uv_mutex_unlock(&obj->padlock);
+  info.GetReturnValue().Set(status);
+}
+
+// Call with padlock held. Plays the next decoded frame, or holds the last one
+// - or black before the first - while the decoder catches up.
+bool Playback::scheduleY4MFrame() {
+  if (!y4mPlaying_ || y4m_ == NULL) return false;
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat_, m_width);
+  size_t frameBytes = (size_t) rowBytes * m_height;
+  IDeckLinkMutableVideoFrame* frame;
+  uint8_t* frameData = NULL;
+  if (m_deckLinkOutput->CreateVideoFrame(m_width, m_height, rowBytes,
+      (BMDPixelFormat) pixelFormat_, bmdFrameFlagDefault, &frame) != S_OK)
+    return false;
+  if (frame->GetBytes((void**) &frameData) != S_OK) {
+    frame->Release();
+    return false;
+  }
+  bool fresh = y4m_->next(frameData);
+  if (fresh) {
+    y4mLast_.assign(frameData, frameData + frameBytes);
+    y4mHasLast_ = true;
+  } else {
+    y4mRepeats_++;
+    if (y4mHasLast_)
+      memcpy(frameData, &y4mLast_[0], frameBytes);
+    else {
+      TestPatternOptions black = { patternBlack, false, false, 1 };
+      if (!renderTestPattern(black, m_width, m_height, pixelFormat_, 0, frameData, rowBytes))
+        memset(frameData, 0, frameBytes);
+    }
+  }
+  if (m_deckLinkOutput->ScheduleVideoFrame(frame, streamTime(m_totalFrameScheduled),
+      m_frameDuration, m_timeScale) != S_OK) {
+    frame->Release();
+    return false;
+  }
+  FrameReport report = { m_totalFrameScheduled, 0, false, false, 0, 0, hashType_,
+    !fresh, -1, 0 };
+  if (hashType_ != hashNone) {
+    report.videoHash = hashBytes(hashType_, frameData, frameBytes);
+    report.hasVideoHash = true;
+  }
+  scheduled_.push_back(report);
+  m_totalFrameScheduled++;
+  skipAudio();
+  return true;
+}
+
+// playY4M(path | fd, queue) - plays a Y4M stream, usually a decoder writing
+// into a FIFO, in place of frames from JS. A descriptor passed in is left open.
+NAN_METHOD(Playback::PlayY4M) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  if (!info[0]->IsString() && !info[0]->IsNumber()) {
+    Nan::ThrowTypeError("Y4M source must be a path or a file descriptor.");
+    return;
+  }
+  if (obj->m_width <= 0) {
+    info.GetReturnValue().Set(Nan::New("Playback is not initialised.").ToLocalChecked());
+    return;
+  }
+  uint32_t queue = info[1]->IsNumber() ? Nan::To<uint32_t>(info[1]).FromJust() : 8;
+
+  uv_mutex_lock(&obj->padlock);
+  if (obj->m_generating) {
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().Set(Nan::New("Test pattern is playing.").ToLocalChecked());
+    return;
+  }
+  obj->clipPlaying_ = false;
+  obj->listPlaying_ = false;
+  obj->shiftPlaying_ = false;
+  obj->y4mPlaying_ = false;
+  Y4MReader* old = obj->y4m_;
+  obj->y4m_ = NULL;
+  uv_mutex_unlock(&obj->padlock);
+  delete old;
+
+  bool own = info[0]->IsString();
+  std::string error = "Y4M playout needs a 4:2:2 pixel format.";
+  int fd = own ? openY4MPath(*Nan::Utf8String(info[0]), false, error) :
+    Nan::To<int32_t>(info[0]).FromJust();
+  Y4MReader* reader = new Y4MReader;
+  if (fd < 0 || !reader->open(fd, own, obj->pixelFormat_, obj->m_width, obj->m_height, queue)) {
+    delete reader;
+    info.GetReturnValue().Set(Nan::New(error).ToLocalChecked());
+    return;
+  }
+
+  uv_mutex_lock(&obj->padlock);
+  obj->y4m_ = reader;
+  obj->y4mPlaying_ = true;
+  obj->y4mHasLast_ = false;
+  obj->y4mRepeats_ = 0;
+  for (uint32_t x = 0 ; x < clipPreroll ; x++)
+    obj->scheduleY4MFrame();
+  uv_mutex_unlock(&obj->padlock);
+
+  info.GetReturnValue().Set(Nan::New("Y4M playing.").ToLocalChecked());
+}
+
+NAN_METHOD(Playback::StopY4M) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  uv_mutex_lock(&obj->padlock);
+  Y4MReader* reader = obj->y4m_;
+  obj->y4m_ = NULL;
+  obj->y4mPlaying_ = false;
+  uv_mutex_unlock(&obj->padlock);
+  delete reader;
+  info.GetReturnValue().Set(Nan::New("Y4M stopped.").ToLocalChecked());
+}
+
+// Frames read and shown, frames queued, repeats while waiting for the decoder,
+// whether the stream has started or ended, and the stream's format.
+NAN_METHOD(Playback::Y4MStatus) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  uv_mutex_lock(&obj->padlock);
+  if (obj->y4m_ == NULL) {
+    uv_mutex_unlock(&obj->padlock);
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  Y4MReader::Status status = obj->y4m_->status();
+  uint64_t repeats = obj->y4mRepeats_;
+  uv_mutex_unlock(&obj->padlock);
+
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("read").ToLocalChecked(), Nan::New((double) status.read));
+  Nan::Set(result, Nan::New("shown").ToLocalChecked(), Nan::New((double) status.shown));
+  Nan::Set(result, Nan::New("queued").ToLocalChecked(), Nan::New(status.queued));
+  Nan::Set(result, Nan::New("repeats").ToLocalChecked(), Nan::New((double) repeats));
+  Nan::Set(result, Nan::New("started").ToLocalChecked(), Nan::New(status.started));
+  Nan::Set(result, Nan::New("ended").ToLocalChecked(), Nan::New(status.ended));
+  if (status.started) {
+    Nan::Set(result, Nan::New("depth").ToLocalChecked(), Nan::New(status.format.depth));
+    Nan::Set(result, Nan::New("rate").ToLocalChecked(), Nan::New(
+      std::to_string(status.format.rateNum) + ":" + std::to_string(status.format.rateDen)).ToLocalChecked());
+  }
+  if (status.failed)
+    Nan::Set(result, Nan::New("error").ToLocalChecked(), Nan::New(status.error).ToLocalChecked());
+  info.GetReturnValue().Set(result);
+}
+
+// Frames scheduled with the driver and not yet played, for a Writable stream
+// to wait on before taking more.
+NAN_METHOD(Playback::BufferedFrames) {
+  Playback* obj = ObjectWrap::Unwrap<Playback>(info.Holder());
+  uint32_t buffered = 0;
+  if (obj->m_deckLinkOutput == NULL ||
+      obj->m_deckLinkOutput->GetBufferedVideoFrameCount(&buffered) != S_OK) {
+    info.GetReturnValue().Set(Nan::New("Cannot read the frames buffered.").ToLocalChecked());
+    return;
+  }
+  info.GetReturnValue().Set(Nan::New(buffered));
+}
+
+void Playback::cleanup(void* arg) {
+  static_cast<Playback*>(arg)->shutdown();
+}
+
+void Playback::shutdown() {
+  uv_mutex_lock(&padlock);
+  m_generating = false;
+  clipPlaying_ = false;
+  listPlaying_ = false;
+  shiftPlaying_ = false;
+  y4mPlaying_ = false;
+  uv_mutex_unlock(&padlock);
+  if (m_deckLinkOutput != NULL)
+    cleanupDeckLinkOutput();
+  m_running = false;
+
+  uv_mutex_lock(&padlock);
+  TrickPlayer* clip = clip_;
+  Playlist* playlist = playlist_;
+  Y4MReader* y4m = y4m_;
+  clip_ = NULL;
+  playlist_ = NULL;
+  y4m_ = NULL;
+  uv_mutex_unlock(&padlock);
+  delete clip;
+  delete playlist;
+  delete y4m;
+
+  closeAndDelete(async);
+  async = NULL;
+}
+
 void Playback::cleanupDeckLinkOutput()
 {
 	m_deckLinkOutput->StopScheduledPlayback(0, NULL, 0);
 	m_deckLinkOutput->DisableVideoOutput();
 	m_deckLinkOutput->SetScheduledFrameCompletionCallback(NULL);
+	if (audioRingMode_) {
+		m_deckLinkOutput->SetAudioCallback(NULL);
+		audioRingMode_ = false;
+	}
 }
 
 HRESULT Playback::setupAudioOutput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType,
@@ -344,28 +1806,90 @@ HRESULT Playback::setupAudioOutput(BMDAudioSampleRate sampleRate, BMDAudioSample
   hasAudio_ = true;
   audioSampleRate_ = sampleRate;
   sampleByteFactor_ = channelCount * (sampleType / 8);
+  audioSampleType_ = sampleType;
+  audioChannels_ = channelCount;
+  configureAudioConverter();
   m_totalSampleScheduled = 0;
   HRESULT result = m_deckLinkOutput->EnableAudioOutput(sampleRate, sampleType, channelCount, streamType);
 
+  // The callback is set first so that preroll is filled from the ring
+  if (audioRingMode_ && result == S_OK)
+    m_deckLinkOutput->SetAudioCallback(this);
+
   if (m_deckLinkOutput->BeginAudioPreroll() != S_OK)
     printf("Failed to begin audio preroll.\n");
 
   return result;
 }
 
+// Converts from the layout given to setAudioFormat into interleaved samples
+// of the type and channel count audio output was enabled with.
+bool Playback::configureAudioConverter() {
+  AudioLayout out;
+  out.format = (audioSampleType_ == bmdAudioSampleType32bitInteger) ?
+    sampleInt32 : sampleInt16;
+  out.planar = false;
+  out.channels = audioChannels_;
+  if (!convertAudio_) {
+    audioConverter_ = AudioConverter();
+    return true;
+  }
+  if (!audioMap_.empty() && audioMap_.size() != audioChannels_) {
+    audioConverter_ = AudioConverter();
+    return false;
+  }
+  return audioConverter_.configure(audioInput_, out, audioMap_);
+}
+
+// Call with padlock held. Returns audio in the card's format, converting it
+// if setAudioFormat was used, and the number of whole sample frames in it.
+const char* Playback::prepareAudio(const char* data, size_t length, uint32_t* sampleFrames) {
+  if (!audioConverter_.isConfigured()) {
+    *sampleFrames = (uint32_t) (length / sampleByteFactor_);
+    return data;
+  }
+  *sampleFrames = (uint32_t) (length / audioConverter_.inputBytes(1));
+  convertedAudio_.resize(audioConverter_.outputBytes(*sampleFrames));
+  if (*sampleFrames > 0)
+    audioConverter_.convert((const uint8_t*) data, *sampleFrames, &convertedAudio_[0]);
+  return (const char*) convertedAudio_.data();
+}
+
 NAUV_WORK_CB(Playback::FrameCallback) {
   Nan::HandleScope scope;
   Playback *playback = static_cast<Playback*>(async->data);
+  std::vector<FrameReport> completed;
   uv_mutex_lock(&playback->padlock);
-  if (!playback->playbackCB_.IsEmpty()) {
-    Nan::Callback cb(Nan::New(playback->playbackCB_));
+  completed.swap(playback->completed_);
+  uv_mutex_unlock(&playback->padlock);
 
-    v8::Local<v8::Value> argv[1] = { Nan::New(playback->result_) };
-    cb.Call(1, argv);
-  } else {
+  // Called without the lock, so that JS can schedule more frames from here
+  if (playback->playbackCB_.IsEmpty()) {
     printf("Frame callback is empty. Assuming finished.\n");
+    return;
   }
-  uv_mutex_unlock(&playback->padlock);
-}
+  Nan::Callback cb(Nan::New(playback->playbackCB_));
+  for (size_t x = 0 ; x < completed.size() ; x++) {
+    const FrameReport& r = completed[x];
+    v8::Local<v8::Object> report = Nan::New<v8::Object>();
+    Nan::Set(report, Nan::New("frame").ToLocalChecked(), Nan::New(r.frame));
+    Nan::Set(report, Nan::New("result").ToLocalChecked(), Nan::New(r.result));
+    if (r.hasVideoHash)
+      Nan::Set(report, Nan::New("videoHash").ToLocalChecked(),
+        Nan::New(hashToHex(r.hashType, r.videoHash)).ToLocalChecked());
+    if (r.hasAudioHash)
+      Nan::Set(report, Nan::New("audioHash").ToLocalChecked(),
+        Nan::New(hashToHex(r.hashType, r.audioHash)).ToLocalChecked());
+    if (r.substitute)
+      Nan::Set(report, Nan::New("substitute").ToLocalChecked(), Nan::True());
+    if (r.item >= 0) {
+      Nan::Set(report, Nan::New("item").ToLocalChecked(), Nan::New((double) r.item));
+      Nan::Set(report, Nan::New("itemFrame").ToLocalChecked(), Nan::New((double) r.itemFrame));
+    }
+    v8::Local<v8::Value> argv[2] = { Nan::New(r.result), report };
+    cb.Call(2, argv);
+    if (playback->playbackCB_.IsEmpty()) break; // stopped from JS
+  }
+}
 
 }
@@ -50,10 +50,46 @@
 #include <nan.h>
 
 #include "DeckLinkAPI.h"
+#include "TestPattern.h"
+#include "Overlay.h"
+#include "AudioConvert.h"
+#include "Hash.h"
+#include "AudioRing.h"
+#include "Resampler.h"
+#include "TrickPlay.h"
+#include "Playlist.h"
+#include "Timeshift.h"
+#include "Y4M.h"
+#include "Environment.h"
+#include <vector>
+#include <deque>
 
 namespace streampunk {
 
-class Playback : public IDeckLinkVideoOutputCallback, public Nan::ObjectWrap
+// What was scheduled for one frame, reported back to JS when it completes
+struct FrameReport {
+  uint32_t frame;
+  uint32_t result;
+  bool hasVideoHash;
+  bool hasAudioHash;
+  uint64_t videoHash;
+  uint64_t audioHash;
+  HashType hashType;
+  bool substitute;    // scheduled natively because JS was late
+  int64_t item;       // playlist item id, -1 when not from a playlist
+  uint64_t itemFrame;
+};
+
+// What to play when JS has not supplied the next frame in time
+enum UnderrunPolicy {
+  underrunNone = 0,   // let the output run dry
+  underrunHold,       // repeat the last frame scheduled
+  underrunSlate,      // a frame given to setUnderrunPolicy
+  underrunBlack
+};
+
+class Playback : public IDeckLinkVideoOutputCallback,
+  public IDeckLinkAudioOutputCallback, public Nan::ObjectWrap
 {
 private:
   explicit Playback(uint32_t deviceIndex = 0, uint32_t displayMode = 0, uint32_t pixelFormat = 0);
@@ -79,9 +115,15 @@ private:
 
 	// array of coloured frames
 	IDeckLinkMutableVideoFrame** m_videoFrames;
+	uint32_t					m_frameCount;
 	uint32_t					m_nextFrameIndex;
+	TestPatternOptions			m_pattern;
+	bool						m_generating;
 	uint32_t					m_totalFrameScheduled;
   uint64_t          m_totalSampleScheduled;
+	bool						m_running;
+	// Stream time of frame 0, moved by cue() and splices
+	BMDTimeValue				m_streamBase;
 
 	// video mode
 	long						m_width;
@@ -97,6 +139,21 @@ private:
 
 	bool			scheduleNextFrame(bool preroll);
 
+	BMDTimeValue	streamTime(uint32_t frame) const {
+		return m_streamBase + (BMDTimeValue) frame * m_frameDuration; }
+	void			rebase(BMDTimeValue time);
+	bool			scheduleSubstitute();
+	bool			scheduleClipFrame();
+	bool			scheduleListFrame();
+	bool			scheduleShiftFrame();
+	bool			scheduleY4MFrame();
+	void			queueAudio(const uint8_t* data, uint32_t sampleFrames);
+	void			skipAudio();
+
+	bool			configureAudioConverter();
+	const char*		prepareAudio(const char* data, size_t length, uint32_t* sampleFrames);
+	void			steerResampler(uint32_t buffered, BMDTimeValue now);
+
 	void			cleanupDeckLinkOutput();
 
   HRESULT setupAudioOutput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType,
@@ -114,6 +171,68 @@ private:
 
   static NAN_METHOD(SchedukeAudio);
 
+  static NAN_METHOD(SetTestPattern);
+
+  static NAN_METHOD(SetOverlay);
+
+  static NAN_METHOD(ClearOverlay);
+
+  static NAN_METHOD(SetAudioFormat);
+
+  static NAN_METHOD(SetHashing);
+
+  static NAN_METHOD(EnableAudioRing);
+
+  static NAN_METHOD(WriteAudio);
+
+  static NAN_METHOD(AudioStatus);
+
+  static NAN_METHOD(SetDriftCompensation);
+
+  static NAN_METHOD(Cue);
+
+  static NAN_METHOD(ReferenceClock);
+
+  static NAN_METHOD(SetUnderrunPolicy);
+
+  static NAN_METHOD(UnderrunStatus);
+
+  static NAN_METHOD(OpenClip);
+
+  static NAN_METHOD(CloseClip);
+
+  static NAN_METHOD(Shuttle);
+
+  static NAN_METHOD(Jog);
+
+  static NAN_METHOD(SeekClip);
+
+  static NAN_METHOD(ClipStatus);
+
+  static NAN_METHOD(PlaylistAdd);
+
+  static NAN_METHOD(PlaylistClear);
+
+  static NAN_METHOD(PlaylistStart);
+
+  static NAN_METHOD(PlaylistStatus);
+
+  static NAN_METHOD(PlayTimeshift);
+
+  static NAN_METHOD(TimeshiftSeek);
+
+  static NAN_METHOD(TimeshiftStatus);
+
+  static NAN_METHOD(StopTimeshift);
+
+  static NAN_METHOD(PlayY4M);
+
+  static NAN_METHOD(StopY4M);
+
+  static NAN_METHOD(Y4MStatus);
+
+  static NAN_METHOD(BufferedFrames);
+
   static NAUV_WORK_CB(FrameCallback);
 
   static NAN_METHOD(TestStuff);
@@ -126,6 +245,96 @@ private:
   Nan::Persistent<v8::Function> playbackCB_;
   uint32_t result_;
   bool hasAudio_ = false;
+  BMDAudioSampleType audioSampleType_;
+  uint32_t audioChannels_;
+
+  // conversion of audio passed to ScheduleFrame into the card's format
+  bool convertAudio_;
+  AudioLayout audioInput_;
+  ChannelMap audioMap_;
+  AudioConverter audioConverter_;
+  std::vector<uint8_t> convertedAudio_;
+
+  // Audio written from JS into audioRing_ is drained by RenderAudioSamples,
+  // which keeps the driver holding audioTarget_ sample frames whatever video
+  // is doing. When audio is short, silence keeps at least half that queued.
+  bool audioRingMode_;
+  AudioRing audioRing_;
+  uint32_t audioTarget_;
+  std::vector<uint8_t> renderBuffer_; // only touched by the audio callback
+  bool audioStarved_;
+  uint64_t audioRendered_;
+  uint32_t audioUnderruns_;
+  uint64_t audioSilence_;
+  uint64_t audioOverflow_;
+
+  // Ring audio resampled to hold the audio queued, smoothed over time measured
+  // by the hardware reference clock, at the level it settled to at the start
+  bool driftCompensation_;
+  AudioResampler resampler_;
+  std::vector<uint8_t> driftInput_;
+  double driftMaxRatio_;
+  double driftLevel_;
+  double driftSetpoint_;
+  double driftIntegral_;
+  BMDTimeValue driftStart_;
+  BMDTimeValue driftLast_;
+
+  // frames in flight, in schedule order, and those completed since the last
+  // FrameCallback
+  HashType hashType_;
+  std::deque<FrameReport> scheduled_;
+  std::vector<FrameReport> completed_;
+
+  // substitute frames scheduled from ScheduledFrameCompleted whenever fewer
+  // than underrunThreshold_ frames are queued
+  UnderrunPolicy underrunPolicy_;
+  uint32_t underrunThreshold_;
+  IDeckLinkMutableVideoFrame* lastFrame_;
+  IDeckLinkMutableVideoFrame* fillFrame_;
+  bool inUnderrun_;
+  uint32_t underruns_;
+  uint64_t substituted_;
+
+  // a clip file played natively at variable speed, one frame per completion
+  TrickPlayer* clip_;
+  bool clipPlaying_;
+
+  // a list of sources played back to back, one frame per completion
+  Playlist* playlist_;
+  bool listPlaying_;
+
+  // past frames read from a Timeshift ring while it is still recording,
+  // one frame per completion
+  Timeshift* shift_;
+  Nan::Persistent<v8::Object> shiftHandle_;
+  bool shiftPlaying_;
+  uint64_t shiftPosition_;
+  uint64_t shiftRepeats_;
+  uint64_t shiftSkips_;
+  std::vector<uint8_t> shiftAudio_;
+
+  // frames from a decoder's Y4M output, converted on the reader's thread.
+  // The last frame is held when the decoder falls behind.
+  Y4MReader* y4m_;
+  bool y4mPlaying_;
+  std::vector<uint8_t> y4mLast_;
+  bool y4mHasLast_;
+  uint64_t y4mRepeats_;
+
+  // graphics layers blended, in order, into every frame scheduled from JS
+  static const uint32_t maxOverlays = 8;
+  Overlay* overlays_[maxOverlays];
+  Nan::Persistent<v8::Object> overlayHandles_[maxOverlays];
+  int32_t overlayX_[maxOverlays];
+  int32_t overlayY_[maxOverlays];
+  uint32_t overlayAlpha_[maxOverlays];
+
+  // Stops the device and the file and decoder readers, and closes the async
+  // handle, when the object is collected or its environment is torn down (a
+  // worker exiting), whichever comes first.
+  static void cleanup(void* arg);
+  void shutdown();
 public:
   static NAN_MODULE_INIT(Init);
 
@@ -133,6 +342,9 @@ public:
 	virtual HRESULT	ScheduledFrameCompleted (IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result);
 	virtual HRESULT	ScheduledPlaybackHasStopped () {return S_OK;};
 
+	// IDeckLinkAudioOutputCallback
+	virtual HRESULT	RenderAudioSamples (bool preroll);
+
 	// IUnknown
 	HRESULT			QueryInterface (REFIID iid, LPVOID *ppv)	{return E_NOINTERFACE;}
 	ULONG			AddRef ()									{return 1;}
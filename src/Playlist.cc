@@ -0,0 +1,312 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Playlist.h"
+#include "DeckLinkAPI.h"
+#include <string.h>
+#include <algorithm>
+
+#ifdef WIN32
+#define listSeek _fseeki64
+#define listTell _ftelli64
+#else
+#define listSeek fseeko
+#define listTell ftello
+#endif
+
+namespace streampunk {
+
+bool dissolveFrame(uint32_t pixelFormat, const uint8_t* a, const uint8_t* b,
+    uint32_t weight, size_t bytes, uint8_t* dest) {
+  uint32_t inverse = 256 - weight;
+  switch (pixelFormat) {
+    case bmdFormat10BitYUV: {
+      // Three 10-bit samples in each little endian word, mixed in place
+      const uint32_t* wa = (const uint32_t*) a;
+      const uint32_t* wb = (const uint32_t*) b;
+      uint32_t* wd = (uint32_t*) dest;
+      for (size_t x = 0 ; x < bytes / 4 ; x++) {
+        uint32_t p = wa[x], q = wb[x];
+        uint32_t s0 = ((p & 0x3ff) * inverse + (q & 0x3ff) * weight + 128) >> 8;
+        uint32_t s1 = (((p >> 10) & 0x3ff) * inverse + ((q >> 10) & 0x3ff) * weight + 128) >> 8;
+        uint32_t s2 = (((p >> 20) & 0x3ff) * inverse + ((q >> 20) & 0x3ff) * weight + 128) >> 8;
+        wd[x] = s0 | (s1 << 10) | (s2 << 20);
+      }
+      return true;
+    }
+    case bmdFormat8BitYUV:
+    case bmdFormat8BitARGB:
+    case bmdFormat8BitBGRA:
+      for (size_t x = 0 ; x < bytes ; x++)
+        dest[x] = (uint8_t) ((a[x] * inverse + b[x] * weight + 128) >> 8);
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool Playlist::Source::open(uint32_t frameBytes) {
+  opened = true;
+  item.layout.frameBytes = frameBytes;
+  switch (item.type) {
+    case sourceFile: {
+      file = fopen(item.path.c_str(), "rb");
+      if (file == NULL) break;
+      coded = new LosslessClip;
+      if (coded->open(file, item.layout.headerBytes)) {
+        count = coded->frames();
+        break;
+      }
+      delete coded;
+      coded = NULL;
+      listSeek(file, 0, SEEK_END);
+      int64_t size = listTell(file);
+      uint64_t stride = (uint64_t) item.layout.framePrefix + frameBytes;
+      if (size > 0 && (uint64_t) size >= item.layout.headerBytes)
+        count = ((uint64_t) size - item.layout.headerBytes) / stride;
+      break;
+    }
+    case sourceDirectory: {
+      uv_fs_t req;
+      uv_dirent_t entry;
+      if (uv_fs_scandir(NULL, &req, item.path.c_str(), 0, NULL) < 0) {
+        uv_fs_req_cleanup(&req);
+        break;
+      }
+      while (uv_fs_scandir_next(&req, &entry) != UV_EOF)
+        if (entry.type == UV_DIRENT_FILE || entry.type == UV_DIRENT_UNKNOWN)
+          names.push_back(item.path + "/" + entry.name);
+      uv_fs_req_cleanup(&req);
+      std::sort(names.begin(), names.end());
+      count = names.size();
+      break;
+    }
+    case sourceBuffers:
+      count = item.frames.size();
+      break;
+  }
+  uint64_t out = (item.out == 0 || item.out > count) ? count : item.out;
+  length = out > item.in ? out - item.in : 0;
+  failed = (length == 0);
+  return !failed;
+}
+
+bool Playlist::Source::read(uint64_t frame, uint8_t* dest, uint32_t frameBytes,
+    LosslessCodec* codec) {
+  uint64_t index = item.in + frame;
+  switch (item.type) {
+    case sourceFile: {
+      if (coded != NULL)
+        return codec != NULL && coded->read(file, index, *codec, dest, frameBytes);
+      uint64_t stride = (uint64_t) item.layout.framePrefix + frameBytes;
+      return listSeek(file, (int64_t) (item.layout.headerBytes + index * stride +
+          item.layout.framePrefix), SEEK_SET) == 0 &&
+        fread(dest, 1, frameBytes, file) == frameBytes;
+    }
+    case sourceDirectory: {
+      FILE* f = fopen(names[index].c_str(), "rb");
+      if (f == NULL) return false;
+      bool ok = listSeek(f, (int64_t) item.layout.headerBytes, SEEK_SET) == 0 &&
+        fread(dest, 1, frameBytes, f) == frameBytes;
+      fclose(f);
+      return ok;
+    }
+    case sourceBuffers: {
+      const std::vector<uint8_t>& data = item.frames[index];
+      size_t length = data.size() < frameBytes ? data.size() : frameBytes;
+      memcpy(dest, data.data(), length);
+      memset(dest + length, 0, frameBytes - length);
+      return true;
+    }
+  }
+  return false;
+}
+
+Playlist::Playlist(uint32_t pixelFormat, uint32_t frameBytes, uint32_t queueFrames) :
+    pixelFormat_(pixelFormat), frameBytes_(frameBytes), position_(0), nextId_(0),
+    head_(0), count_(0), held_(false), codec_(NULL), busy_(false), generation_(0),
+    quit_(false) {
+  if (queueFrames < 2) queueFrames = 2;
+  slots_.resize(queueFrames + 1);
+  for (size_t x = 0 ; x < slots_.size() ; x++)
+    slots_[x].data.resize(frameBytes);
+  mix_.resize(frameBytes);
+  memset(&stats_, 0, sizeof(stats_));
+  uv_mutex_init(&lock_);
+  uv_cond_init(&wake_);
+  uv_cond_init(&idle_);
+  uv_thread_create(&thread_, readAhead, this);
+}
+
+Playlist::~Playlist() {
+  uv_mutex_lock(&lock_);
+  quit_ = true;
+  uv_cond_signal(&wake_);
+  uv_mutex_unlock(&lock_);
+  uv_thread_join(&thread_);
+  for (size_t x = 0 ; x < sources_.size() ; x++)
+    delete sources_[x];
+  delete codec_;
+  uv_cond_destroy(&idle_);
+  uv_cond_destroy(&wake_);
+  uv_mutex_destroy(&lock_);
+}
+
+uint32_t Playlist::add(PlaylistItem& item) {
+  Source* source = new Source;
+  uv_mutex_lock(&lock_);
+  item.id = nextId_++;
+  std::swap(source->item, item);
+  item.id = source->item.id;
+  sources_.push_back(source);
+  uv_cond_signal(&wake_);
+  uv_mutex_unlock(&lock_);
+  return item.id;
+}
+
+// The frame last played is kept, to be repeated until new items arrive
+void Playlist::clear() {
+  uv_mutex_lock(&lock_);
+  while (busy_)
+    uv_cond_wait(&idle_, &lock_);
+  for (size_t x = 0 ; x < sources_.size() ; x++)
+    delete sources_[x];
+  sources_.clear();
+  position_ = 0;
+  count_ = 0;
+  generation_++;
+  uv_mutex_unlock(&lock_);
+}
+
+bool Playlist::next(uint8_t* dest, PlaylistFrame* frame) {
+  uv_mutex_lock(&lock_);
+  if (count_ > 0) {
+    held_ = true;
+    head_ = (head_ + 1) % slots_.size();
+    count_--;
+    stats_.played++;
+    uv_cond_signal(&wake_);
+  } else {
+    stats_.misses++;
+  }
+  // The slot just played, or held from before, is never written by the reader
+  const Slot& slot = slots_[(head_ + slots_.size() - 1) % slots_.size()];
+  bool found = held_;
+  if (found) {
+    *frame = slot.frame;
+    uv_mutex_unlock(&lock_);
+    memcpy(dest, &slot.data[0], frameBytes_);
+    return true;
+  }
+  uv_mutex_unlock(&lock_);
+  frame->item = -1;
+  frame->frame = 0;
+  frame->transition = false;
+  return false;
+}
+
+Playlist::Status Playlist::status() {
+  uv_mutex_lock(&lock_);
+  Status status = stats_;
+  status.item = sources_.empty() ? -1 : (int64_t) sources_.front()->item.id;
+  status.items = (uint32_t) sources_.size();
+  status.queued = count_;
+  uv_mutex_unlock(&lock_);
+  return status;
+}
+
+// Dissolves run over the last frames of one item and the first of the next,
+// so they are limited by the length of both.
+uint32_t Playlist::dissolveFrames(const Source* from, const Source* to) const {
+  if (to == NULL || !to->opened || to->failed) return 0;
+  uint64_t frames = to->item.dissolve;
+  if (frames > from->length) frames = from->length;
+  if (frames > to->length) frames = to->length;
+  return (uint32_t) frames;
+}
+
+void Playlist::readAhead(void* arg) {
+  Playlist* list = static_cast<Playlist*>(arg);
+  uv_mutex_lock(&list->lock_);
+  while (!list->quit_) {
+    if (list->count_ + 1 >= list->slots_.size() || list->sources_.empty()) {
+      uv_cond_wait(&list->wake_, &list->lock_);
+      continue;
+    }
+    Source* current = list->sources_.front();
+    Source* next = list->sources_.size() > 1 ? list->sources_[1] : NULL;
+    uint64_t position = list->position_;
+    uint32_t generation = list->generation_;
+    Slot& slot = list->slots_[(list->head_ + list->count_) % list->slots_.size()];
+    // Queued or held, the slot before is not written again until this one is
+    const Slot* before = (list->count_ > 0 || list->held_) ?
+      &list->slots_[(list->head_ + list->count_ + list->slots_.size() - 1) %
+        list->slots_.size()] : NULL;
+    list->busy_ = true;
+    uv_mutex_unlock(&list->lock_);
+
+    // Open this source and the next well before they are needed
+    if (!current->opened) current->open(list->frameBytes_);
+    if (next != NULL && !next->opened) next->open(list->frameBytes_);
+    if (list->codec_ == NULL && (current->coded != NULL ||
+        (next != NULL && next->coded != NULL)))
+      list->codec_ = new LosslessCodec(LosslessCodec::defaultThreads());
+
+    bool made = false;
+    if (!current->failed && position < current->length) {
+      made = current->read(position, &slot.data[0], list->frameBytes_, list->codec_);
+      slot.frame.item = current->item.id;
+      slot.frame.frame = position;
+      slot.frame.transition = false;
+      uint32_t dissolve = list->dissolveFrames(current, next);
+      uint64_t remaining = current->length - position;
+      if (made && remaining <= dissolve) {
+        uint64_t into = dissolve - remaining;
+        uint32_t weight = (uint32_t) ((into + 1) * 256 / (dissolve + 1));
+        if (next->read(into, &list->mix_[0], list->frameBytes_, list->codec_) &&
+            dissolveFrame(list->pixelFormat_, &slot.data[0], &list->mix_[0],
+              weight, list->frameBytes_, &slot.data[0]))
+          slot.frame.transition = true;
+      }
+    }
+    // A frame that cannot be read repeats the one before, so that one bad
+    // frame does not end the item. With nothing before, it is skipped.
+    bool unread = !current->failed && position < current->length && !made;
+    if (unread && before != NULL) {
+      memcpy(&slot.data[0], &before->data[0], list->frameBytes_);
+      made = true;
+    }
+
+    uv_mutex_lock(&list->lock_);
+    list->busy_ = false;
+    uv_cond_broadcast(&list->idle_);
+    if (generation != list->generation_) continue; // cleared meanwhile
+
+    if (made) list->count_++;
+    if (unread) list->stats_.unread++;
+    if (current->failed) list->stats_.failed++;
+    if (current->failed || position + 1 >= current->length) {
+      // On to the next item, past any frames already shown in a dissolve
+      list->position_ = list->dissolveFrames(current, next);
+      list->sources_.pop_front();
+      delete current;
+    } else {
+      list->position_ = position + 1;
+    }
+  }
+  uv_mutex_unlock(&list->lock_);
+}
+
+} // namespace streampunk
@@ -0,0 +1,140 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <uv.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "TrickPlay.h"
+
+namespace streampunk {
+
+enum PlaylistSourceType {
+  sourceFile = 0,     // frames in one file, laid out as for clips
+  sourceDirectory,    // one file per frame, in name order
+  sourceBuffers       // frames copied from JS
+};
+
+struct PlaylistItem {
+  uint32_t id;
+  PlaylistSourceType type;
+  std::string path;
+  ClipLayout layout;  // for directories, headerBytes is skipped in each file
+  std::vector<std::vector<uint8_t> > frames;
+  uint64_t in;
+  uint64_t out;       // exclusive, 0 for the end of the source
+  uint32_t dissolve;  // frames of dissolve from the previous item, 0 to cut
+};
+
+// Where an output frame came from
+struct PlaylistFrame {
+  int64_t item;       // id, -1 for none
+  uint64_t frame;     // from the item's in point
+  bool transition;    // mixed with the next item
+};
+
+// Plays a list of sources back to back. A thread opens each source before
+// it is needed and reads ahead into a queue of finished output frames, so
+// that cuts land on exact frames and never wait for a file to open.
+// Dissolves mix the tail of one item with the head of the next.
+class Playlist {
+public:
+  Playlist(uint32_t pixelFormat, uint32_t frameBytes, uint32_t queueFrames);
+  ~Playlist();
+
+  // Takes the contents of item, setting its id. Returns the id.
+  uint32_t add(PlaylistItem& item);
+  void clear();
+
+  // Copies the next output frame into dest. When the queue is empty, the last
+  // frame is repeated and counted as a miss; returns false if there is none.
+  bool next(uint8_t* dest, PlaylistFrame* frame);
+
+  struct Status {
+    int64_t item;     // being read, -1 when the list has run out
+    uint32_t items;   // still to finish reading, including the current one
+    uint32_t queued;
+    uint64_t played;
+    uint64_t misses;
+    uint32_t failed;  // items skipped because their source could not be read
+    uint64_t unread;  // frames that could not be read, the one before repeated
+  };
+  Status status();
+
+private:
+  struct Source {
+    PlaylistItem item;
+    bool opened;
+    bool failed;
+    FILE* file;
+    LosslessClip* coded; // for a file of coded frames
+    std::vector<std::string> names;
+    uint64_t count;
+    uint64_t length;  // frames between in and out
+
+    Source() : opened(false), failed(false), file(NULL), coded(NULL), count(0),
+      length(0) {}
+    ~Source() { if (file != NULL) fclose(file); delete coded; }
+    bool open(uint32_t frameBytes);
+    bool read(uint64_t frame, uint8_t* dest, uint32_t frameBytes,
+      LosslessCodec* codec);
+  };
+
+  struct Slot {
+    std::vector<uint8_t> data;
+    PlaylistFrame frame;
+  };
+
+  static void readAhead(void* arg);
+  uint32_t dissolveFrames(const Source* from, const Source* to) const;
+
+  uint32_t pixelFormat_;
+  uint32_t frameBytes_;
+  std::deque<Source*> sources_;
+  uint64_t position_; // in the first source, from its in point
+  uint32_t nextId_;
+
+  // One slot is kept back, holding the frame last played
+  std::vector<Slot> slots_;
+  uint32_t head_;
+  uint32_t count_;
+  bool held_;
+  std::vector<uint8_t> mix_;
+
+  LosslessCodec* codec_; // reader thread only, made for the first coded file
+
+  uv_thread_t thread_;
+  uv_mutex_t lock_;
+  uv_cond_t wake_;
+  uv_cond_t idle_;
+  bool busy_;         // the reader is working outside the lock
+  uint32_t generation_;
+  bool quit_;
+  Status stats_;
+};
+
+// Mix b over a with weight from 0 (all a) to 256 (all b), for v210, 2vuy
+// and 8-bit RGB. Returns false for other formats.
+bool dissolveFrame(uint32_t pixelFormat, const uint8_t* a, const uint8_t* b,
+  uint32_t weight, size_t bytes, uint8_t* dest);
+
+} // namespace streampunk
+
+#endif
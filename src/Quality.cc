@@ -0,0 +1,287 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Quality.h"
+#include "Formats.h"
+#include <math.h>
+#include <vector>
+
+namespace streampunk {
+
+static double planeMSE(const uint16_t* a, const uint16_t* b, size_t count, uint32_t shift) {
+  uint64_t sum = 0;
+  for (size_t x = 0 ; x < count ; x++) {
+    int32_t d = (int32_t) (a[x] >> shift) - (int32_t) (b[x] >> shift);
+    sum += (uint32_t) (d * d);
+  }
+  return (double) sum / count;
+}
+
+static double toPSNR(double mse, double peak) {
+  return mse > 0.0 ? 10.0 * log10(peak * peak / mse) : HUGE_VAL;
+}
+
+// SSIM over 8x8 windows on a 4 pixel grid. Sums are gathered once per 4x4
+// block and each window combines four neighbouring blocks.
+static double planeSSIM(const uint16_t* a, const uint16_t* b, uint32_t width,
+    uint32_t height, uint32_t shift, double peak) {
+  uint32_t blocksW = width / 4, blocksH = height / 4;
+  if (blocksW < 2 || blocksH < 2) return -1.0;
+
+  struct Sums { uint32_t a, b, aa, bb, ab; };
+  std::vector<Sums> blocks((size_t) blocksW * blocksH);
+  for (uint32_t by = 0 ; by < blocksH ; by++)
+    for (uint32_t bx = 0 ; bx < blocksW ; bx++) {
+      Sums s = { 0, 0, 0, 0, 0 };
+      for (uint32_t y = by * 4 ; y < by * 4 + 4 ; y++) {
+        const uint16_t* pa = a + (size_t) y * width + bx * 4;
+        const uint16_t* pb = b + (size_t) y * width + bx * 4;
+        for (uint32_t x = 0 ; x < 4 ; x++) {
+          uint32_t va = pa[x] >> shift, vb = pb[x] >> shift;
+          s.a += va;
+          s.b += vb;
+          s.aa += va * va;
+          s.bb += vb * vb;
+          s.ab += va * vb;
+        }
+      }
+      blocks[(size_t) by * blocksW + bx] = s;
+    }
+
+  double c1 = (0.01 * peak) * (0.01 * peak);
+  double c2 = (0.03 * peak) * (0.03 * peak);
+  double total = 0.0;
+  for (uint32_t by = 0 ; by + 1 < blocksH ; by++)
+    for (uint32_t bx = 0 ; bx + 1 < blocksW ; bx++) {
+      const Sums* s0 = &blocks[(size_t) by * blocksW + bx];
+      const Sums* s1 = s0 + blocksW;
+      double sa = (double) s0[0].a + s0[1].a + s1[0].a + s1[1].a;
+      double sb = (double) s0[0].b + s0[1].b + s1[0].b + s1[1].b;
+      double saa = (double) s0[0].aa + s0[1].aa + s1[0].aa + s1[1].aa;
+      double sbb = (double) s0[0].bb + s0[1].bb + s1[0].bb + s1[1].bb;
+      double sab = (double) s0[0].ab + s0[1].ab + s1[0].ab + s1[1].ab;
+      double ma = sa / 64.0, mb = sb / 64.0;
+      double va = saa / 64.0 - ma * ma;
+      double vb = sbb / 64.0 - mb * mb;
+      double cov = sab / 64.0 - ma * mb;
+      total += ((2.0 * ma * mb + c1) * (2.0 * cov + c2)) /
+        ((ma * ma + mb * mb + c1) * (va + vb + c2));
+    }
+  return total / ((double) (blocksW - 1) * (blocksH - 1));
+}
+
+bool compareFrames(uint32_t pixelFormat, const uint8_t* a, const uint8_t* b,
+    uint32_t rowBytes, uint32_t width, uint32_t height, bool ssim,
+    FrameQuality* quality) {
+  if (!isYUV422Format(pixelFormat) || width == 0 || height == 0)
+    return false;
+
+  // Compare 2vuy at its own 8-bit depth
+  uint32_t shift = (pixelFormat == bmdFormat8BitYUV) ? 2 : 0;
+  double peak = (pixelFormat == bmdFormat8BitYUV) ? 255.0 : 1023.0;
+  uint32_t chromaWidth = (width + 1) / 2;
+  size_t lumaCount = (size_t) width * height;
+  size_t chromaCount = (size_t) chromaWidth * height;
+  std::vector<uint16_t> planes[2];
+  for (int f = 0 ; f < 2 ; f++) {
+    planes[f].resize(lumaCount + 2 * chromaCount);
+    uint16_t* y = &planes[f][0];
+    uint16_t* cb = y + lumaCount;
+    uint16_t* cr = cb + chromaCount;
+    const uint8_t* src = f == 0 ? a : b;
+    for (uint32_t row = 0 ; row < height ; row++)
+      unpackLine(pixelFormat, src + (size_t) row * rowBytes, width,
+        y + (size_t) row * width, cb + (size_t) row * chromaWidth,
+        cr + (size_t) row * chromaWidth);
+  }
+
+  PlaneQuality* results[3] = { &quality->y, &quality->cb, &quality->cr };
+  size_t offsets[3] = { 0, lumaCount, lumaCount + chromaCount };
+  uint32_t widths[3] = { width, chromaWidth, chromaWidth };
+  for (int p = 0 ; p < 3 ; p++) {
+    const uint16_t* pa = &planes[0][offsets[p]];
+    const uint16_t* pb = &planes[1][offsets[p]];
+    results[p]->mse = planeMSE(pa, pb, (size_t) widths[p] * height, shift);
+    results[p]->psnr = toPSNR(results[p]->mse, peak);
+    results[p]->ssim = ssim ? planeSSIM(pa, pb, widths[p], height, shift, peak) : -1.0;
+  }
+  return true;
+}
+
+// Cells: a 1010 sync pattern, the 32-bit counter most significant bit first,
+// then a 4-bit check of the number of bits set.
+static bool counterBit(uint32_t counter, uint32_t cell) {
+  if (cell < 4) return (cell & 1) == 0;
+  if (cell < 36) return ((counter >> (35 - cell)) & 1) != 0;
+  uint32_t check = 0;
+  for (uint32_t x = counter ; x != 0 ; x &= x - 1) check++;
+  return ((check & 0xf) >> (39 - cell) & 1) != 0;
+}
+
+bool embedFrameCounter(uint32_t pixelFormat, uint8_t* frame, uint32_t rowBytes,
+    uint32_t width, uint32_t height, uint32_t counter) {
+  if (!isYUV422Format(pixelFormat) || width < counterCells * counterCellWidth)
+    return false;
+  uint32_t chromaWidth = (width + 1) / 2;
+  std::vector<uint16_t> y(width), cb(chromaWidth), cr(chromaWidth);
+  for (uint32_t row = 0 ; row < counterCellHeight && row < height ; row++) {
+    uint8_t* line = frame + (size_t) row * rowBytes;
+    unpackLine(pixelFormat, line, width, &y[0], &cb[0], &cr[0]);
+    for (uint32_t x = 0 ; x < counterCells * counterCellWidth ; x++) {
+      y[x] = counterBit(counter, x / counterCellWidth) ? 940 : 64;
+      cb[x / 2] = cr[x / 2] = 512;
+    }
+    packLine(pixelFormat, &y[0], &cb[0], &cr[0], width, line);
+  }
+  return true;
+}
+
+bool readFrameCounter(uint32_t pixelFormat, const uint8_t* frame, uint32_t rowBytes,
+    uint32_t width, uint32_t height, uint32_t* counter) {
+  if (!isYUV422Format(pixelFormat) || width < counterCells * counterCellWidth ||
+      height == 0)
+    return false;
+  uint32_t chromaWidth = (width + 1) / 2;
+  std::vector<uint16_t> y(width), cb(chromaWidth), cr(chromaWidth);
+  uint32_t row = counterCellHeight / 2 < height ? counterCellHeight / 2 : height - 1;
+  unpackLine(pixelFormat, frame + (size_t) row * rowBytes, width, &y[0], &cb[0], &cr[0]);
+
+  bool bits[counterCells];
+  for (uint32_t cell = 0 ; cell < counterCells ; cell++)
+    bits[cell] = y[cell * counterCellWidth + counterCellWidth / 2] > 502;
+  uint32_t value = 0;
+  for (uint32_t cell = 4 ; cell < 36 ; cell++)
+    value = (value << 1) | (bits[cell] ? 1 : 0);
+  for (uint32_t cell = 0 ; cell < counterCells ; cell++)
+    if (bits[cell] != counterBit(value, cell))
+      return false;
+  *counter = value;
+  return true;
+}
+
+static bool frameArgs(const Nan::FunctionCallbackInfo<v8::Value>& info,
+    uint32_t buffers, uint32_t* width, uint32_t* height, uint32_t* pixelFormat,
+    uint32_t* rowBytes) {
+  for (uint32_t x = 0 ; x < buffers ; x++)
+    if (!node::Buffer::HasInstance(info[x])) {
+      Nan::ThrowTypeError("Frames must be buffers.");
+      return false;
+    }
+  *width = Nan::To<uint32_t>(info[buffers]).FromMaybe(0);
+  *height = Nan::To<uint32_t>(info[buffers + 1]).FromMaybe(0);
+  *pixelFormat = Nan::To<uint32_t>(info[buffers + 2]).FromMaybe(0);
+  if (!isYUV422Format(*pixelFormat)) {
+    Nan::ThrowError("Frame comparison requires 8-bit (2vuy) or 10-bit (v210) YUV.");
+    return false;
+  }
+  *rowBytes = rowBytesForFormat(*pixelFormat, *width);
+  for (uint32_t x = 0 ; x < buffers ; x++)
+    if (node::Buffer::Length(info[x]) < (size_t) *rowBytes * *height) {
+      Nan::ThrowRangeError("Buffer is too small for a frame of the given dimensions.");
+      return false;
+    }
+  return true;
+}
+
+static v8::Local<v8::Object> planeToObject(const PlaneQuality& plane) {
+  v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+  Nan::Set(obj, Nan::New("mse").ToLocalChecked(), Nan::New(plane.mse));
+  Nan::Set(obj, Nan::New("psnr").ToLocalChecked(), Nan::New(plane.psnr));
+  if (plane.ssim >= -0.5)
+    Nan::Set(obj, Nan::New("ssim").ToLocalChecked(), Nan::New(plane.ssim));
+  return obj;
+}
+
+class CompareWorker : public Nan::AsyncWorker {
+public:
+  CompareWorker(Nan::Callback* callback, v8::Local<v8::Object> a,
+      v8::Local<v8::Object> b, uint32_t pixelFormat, uint32_t rowBytes,
+      uint32_t width, uint32_t height, bool ssim)
+    : Nan::AsyncWorker(callback), a_((const uint8_t*) node::Buffer::Data(a)),
+      b_((const uint8_t*) node::Buffer::Data(b)), pixelFormat_(pixelFormat),
+      rowBytes_(rowBytes), width_(width), height_(height), ssim_(ssim) {
+    // Keep the frames alive while the pool thread reads them
+    SaveToPersistent("a", a);
+    SaveToPersistent("b", b);
+  }
+
+  void Execute() {
+    if (!compareFrames(pixelFormat_, a_, b_, rowBytes_, width_, height_, ssim_, &quality_))
+      SetErrorMessage("Failed to compare frames.");
+  }
+
+  void HandleOKCallback() {
+    Nan::HandleScope scope;
+    v8::Local<v8::Object> result = Nan::New<v8::Object>();
+    Nan::Set(result, Nan::New("y").ToLocalChecked(), planeToObject(quality_.y));
+    Nan::Set(result, Nan::New("cb").ToLocalChecked(), planeToObject(quality_.cb));
+    Nan::Set(result, Nan::New("cr").ToLocalChecked(), planeToObject(quality_.cr));
+    v8::Local<v8::Value> argv[2] = { Nan::Null(), result };
+    callback->Call(2, argv);
+  }
+
+private:
+  const uint8_t* a_;
+  const uint8_t* b_;
+  uint32_t pixelFormat_;
+  uint32_t rowBytes_;
+  uint32_t width_;
+  uint32_t height_;
+  bool ssim_;
+  FrameQuality quality_;
+};
+
+NAN_METHOD(CompareFrames) {
+  uint32_t width, height, pixelFormat, rowBytes;
+  if (info.Length() < 7 || !info[6]->IsFunction()) {
+    Nan::ThrowTypeError("CompareFrames requires two buffers, width, height, pixel format, SSIM flag and a callback.");
+    return;
+  }
+  if (!frameArgs(info, 2, &width, &height, &pixelFormat, &rowBytes))
+    return;
+  bool ssim = Nan::To<bool>(info[5]).FromMaybe(true);
+  Nan::Callback* callback = new Nan::Callback(v8::Local<v8::Function>::Cast(info[6]));
+  Nan::AsyncQueueWorker(new CompareWorker(callback,
+    Nan::To<v8::Object>(info[0]).ToLocalChecked(),
+    Nan::To<v8::Object>(info[1]).ToLocalChecked(),
+    pixelFormat, rowBytes, width, height, ssim));
+}
+
+NAN_METHOD(EmbedFrameCounter) {
+  uint32_t width, height, pixelFormat, rowBytes;
+  if (!frameArgs(info, 1, &width, &height, &pixelFormat, &rowBytes))
+    return;
+  uint32_t counter = Nan::To<uint32_t>(info[4]).FromMaybe(0);
+  if (!embedFrameCounter(pixelFormat, (uint8_t*) node::Buffer::Data(info[0]),
+      rowBytes, width, height, counter)) {
+    Nan::ThrowRangeError("Frame is too narrow for a frame counter.");
+    return;
+  }
+  info.GetReturnValue().Set(info[0]);
+}
+
+NAN_METHOD(ReadFrameCounter) {
+  uint32_t width, height, pixelFormat, rowBytes;
+  if (!frameArgs(info, 1, &width, &height, &pixelFormat, &rowBytes))
+    return;
+  uint32_t counter = 0;
+  if (readFrameCounter(pixelFormat, (const uint8_t*) node::Buffer::Data(info[0]),
+      rowBytes, width, height, &counter))
+    info.GetReturnValue().Set(counter);
+  else
+    info.GetReturnValue().SetNull();
+}
+
+} // namespace streampunk
@@ -0,0 +1,63 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <nan.h>
+#include <stdint.h>
+
+namespace streampunk {
+
+struct PlaneQuality {
+  double mse;    // in the bit depth of the pixel format
+  double psnr;   // dB, Infinity for identical planes
+  double ssim;   // mean SSIM over 8x8 windows, -1 when not computed
+};
+
+struct FrameQuality {
+  PlaneQuality y;
+  PlaneQuality cb;
+  PlaneQuality cr;
+};
+
+// Compare two 2vuy or v210 frames of the same format, plane by plane.
+bool compareFrames(uint32_t pixelFormat, const uint8_t* a, const uint8_t* b,
+  uint32_t rowBytes, uint32_t width, uint32_t height, bool ssim,
+  FrameQuality* quality);
+
+// A frame number burnt into the top rows of a frame as a strip of black and
+// white cells, which survives a loopback through the card unchanged.
+static const uint32_t counterCellWidth = 16;
+static const uint32_t counterCellHeight = 8;
+static const uint32_t counterCells = 40;
+
+bool embedFrameCounter(uint32_t pixelFormat, uint8_t* frame, uint32_t rowBytes,
+  uint32_t width, uint32_t height, uint32_t counter);
+// Returns false if no valid counter strip is found.
+bool readFrameCounter(uint32_t pixelFormat, const uint8_t* frame, uint32_t rowBytes,
+  uint32_t width, uint32_t height, uint32_t* counter);
+
+// compareFrames(a, b, width, height, pixelFormat, ssim, callback) - runs on
+// the libuv thread pool, calling back with (err, quality)
+NAN_METHOD(CompareFrames);
+// embedFrameCounter(buffer, width, height, pixelFormat, counter), in place
+NAN_METHOD(EmbedFrameCounter);
+// readFrameCounter(buffer, width, height, pixelFormat) -> number or null
+NAN_METHOD(ReadFrameCounter);
+
+} // namespace streampunk
+
+#endif
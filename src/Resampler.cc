@@ -0,0 +1,174 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Resampler.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+namespace streampunk {
+
+static const double pi = 3.14159265358979323846;
+// Passband edge as a fraction of the input Nyquist frequency
+static const double cutoff = 0.95;
+// Kaiser window shape, about 80dB of stopband rejection
+static const double kaiserBeta = 8.0;
+
+static double besselI0(double x) {
+  double sum = 1.0, term = 1.0;
+  for (int k = 1 ; k < 32 ; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+AudioResampler::AudioResampler() : channels_(0), bytesPerSample_(2),
+    capacity_(0), first_(0), frames_(0), position_(0.0), ratio_(1.0) {
+  const uint32_t width = 2 * halfTaps;
+  kernel_.resize((phases + 1) * width);
+  taps_.resize(width);
+  double norm = besselI0(kaiserBeta);
+  for (uint32_t r = 0 ; r <= phases ; r++) {
+    double sum = 0.0;
+    for (uint32_t k = 0 ; k < width ; k++) {
+      // Distance from the output position to input sample k of the window
+      double t = (double) r / phases + halfTaps - 1.0 - k;
+      double x = t / halfTaps;
+      double w = (x * x < 1.0) ? besselI0(kaiserBeta * sqrt(1.0 - x * x)) / norm : 0.0;
+      double s = (t == 0.0) ? 1.0 : sin(pi * cutoff * t) / (pi * cutoff * t);
+      kernel_[r * width + k] = (float) (cutoff * s * w);
+      sum += cutoff * s * w;
+    }
+    for (uint32_t k = 0 ; k < width ; k++)
+      kernel_[r * width + k] = (float) (kernel_[r * width + k] / sum);
+  }
+}
+
+// Between pulls the ring holds at most the frames that a pull could not
+// consume, less than 2 * halfTaps + 1 of them, plus what is pushed.
+void AudioResampler::configure(uint32_t channels, uint32_t bytesPerSample,
+    uint32_t maxPush) {
+  channels_ = channels;
+  bytesPerSample_ = bytesPerSample;
+  capacity_ = maxPush + 2 * halfTaps + 2;
+  history_.resize((size_t) 2 * capacity_ * channels_);
+  sums_.resize(channels_);
+  reset();
+}
+
+// Primed with silence so that the first output frame is centred on the
+// first input frame.
+void AudioResampler::reset() {
+  std::fill(history_.begin(), history_.end(), 0.0f);
+  first_ = 0;
+  frames_ = halfTaps - 1;
+  position_ = (double) (halfTaps - 1);
+}
+
+uint32_t AudioResampler::inputNeeded(uint32_t outFrames) const {
+  if (outFrames == 0) return 0;
+  double last = position_ + (outFrames - 1) * ratio_;
+  uint32_t total = (uint32_t) last + halfTaps + 1;
+  return total > frames_ ? total - frames_ : 0;
+}
+
+double AudioResampler::held() const {
+  return frames_ - position_;
+}
+
+uint32_t AudioResampler::push(const uint8_t* data, uint32_t frames) {
+  if (frames > capacity_ - frames_) frames = capacity_ - frames_;
+  uint32_t taken = 0;
+  // At most two runs, either side of the end of the ring
+  while (taken < frames) {
+    uint32_t at = (first_ + frames_ + taken) % capacity_;
+    uint32_t run = frames - taken;
+    if (run > capacity_ - at) run = capacity_ - at;
+    size_t samples = (size_t) run * channels_;
+    float* out = &history_[(size_t) at * channels_];
+    float* mirror = out + (size_t) capacity_ * channels_;
+    if (bytesPerSample_ == 4) {
+      const int32_t* in = (const int32_t*) data + (size_t) taken * channels_;
+      for (size_t x = 0 ; x < samples ; x++)
+        out[x] = (float) (in[x] * (1.0 / 2147483648.0));
+    } else {
+      const int16_t* in = (const int16_t*) data + (size_t) taken * channels_;
+      for (size_t x = 0 ; x < samples ; x++)
+        out[x] = in[x] * (1.0f / 32768.0f);
+    }
+    memcpy(mirror, out, samples * sizeof(float));
+    taken += run;
+  }
+  frames_ += frames;
+  return frames;
+}
+
+uint32_t AudioResampler::pull(uint8_t* data, uint32_t frames) {
+  const uint32_t width = 2 * halfTaps;
+  uint32_t made = 0;
+  for ( ; made < frames ; made++) {
+    uint32_t i = (uint32_t) position_;
+    if (i + halfTaps >= frames_) break;
+
+    // Interpolate between the two nearest phases of the kernel
+    double phase = (position_ - i) * phases;
+    uint32_t p = (uint32_t) phase;
+    float t = (float) (phase - p);
+    const float* k0 = &kernel_[p * width];
+    const float* k1 = k0 + width;
+    float* taps = &taps_[0];
+    for (uint32_t k = 0 ; k < width ; k++)
+      taps[k] = k0[k] + (k1[k] - k0[k]) * t;
+
+    // Accumulated a tap at a time across all channels, so that the inner
+    // loop runs over contiguous samples.
+    uint32_t start = (first_ + i + 1 - halfTaps) % capacity_;
+    const float* in = &history_[(size_t) start * channels_];
+    float* sums = &sums_[0];
+    for (uint32_t c = 0 ; c < channels_ ; c++)
+      sums[c] = 0.0f;
+    for (uint32_t k = 0 ; k < width ; k++, in += channels_)
+      for (uint32_t c = 0 ; c < channels_ ; c++)
+        sums[c] += in[c] * taps[k];
+
+    for (uint32_t c = 0 ; c < channels_ ; c++) {
+      float sum = sums[c];
+      if (bytesPerSample_ == 4) {
+        double v = sum * 2147483648.0;
+        v = v < -2147483648.0 ? -2147483648.0 : (v > 2147483647.0 ? 2147483647.0 : v);
+        ((int32_t*) data)[(size_t) made * channels_ + c] = (int32_t) lrint(v);
+      } else {
+        float v = sum * 32768.0f;
+        v = v < -32768.0f ? -32768.0f : (v > 32767.0f ? 32767.0f : v);
+        ((int16_t*) data)[(size_t) made * channels_ + c] = (int16_t) lrintf(v);
+      }
+    }
+    position_ += ratio_;
+  }
+
+  // Drop input that no future output frame can reach
+  uint32_t consumed = (uint32_t) position_;
+  if (consumed > halfTaps - 1) {
+    uint32_t drop = consumed - (halfTaps - 1);
+    if (drop > frames_) drop = frames_;
+    first_ = (first_ + drop) % capacity_;
+    frames_ -= drop;
+    position_ -= drop;
+  }
+  return made;
+}
+
+} // namespace streampunk
@@ -0,0 +1,75 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace streampunk {
+
+// Interleaved integer audio resampled by a variable ratio with a polyphase
+// Kaiser windowed sinc, interpolating between phases. Meant for small,
+// slowly changing ratios such as clock drift, so the cutoff is fixed just
+// below the input Nyquist frequency.
+class AudioResampler {
+public:
+  AudioResampler();
+
+  // bytesPerSample is 2 or 4 for 16 or 32 bit integer samples. maxPush is
+  // the most frames that will be pushed between pulls; history is allocated
+  // here for that, so push() and pull() never allocate. Clears state.
+  void configure(uint32_t channels, uint32_t bytesPerSample, uint32_t maxPush);
+  void reset();
+
+  // Input sample frames consumed per output sample frame.
+  void setRatio(double ratio) { ratio_ = ratio; }
+  double ratio() const { return ratio_; }
+
+  // Input frames still needed before pull() can make outFrames.
+  uint32_t inputNeeded(uint32_t outFrames) const;
+  // Input frames held but not yet consumed.
+  double held() const;
+
+  // Returns the number of frames taken, fewer than given only when more than
+  // maxPush frames arrive between pulls.
+  uint32_t push(const uint8_t* data, uint32_t frames);
+  // Returns the number of frames made, fewer than asked when short of input.
+  uint32_t pull(uint8_t* data, uint32_t frames);
+
+  static const uint32_t halfTaps = 16;
+  static const uint32_t phases = 256;
+
+private:
+  std::vector<float> kernel_;   // (phases + 1) rows of 2 * halfTaps
+  // Interleaved input as floats, a ring of capacity_ frames stored twice
+  // over so that any run of 2 * halfTaps frames is contiguous.
+  std::vector<float> history_;
+  std::vector<float> taps_;     // interpolated kernel for one output frame
+  std::vector<float> sums_;     // one per channel
+  uint32_t channels_;
+  uint32_t bytesPerSample_;
+  uint32_t capacity_;           // frames in the ring
+  uint32_t first_;              // ring index of the oldest input frame held
+  uint32_t frames_;             // input frames held
+  double position_;             // of the next output frame, from first_
+  double ratio_;
+};
+
+} // namespace streampunk
+
+#endif
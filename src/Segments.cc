@@ -0,0 +1,433 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Segments.h"
+#include "Formats.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#ifdef WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace streampunk {
+
+static const uint64_t noIndex = ~(uint64_t) 0;
+
+static int createFile(const std::string& path) {
+#ifdef WIN32
+  return _open(path.c_str(), _O_CREAT | _O_TRUNC | _O_WRONLY | _O_BINARY,
+    _S_IREAD | _S_IWRITE);
+#else
+  return open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+#endif
+}
+
+// Allocates the whole file up front, so that writes into it never have to
+// extend it. Where that is not possible the file is at least created ahead.
+static bool reserveFile(int fd, uint64_t bytes) {
+#ifdef __linux__
+  return posix_fallocate(fd, 0, (off_t) bytes) == 0;
+#else
+  (void) fd;
+  (void) bytes;
+  return true;
+#endif
+}
+
+static bool truncateFile(int fd, uint64_t bytes) {
+#ifdef WIN32
+  return _chsize_s(fd, (__int64) bytes) == 0;
+#else
+  return ftruncate(fd, (off_t) bytes) == 0;
+#endif
+}
+
+static bool writeFile(int fd, const uint8_t* data, size_t bytes) {
+  while (bytes > 0) {
+#ifdef WIN32
+    int written = _write(fd, data, (unsigned int) bytes);
+#else
+    ssize_t written = write(fd, data, bytes);
+#endif
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += written;
+    bytes -= (size_t) written;
+  }
+  return true;
+}
+
+static void closeFile(int fd) {
+#ifdef WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+}
+
+static void removeFile(const std::string& path) {
+#ifdef WIN32
+  _unlink(path.c_str());
+#else
+  unlink(path.c_str());
+#endif
+}
+
+SegmentRecorder::SegmentRecorder() : frameBytes_(0), notify_(NULL),
+    notifyData_(NULL), running_(false), quit_(false), writerDone_(false),
+    nextIndex_(0), codec_(NULL), prepareIndex_(noIndex), preparedIndex_(noIndex),
+    preparing_(false) {
+  uv_mutex_init(&lock_);
+  uv_cond_init(&work_);
+  uv_cond_init(&house_);
+  uv_cond_init(&ready_);
+  current_.fd = -1;
+  prepared_.fd = -1;
+  memset(&status_, 0, sizeof(status_));
+}
+
+SegmentRecorder::~SegmentRecorder() {
+  stop();
+  uv_cond_destroy(&ready_);
+  uv_cond_destroy(&house_);
+  uv_cond_destroy(&work_);
+  uv_mutex_destroy(&lock_);
+}
+
+bool SegmentRecorder::start(const SegmentOptions& options, uint32_t frameBytes,
+    Notify notify, void* data) {
+  stop();
+  if (frameBytes == 0 || options.segmentFrames == 0 || options.queueFrames < 2)
+    return false;
+  if (options.losslessThreads > 0 && (!LosslessCodec::canCode(options.pixelFormat) ||
+      (uint64_t) rowBytesForFormat(options.pixelFormat, options.width) *
+        options.height != frameBytes))
+    return false;
+  options_ = options;
+  frameBytes_ = frameBytes;
+  notify_ = notify;
+  notifyData_ = data;
+
+  slots_.resize(options.queueFrames);
+  free_.clear();
+  queue_.clear();
+  for (uint32_t x = 0 ; x < options.queueFrames ; x++) {
+    slots_[x].data.resize(frameBytes);
+    free_.push_back(x);
+  }
+  current_.fd = -1;
+  prepared_.fd = -1;
+  nextIndex_ = 0;
+  prepareIndex_ = 0; // the first file is pre-allocated too
+  preparedIndex_ = noIndex;
+  preparing_ = false;
+  closing_.clear();
+  kept_.clear();
+  events_.clear();
+  memset(&status_, 0, sizeof(status_));
+  quit_ = false;
+  writerDone_ = false;
+  if (options.losslessThreads > 0)
+    codec_ = new LosslessCodec(options.losslessThreads);
+
+  running_ = true;
+  uv_thread_create(&housekeeper_, houseLoop, this);
+  uv_thread_create(&writer_, writeLoop, this);
+  return true;
+}
+
+void SegmentRecorder::stop() {
+  if (!running_) return;
+  uv_mutex_lock(&lock_);
+  quit_ = true;
+  uv_cond_signal(&work_);
+  uv_cond_signal(&house_);
+  uv_mutex_unlock(&lock_);
+  uv_thread_join(&writer_);
+  uv_thread_join(&housekeeper_);
+  running_ = false;
+  delete codec_;
+  codec_ = NULL;
+  coded_.clear();
+  slots_.clear();
+  free_.clear();
+  queue_.clear();
+}
+
+bool SegmentRecorder::push(const uint8_t* frame, uint32_t bytes, int64_t streamTime) {
+  uv_mutex_lock(&lock_);
+  uint64_t number = status_.offered++;
+  if (quit_ || bytes != frameBytes_ || free_.empty()) {
+    status_.dropped++;
+    uv_mutex_unlock(&lock_);
+    return false;
+  }
+  uint32_t x = free_.back();
+  free_.pop_back();
+  uv_mutex_unlock(&lock_);
+
+  // The slot belongs to this thread until it is queued
+  Slot& slot = slots_[x];
+  memcpy(&slot.data[0], frame, bytes);
+  slot.frame = number;
+  slot.streamTime = streamTime;
+
+  uv_mutex_lock(&lock_);
+  queue_.push_back(x);
+  uv_cond_signal(&work_);
+  uv_mutex_unlock(&lock_);
+  return true;
+}
+
+void SegmentRecorder::takeEvents(std::vector<SegmentEvent>& events) {
+  uv_mutex_lock(&lock_);
+  events.insert(events.end(), events_.begin(), events_.end());
+  events_.clear();
+  uv_mutex_unlock(&lock_);
+}
+
+SegmentRecorder::Status SegmentRecorder::status() {
+  uv_mutex_lock(&lock_);
+  Status status = status_;
+  status.queued = (uint32_t) queue_.size();
+  uv_mutex_unlock(&lock_);
+  return status;
+}
+
+std::string SegmentRecorder::segmentPath(uint64_t index) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%08llu", (unsigned long long) index);
+  std::string path = options_.directory;
+  if (!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\')
+    path += '/';
+  return path + options_.prefix + name + options_.extension;
+}
+
+// Call with lock_ held.
+void SegmentRecorder::post(const SegmentEvent& event) {
+  events_.push_back(event);
+  if (notify_ != NULL) notify_(notifyData_);
+}
+
+// Writer thread. Takes the pre-allocated file if the housekeeper has it ready,
+// waiting if it is part way through, and asks for the one after.
+bool SegmentRecorder::openSegment(uint64_t index) {
+  OpenSegment segment;
+  segment.fd = -1;
+  segment.index = index;
+  segment.path = segmentPath(index);
+  segment.firstFrame = 0;
+  segment.lastFrame = 0;
+  segment.frames = 0;
+  segment.bytes = 0;
+  segment.streamTime = 0;
+  segment.partial = false;
+
+  uv_mutex_lock(&lock_);
+  while (preparing_ && preparedIndex_ == index)
+    uv_cond_wait(&ready_, &lock_);
+  if (prepared_.fd >= 0 && prepared_.index == index) {
+    segment.fd = prepared_.fd;
+    prepared_.fd = -1;
+  } else {
+    status_.unprepared++;
+  }
+  status_.index = index;
+  prepareIndex_ = index + 1;
+  uv_cond_signal(&house_);
+  uv_mutex_unlock(&lock_);
+
+  if (segment.fd < 0)
+    segment.fd = createFile(segment.path);
+  if (segment.fd < 0) {
+    SegmentEvent event = { segmentFailed, index, segment.path, 0, 0, 0, 0, 0,
+      strerror(errno) };
+    uv_mutex_lock(&lock_);
+    post(event);
+    uv_mutex_unlock(&lock_);
+    return false;
+  }
+  current_ = segment;
+  return true;
+}
+
+// Writer thread. Hands the file to the housekeeper to close.
+void SegmentRecorder::finishSegment(bool partial) {
+  if (current_.fd < 0) return;
+  current_.partial = partial;
+  uv_mutex_lock(&lock_);
+  closing_.push_back(current_);
+  uv_cond_signal(&house_);
+  uv_mutex_unlock(&lock_);
+  current_.fd = -1;
+  nextIndex_ = current_.index + 1;
+}
+
+void SegmentRecorder::writeLoop(void* arg) {
+  SegmentRecorder* rec = static_cast<SegmentRecorder*>(arg);
+  for (;;) {
+    uv_mutex_lock(&rec->lock_);
+    while (rec->queue_.empty() && !rec->quit_)
+      uv_cond_wait(&rec->work_, &rec->lock_);
+    if (rec->queue_.empty()) {
+      uv_mutex_unlock(&rec->lock_);
+      break;
+    }
+    uint32_t x = rec->queue_.front();
+    rec->queue_.pop_front();
+    uv_mutex_unlock(&rec->lock_);
+
+    Slot& slot = rec->slots_[x];
+    const uint8_t* data = &slot.data[0];
+    size_t bytes = rec->frameBytes_;
+    if (rec->codec_ != NULL) {
+      rec->codec_->encode(rec->options_.pixelFormat, rec->options_.width,
+        rec->options_.height, data, rec->coded_);
+      data = &rec->coded_[0];
+      bytes = rec->coded_.size();
+    }
+    bool written = false;
+    if (rec->current_.fd >= 0 || rec->openSegment(rec->nextIndex_)) {
+      OpenSegment& segment = rec->current_;
+      written = writeFile(segment.fd, data, bytes);
+      if (written) {
+        if (segment.frames == 0) {
+          segment.firstFrame = slot.frame;
+          segment.streamTime = slot.streamTime;
+        }
+        segment.lastFrame = slot.frame;
+        segment.frames++;
+        segment.bytes += bytes;
+        if (segment.frames == rec->options_.segmentFrames)
+          rec->finishSegment(false);
+      } else {
+        SegmentEvent event = { segmentFailed, segment.index, segment.path,
+          segment.firstFrame, segment.lastFrame, segment.frames, segment.bytes,
+          segment.streamTime, strerror(errno) };
+        uv_mutex_lock(&rec->lock_);
+        rec->post(event);
+        uv_mutex_unlock(&rec->lock_);
+        rec->finishSegment(true);
+      }
+    } else {
+      // Could not create the file. Try the next one with the next frame.
+      rec->nextIndex_++;
+    }
+
+    uv_mutex_lock(&rec->lock_);
+    if (written) {
+      rec->status_.written++;
+      rec->status_.bytes += bytes;
+    } else {
+      rec->status_.dropped++;
+    }
+    rec->free_.push_back(x);
+    uv_mutex_unlock(&rec->lock_);
+  }
+
+  rec->finishSegment(true);
+  uv_mutex_lock(&rec->lock_);
+  rec->writerDone_ = true;
+  uv_cond_signal(&rec->house_);
+  uv_mutex_unlock(&rec->lock_);
+}
+
+// Pre-allocation comes first, as the writer may be waiting on it. Closing and
+// deleting files, which can take a while for large files, only ever holds up
+// this thread.
+void SegmentRecorder::houseLoop(void* arg) {
+  SegmentRecorder* rec = static_cast<SegmentRecorder*>(arg);
+  uint64_t segmentBytes = (uint64_t) rec->options_.segmentFrames * rec->frameBytes_;
+  uv_mutex_lock(&rec->lock_);
+  for (;;) {
+    if (!rec->quit_ && rec->prepareIndex_ != noIndex &&
+        rec->prepareIndex_ != rec->preparedIndex_) {
+      uint64_t index = rec->prepareIndex_;
+      rec->preparedIndex_ = index;
+      rec->preparing_ = true;
+      uv_mutex_unlock(&rec->lock_);
+      std::string path = rec->segmentPath(index);
+      int fd = createFile(path);
+      if (fd >= 0 && !reserveFile(fd, segmentBytes)) {
+        // Out of space already - leave the writer to find out for itself
+        closeFile(fd);
+        removeFile(path);
+        fd = -1;
+      }
+      uv_mutex_lock(&rec->lock_);
+      rec->prepared_.fd = fd;
+      rec->prepared_.index = index;
+      rec->prepared_.path = path;
+      rec->preparing_ = false;
+      uv_cond_broadcast(&rec->ready_);
+      continue;
+    }
+
+    if (!rec->closing_.empty()) {
+      OpenSegment segment = rec->closing_.front();
+      rec->closing_.pop_front();
+      uv_mutex_unlock(&rec->lock_);
+      if (segment.partial || segment.bytes != segmentBytes)
+        truncateFile(segment.fd, segment.bytes);
+      closeFile(segment.fd);
+      if (segment.frames == 0) {
+        removeFile(segment.path);
+        uv_mutex_lock(&rec->lock_);
+        continue;
+      }
+      uv_mutex_lock(&rec->lock_);
+      SegmentEvent closed = { segmentClosed, segment.index, segment.path,
+        segment.firstFrame, segment.lastFrame, segment.frames, segment.bytes,
+        segment.streamTime, "" };
+      rec->status_.closed++;
+      rec->kept_.push_back(closed);
+      rec->post(closed);
+
+      while (rec->options_.retain > 0 && rec->kept_.size() > rec->options_.retain) {
+        SegmentEvent deleted = rec->kept_.front();
+        rec->kept_.pop_front();
+        uv_mutex_unlock(&rec->lock_);
+        removeFile(deleted.path);
+        uv_mutex_lock(&rec->lock_);
+        deleted.type = segmentDeleted;
+        rec->status_.deleted++;
+        rec->post(deleted);
+      }
+      continue;
+    }
+
+    if (rec->quit_ && rec->writerDone_) break;
+    uv_cond_wait(&rec->house_, &rec->lock_);
+  }
+
+  // The next file was never started
+  if (rec->prepared_.fd >= 0) {
+    closeFile(rec->prepared_.fd);
+    removeFile(rec->prepared_.path);
+    rec->prepared_.fd = -1;
+  }
+  uv_mutex_unlock(&rec->lock_);
+}
+
+} // namespace streampunk
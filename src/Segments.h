@@ -0,0 +1,165 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <uv.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "Lossless.h"
+
+namespace streampunk {
+
+struct SegmentOptions {
+  std::string directory;
+  std::string prefix;        // files are prefix, an eight digit index, extension
+  std::string extension;
+  uint32_t segmentFrames;    // frames per file, rotation is on this boundary
+  uint32_t retain;           // closed segments kept on disk, 0 keeps them all
+  uint32_t queueFrames;      // frames buffered for the writer before dropping
+  uint32_t losslessThreads;  // codes frames with a LosslessCodec, 0 for raw
+  uint32_t pixelFormat;      // of the frames, when coding
+  uint32_t width;
+  uint32_t height;
+};
+
+enum SegmentEventType {
+  segmentClosed,
+  segmentDeleted,
+  segmentFailed
+};
+
+struct SegmentEvent {
+  SegmentEventType type;
+  uint64_t index;
+  std::string path;
+  uint64_t firstFrame;       // numbers of frames offered, inclusive
+  uint64_t lastFrame;
+  uint32_t frames;           // frames written, fewer than the range if dropped
+  uint64_t bytes;
+  int64_t streamTime;        // of the first frame
+  std::string error;
+};
+
+// Records raw frames into a rolling series of files of a fixed number of
+// frames each. Frames are copied into a queue by the capture thread and
+// written by a writer thread. A second, housekeeping thread pre-allocates the
+// next file before it is needed, closes finished files and deletes those
+// beyond the retention limit, so the writer never waits on the file system
+// for anything but its own writes. The files are laid out like a raw capture,
+// or hold frames from the lossless codec, and either way can be played with a
+// TrickPlayer or a Playlist. A file is reserved at its raw size and truncated
+// to what was written when coding.
+class SegmentRecorder {
+public:
+  // Called from either thread when there are events to collect.
+  typedef void (*Notify)(void* data);
+
+  SegmentRecorder();
+  ~SegmentRecorder();
+
+  bool start(const SegmentOptions& options, uint32_t frameBytes,
+    Notify notify, void* data);
+  // Writes out the queue, then truncates the last file to what was written.
+  void stop();
+  bool isRecording() const { return running_; }
+  uint32_t frameBytes() const { return frameBytes_; }
+
+  // On the capture thread. Returns false if the frame was dropped.
+  bool push(const uint8_t* frame, uint32_t bytes, int64_t streamTime);
+
+  void takeEvents(std::vector<SegmentEvent>& events);
+
+  struct Status {
+    uint64_t offered;
+    uint64_t written;
+    uint64_t dropped;
+    uint64_t index;          // of the segment being written
+    uint64_t closed;
+    uint64_t deleted;
+    uint64_t unprepared;     // rotations that had to create the file in line
+    uint64_t bytes;          // written, after any coding
+    uint32_t queued;
+  };
+  Status status();
+
+private:
+  struct Slot {
+    std::vector<uint8_t> data;
+    uint64_t frame;
+    int64_t streamTime;
+  };
+
+  struct OpenSegment {
+    int fd;
+    uint64_t index;
+    std::string path;
+    uint64_t firstFrame;
+    uint64_t lastFrame;
+    uint32_t frames;
+    uint64_t bytes;
+    int64_t streamTime;
+    bool partial;            // truncate to bytes on close
+  };
+
+  static void writeLoop(void* arg);
+  static void houseLoop(void* arg);
+  std::string segmentPath(uint64_t index) const;
+  bool openSegment(uint64_t index);
+  void finishSegment(bool partial);
+  void post(const SegmentEvent& event);
+
+  SegmentOptions options_;
+  uint32_t frameBytes_;
+  Notify notify_;
+  void* notifyData_;
+  bool running_;
+
+  uv_mutex_t lock_;
+  uv_cond_t work_;           // frames queued, or stopping
+  uv_cond_t house_;          // housekeeping to do, or stopping
+  uv_cond_t ready_;          // a file has been pre-allocated
+  uv_thread_t writer_;
+  uv_thread_t housekeeper_;
+  bool quit_;
+  bool writerDone_;
+
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> free_;
+  std::deque<uint32_t> queue_;
+
+  // writer thread only
+  OpenSegment current_;
+  uint64_t nextIndex_;
+  LosslessCodec* codec_;
+  std::vector<uint8_t> coded_;
+
+  // shared with the housekeeper, under lock_
+  OpenSegment prepared_;
+  uint64_t prepareIndex_;    // wanted next
+  uint64_t preparedIndex_;   // last started
+  bool preparing_;
+  std::deque<OpenSegment> closing_;
+  std::deque<SegmentEvent> kept_;
+  std::vector<SegmentEvent> events_;
+  Status status_;
+};
+
+} // namespace streampunk
+
+#endif
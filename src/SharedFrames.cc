@@ -0,0 +1,708 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "SharedFrames.h"
+#include <string.h>
+#include <errno.h>
+#include <new>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <limits.h>
+#endif
+
+namespace streampunk {
+
+static const char sharedMagic[8] = { 'M', 'A', 'C', 'S', 'H', 'F', 'R', 'M' };
+static const uint32_t sharedVersion = 1;
+static const size_t pageBytes = 4096;
+static const int waitMillis = 100;
+
+static size_t roundUp(size_t value, size_t to) {
+  return (value + to - 1) / to * to;
+}
+
+// At the start of the object. The magic is written last, so a subscriber
+// that opens the ring while it is being set up does not take it for ready.
+struct SharedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t slots;
+  uint32_t frameBytes;
+  uint32_t audioBytes;
+  uint64_t slotBytes;
+  uint64_t entryOffset;
+  uint64_t slotOffset;
+  uint32_t pixelFormat;
+  uint32_t width;
+  uint32_t height;
+  uint32_t audioChannels;
+  uint32_t audioSampleBytes;
+  uint32_t audioSampleRate;
+  uint32_t publisherPid;
+  std::atomic<uint32_t> closed;
+  std::atomic<uint32_t> wake;      // bumped after every frame, a futex on Linux
+  uint32_t reserved;
+  std::atomic<int64_t> timeScale;
+  std::atomic<uint64_t> next;
+};
+
+struct SharedEntry {
+  std::atomic<uint64_t> sequence;  // frame number + 1, 0 while being written
+  int64_t streamTime;
+  int64_t frameDuration;
+  uint32_t videoBytes;
+  uint32_t audioBytes;
+  uint32_t audioFrames;
+  uint32_t reserved;
+};
+
+// Names are as for shm_open, with a leading slash added if missing.
+static std::string sharedName(const std::string& name) {
+#ifdef WIN32
+  return "Local\\macadam-" + (name.size() > 0 && name[0] == '/' ? name.substr(1) : name);
+#else
+  return name.size() > 0 && name[0] == '/' ? name : "/" + name;
+#endif
+}
+
+static void wakeAll(std::atomic<uint32_t>* word) {
+#ifdef __linux__
+  syscall(SYS_futex, (uint32_t*) word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+  (void) word;
+#endif
+}
+
+// Returns when the word may have moved on from seen, or after a while.
+// Elsewhere than Linux, subscribers poll.
+static void waitForChange(const std::atomic<uint32_t>* word, uint32_t seen) {
+#ifdef __linux__
+  struct timespec timeout = { 0, waitMillis * 1000000L };
+  syscall(SYS_futex, (const uint32_t*) word, FUTEX_WAIT, seen, &timeout, NULL, 0);
+#elif defined(WIN32)
+  (void) word;
+  (void) seen;
+  Sleep(1);
+#else
+  (void) word;
+  (void) seen;
+  usleep(1000);
+#endif
+}
+
+static bool processAlive(uint32_t pid) {
+#ifdef WIN32
+  HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD) pid);
+  if (process == NULL)
+    return GetLastError() == ERROR_ACCESS_DENIED;
+  bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+  CloseHandle(process);
+  return alive;
+#else
+  return kill((pid_t) pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+// True while the publisher that set up a ring has neither closed it nor
+// exited. A ring still being set up has no publisher yet.
+static bool publisherLive(const uint8_t* base, size_t size) {
+  if (base == NULL || size < sizeof(SharedHeader)) return false;
+  const SharedHeader* header = (const SharedHeader*) base;
+  uint32_t pid = header->publisherPid;
+  return header->closed.load(std::memory_order_acquire) == 0 && pid != 0 &&
+    processAlive(pid);
+}
+
+FramePublisher::FramePublisher() : base_(NULL), size_(0), header_(NULL),
+    entries_(NULL), slots_(NULL), slotCount_(0), frameBytes_(0), audioBytes_(0),
+    slotBytes_(0)
+#ifdef WIN32
+    , mapping_(NULL)
+#endif
+{}
+
+FramePublisher::~FramePublisher() {
+  close();
+}
+
+bool FramePublisher::open(const std::string& name, const SharedFormat& format,
+    std::string& error) {
+  close();
+  if (name.empty() || format.slots < 2 || format.frameBytes == 0) {
+    error = "Shared output needs a name and at least two frame slots.";
+    return false;
+  }
+  size_t entryOffset = roundUp(sizeof(SharedHeader), 64);
+  size_t slotOffset = roundUp(entryOffset + format.slots * sizeof(SharedEntry), pageBytes);
+  slotBytes_ = roundUp((size_t) format.frameBytes + format.audioBytes, pageBytes);
+  size_ = slotOffset + format.slots * slotBytes_;
+  name_ = sharedName(name);
+
+#ifdef WIN32
+  mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+    (DWORD) ((uint64_t) size_ >> 32), (DWORD) (size_ & 0xffffffff), name_.c_str());
+  if (mapping_ != NULL && GetLastError() == ERROR_ALREADY_EXISTS) {
+    // Only subscribers can keep a ring open after its publisher has gone,
+    // and the name cannot be taken from them.
+    uint8_t* existing = (uint8_t*) MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0,
+      sizeof(SharedHeader));
+    bool live = publisherLive(existing, sizeof(SharedHeader));
+    if (existing != NULL) UnmapViewOfFile(existing);
+    CloseHandle(mapping_);
+    mapping_ = NULL;
+    error = live ? "A shared output of that name is already published." :
+      "Subscribers still map an earlier shared output of that name.";
+    return false;
+  }
+  if (mapping_ != NULL)
+    base_ = (uint8_t*) MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size_);
+  if (base_ == NULL) {
+    error = "Unable to create shared memory.";
+    close();
+    return false;
+  }
+#else
+  int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    bool live = false;
+    int existing = shm_open(name_.c_str(), O_RDONLY, 0);
+    struct stat st;
+    if (existing >= 0 && fstat(existing, &st) == 0 &&
+        st.st_size >= (off_t) sizeof(SharedHeader)) {
+      void* header = mmap(NULL, sizeof(SharedHeader), PROT_READ, MAP_SHARED, existing, 0);
+      if (header != MAP_FAILED) {
+        live = publisherLive((const uint8_t*) header, sizeof(SharedHeader));
+        munmap(header, sizeof(SharedHeader));
+      }
+    }
+    if (existing >= 0) ::close(existing);
+    if (live) {
+      error = "A shared output of that name is already published.";
+      return false;
+    }
+    // A ring left behind by a publisher that died is replaced. Subscribers
+    // still mapping it keep the old one.
+    shm_unlink(name_.c_str());
+    fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  }
+  if (fd < 0) {
+    error = std::string("Unable to create shared memory: ") + strerror(errno);
+    return false;
+  }
+  // Allocate the pages up front so that publishing never faults them in
+#ifdef __linux__
+  bool sized = posix_fallocate(fd, 0, (off_t) size_) == 0 || ftruncate(fd, (off_t) size_) == 0;
+#else
+  bool sized = ftruncate(fd, (off_t) size_) == 0;
+#endif
+  void* base = sized ?
+    mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    error = std::string("Unable to map shared memory: ") + strerror(errno);
+    shm_unlink(name_.c_str());
+    base_ = NULL;
+    return false;
+  }
+  base_ = (uint8_t*) base;
+#endif
+
+  // The object starts zeroed, so every slot reads as empty
+  header_ = new (base_) SharedHeader;
+  header_->version = sharedVersion;
+  header_->slots = format.slots;
+  header_->frameBytes = format.frameBytes;
+  header_->audioBytes = format.audioBytes;
+  header_->slotBytes = slotBytes_;
+  header_->entryOffset = entryOffset;
+  header_->slotOffset = slotOffset;
+  header_->pixelFormat = format.pixelFormat;
+  header_->width = format.width;
+  header_->height = format.height;
+  header_->audioChannels = format.audioChannels;
+  header_->audioSampleBytes = format.audioSampleBytes;
+  header_->audioSampleRate = format.audioSampleRate;
+#ifdef WIN32
+  header_->publisherPid = (uint32_t) GetCurrentProcessId();
+#else
+  header_->publisherPid = (uint32_t) getpid();
+#endif
+  header_->closed.store(0);
+  header_->wake.store(0);
+  header_->timeScale.store(0);
+  header_->next.store(0);
+  entries_ = (SharedEntry*) (base_ + entryOffset);
+  for (uint32_t x = 0 ; x < format.slots ; x++)
+    new (&entries_[x]) SharedEntry;
+  slots_ = base_ + slotOffset;
+  slotCount_ = format.slots;
+  frameBytes_ = format.frameBytes;
+  audioBytes_ = format.audioBytes;
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header_->magic, sharedMagic, sizeof(sharedMagic));
+  return true;
+}
+
+void FramePublisher::close() {
+  if (header_ != NULL) {
+    header_->closed.store(1, std::memory_order_release);
+    header_->wake.fetch_add(1, std::memory_order_release);
+    wakeAll(&header_->wake);
+  }
+#ifdef WIN32
+  if (base_ != NULL) UnmapViewOfFile(base_);
+  if (mapping_ != NULL) CloseHandle(mapping_);
+  mapping_ = NULL;
+#else
+  if (base_ != NULL) {
+    munmap(base_, size_);
+    shm_unlink(name_.c_str());
+  }
+#endif
+  base_ = NULL;
+  header_ = NULL;
+}
+
+uint64_t FramePublisher::published() const {
+  return header_ != NULL ? header_->next.load(std::memory_order_relaxed) : 0;
+}
+
+// On the capture thread, as Timeshift::write.
+void FramePublisher::write(const uint8_t* video, uint32_t videoBytes,
+    const uint8_t* audio, uint32_t audioBytes, uint32_t audioFrames,
+    int64_t streamTime, int64_t frameDuration, int64_t timeScale) {
+  if (header_ == NULL) return;
+  uint64_t frame = header_->next.load(std::memory_order_relaxed);
+  SharedEntry* e = &entries_[frame % slotCount_];
+  uint8_t* data = slots_ + (size_t) (frame % slotCount_) * slotBytes_;
+  if (videoBytes > frameBytes_) videoBytes = frameBytes_;
+  if (audio == NULL) audioBytes = 0;
+  if (audioBytes > audioBytes_) audioBytes = audioBytes_;
+
+  e->sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(data, video, videoBytes);
+  if (audioBytes > 0)
+    memcpy(data + frameBytes_, audio, audioBytes);
+  e->streamTime = streamTime;
+  e->frameDuration = frameDuration;
+  e->videoBytes = videoBytes;
+  e->audioBytes = audioBytes;
+  e->audioFrames = audioFrames;
+  e->sequence.store(frame + 1, std::memory_order_release);
+  header_->timeScale.store(timeScale, std::memory_order_relaxed);
+  header_->next.store(frame + 1, std::memory_order_release);
+  header_->wake.fetch_add(1, std::memory_order_release);
+  wakeAll(&header_->wake);
+}
+
+struct SharedMapping {
+  uint8_t* base;
+  size_t size;
+  std::string name;
+  std::atomic<int> refs;
+#ifdef WIN32
+  void* handle;
+#endif
+
+  static SharedMapping* open(const std::string& name, std::string& error);
+  void retain() { refs.fetch_add(1); }
+  void release();
+  const SharedHeader* header() const { return (const SharedHeader*) base; }
+};
+
+SharedMapping* SharedMapping::open(const std::string& name, std::string& error) {
+  std::string path = sharedName(name);
+  uint8_t* base = NULL;
+  size_t size = 0;
+#ifdef WIN32
+  void* handle = OpenFileMappingA(FILE_MAP_READ, FALSE, path.c_str());
+  if (handle != NULL)
+    base = (uint8_t*) MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+  MEMORY_BASIC_INFORMATION info;
+  if (base != NULL && VirtualQuery(base, &info, sizeof(info)) != 0)
+    size = info.RegionSize;
+  if (base == NULL) {
+    if (handle != NULL) CloseHandle(handle);
+    error = "No shared output of that name is published.";
+    return NULL;
+  }
+#else
+  int fd = shm_open(path.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    error = std::string("No shared output of that name is published: ") + strerror(errno);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(SharedHeader)) {
+    size = (size_t) st.st_size;
+    void* mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped != MAP_FAILED) base = (uint8_t*) mapped;
+  }
+  ::close(fd);
+  if (base == NULL) {
+    error = "The shared output is not ready yet.";
+    return NULL;
+  }
+#endif
+
+  const SharedHeader* header = (const SharedHeader*) base;
+  bool valid = size >= sizeof(SharedHeader) &&
+    memcmp(header->magic, sharedMagic, sizeof(sharedMagic)) == 0;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  valid = valid && header->version == sharedVersion && header->slots >= 2 &&
+    header->entryOffset >= sizeof(SharedHeader) &&
+    header->entryOffset + header->slots * sizeof(SharedEntry) <= header->slotOffset &&
+    header->slotBytes >= (uint64_t) header->frameBytes + header->audioBytes &&
+    header->slotOffset + header->slots * header->slotBytes <= size;
+  if (!valid) {
+#ifdef WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(handle);
+#else
+    munmap(base, size);
+#endif
+    error = "The shared output is not ready yet, or is not a macadam frame ring.";
+    return NULL;
+  }
+
+  SharedMapping* mapping = new SharedMapping;
+  mapping->base = base;
+  mapping->size = size;
+  mapping->name = path;
+  mapping->refs.store(1);
+#ifdef WIN32
+  mapping->handle = handle;
+#endif
+  return mapping;
+}
+
+void SharedMapping::release() {
+  if (refs.fetch_sub(1) != 1) return;
+#ifdef WIN32
+  UnmapViewOfFile(base);
+  CloseHandle(handle);
+#else
+  munmap(base, size);
+#endif
+  delete this;
+}
+
+// A Buffer viewing the mapping holds a reference to it
+static void releaseView(char* data, void* hint) {
+  (void) data;
+  static_cast<SharedMapping*>(hint)->release();
+}
+
+inline Nan::Persistent<v8::Function> &FrameSubscriber::constructor() {
+  static thread_local Nan::Persistent<v8::Function> myConstructor;
+  return myConstructor;
+}
+
+FrameSubscriber::FrameSubscriber(SharedMapping* mapping) : mapping_(mapping),
+    delivered_(0), dropped_(0), zeroCopy_(false), ended_(false), waiting_(false),
+    quit_(false), async_(NULL) {
+  delivered_ = next();
+  addCleanupHook(cleanup, this);
+}
+
+FrameSubscriber::~FrameSubscriber() {
+  removeCleanupHook(cleanup, this);
+  stopWaiting();
+  if (mapping_ != NULL) mapping_->release();
+}
+
+NAN_MODULE_INIT(FrameSubscriber::Init) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+  tpl->SetClassName(Nan::New("FrameSubscriber").ToLocalChecked());
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  Nan::SetPrototypeMethod(tpl, "status", Status);
+  Nan::SetPrototypeMethod(tpl, "read", Read);
+  Nan::SetPrototypeMethod(tpl, "isCurrent", IsCurrent);
+  Nan::SetPrototypeMethod(tpl, "start", Start);
+  Nan::SetPrototypeMethod(tpl, "stop", Stop);
+  Nan::SetPrototypeMethod(tpl, "close", Close);
+
+  constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  resetOnCleanup(&constructor());
+  Nan::Set(target, Nan::New("FrameSubscriber").ToLocalChecked(),
+               Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+// new FrameSubscriber(name)
+NAN_METHOD(FrameSubscriber::New) {
+  if (info.IsConstructCall()) {
+    if (!info[0]->IsString()) {
+      Nan::ThrowTypeError("FrameSubscriber needs the name of a shared output.");
+      return;
+    }
+    std::string error;
+    SharedMapping* mapping = SharedMapping::open(*Nan::Utf8String(info[0]), error);
+    if (mapping == NULL) {
+      Nan::ThrowError(error.c_str());
+      return;
+    }
+    FrameSubscriber* obj = new FrameSubscriber(mapping);
+    obj->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+  } else {
+    const int argc = 1;
+    v8::Local<v8::Value> argv[argc] = { info[0] };
+    v8::Local<v8::Function> cons = Nan::New(constructor());
+    info.GetReturnValue().Set(Nan::NewInstance(cons, argc, argv).ToLocalChecked());
+  }
+}
+
+const SharedHeader* FrameSubscriber::header() const {
+  return mapping_->header();
+}
+
+const SharedEntry* FrameSubscriber::entry(uint64_t frame) const {
+  return (const SharedEntry*) (mapping_->base + header()->entryOffset) +
+    frame % header()->slots;
+}
+
+const uint8_t* FrameSubscriber::slot(uint64_t frame) const {
+  return mapping_->base + header()->slotOffset +
+    (size_t) (frame % header()->slots) * header()->slotBytes;
+}
+
+uint64_t FrameSubscriber::next() const {
+  return header()->next.load(std::memory_order_acquire);
+}
+
+// The slot after the newest frame may be in the middle of being rewritten
+uint64_t FrameSubscriber::oldest() const {
+  uint64_t n = next();
+  return n >= header()->slots ? n - header()->slots + 1 : 0;
+}
+
+bool FrameSubscriber::isOpen() const {
+  return header()->closed.load(std::memory_order_acquire) == 0;
+}
+
+// A copy of the frame, or with view a set of Buffers on the mapping itself
+// that the publisher will overwrite in time. Null if it has gone already.
+v8::Local<v8::Value> FrameSubscriber::frameObject(uint64_t frame, bool view) {
+  const SharedHeader* h = header();
+  if (frame >= next() || frame < oldest()) return Nan::Null();
+  const SharedEntry* e = entry(frame);
+  const uint8_t* data = slot(frame);
+  if (e->sequence.load(std::memory_order_acquire) != frame + 1) return Nan::Null();
+
+  int64_t streamTime = e->streamTime, frameDuration = e->frameDuration;
+  uint32_t videoBytes = e->videoBytes, audioBytes = e->audioBytes;
+  uint32_t audioFrames = e->audioFrames;
+  if (videoBytes > h->frameBytes) videoBytes = h->frameBytes;
+  if (audioBytes > h->audioBytes) audioBytes = h->audioBytes;
+  v8::Local<v8::Object> video, audio;
+  if (view) {
+    mapping_->retain();
+    video = Nan::NewBuffer((char*) data, videoBytes, releaseView, mapping_).ToLocalChecked();
+    if (audioBytes > 0) {
+      mapping_->retain();
+      audio = Nan::NewBuffer((char*) data + h->frameBytes, audioBytes, releaseView,
+        mapping_).ToLocalChecked();
+    } else {
+      audio = Nan::NewBuffer(0).ToLocalChecked();
+    }
+  } else {
+    video = Nan::CopyBuffer((const char*) data, videoBytes).ToLocalChecked();
+    audio = Nan::CopyBuffer((const char*) data + h->frameBytes, audioBytes).ToLocalChecked();
+    // Overwritten while copying?
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (e->sequence.load(std::memory_order_relaxed) != frame + 1) return Nan::Null();
+  }
+
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("frame").ToLocalChecked(), Nan::New((double) frame));
+  Nan::Set(result, Nan::New("video").ToLocalChecked(), video);
+  Nan::Set(result, Nan::New("audio").ToLocalChecked(), audio);
+  Nan::Set(result, Nan::New("audioFrames").ToLocalChecked(), Nan::New(audioFrames));
+  Nan::Set(result, Nan::New("streamTime").ToLocalChecked(), Nan::New((double) streamTime));
+  Nan::Set(result, Nan::New("frameDuration").ToLocalChecked(), Nan::New((double) frameDuration));
+  return result;
+}
+
+NAN_METHOD(FrameSubscriber::Status) {
+  FrameSubscriber* obj = ObjectWrap::Unwrap<FrameSubscriber>(info.Holder());
+  if (obj->mapping_ == NULL) {
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  const SharedHeader* h = obj->header();
+  v8::Local<v8::Object> status = Nan::New<v8::Object>();
+  Nan::Set(status, Nan::New("name").ToLocalChecked(), Nan::New(obj->mapping_->name).ToLocalChecked());
+  Nan::Set(status, Nan::New("open").ToLocalChecked(), Nan::New(obj->isOpen()));
+  Nan::Set(status, Nan::New("publisherPid").ToLocalChecked(), Nan::New(h->publisherPid));
+  Nan::Set(status, Nan::New("capacity").ToLocalChecked(), Nan::New(h->slots));
+  Nan::Set(status, Nan::New("next").ToLocalChecked(), Nan::New((double) obj->next()));
+  Nan::Set(status, Nan::New("oldest").ToLocalChecked(), Nan::New((double) obj->oldest()));
+  Nan::Set(status, Nan::New("frameBytes").ToLocalChecked(), Nan::New(h->frameBytes));
+  Nan::Set(status, Nan::New("audioBytes").ToLocalChecked(), Nan::New(h->audioBytes));
+  Nan::Set(status, Nan::New("pixelFormat").ToLocalChecked(), Nan::New(h->pixelFormat));
+  Nan::Set(status, Nan::New("width").ToLocalChecked(), Nan::New(h->width));
+  Nan::Set(status, Nan::New("height").ToLocalChecked(), Nan::New(h->height));
+  Nan::Set(status, Nan::New("audioChannels").ToLocalChecked(), Nan::New(h->audioChannels));
+  Nan::Set(status, Nan::New("audioSampleBytes").ToLocalChecked(), Nan::New(h->audioSampleBytes));
+  Nan::Set(status, Nan::New("audioSampleRate").ToLocalChecked(), Nan::New(h->audioSampleRate));
+  Nan::Set(status, Nan::New("timeScale").ToLocalChecked(),
+    Nan::New((double) h->timeScale.load(std::memory_order_relaxed)));
+  Nan::Set(status, Nan::New("delivered").ToLocalChecked(), Nan::New((double) obj->delivered_));
+  Nan::Set(status, Nan::New("dropped").ToLocalChecked(), Nan::New((double) obj->dropped_));
+  info.GetReturnValue().Set(status);
+}
+
+// read(frame[, view]) -> { frame, video, audio, audioFrames, streamTime,
+//   frameDuration }, or null if the frame is not in the ring
+NAN_METHOD(FrameSubscriber::Read) {
+  FrameSubscriber* obj = ObjectWrap::Unwrap<FrameSubscriber>(info.Holder());
+  double frame = Nan::To<double>(info[0]).FromMaybe(-1.0);
+  if (obj->mapping_ == NULL || frame < 0.0) {
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  info.GetReturnValue().Set(obj->frameObject((uint64_t) frame,
+    Nan::To<bool>(info[1]).FromMaybe(false)));
+}
+
+// Whether a frame viewed in place has not been overwritten since
+NAN_METHOD(FrameSubscriber::IsCurrent) {
+  FrameSubscriber* obj = ObjectWrap::Unwrap<FrameSubscriber>(info.Holder());
+  double frame = Nan::To<double>(info[0]).FromMaybe(-1.0);
+  bool current = obj->mapping_ != NULL && frame >= 0.0 &&
+    obj->entry((uint64_t) frame)->sequence.load(std::memory_order_acquire) ==
+      (uint64_t) frame + 1;
+  info.GetReturnValue().Set(Nan::New(current));
+}
+
+void FrameSubscriber::waitLoop(void* arg) {
+  FrameSubscriber* obj = static_cast<FrameSubscriber*>(arg);
+  const SharedHeader* h = obj->header();
+  uint32_t seen = h->wake.load(std::memory_order_acquire);
+  while (!obj->quit_) {
+    waitForChange(&h->wake, seen);
+    uint32_t now = h->wake.load(std::memory_order_acquire);
+    if (now != seen) {
+      seen = now;
+      uv_async_send(obj->async_);
+    }
+    if (h->closed.load(std::memory_order_acquire) != 0) {
+      uv_async_send(obj->async_);
+      break;
+    }
+  }
+}
+
+// Frames that have arrived since the last call, oldest first. Frames the
+// publisher has lapped are counted as dropped.
+NAUV_WORK_CB(FrameSubscriber::FrameCallback) {
+  Nan::HandleScope scope;
+  FrameSubscriber* obj = static_cast<FrameSubscriber*>(async->data);
+  if (obj->mapping_ == NULL || obj->callback_.IsEmpty()) return;
+  uint64_t next = obj->next();
+  uint64_t oldest = obj->oldest();
+  uint64_t dropped = 0;
+  if (obj->delivered_ < oldest) {
+    dropped = oldest - obj->delivered_;
+    obj->delivered_ = oldest;
+  }
+  v8::Local<v8::Array> frames = Nan::New<v8::Array>();
+  uint32_t count = 0;
+  for ( ; obj->delivered_ < next ; obj->delivered_++) {
+    v8::Local<v8::Value> frame = obj->frameObject(obj->delivered_, obj->zeroCopy_);
+    if (frame->IsNull()) dropped++;
+    else Nan::Set(frames, count++, frame);
+  }
+  obj->dropped_ += dropped;
+  bool ended = !obj->isOpen() && !obj->ended_;
+  if (ended) obj->ended_ = true;
+  if (count == 0 && dropped == 0 && !ended) return;
+
+  Nan::Callback cb(Nan::New(obj->callback_));
+  v8::Local<v8::Value> argv[3] = { frames, Nan::New((double) dropped), Nan::New(ended) };
+  cb.Call(3, argv);
+}
+
+// The waiting thread is joined and the handle closed before a worker's loop
+void FrameSubscriber::cleanup(void* arg) {
+  static_cast<FrameSubscriber*>(arg)->stopWaiting();
+}
+
+void FrameSubscriber::stopWaiting() {
+  if (!waiting_) return;
+  quit_ = true;
+  uv_thread_join(&thread_);
+  closeAndDelete(async_);
+  async_ = NULL;
+  waiting_ = false;
+  callback_.Reset();
+}
+
+// start(callback[, view]) - calls back with (frames, dropped, ended) as frames
+// arrive, starting from the next one published
+NAN_METHOD(FrameSubscriber::Start) {
+  FrameSubscriber* obj = ObjectWrap::Unwrap<FrameSubscriber>(info.Holder());
+  if (!info[0]->IsFunction()) {
+    Nan::ThrowTypeError("Subscribing needs a callback.");
+    return;
+  }
+  if (obj->mapping_ == NULL) {
+    info.GetReturnValue().Set(Nan::New("Subscriber is closed.").ToLocalChecked());
+    return;
+  }
+  obj->stopWaiting();
+  obj->callback_.Reset(v8::Local<v8::Function>::Cast(info[0]));
+  obj->zeroCopy_ = Nan::To<bool>(info[1]).FromMaybe(false);
+  obj->delivered_ = obj->next();
+  obj->ended_ = false;
+  obj->async_ = new uv_async_t;
+  uv_async_init(currentLoop(), obj->async_, FrameCallback);
+  obj->async_->data = obj;
+  obj->quit_ = false;
+  obj->waiting_ = true;
+  uv_thread_create(&obj->thread_, waitLoop, obj);
+  info.GetReturnValue().Set(Nan::New("Subscribed.").ToLocalChecked());
+}
+
+NAN_METHOD(FrameSubscriber::Stop) {
+  FrameSubscriber* obj = ObjectWrap::Unwrap<FrameSubscriber>(info.Holder());
+  obj->stopWaiting();
+  info.GetReturnValue().Set(Nan::New("Unsubscribed.").ToLocalChecked());
+}
+
+// The mapping itself goes once no Buffer views it
+NAN_METHOD(FrameSubscriber::Close) {
+  FrameSubscriber* obj = ObjectWrap::Unwrap<FrameSubscriber>(info.Holder());
+  obj->stopWaiting();
+  if (obj->mapping_ != NULL) obj->mapping_->release();
+  obj->mapping_ = NULL;
+  info.GetReturnValue().Set(Nan::New("Subscriber closed.").ToLocalChecked());
+}
+
+} // namespace streampunk
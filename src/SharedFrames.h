@@ -0,0 +1,143 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef SHAREDFRAMES_H
+#define SHAREDFRAMES_H
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <node_buffer.h>
+#include <nan.h>
+#include <uv.h>
+#include "Environment.h"
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace streampunk {
+
+// A ring of frame slots in a named shared memory object, written by one
+// publishing process and mapped read-only by any number of subscribing
+// processes on the same host. The layout follows the Timeshift ring: a
+// header, an entry per slot carrying a sequence number that the publisher
+// clears while it rewrites the slot, then the slots. A counter in the header
+// is bumped and woken, as a futex on Linux, after every frame.
+struct SharedFormat {
+  uint32_t slots;
+  uint32_t frameBytes;
+  uint32_t audioBytes;
+  uint32_t pixelFormat;
+  uint32_t width;
+  uint32_t height;
+  uint32_t audioChannels;
+  uint32_t audioSampleBytes;   // per sample of one channel
+  uint32_t audioSampleRate;
+};
+
+struct SharedHeader;
+struct SharedEntry;
+
+// The publishing side, owned by a Capture and written on its capture thread.
+class FramePublisher {
+public:
+  FramePublisher();
+  ~FramePublisher();
+
+  // Fails while another publisher, in this process or another, holds the
+  // name. A ring left by a publisher that has gone is replaced, except on
+  // Windows while subscribers still map it.
+  bool open(const std::string& name, const SharedFormat& format, std::string& error);
+  // Marks the ring closed, wakes subscribers and removes the name.
+  void close();
+
+  void write(const uint8_t* video, uint32_t videoBytes, const uint8_t* audio,
+    uint32_t audioBytes, uint32_t audioFrames, int64_t streamTime,
+    int64_t frameDuration, int64_t timeScale);
+
+  uint64_t published() const;
+  const std::string& name() const { return name_; }
+  size_t bytes() const { return size_; }
+
+private:
+  std::string name_;
+  uint8_t* base_;
+  size_t size_;
+  SharedHeader* header_;
+  SharedEntry* entries_;
+  uint8_t* slots_;
+  uint32_t slotCount_;
+  uint32_t frameBytes_;
+  uint32_t audioBytes_;
+  size_t slotBytes_;
+#ifdef WIN32
+  void* mapping_;
+#endif
+};
+
+// A read-only mapping of a published ring, shared with the Buffers that
+// view it so that it outlives the subscriber if need be.
+struct SharedMapping;
+
+// new FrameSubscriber(name) maps a ring published by another process, or
+// this one. Frames can be copied out or viewed in place, and a thread can
+// wait on the publisher's wakeups and call back into JS with new frames.
+class FrameSubscriber : public Nan::ObjectWrap
+{
+private:
+  explicit FrameSubscriber(SharedMapping* mapping);
+  ~FrameSubscriber();
+
+  static NAN_METHOD(New);
+  static inline Nan::Persistent<v8::Function> &constructor();
+
+  static NAN_METHOD(Status);
+  static NAN_METHOD(Read);
+  static NAN_METHOD(IsCurrent);
+  static NAN_METHOD(Start);
+  static NAN_METHOD(Stop);
+  static NAN_METHOD(Close);
+
+  static NAUV_WORK_CB(FrameCallback);
+  static void waitLoop(void* arg);
+  static void cleanup(void* arg);
+
+  const SharedHeader* header() const;
+  const SharedEntry* entry(uint64_t frame) const;
+  const uint8_t* slot(uint64_t frame) const;
+  uint64_t next() const;
+  uint64_t oldest() const;
+  bool isOpen() const;
+  v8::Local<v8::Value> frameObject(uint64_t frame, bool view);
+  void stopWaiting();
+
+  SharedMapping* mapping_;
+  uint64_t delivered_;         // next frame to deliver to the callback
+  uint64_t dropped_;
+  bool zeroCopy_;
+  bool ended_;
+
+  uv_thread_t thread_;
+  bool waiting_;
+  std::atomic<bool> quit_;
+  uv_async_t* async_;
+  Nan::Persistent<v8::Function> callback_;
+
+public:
+  static NAN_MODULE_INIT(Init);
+};
+
+} // namespace streampunk
+
+#endif
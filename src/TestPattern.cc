@@ -0,0 +1,316 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "TestPattern.h"
+#include "Formats.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+namespace streampunk {
+
+static const double pi = 3.14159265358979323846;
+
+struct RGB { float r, g, b; };
+
+// 5x7 digits, most significant bit of the low five is the left column
+static const uint8_t digitFont[10][7] = {
+  { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e },
+  { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e },
+  { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f },
+  { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e },
+  { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 },
+  { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e },
+  { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e },
+  { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+  { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e },
+  { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c }
+};
+
+static const uint32_t counterDigits = 6;
+
+static const RGB ebuBars[8] = {
+  { 1.0f, 1.0f, 1.0f }, { 0.75f, 0.75f, 0.0f }, { 0.0f, 0.75f, 0.75f },
+  { 0.0f, 0.75f, 0.0f }, { 0.75f, 0.0f, 0.75f }, { 0.75f, 0.0f, 0.0f },
+  { 0.0f, 0.0f, 0.75f }, { 0.0f, 0.0f, 0.0f }
+};
+
+static const RGB smpteBars[7] = {
+  { 0.75f, 0.75f, 0.75f }, { 0.75f, 0.75f, 0.0f }, { 0.0f, 0.75f, 0.75f },
+  { 0.0f, 0.75f, 0.0f }, { 0.75f, 0.0f, 0.75f }, { 0.75f, 0.0f, 0.0f },
+  { 0.0f, 0.0f, 0.75f }
+};
+
+static const RGB smpteReverse[7] = {
+  { 0.0f, 0.0f, 0.75f }, { 0.0f, 0.0f, 0.0f }, { 0.75f, 0.0f, 0.75f },
+  { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.75f, 0.75f }, { 0.0f, 0.0f, 0.0f },
+  { 0.75f, 0.75f, 0.75f }
+};
+
+static const RGB minusI = { 0.0f, 0.129f, 0.298f };
+static const RGB plusQ = { 0.196f, 0.0f, 0.416f };
+
+bool parseTestPattern(const char* name, TestPatternType* type) {
+  if (strcmp(name, "black") == 0) *type = patternBlack;
+  else if (strcmp(name, "bars") == 0 || strcmp(name, "ebu") == 0) *type = patternBarsEBU;
+  else if (strcmp(name, "smpte") == 0) *type = patternBarsSMPTE;
+  else if (strcmp(name, "ramp") == 0) *type = patternRamp;
+  else if (strcmp(name, "zoneplate") == 0) *type = patternZonePlate;
+  else return false;
+  return true;
+}
+
+static inline void setGrey(RGB& p, float v) { p.r = p.g = p.b = v; }
+
+static void renderBackground(const TestPatternOptions& options, uint32_t width,
+    uint32_t height, uint32_t y, uint32_t frameIndex, RGB* line) {
+  switch (options.type) {
+    case patternBarsEBU:
+      for (uint32_t x = 0 ; x < width ; x++)
+        line[x] = ebuBars[(x * 8) / width];
+      break;
+    case patternBarsSMPTE: {
+      if (y < (height * 2) / 3) {
+        for (uint32_t x = 0 ; x < width ; x++)
+          line[x] = smpteBars[(x * 7) / width];
+      } else if (y < (height * 3) / 4) {
+        for (uint32_t x = 0 ; x < width ; x++)
+          line[x] = smpteReverse[(x * 7) / width];
+      } else {
+        // Bottom band in twelfths of a bar: -I, white, +Q, black, PLUGE, black
+        for (uint32_t x = 0 ; x < width ; x++) {
+          uint32_t u = (x * 84) / width;
+          if (u < 15) line[x] = minusI;
+          else if (u < 30) setGrey(line[x], 1.0f);
+          else if (u < 45) line[x] = plusQ;
+          else if (u < 60) setGrey(line[x], 0.0f);
+          else if (u < 64) setGrey(line[x], -0.04f);
+          else if (u < 68) setGrey(line[x], 0.0f);
+          else if (u < 72) setGrey(line[x], 0.04f);
+          else setGrey(line[x], 0.0f);
+        }
+      }
+      break;
+    }
+    case patternRamp:
+      for (uint32_t x = 0 ; x < width ; x++)
+        setGrey(line[x], (float) x / (width - 1));
+      break;
+    case patternZonePlate: {
+      // Frequency rises with radius to reach Nyquist at the picture edge
+      double k = pi / width;
+      double phase = frameIndex * pi / 4.0;
+      double dy = y - height / 2.0;
+      for (uint32_t x = 0 ; x < width ; x++) {
+        double dx = x - width / 2.0;
+        setGrey(line[x], (float) (0.5 + 0.5 * cos(k * (dx * dx + dy * dy) + phase)));
+      }
+      break;
+    }
+    default:
+      for (uint32_t x = 0 ; x < width ; x++)
+        setGrey(line[x], 0.0f);
+      break;
+  }
+}
+
+static void renderOverlays(const TestPatternOptions& options, uint32_t width,
+    uint32_t height, uint32_t y, uint32_t frameIndex, RGB* line) {
+  if (options.movingBox) {
+    uint32_t size = height / 6;
+    uint32_t cycle = options.cycle > 1 ? options.cycle : 1;
+    uint32_t travel = width > size ? width - size : 0;
+    uint32_t left = (uint32_t) (((uint64_t) (frameIndex % cycle) * travel) / cycle);
+    uint32_t top = (height - size) / 2;
+    if (y >= top && y < top + size)
+      for (uint32_t x = left ; x < left + size && x < width ; x++)
+        setGrey(line[x], 1.0f);
+  }
+
+  if (options.counter) {
+    uint32_t scale = height >= 108 ? height / 108 : 1;
+    uint32_t cell = 6 * scale;
+    uint32_t boxWidth = counterDigits * cell + scale;
+    uint32_t boxHeight = 9 * scale;
+    if (boxWidth > width) return;
+    uint32_t left = (width - boxWidth) / 2;
+    uint32_t top = (height * 3) / 4 - boxHeight / 2;
+    if (y < top || y >= top + boxHeight) return;
+
+    uint32_t row = (y - top) / scale; // font rows 1..7 inside a black box
+    char digits[counterDigits + 1];
+    uint32_t n = frameIndex;
+    for (int d = counterDigits - 1 ; d >= 0 ; d--, n /= 10)
+      digits[d] = (char) (n % 10);
+    for (uint32_t x = left ; x < left + boxWidth ; x++) {
+      float v = 0.0f;
+      uint32_t cx = x - left;
+      if (row >= 1 && row <= 7 && cx >= scale) {
+        uint32_t digit = (cx - scale) / cell;
+        uint32_t col = ((cx - scale) % cell) / scale;
+        if (col < 5 && (digitFont[(int) digits[digit]][row - 1] & (0x10 >> col)))
+          v = 1.0f;
+      }
+      setGrey(line[x], v);
+    }
+  }
+}
+
+static inline uint16_t clampCode(double v, uint16_t lo, uint16_t hi) {
+  long c = lround(v);
+  return (uint16_t) (c < lo ? lo : (c > hi ? hi : c));
+}
+
+static inline uint8_t fullRange8(float v) {
+  return (uint8_t) clampCode(v * 255.0, 0, 255);
+}
+
+static inline uint32_t videoRange10(float v) {
+  return clampCode(64.0 + v * 876.0, 4, 1019);
+}
+
+static inline uint32_t fullRange12(float v) {
+  return clampCode(v * 4095.0, 0, 4095);
+}
+
+// 12-bit RGB is a stream of 12-bit samples, red first, filling 32-bit words
+// from the least significant bit, so that eight pixels fill nine words. The
+// words are little-endian for R12L and big-endian for R12B.
+static void packRGB12Line(uint32_t pixelFormat, const RGB* line, uint32_t width,
+    uint8_t* dst) {
+  size_t bytes = rowBytesForFormat(pixelFormat, width);
+  size_t swap = (pixelFormat == bmdFormat12BitRGB) ? 3 : 0;
+  memset(dst, 0, bytes);
+  uint32_t bit = 0;
+  for (uint32_t x = 0 ; x < width ; x++) {
+    uint32_t samples[3] = { fullRange12(line[x].r), fullRange12(line[x].g),
+      fullRange12(line[x].b) };
+    for (int s = 0 ; s < 3 ; s++, bit += 12) {
+      uint32_t v = samples[s] << (bit & 7);
+      for (size_t b = bit >> 3 ; v != 0 ; b++, v >>= 8)
+        if ((b ^ swap) < bytes) dst[b ^ swap] |= (uint8_t) v;
+    }
+  }
+}
+
+static void packRGBLine(uint32_t pixelFormat, const RGB* line, uint32_t width,
+    uint8_t* dst) {
+  for (uint32_t x = 0 ; x < width ; x++, dst += 4) {
+    const RGB& p = line[x];
+    switch (pixelFormat) {
+      case bmdFormat8BitARGB:
+        dst[0] = 255; dst[1] = fullRange8(p.r); dst[2] = fullRange8(p.g); dst[3] = fullRange8(p.b);
+        break;
+      case bmdFormat8BitBGRA:
+        dst[0] = fullRange8(p.b); dst[1] = fullRange8(p.g); dst[2] = fullRange8(p.r); dst[3] = 255;
+        break;
+      default: {
+        uint32_t r = videoRange10(p.r), g = videoRange10(p.g), b = videoRange10(p.b);
+        uint32_t word = (pixelFormat == bmdFormat10BitRGB) ?
+          (r << 20) | (g << 10) | b :
+          (r << 22) | (g << 12) | (b << 2);
+        if (pixelFormat == bmdFormat10BitRGBXLE) {
+          dst[0] = (uint8_t) word; dst[1] = (uint8_t) (word >> 8);
+          dst[2] = (uint8_t) (word >> 16); dst[3] = (uint8_t) (word >> 24);
+        } else {
+          dst[0] = (uint8_t) (word >> 24); dst[1] = (uint8_t) (word >> 16);
+          dst[2] = (uint8_t) (word >> 8); dst[3] = (uint8_t) word;
+        }
+        break;
+      }
+    }
+  }
+}
+
+bool renderTestPattern(const TestPatternOptions& options, uint32_t width,
+    uint32_t height, uint32_t pixelFormat, uint32_t frameIndex,
+    uint8_t* dst, size_t rowBytes) {
+  bool yuv = isYUV422Format(pixelFormat);
+  if (!yuv && pixelFormat != bmdFormat8BitARGB && pixelFormat != bmdFormat8BitBGRA &&
+      pixelFormat != bmdFormat10BitRGB && pixelFormat != bmdFormat10BitRGBX &&
+      pixelFormat != bmdFormat10BitRGBXLE && pixelFormat != bmdFormat12BitRGB &&
+      pixelFormat != bmdFormat12BitRGBLE)
+    return false;
+  if (width < 2 || height == 0 || rowBytes < rowBytesForFormat(pixelFormat, width))
+    return false;
+
+  // Rec. 601 for SD, Rec. 709 for everything else
+  double kr = height < 720 ? 0.299 : 0.2126;
+  double kb = height < 720 ? 0.114 : 0.0722;
+  double kg = 1.0 - kr - kb;
+
+  uint32_t chromaWidth = (width + 1) / 2;
+  std::vector<RGB> line(width);
+  std::vector<uint16_t> y(width + 6), cb(chromaWidth + 3), cr(chromaWidth + 3);
+
+  for (uint32_t row = 0 ; row < height ; row++) {
+    renderBackground(options, width, height, row, frameIndex, &line[0]);
+    renderOverlays(options, width, height, row, frameIndex, &line[0]);
+    uint8_t* out = dst + row * rowBytes;
+    if (pixelFormat == bmdFormat12BitRGB || pixelFormat == bmdFormat12BitRGBLE) {
+      packRGB12Line(pixelFormat, &line[0], width, out);
+      continue;
+    }
+    if (!yuv) {
+      packRGBLine(pixelFormat, &line[0], width, out);
+      continue;
+    }
+    for (uint32_t x = 0 ; x < width ; x++) {
+      const RGB& p = line[x];
+      y[x] = clampCode(64.0 + 876.0 * (kr * p.r + kg * p.g + kb * p.b), 4, 1019);
+    }
+    for (uint32_t c = 0 ; c < chromaWidth ; c++) {
+      const RGB& p0 = line[c * 2];
+      const RGB& p1 = line[(c * 2 + 1 < width) ? c * 2 + 1 : c * 2];
+      double r = (p0.r + p1.r) / 2.0, g = (p0.g + p1.g) / 2.0, b = (p0.b + p1.b) / 2.0;
+      double luma = kr * r + kg * g + kb * b;
+      cb[c] = clampCode(512.0 + 896.0 * (b - luma) / (2.0 * (1.0 - kb)), 4, 1019);
+      cr[c] = clampCode(512.0 + 896.0 * (r - luma) / (2.0 * (1.0 - kr)), 4, 1019);
+    }
+    packLine(pixelFormat, &y[0], &cb[0], &cr[0], width, out);
+  }
+  return true;
+}
+
+NAN_METHOD(TestPattern) {
+  if (info.Length() < 4 || !info[3]->IsString()) {
+    Nan::ThrowTypeError("TestPattern requires width, height, pixel format and pattern name.");
+    return;
+  }
+  uint32_t width = Nan::To<uint32_t>(info[0]).FromJust();
+  uint32_t height = Nan::To<uint32_t>(info[1]).FromJust();
+  uint32_t pixelFormat = Nan::To<uint32_t>(info[2]).FromJust();
+  TestPatternOptions options;
+  Nan::Utf8String name(info[3]);
+  if (!parseTestPattern(*name, &options.type)) {
+    Nan::ThrowError("Unknown test pattern. Use black, ebu, smpte, ramp or zoneplate.");
+    return;
+  }
+  uint32_t frameIndex = info[4]->IsNumber() ? Nan::To<uint32_t>(info[4]).FromJust() : 0;
+  options.counter = Nan::To<bool>(info[5]).FromMaybe(false);
+  options.movingBox = Nan::To<bool>(info[6]).FromMaybe(false);
+  options.cycle = info[7]->IsNumber() ? Nan::To<uint32_t>(info[7]).FromJust() : 50;
+
+  size_t rowBytes = rowBytesForFormat(pixelFormat, width);
+  v8::Local<v8::Object> frame = Nan::NewBuffer(rowBytes * height).ToLocalChecked();
+  if (!renderTestPattern(options, width, height, pixelFormat, frameIndex,
+      (uint8_t*) node::Buffer::Data(frame), rowBytes)) {
+    Nan::ThrowError("Test patterns cannot be generated for this pixel format and size.");
+    return;
+  }
+  info.GetReturnValue().Set(frame);
+}
+
+} // namespace streampunk
@@ -0,0 +1,56 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef TESTPATTERN_H
+#define TESTPATTERN_H
+
+#include <nan.h>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace streampunk {
+
+enum TestPatternType {
+  patternBlack = 0,
+  patternBarsEBU,     // EBU 100/0/75/0 full field bars
+  patternBarsSMPTE,   // SMPTE EG 1 bars with reverse blue, -I/+Q and PLUGE
+  patternRamp,        // horizontal black to white ramp
+  patternZonePlate    // circular luma zone plate, phase advances per frame
+};
+
+struct TestPatternOptions {
+  TestPatternType type;
+  bool counter;       // burn the frame number into the picture
+  bool movingBox;     // a white box that crosses the picture once per cycle
+  uint32_t cycle;     // frames for the box to cross the picture
+};
+
+bool parseTestPattern(const char* name, TestPatternType* type);
+
+// Renders one frame of the pattern for frame number frameIndex. Supports the
+// YUV (2vuy, v210), 8-bit RGB (ARGB, BGRA), 10-bit RGB (r210, R10b, R10l)
+// and 12-bit RGB (R12B, R12L) formats. Returns false for formats that cannot
+// be generated.
+bool renderTestPattern(const TestPatternOptions& options, uint32_t width,
+  uint32_t height, uint32_t pixelFormat, uint32_t frameIndex,
+  uint8_t* dst, size_t rowBytes);
+
+// testPattern(width, height, pixelFormat, pattern [, frameIndex [, counter
+//   [, movingBox [, cycle]]]]) -> Buffer
+NAN_METHOD(TestPattern);
+
+} // namespace streampunk
+
+#endif
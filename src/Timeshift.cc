@@ -0,0 +1,333 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Timeshift.h"
+#include <string.h>
+#include <new>
+#include <vector>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace streampunk {
+
+static const size_t pageBytes = 4096;
+static const size_t hugePageBytes = 2 * 1024 * 1024;
+
+static size_t roundUp(size_t value, size_t to) {
+  return (value + to - 1) / to * to;
+}
+
+// At the start of the mapping, followed by one entry per slot and then the
+// slots themselves, page aligned. A ring file is only meaningful while its
+// writer is running and is recreated each time.
+struct Timeshift::Header {
+  char magic[8];
+  uint32_t slots;
+  uint32_t frameBytes;
+  uint32_t audioBytes;
+  uint32_t reserved;
+  uint64_t slotBytes;
+  std::atomic<uint64_t> next;
+};
+
+struct Timeshift::Entry {
+  std::atomic<uint64_t> sequence; // frame number + 1, 0 while being written
+  int64_t streamTime;
+  uint32_t videoBytes;
+  uint32_t audioBytes;
+  uint64_t reserved;
+};
+
+inline Nan::Persistent<v8::Function> &Timeshift::constructor() {
+  static thread_local Nan::Persistent<v8::Function> myConstructor;
+  return myConstructor;
+}
+
+Timeshift::Timeshift() : base_(NULL), size_(0), header_(NULL), entries_(NULL),
+    slots_(NULL), slotCount_(0), frameBytes_(0), audioBytes_(0), slotBytes_(0),
+    hugePages_(false),
+#ifdef WIN32
+    file_(NULL), mapping_(NULL)
+#else
+    fd_(-1)
+#endif
+{}
+
+Timeshift::~Timeshift() {
+  unmap();
+}
+
+NAN_MODULE_INIT(Timeshift::Init) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+  tpl->SetClassName(Nan::New("Timeshift").ToLocalChecked());
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  Nan::SetPrototypeMethod(tpl, "status", Status);
+  Nan::SetPrototypeMethod(tpl, "read", Read);
+
+  constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  resetOnCleanup(&constructor());
+  Nan::Set(target, Nan::New("Timeshift").ToLocalChecked(),
+               Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+bool Timeshift::IsTimeshift(v8::Local<v8::Value> value) {
+  if (!value->IsObject()) return false;
+  v8::Local<v8::Function> cons = Nan::New(constructor());
+  return Nan::To<v8::Object>(value).ToLocalChecked()->InstanceOf(
+    Nan::GetCurrentContext(), cons).FromMaybe(false);
+}
+
+// new Timeshift(frames, frameBytes, audioBytes[, path[, hugePages]])
+NAN_METHOD(Timeshift::New) {
+  if (info.IsConstructCall()) {
+    uint32_t frames = Nan::To<uint32_t>(info[0]).FromMaybe(0);
+    uint32_t frameBytes = Nan::To<uint32_t>(info[1]).FromMaybe(0);
+    uint32_t audioBytes = Nan::To<uint32_t>(info[2]).FromMaybe(0);
+    if (frames < 2 || frameBytes == 0) {
+      Nan::ThrowRangeError("Timeshift needs at least two frames of a non-zero size.");
+      return;
+    }
+    std::string path;
+    if (info[3]->IsString()) path = *Nan::Utf8String(info[3]);
+    bool hugePages = Nan::To<bool>(info[4]).FromMaybe(false);
+    Timeshift* obj = new Timeshift();
+    if (!obj->map(frames, frameBytes, audioBytes, path, hugePages)) {
+      delete obj;
+      Nan::ThrowError(path.empty() ? "Unable to allocate timeshift memory." :
+        "Unable to create and map timeshift file.");
+      return;
+    }
+    obj->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+  } else {
+    const int argc = 5;
+    v8::Local<v8::Value> argv[argc] = { info[0], info[1], info[2], info[3], info[4] };
+    v8::Local<v8::Function> cons = Nan::New(constructor());
+    info.GetReturnValue().Set(Nan::NewInstance(cons, argc, argv).ToLocalChecked());
+  }
+}
+
+bool Timeshift::map(uint32_t slots, uint32_t frameBytes, uint32_t audioBytes,
+    const std::string& path, bool hugePages) {
+  size_t entryOffset = roundUp(sizeof(Header), 64);
+  size_t slotOffset = roundUp(entryOffset + slots * sizeof(Entry), pageBytes);
+  slotBytes_ = roundUp((size_t) frameBytes + audioBytes, pageBytes);
+  size_ = slotOffset + slots * slotBytes_;
+  path_ = path;
+
+#ifdef WIN32
+  hugePages_ = false; // large pages need a privilege most users do not have
+  if (!path.empty()) {
+    file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+      NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) {
+      file_ = NULL;
+      return false;
+    }
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE,
+      (DWORD) ((uint64_t) size_ >> 32), (DWORD) (size_ & 0xffffffff), NULL);
+    if (mapping_ != NULL)
+      base_ = (uint8_t*) MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size_);
+  } else {
+    base_ = (uint8_t*) VirtualAlloc(NULL, size_, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  }
+  if (base_ == NULL) {
+    unmap();
+    return false;
+  }
+#else
+  void* base = MAP_FAILED;
+  if (!path.empty()) {
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) return false;
+    // Allocate the blocks up front so that recording never waits on them
+#ifdef __linux__
+    if (posix_fallocate(fd_, 0, (off_t) size_) != 0 && ftruncate(fd_, (off_t) size_) != 0) {
+#else
+    if (ftruncate(fd_, (off_t) size_) != 0) {
+#endif
+      unmap();
+      return false;
+    }
+    base = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  } else {
+#ifdef MAP_HUGETLB
+    if (hugePages) {
+      size_t hugeSize = roundUp(size_, hugePageBytes);
+      base = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (base != MAP_FAILED) size_ = hugeSize;
+    }
+#endif
+    hugePages_ = (base != MAP_FAILED);
+    if (base == MAP_FAILED)
+      base = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if (base == MAP_FAILED) {
+    unmap();
+    return false;
+  }
+  base_ = (uint8_t*) base;
+#endif
+
+  // The mapping starts zeroed, so every slot reads as empty
+  header_ = new (base_) Header;
+  memcpy(header_->magic, "MACTSHFT", 8);
+  header_->slots = slots;
+  header_->frameBytes = frameBytes;
+  header_->audioBytes = audioBytes;
+  header_->slotBytes = slotBytes_;
+  header_->next.store(0);
+  entries_ = (Entry*) (base_ + entryOffset);
+  for (uint32_t x = 0 ; x < slots ; x++)
+    new (&entries_[x]) Entry;
+  slots_ = base_ + slotOffset;
+  slotCount_ = slots;
+  frameBytes_ = frameBytes;
+  audioBytes_ = audioBytes;
+  return true;
+}
+
+void Timeshift::unmap() {
+#ifdef WIN32
+  if (base_ != NULL) {
+    if (mapping_ != NULL) UnmapViewOfFile(base_);
+    else VirtualFree(base_, 0, MEM_RELEASE);
+  }
+  if (mapping_ != NULL) CloseHandle(mapping_);
+  if (file_ != NULL) CloseHandle(file_);
+  mapping_ = NULL;
+  file_ = NULL;
+#else
+  if (base_ != NULL) munmap(base_, size_);
+  if (fd_ >= 0) close(fd_);
+  fd_ = -1;
+#endif
+  base_ = NULL;
+  header_ = NULL;
+}
+
+Timeshift::Entry* Timeshift::entry(uint64_t frame) const {
+  return &entries_[frame % slotCount_];
+}
+
+uint8_t* Timeshift::slot(uint64_t frame) const {
+  return slots_ + (size_t) (frame % slotCount_) * slotBytes_;
+}
+
+uint64_t Timeshift::next() const {
+  return header_->next.load(std::memory_order_acquire);
+}
+
+// The slot after the newest frame may be in the middle of being rewritten
+uint64_t Timeshift::oldest() const {
+  uint64_t n = next();
+  return n >= slotCount_ ? n - slotCount_ + 1 : 0;
+}
+
+void Timeshift::write(const uint8_t* video, uint32_t videoBytes, const uint8_t* audio,
+    uint32_t audioBytes, int64_t streamTime) {
+  uint64_t frame = header_->next.load(std::memory_order_relaxed);
+  Entry* e = entry(frame);
+  uint8_t* data = slot(frame);
+  if (videoBytes > frameBytes_) videoBytes = frameBytes_;
+  if (audioBytes > audioBytes_ || audio == NULL) audioBytes = audio == NULL ? 0 : audioBytes_;
+
+  e->sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(data, video, videoBytes);
+  if (audioBytes > 0)
+    memcpy(data + frameBytes_, audio, audioBytes);
+  e->streamTime = streamTime;
+  e->videoBytes = videoBytes;
+  e->audioBytes = audioBytes;
+  e->sequence.store(frame + 1, std::memory_order_release);
+  header_->next.store(frame + 1, std::memory_order_release);
+}
+
+bool Timeshift::read(uint64_t frame, uint8_t* video, uint32_t maxVideo, uint32_t* videoBytes,
+    uint8_t* audio, uint32_t* audioBytes, int64_t* streamTime) const {
+  if (frame >= next() || frame < oldest()) return false;
+  const Entry* e = entry(frame);
+  const uint8_t* data = slot(frame);
+  if (e->sequence.load(std::memory_order_acquire) != frame + 1) return false;
+
+  uint32_t vb = e->videoBytes, ab = e->audioBytes;
+  if (vb > maxVideo) vb = maxVideo;
+  if (ab > audioBytes_) ab = audioBytes_;
+  *streamTime = e->streamTime;
+  memcpy(video, data, vb);
+  if (audio != NULL && ab > 0)
+    memcpy(audio, data + frameBytes_, ab);
+
+  // Overwritten while copying?
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (e->sequence.load(std::memory_order_relaxed) != frame + 1) return false;
+  *videoBytes = vb;
+  *audioBytes = audio != NULL ? ab : 0;
+  return true;
+}
+
+NAN_METHOD(Timeshift::Status) {
+  Timeshift* obj = ObjectWrap::Unwrap<Timeshift>(info.Holder());
+  v8::Local<v8::Object> status = Nan::New<v8::Object>();
+  Nan::Set(status, Nan::New("capacity").ToLocalChecked(), Nan::New(obj->slotCount_));
+  Nan::Set(status, Nan::New("next").ToLocalChecked(), Nan::New((double) obj->next()));
+  Nan::Set(status, Nan::New("oldest").ToLocalChecked(), Nan::New((double) obj->oldest()));
+  Nan::Set(status, Nan::New("frameBytes").ToLocalChecked(), Nan::New(obj->frameBytes_));
+  Nan::Set(status, Nan::New("audioBytes").ToLocalChecked(), Nan::New(obj->audioBytes_));
+  Nan::Set(status, Nan::New("bytes").ToLocalChecked(), Nan::New((double) obj->size_));
+  Nan::Set(status, Nan::New("hugePages").ToLocalChecked(), Nan::New(obj->hugePages_));
+  if (!obj->path_.empty())
+    Nan::Set(status, Nan::New("path").ToLocalChecked(), Nan::New(obj->path_).ToLocalChecked());
+  info.GetReturnValue().Set(status);
+}
+
+// read(frame) -> { frame, video, audio, streamTime } copied out, or null
+NAN_METHOD(Timeshift::Read) {
+  Timeshift* obj = ObjectWrap::Unwrap<Timeshift>(info.Holder());
+  double frame = Nan::To<double>(info[0]).FromMaybe(-1.0);
+  if (frame < 0.0) {
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  v8::Local<v8::Object> video = Nan::NewBuffer(obj->frameBytes_).ToLocalChecked();
+  std::vector<uint8_t> audio(obj->audioBytes_);
+  uint32_t videoBytes = 0, audioBytes = 0;
+  int64_t streamTime = 0;
+  if (!obj->read((uint64_t) frame, (uint8_t*) node::Buffer::Data(video), obj->frameBytes_,
+      &videoBytes, audio.empty() ? NULL : &audio[0], &audioBytes, &streamTime)) {
+    info.GetReturnValue().SetNull();
+    return;
+  }
+  if (videoBytes < obj->frameBytes_)
+    video = Nan::CopyBuffer(node::Buffer::Data(video), videoBytes).ToLocalChecked();
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("frame").ToLocalChecked(), Nan::New(frame));
+  Nan::Set(result, Nan::New("video").ToLocalChecked(), video);
+  Nan::Set(result, Nan::New("audio").ToLocalChecked(),
+    Nan::CopyBuffer((const char*) audio.data(), audioBytes).ToLocalChecked());
+  Nan::Set(result, Nan::New("streamTime").ToLocalChecked(), Nan::New((double) streamTime));
+  info.GetReturnValue().Set(result);
+}
+
+} // namespace streampunk
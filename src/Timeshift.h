@@ -0,0 +1,98 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef TIMESHIFT_H
+#define TIMESHIFT_H
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <node_buffer.h>
+#include <nan.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "Environment.h"
+
+namespace streampunk {
+
+// A fixed number of frame slots, each with room for a video frame and its
+// audio, in one preallocated mapping - of a file, or of (huge page) memory.
+// One writer, normally a Capture, records continuously; any number of
+// readers copy out past frames while it does. No locks are taken: every slot
+// has a sequence number that the writer clears before rewriting the slot, so
+// a reader can tell whether what it copied was overwritten meanwhile.
+class Timeshift : public Nan::ObjectWrap
+{
+private:
+  Timeshift();
+  ~Timeshift();
+
+  static NAN_METHOD(New);
+  static inline Nan::Persistent<v8::Function> &constructor();
+
+  static NAN_METHOD(Status);
+  static NAN_METHOD(Read);
+
+  bool map(uint32_t slots, uint32_t frameBytes, uint32_t audioBytes,
+    const std::string& path, bool hugePages);
+  void unmap();
+
+  struct Header;
+  struct Entry;
+  Entry* entry(uint64_t frame) const;
+  uint8_t* slot(uint64_t frame) const;
+
+  uint8_t* base_;
+  size_t size_;
+  Header* header_;
+  Entry* entries_;
+  uint8_t* slots_;
+  uint32_t slotCount_;
+  uint32_t frameBytes_;
+  uint32_t audioBytes_;
+  size_t slotBytes_;
+  std::string path_;
+  bool hugePages_;
+#ifdef WIN32
+  void* file_;
+  void* mapping_;
+#else
+  int fd_;
+#endif
+
+public:
+  static NAN_MODULE_INIT(Init);
+  static bool IsTimeshift(v8::Local<v8::Value> value);
+
+  uint32_t frameBytes() const { return frameBytes_; }
+  uint32_t audioBytes() const { return audioBytes_; }
+  uint32_t capacity() const { return slotCount_; }
+  // The number of the next frame to be written, so the count written so far.
+  uint64_t next() const;
+  // The oldest frame that can still be read.
+  uint64_t oldest() const;
+
+  // From the writer only. Video and audio beyond the slot sizes is dropped.
+  void write(const uint8_t* video, uint32_t videoBytes, const uint8_t* audio,
+    uint32_t audioBytes, int64_t streamTime);
+  // Copies up to maxVideo bytes of video, and all the audio if audio is not
+  // NULL. Returns false if the frame has not been written or was overwritten.
+  bool read(uint64_t frame, uint8_t* video, uint32_t maxVideo, uint32_t* videoBytes,
+    uint8_t* audio, uint32_t* audioBytes, int64_t* streamTime) const;
+};
+
+} // namespace streampunk
+
+#endif
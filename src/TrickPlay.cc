@@ -0,0 +1,255 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "TrickPlay.h"
+#include <string.h>
+#include <math.h>
+
+#ifdef WIN32
+#define clipSeek _fseeki64
+#define clipTell _ftelli64
+#else
+#define clipSeek fseeko
+#define clipTell ftello
+#endif
+
+namespace streampunk {
+
+const double TrickPlayer::maxSpeed = 8.0;
+
+TrickPlayer::TrickPlayer() : file_(NULL), frames_(0), codec_(NULL), quit_(false),
+    position_(0.0), speed_(0.0) {
+  uv_mutex_init(&lock_);
+  uv_cond_init(&wake_);
+  memset(&stats_, 0, sizeof(stats_));
+  stats_.shown = -1;
+}
+
+TrickPlayer::~TrickPlayer() {
+  close();
+  uv_cond_destroy(&wake_);
+  uv_mutex_destroy(&lock_);
+}
+
+bool TrickPlayer::open(const char* path, const ClipLayout& layout, uint32_t cacheFrames) {
+  close();
+  if (layout.frameBytes == 0 || cacheFrames < 2) return false;
+  file_ = fopen(path, "rb");
+  if (file_ == NULL) return false;
+  layout_ = layout;
+  if (coded_.open(file_, layout.headerBytes)) {
+    codec_ = new LosslessCodec(LosslessCodec::defaultThreads());
+    frames_ = coded_.frames();
+  } else {
+    clipSeek(file_, 0, SEEK_END);
+    int64_t size = clipTell(file_);
+    uint64_t stride = (uint64_t) layout.framePrefix + layout.frameBytes;
+    if (size < 0 || (uint64_t) size < layout.headerBytes + stride) {
+      fclose(file_);
+      file_ = NULL;
+      return false;
+    }
+    frames_ = ((uint64_t) size - layout.headerBytes) / stride;
+  }
+  slots_.resize(cacheFrames);
+  for (size_t x = 0 ; x < slots_.size() ; x++) {
+    slots_[x].index = -1;
+    slots_[x].ready = false;
+    slots_[x].loading = false;
+    slots_[x].data.resize(layout.frameBytes);
+  }
+  // The first frame is read now, so there is always a frame to show
+  last_.resize(layout.frameBytes);
+  if (!readFrame(0, &last_[0])) {
+    fclose(file_);
+    file_ = NULL;
+    delete codec_;
+    codec_ = NULL;
+    return false;
+  }
+  position_ = 0.0;
+  speed_ = 0.0;
+  memset(&stats_, 0, sizeof(stats_));
+  stats_.shown = -1;
+  quit_ = false;
+  uv_thread_create(&thread_, readAhead, this);
+  return true;
+}
+
+void TrickPlayer::close() {
+  if (file_ == NULL) return;
+  uv_mutex_lock(&lock_);
+  quit_ = true;
+  uv_cond_signal(&wake_);
+  uv_mutex_unlock(&lock_);
+  uv_thread_join(&thread_);
+  fclose(file_);
+  file_ = NULL;
+  delete codec_;
+  codec_ = NULL;
+  slots_.clear();
+}
+
+void TrickPlayer::setSpeed(double speed) {
+  if (speed > maxSpeed) speed = maxSpeed;
+  if (speed < -maxSpeed) speed = -maxSpeed;
+  uv_mutex_lock(&lock_);
+  speed_ = speed;
+  uv_cond_signal(&wake_);
+  uv_mutex_unlock(&lock_);
+}
+
+void TrickPlayer::seek(double frame) {
+  uv_mutex_lock(&lock_);
+  position_ = (double) clampFrame(frame);
+  uv_cond_signal(&wake_);
+  uv_mutex_unlock(&lock_);
+}
+
+void TrickPlayer::step(int32_t frames) {
+  uv_mutex_lock(&lock_);
+  speed_ = 0.0;
+  position_ = (double) clampFrame(floor(position_ + 0.5) + frames);
+  uv_cond_signal(&wake_);
+  uv_mutex_unlock(&lock_);
+}
+
+TrickPlayer::Status TrickPlayer::status() {
+  uv_mutex_lock(&lock_);
+  Status status = stats_;
+  status.position = position_;
+  status.speed = speed_;
+  uv_mutex_unlock(&lock_);
+  return status;
+}
+
+int64_t TrickPlayer::clampFrame(double position) const {
+  if (frames_ == 0 || position <= 0.0) return 0;
+  int64_t frame = (int64_t) floor(position + 0.5);
+  return frame >= (int64_t) frames_ ? (int64_t) frames_ - 1 : frame;
+}
+
+int64_t TrickPlayer::next(uint8_t* dest) {
+  uv_mutex_lock(&lock_);
+  if (file_ == NULL) {
+    uv_mutex_unlock(&lock_);
+    return -1;
+  }
+  int64_t frame = clampFrame(position_);
+  const Slot* found = NULL;
+  for (size_t x = 0 ; x < slots_.size() ; x++)
+    if (slots_[x].index == frame && slots_[x].ready)
+      found = &slots_[x];
+  if (found != NULL) {
+    memcpy(&last_[0], &found->data[0], layout_.frameBytes);
+    stats_.shown = frame;
+    stats_.hits++;
+  } else {
+    stats_.misses++;
+  }
+  memcpy(dest, &last_[0], layout_.frameBytes);
+
+  // Hold on the first or last frame when playing off either end
+  position_ += speed_;
+  if (position_ < 0.0 || position_ > (double) (frames_ - 1)) {
+    position_ = (double) clampFrame(position_);
+    speed_ = 0.0;
+  }
+  int64_t shown = stats_.shown;
+  uv_cond_signal(&wake_);
+  uv_mutex_unlock(&lock_);
+  return shown;
+}
+
+// Call with lock_ held. Frames the play head will reach next, nearest first.
+// When paused, frames either side so that jogging is immediate.
+void TrickPlayer::wanted(std::vector<int64_t>& indices) const {
+  indices.clear();
+  size_t count = slots_.size() - 1;
+  for (size_t k = 0 ; indices.size() < count && k < 4 * count ; k++) {
+    int64_t frame;
+    if (speed_ != 0.0)
+      frame = clampFrame(position_ + k * speed_);
+    else
+      frame = clampFrame(position_ + ((k & 1) ? (double) (k + 1) / 2 : -(double) k / 2));
+    bool seen = false;
+    for (size_t x = 0 ; x < indices.size() ; x++)
+      if (indices[x] == frame) seen = true;
+    if (!seen) indices.push_back(frame);
+  }
+}
+
+// On the read ahead thread, or before it starts
+bool TrickPlayer::readFrame(uint64_t index, uint8_t* dest) {
+  if (codec_ != NULL)
+    return coded_.read(file_, index, *codec_, dest, layout_.frameBytes);
+  uint64_t stride = (uint64_t) layout_.framePrefix + layout_.frameBytes;
+  return clipSeek(file_, (int64_t) (layout_.headerBytes + index * stride +
+      layout_.framePrefix), SEEK_SET) == 0 &&
+    fread(dest, 1, layout_.frameBytes, file_) == layout_.frameBytes;
+}
+
+void TrickPlayer::readAhead(void* arg) {
+  TrickPlayer* player = static_cast<TrickPlayer*>(arg);
+  std::vector<int64_t> indices;
+  uv_mutex_lock(&player->lock_);
+  while (!player->quit_) {
+    std::vector<Slot>& slots = player->slots_;
+    player->wanted(indices);
+
+    // The nearest wanted frame not cached, and a slot holding nothing wanted
+    int64_t load = -1;
+    for (size_t w = 0 ; w < indices.size() && load < 0 ; w++) {
+      bool cached = false;
+      for (size_t x = 0 ; x < slots.size() ; x++)
+        if (slots[x].index == indices[w]) cached = true;
+      if (!cached) load = indices[w];
+    }
+    Slot* slot = NULL;
+    for (size_t x = 0 ; x < slots.size() && load >= 0 && slot == NULL ; x++) {
+      if (slots[x].loading) continue;
+      bool keep = false;
+      for (size_t w = 0 ; w < indices.size() ; w++)
+        if (slots[x].index == indices[w]) keep = true;
+      if (!keep) slot = &slots[x];
+    }
+    if (slot == NULL) {
+      uv_cond_wait(&player->wake_, &player->lock_);
+      continue;
+    }
+
+    slot->index = load;
+    slot->ready = false;
+    slot->loading = true;
+    uv_mutex_unlock(&player->lock_);
+
+    bool ok = player->readFrame((uint64_t) load, &slot->data[0]);
+
+    uv_mutex_lock(&player->lock_);
+    slot->loading = false;
+    slot->ready = ok;
+    player->stats_.reads++;
+    // Free the slot so the frame is tried again, but not before the next
+    // output frame or change of play head, so a bad frame cannot spin.
+    if (!ok) {
+      slot->index = -1;
+      if (!player->quit_)
+        uv_cond_wait(&player->wake_, &player->lock_);
+    }
+  }
+  uv_mutex_unlock(&player->lock_);
+}
+
+} // namespace streampunk
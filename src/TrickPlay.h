@@ -0,0 +1,107 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef TRICKPLAY_H
+#define TRICKPLAY_H
+
+#include <uv.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "Lossless.h"
+
+namespace streampunk {
+
+// Where the frames are in a clip file: an optional file header, then frames
+// of frameBytes each preceded by framePrefix bytes, as raw captures (no
+// prefix) or Y4M ("FRAME\n") are laid out. A file of frames from the
+// lossless codec, after any header, is found by its frame headers instead and
+// frameBytes is then the size the frames decode to.
+struct ClipLayout {
+  uint64_t headerBytes;
+  uint32_t framePrefix;
+  uint32_t frameBytes;
+};
+
+// Plays an indexed clip at any speed from -8x to 8x by repeating or skipping
+// frames, with frame-by-frame jogging. A thread reads ahead of the play head,
+// in the direction of play, into a small cache. When a frame is not there in
+// time the last one is shown again.
+class TrickPlayer {
+public:
+  TrickPlayer();
+  ~TrickPlayer();
+
+  // Starts the read ahead thread. Returns false if the file cannot be read.
+  bool open(const char* path, const ClipLayout& layout, uint32_t cacheFrames);
+  void close();
+  bool isOpen() const { return file_ != NULL; }
+  uint64_t frames() const { return frames_; }
+
+  static const double maxSpeed;
+
+  // Speed 0 pauses. Stepping pauses and moves by whole frames.
+  void setSpeed(double speed);
+  void seek(double frame);
+  void step(int32_t frames);
+
+  struct Status {
+    double position;
+    double speed;
+    int64_t shown;     // last frame copied out
+    uint64_t hits;
+    uint64_t misses;   // output frames repeated waiting for the cache
+    uint64_t reads;
+  };
+  Status status();
+
+  // Once per output frame: copies the frame at the play head into dest and
+  // advances by the speed. Returns the frame shown, or -1 if nothing could be.
+  int64_t next(uint8_t* dest);
+
+private:
+  struct Slot {
+    int64_t index;     // -1 when empty
+    bool ready;
+    bool loading;
+    std::vector<uint8_t> data;
+  };
+
+  static void readAhead(void* arg);
+  bool readFrame(uint64_t index, uint8_t* dest);
+  void wanted(std::vector<int64_t>& indices) const;
+  int64_t clampFrame(double position) const;
+
+  FILE* file_;
+  ClipLayout layout_;
+  uint64_t frames_;
+  LosslessClip coded_;
+  LosslessCodec* codec_;     // for a coded file, NULL for raw
+  std::vector<Slot> slots_;
+  std::vector<uint8_t> last_;
+
+  uv_thread_t thread_;
+  uv_mutex_t lock_;
+  uv_cond_t wake_;
+  bool quit_;
+
+  double position_;
+  double speed_;
+  Status stats_;
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,385 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "WaveFile.h"
+#include <string.h>
+#include <errno.h>
+
+#ifdef WIN32
+#define waveSeek _fseeki64
+#else
+#define waveSeek fseeko
+#endif
+
+namespace streampunk {
+
+static const uint32_t junkBytes = 28;      // room for a ds64 chunk with no table
+static const uint32_t bextBytes = 602;     // fixed part of the bext chunk
+
+static void put16(std::vector<uint8_t>& b, uint32_t value) {
+  b.push_back((uint8_t) value);
+  b.push_back((uint8_t) (value >> 8));
+}
+
+static void put32(std::vector<uint8_t>& b, uint32_t value) {
+  put16(b, value & 0xffff);
+  put16(b, value >> 16);
+}
+
+static void put64(std::vector<uint8_t>& b, uint64_t value) {
+  put32(b, (uint32_t) value);
+  put32(b, (uint32_t) (value >> 32));
+}
+
+static void putTag(std::vector<uint8_t>& b, const char* tag) {
+  b.insert(b.end(), tag, tag + 4);
+}
+
+// Fixed width ASCII, truncated or padded with NULs.
+static void putText(std::vector<uint8_t>& b, const std::string& text, size_t width) {
+  size_t length = text.size() < width ? text.size() : width;
+  b.insert(b.end(), text.begin(), text.begin() + length);
+  b.insert(b.end(), width - length, 0);
+}
+
+static bool patch(FILE* file, uint64_t offset, const std::vector<uint8_t>& bytes) {
+  return waveSeek(file, (int64_t) offset, SEEK_SET) == 0 &&
+    fwrite(&bytes[0], 1, bytes.size(), file) == bytes.size();
+}
+
+WaveWriter::WaveWriter(uint64_t riffLimit) : riffLimit_(riffLimit), file_(NULL),
+    blockAlign_(0), junkOffset_(0), dataOffset_(0), dataBytes_(0), rf64_(false),
+    failed_(false), buffered_(0) {}
+
+WaveWriter::~WaveWriter() {
+  close();
+}
+
+bool WaveWriter::open(const std::string& path, uint32_t channels, uint32_t bits,
+    uint32_t sampleRate, const BextInfo& bext, uint32_t bufferBytes) {
+  close();
+  file_ = fopen(path.c_str(), "wb");
+  if (file_ == NULL) return false;
+  // Writes are already gathered into buffer_
+  setvbuf(file_, NULL, _IONBF, 0);
+  blockAlign_ = channels * (bits / 8);
+  dataBytes_ = 0;
+  rf64_ = false;
+  failed_ = false;
+  buffer_.resize(bufferBytes < blockAlign_ ? blockAlign_ : bufferBytes);
+  buffered_ = 0;
+
+  std::vector<uint8_t> header;
+  putTag(header, "RIFF");
+  put32(header, 0);
+  putTag(header, "WAVE");
+
+  junkOffset_ = header.size();
+  putTag(header, "JUNK");
+  put32(header, junkBytes);
+  header.insert(header.end(), junkBytes, 0);
+
+  // WAVE_FORMAT_EXTENSIBLE for more than two channels or more than 16 bits
+  bool extensible = channels > 2 || bits > 16;
+  static const uint8_t pcmGuid[16] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+    0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+  putTag(header, "fmt ");
+  put32(header, extensible ? 40 : 16);
+  put16(header, extensible ? 0xfffe : 1);
+  put16(header, channels);
+  put32(header, sampleRate);
+  put32(header, sampleRate * blockAlign_);
+  put16(header, blockAlign_);
+  put16(header, bits);
+  if (extensible) {
+    put16(header, 22);
+    put16(header, bits);
+    put32(header, 0); // no speaker positions
+    header.insert(header.end(), pcmGuid, pcmGuid + 16);
+  }
+
+  uint32_t historyBytes = (uint32_t) bext.codingHistory.size();
+  putTag(header, "bext");
+  put32(header, bextBytes + historyBytes);
+  putText(header, bext.description, 256);
+  putText(header, bext.originator, 32);
+  putText(header, bext.originatorReference, 32);
+  putText(header, bext.date, 10);
+  putText(header, bext.time, 8);
+  put64(header, bext.timeReference);
+  put16(header, 1); // version, with no UMID or loudness values
+  header.insert(header.end(), 64 + 190, 0);
+  header.insert(header.end(), bext.codingHistory.begin(), bext.codingHistory.end());
+  if (historyBytes & 1) header.push_back(0);
+
+  putTag(header, "data");
+  dataOffset_ = header.size();
+  put32(header, 0);
+
+  if (fwrite(&header[0], 1, header.size(), file_) != header.size()) {
+    fclose(file_);
+    file_ = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool WaveWriter::flush() {
+  if (buffered_ > 0 && fwrite(&buffer_[0], 1, buffered_, file_) != buffered_)
+    failed_ = true;
+  buffered_ = 0;
+  return !failed_;
+}
+
+bool WaveWriter::write(const uint8_t* data, size_t bytes) {
+  if (file_ == NULL || failed_) return false;
+  dataBytes_ += bytes;
+  while (bytes > 0) {
+    size_t room = buffer_.size() - buffered_;
+    size_t chunk = bytes < room ? bytes : room;
+    memcpy(&buffer_[buffered_], data, chunk);
+    buffered_ += chunk;
+    data += chunk;
+    bytes -= chunk;
+    if (buffered_ == buffer_.size() && !flush()) return false;
+  }
+  return true;
+}
+
+bool WaveWriter::close() {
+  if (file_ == NULL) return false;
+  flush();
+  if ((dataBytes_ & 1) && fputc(0, file_) == EOF)
+    failed_ = true;
+
+  uint64_t riffBytes = dataOffset_ + 4 + dataBytes_ + (dataBytes_ & 1) - 8;
+  std::vector<uint8_t> bytes;
+  rf64_ = riffBytes > riffLimit_;
+  if (rf64_) {
+    putTag(bytes, "RF64");
+    put32(bytes, 0xffffffff);
+    if (!patch(file_, 0, bytes)) failed_ = true;
+    bytes.clear();
+    putTag(bytes, "ds64");
+    put32(bytes, junkBytes);
+    put64(bytes, riffBytes);
+    put64(bytes, dataBytes_);
+    put64(bytes, blockAlign_ > 0 ? dataBytes_ / blockAlign_ : 0);
+    put32(bytes, 0); // no table
+    if (!patch(file_, junkOffset_, bytes)) failed_ = true;
+    bytes.clear();
+    put32(bytes, 0xffffffff);
+    if (!patch(file_, dataOffset_, bytes)) failed_ = true;
+  } else {
+    put32(bytes, (uint32_t) riffBytes);
+    if (!patch(file_, 4, bytes)) failed_ = true;
+    bytes.clear();
+    put32(bytes, (uint32_t) dataBytes_);
+    if (!patch(file_, dataOffset_, bytes)) failed_ = true;
+  }
+  if (fclose(file_) != 0) failed_ = true;
+  file_ = NULL;
+  return !failed_;
+}
+
+AudioRecorder::AudioRecorder() : sampleRate_(48000), channels_(2),
+    inputBytes_(2), running_(false), quit_(false), started_(false),
+    opened_(false) {
+  uv_mutex_init(&lock_);
+  uv_cond_init(&work_);
+  status_ = Status();
+}
+
+AudioRecorder::~AudioRecorder() {
+  stop();
+  uv_cond_destroy(&work_);
+  uv_mutex_destroy(&lock_);
+}
+
+bool AudioRecorder::start(const AudioRecordOptions& options, uint32_t sampleRate,
+    uint32_t channels, uint32_t inputBytes) {
+  stop();
+  if (options.path.empty() || channels == 0 || channels > 64 ||
+      (inputBytes != 2 && inputBytes != 4) ||
+      (options.bits != 16 && options.bits != 24 && options.bits != 32))
+    return false;
+  options_ = options;
+  sampleRate_ = sampleRate;
+  channels_ = channels;
+  inputBytes_ = inputBytes;
+  pending_.clear();
+  status_ = Status();
+  paths_.clear();
+  quit_ = false;
+  started_ = false;
+  opened_ = false;
+  running_ = true;
+  uv_thread_create(&thread_, writeLoop, this);
+  return true;
+}
+
+void AudioRecorder::stop() {
+  if (!running_) return;
+  uv_mutex_lock(&lock_);
+  quit_ = true;
+  uv_cond_signal(&work_);
+  uv_mutex_unlock(&lock_);
+  uv_thread_join(&thread_);
+  running_ = false;
+}
+
+bool AudioRecorder::push(const uint8_t* data, uint32_t frames,
+    int64_t timeReference, const std::string& timecode) {
+  uint32_t frameBytes = channels_ * inputBytes_;
+  uv_mutex_lock(&lock_);
+  if (quit_ || pending_.size() / frameBytes + frames > options_.maxPending) {
+    status_.dropped += frames;
+    uv_mutex_unlock(&lock_);
+    return false;
+  }
+  if (!started_) {
+    started_ = true;
+    if (timeReference >= 0)
+      options_.bext.timeReference = (uint64_t) timeReference;
+    if (options_.bext.description.empty() && !timecode.empty())
+      options_.bext.description = "Start timecode " + timecode;
+  }
+  pending_.insert(pending_.end(), data, data + (size_t) frames * frameBytes);
+  uv_cond_signal(&work_);
+  uv_mutex_unlock(&lock_);
+  return true;
+}
+
+AudioRecorder::Status AudioRecorder::status() {
+  uv_mutex_lock(&lock_);
+  Status status = status_;
+  status.pending = (uint32_t) (pending_.size() / (channels_ * inputBytes_));
+  uv_mutex_unlock(&lock_);
+  return status;
+}
+
+// Writer thread. options_ has its final bext by now.
+bool AudioRecorder::openFiles() {
+  uv_mutex_lock(&lock_);
+  BextInfo bext = options_.bext;
+  uv_mutex_unlock(&lock_);
+
+  uint32_t files = options_.splitMono ? channels_ : 1;
+  std::string base = options_.path;
+  std::string extension = ".wav";
+  size_t dot = base.rfind('.');
+  if (dot != std::string::npos && base.find_first_of("/\\", dot) == std::string::npos) {
+    extension = base.substr(dot);
+    base = base.substr(0, dot);
+  }
+  for (uint32_t x = 0 ; x < files ; x++) {
+    std::string path = options_.splitMono ?
+      base + "_" + std::to_string(x + 1) + extension : options_.path;
+    WaveWriter* writer = new WaveWriter;
+    if (!writer->open(path, options_.splitMono ? 1 : channels_, options_.bits,
+        sampleRate_, bext, options_.bufferBytes)) {
+      std::string error = path + ": " + strerror(errno);
+      delete writer;
+      uv_mutex_lock(&lock_);
+      status_.failed = true;
+      status_.error = error;
+      uv_mutex_unlock(&lock_);
+      return false;
+    }
+    writers_.push_back(writer);
+    paths_.push_back(path);
+  }
+  return true;
+}
+
+// Writer thread. Converts to the file sample size, keeping the most
+// significant bytes, and separates the channels for split mono.
+void AudioRecorder::writeOut(const std::vector<uint8_t>& input) {
+  uint32_t frames = (uint32_t) (input.size() / (channels_ * inputBytes_));
+  uint32_t outBytes = options_.bits / 8;
+  uint32_t files = (uint32_t) writers_.size();
+  uint32_t perFile = options_.splitMono ? 1 : channels_;
+  converted_.resize((size_t) frames * perFile * outBytes);
+  bool ok = true;
+  for (uint32_t f = 0 ; f < files ; f++) {
+    uint8_t* out = converted_.data();
+    for (uint32_t s = 0 ; s < frames ; s++) {
+      const uint8_t* in = &input[((size_t) s * channels_ + f) * inputBytes_];
+      for (uint32_t c = 0 ; c < perFile ; c++, in += inputBytes_) {
+        int32_t value = inputBytes_ == 2 ?
+          (int32_t) (int16_t) (in[0] | (in[1] << 8)) * 65536 :
+          (int32_t) ((uint32_t) in[0] | ((uint32_t) in[1] << 8) |
+            ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24));
+        uint32_t bits = (uint32_t) value;
+        for (uint32_t b = 4 - outBytes ; b < 4 ; b++)
+          *out++ = (uint8_t) (bits >> (b * 8));
+      }
+    }
+    if (!writers_[f]->write(converted_.data(), converted_.size())) ok = false;
+  }
+
+  uint64_t bytes = 0;
+  for (uint32_t f = 0 ; f < files ; f++)
+    bytes += writers_[f]->dataBytes();
+  uv_mutex_lock(&lock_);
+  status_.sampleFrames += frames;
+  status_.bytes = bytes;
+  if (!ok && !status_.failed) {
+    status_.failed = true;
+    status_.error = std::string("Write failed: ") + strerror(errno);
+  }
+  uv_mutex_unlock(&lock_);
+}
+
+void AudioRecorder::writeLoop(void* arg) {
+  AudioRecorder* rec = static_cast<AudioRecorder*>(arg);
+  std::vector<uint8_t> input;
+  for (;;) {
+    uv_mutex_lock(&rec->lock_);
+    while (rec->pending_.empty() && !rec->quit_)
+      uv_cond_wait(&rec->work_, &rec->lock_);
+    if (rec->pending_.empty()) {
+      uv_mutex_unlock(&rec->lock_);
+      break;
+    }
+    input.clear();
+    input.swap(rec->pending_);
+    uv_mutex_unlock(&rec->lock_);
+
+    if (!rec->opened_) {
+      rec->opened_ = true;
+      rec->openFiles();
+    }
+    if (!rec->writers_.empty())
+      rec->writeOut(input);
+  }
+
+  bool rf64 = false, ok = true;
+  for (size_t x = 0 ; x < rec->writers_.size() ; x++) {
+    if (!rec->writers_[x]->close()) ok = false;
+    rf64 = rf64 || rec->writers_[x]->isRF64();
+    delete rec->writers_[x];
+  }
+  rec->writers_.clear();
+  uv_mutex_lock(&rec->lock_);
+  rec->status_.rf64 = rf64;
+  if (!ok && !rec->status_.failed) {
+    rec->status_.failed = true;
+    rec->status_.error = "Could not complete the file headers.";
+  }
+  uv_mutex_unlock(&rec->lock_);
+}
+
+} // namespace streampunk
@@ -0,0 +1,144 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef WAVEFILE_H
+#define WAVEFILE_H
+
+#include <uv.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace streampunk {
+
+// What goes in the bext chunk of a Broadcast WAV file (EBU Tech 3285).
+struct BextInfo {
+  std::string description;   // up to 256 characters
+  std::string originator;    // up to 32
+  std::string originatorReference;
+  std::string date;          // yyyy-mm-dd
+  std::string time;          // hh:mm:ss
+  uint64_t timeReference;    // first sample, counted in samples since midnight
+  std::string codingHistory;
+};
+
+// Writes one Broadcast WAV file of interleaved PCM. A JUNK chunk is reserved
+// after the RIFF header and, if the file grows beyond 4GB, it becomes the ds64
+// chunk of an RF64 file (EBU Tech 3306) when the file is closed. Writes are
+// gathered into a large buffer.
+class WaveWriter {
+public:
+  // Files whose RIFF size would pass riffLimit are closed as RF64. A lower
+  // limit is only for testing the RF64 layout with small files.
+  explicit WaveWriter(uint64_t riffLimit = 0xffffffffULL);
+  ~WaveWriter();
+
+  bool open(const std::string& path, uint32_t channels, uint32_t bits,
+    uint32_t sampleRate, const BextInfo& bext, uint32_t bufferBytes);
+  // Samples already in the file's format.
+  bool write(const uint8_t* data, size_t bytes);
+  // Fixes up the chunk sizes. Returns false if anything failed to write.
+  bool close();
+  bool isOpen() const { return file_ != NULL; }
+  uint64_t dataBytes() const { return dataBytes_; }
+  bool isRF64() const { return rf64_; }
+
+private:
+  bool flush();
+
+  uint64_t riffLimit_;
+  FILE* file_;
+  uint32_t blockAlign_;
+  uint64_t junkOffset_;
+  uint64_t dataOffset_;      // of the data chunk's size field
+  uint64_t dataBytes_;
+  bool rf64_;
+  bool failed_;
+  std::vector<uint8_t> buffer_;
+  size_t buffered_;
+};
+
+struct AudioRecordOptions {
+  std::string path;          // with split mono, _1, _2 ... goes before .wav
+  bool splitMono;
+  uint32_t bits;             // 16, 24 or 32
+  uint32_t bufferBytes;      // per file
+  uint32_t maxPending;       // sample frames queued before dropping
+  BextInfo bext;
+};
+
+// Records the capture's audio into Broadcast WAV files on a thread of its own,
+// either as one multi-channel file or one mono file per channel. The capture
+// thread only appends each packet to a pending buffer.
+class AudioRecorder {
+public:
+  AudioRecorder();
+  ~AudioRecorder();
+
+  // Input is interleaved 16 or 32 bit samples, as the card delivers them.
+  bool start(const AudioRecordOptions& options, uint32_t sampleRate,
+    uint32_t channels, uint32_t inputBytes);
+  // Writes out what is pending and closes the files.
+  void stop();
+
+  // On the capture thread. The time reference and timecode are only used
+  // from the first packet; timeReference < 0 leaves the configured value.
+  bool push(const uint8_t* data, uint32_t frames, int64_t timeReference,
+    const std::string& timecode);
+  // Whether the first packet has been pushed. On the capture thread.
+  bool hasStarted() const { return started_; }
+
+  struct Status {
+    uint64_t sampleFrames;   // written
+    uint64_t dropped;
+    uint64_t bytes;
+    uint32_t pending;
+    bool rf64;
+    bool failed;
+    std::string error;
+  };
+  Status status();
+  const std::vector<std::string>& paths() const { return paths_; }
+
+private:
+  static void writeLoop(void* arg);
+  bool openFiles();
+  void writeOut(const std::vector<uint8_t>& input);
+
+  AudioRecordOptions options_;
+  uint32_t sampleRate_;
+  uint32_t channels_;
+  uint32_t inputBytes_;
+  bool running_;
+
+  uv_mutex_t lock_;
+  uv_cond_t work_;
+  uv_thread_t thread_;
+  bool quit_;
+  bool started_;             // first packet seen
+  std::vector<uint8_t> pending_;
+  Status status_;
+
+  // writer thread only
+  std::vector<WaveWriter*> writers_;
+  std::vector<std::string> paths_;
+  std::vector<uint8_t> converted_;
+  bool opened_;
+};
+
+} // namespace streampunk
+
+#endif
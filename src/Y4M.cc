@@ -0,0 +1,558 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Y4M.h"
+#include "Formats.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sstream>
+
+#ifdef WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#endif
+
+namespace streampunk {
+
+static const size_t inputBufferBytes = 1024 * 1024;
+static const int pollMillis = 100;
+static const uint32_t stuckPolls = 20;     // give up a blocked write on close
+static const char frameLine[] = "FRAME\n";
+static const size_t framePad = 2;          // keeps the planes after FRAME\n aligned
+
+// Waits up to pollMillis for the descriptor to be ready, so that the threads
+// can notice they are being stopped. Returns false on a timeout.
+static bool waitReady(int fd, bool forWrite) {
+#ifdef WIN32
+  (void) fd;
+  (void) forWrite;
+  return true;
+#else
+  struct pollfd p;
+  p.fd = fd;
+  p.events = forWrite ? POLLOUT : POLLIN;
+  p.revents = 0;
+  return poll(&p, 1, pollMillis) != 0;
+#endif
+}
+
+static void closeFd(int fd) {
+#ifdef WIN32
+  _close(fd);
+#else
+  ::close(fd);
+#endif
+}
+
+int openY4MPath(const std::string& path, bool forWrite, std::string& error) {
+#ifdef WIN32
+  int fd = forWrite ?
+    _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644) :
+    _open(path.c_str(), _O_RDONLY | _O_BINARY);
+  if (fd < 0) error = path + ": " + strerror(errno);
+  return fd;
+#else
+  int fd = forWrite ?
+    open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644) :
+    open(path.c_str(), O_RDONLY | O_NONBLOCK);
+  if (fd < 0) {
+    error = path + ": " + (errno == ENXIO ? "nothing is reading the FIFO" : strerror(errno));
+    return -1;
+  }
+  // Opened without blocking - the threads then wait with poll
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  return fd;
+#endif
+}
+
+std::string y4mHeader(const Y4MFormat& format) {
+  char header[128];
+  snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:%u I%c A1:1 %s\n",
+    format.width, format.height, format.rateNum, format.rateDen, format.interlace,
+    format.depth == 10 ? "C422p10 XYSCSS=422P10" : "C422 XYSCSS=422");
+  return header;
+}
+
+bool parseY4MHeader(const std::string& line, Y4MFormat* format) {
+  std::istringstream tokens(line);
+  std::string token;
+  if (!(tokens >> token) || token != "YUV4MPEG2") return false;
+  Y4MFormat parsed = { 0, 0, 0, 0, 'p', 0 };
+  while (tokens >> token) {
+    switch (token[0]) {
+      case 'W': parsed.width = (uint32_t) strtoul(token.c_str() + 1, NULL, 10); break;
+      case 'H': parsed.height = (uint32_t) strtoul(token.c_str() + 1, NULL, 10); break;
+      case 'F': sscanf(token.c_str() + 1, "%u:%u", &parsed.rateNum, &parsed.rateDen); break;
+      case 'I': parsed.interlace = token.size() > 1 ? token[1] : 'p'; break;
+      case 'C':
+        if (token == "C422") parsed.depth = 8;
+        else if (token == "C422p10") parsed.depth = 10;
+        else return false;
+        break;
+      default: break;
+    }
+  }
+  if (parsed.width == 0 || parsed.height == 0 || parsed.depth == 0) return false;
+  *format = parsed;
+  return true;
+}
+
+size_t y4mFrameBytes(const Y4MFormat& format) {
+  size_t samples = (size_t) (format.width + (format.width + 1) / 2 * 2) * format.height;
+  return samples * (format.depth == 10 ? 2 : 1);
+}
+
+void packedToY4M(uint32_t pixelFormat, const uint8_t* src, uint32_t rowBytes,
+    const Y4MFormat& format, uint8_t* dest) {
+  uint32_t width = format.width, chroma = (width + 1) / 2;
+  size_t lumaSamples = (size_t) width * format.height;
+  size_t chromaSamples = (size_t) chroma * format.height;
+  if (format.depth == 10) {
+    // The unpacked samples are the planes
+    uint16_t* y = (uint16_t*) dest;
+    uint16_t* cb = y + lumaSamples;
+    uint16_t* cr = cb + chromaSamples;
+    for (uint32_t row = 0 ; row < format.height ; row++)
+      unpackLine(pixelFormat, src + (size_t) row * rowBytes, width,
+        y + (size_t) row * width, cb + (size_t) row * chroma, cr + (size_t) row * chroma);
+    return;
+  }
+  std::vector<uint16_t> line(width + 2 * chroma);
+  uint16_t* ly = &line[0];
+  uint16_t* lcb = ly + width;
+  uint16_t* lcr = lcb + chroma;
+  uint8_t* y = dest;
+  uint8_t* cb = y + lumaSamples;
+  uint8_t* cr = cb + chromaSamples;
+  for (uint32_t row = 0 ; row < format.height ; row++) {
+    unpackLine(pixelFormat, src + (size_t) row * rowBytes, width, ly, lcb, lcr);
+    for (uint32_t x = 0 ; x < width ; x++) {
+      uint32_t v = (ly[x] + 2) >> 2;
+      *y++ = (uint8_t) (v > 255 ? 255 : v);
+    }
+    for (uint32_t x = 0 ; x < chroma ; x++) {
+      uint32_t b = (lcb[x] + 2) >> 2, r = (lcr[x] + 2) >> 2;
+      *cb++ = (uint8_t) (b > 255 ? 255 : b);
+      *cr++ = (uint8_t) (r > 255 ? 255 : r);
+    }
+  }
+}
+
+void y4mToPacked(uint32_t pixelFormat, const uint8_t* src,
+    const Y4MFormat& format, uint8_t* dest, uint32_t rowBytes) {
+  uint32_t width = format.width, chroma = (width + 1) / 2;
+  size_t lumaSamples = (size_t) width * format.height;
+  size_t chromaSamples = (size_t) chroma * format.height;
+  std::vector<uint16_t> line(width + 2 * chroma);
+  uint16_t* ly = &line[0];
+  uint16_t* lcb = ly + width;
+  uint16_t* lcr = lcb + chroma;
+  for (uint32_t row = 0 ; row < format.height ; row++) {
+    if (format.depth == 10) {
+      // Out of range samples from a decoder are clamped rather than wrapped
+      const uint16_t* y = (const uint16_t*) src + (size_t) row * width;
+      const uint16_t* cb = (const uint16_t*) src + lumaSamples + (size_t) row * chroma;
+      const uint16_t* cr = cb + chromaSamples;
+      for (uint32_t x = 0 ; x < width ; x++)
+        ly[x] = y[x] > 1023 ? 1023 : y[x];
+      for (uint32_t x = 0 ; x < chroma ; x++) {
+        lcb[x] = cb[x] > 1023 ? 1023 : cb[x];
+        lcr[x] = cr[x] > 1023 ? 1023 : cr[x];
+      }
+    } else {
+      const uint8_t* y = src + (size_t) row * width;
+      const uint8_t* cb = src + lumaSamples + (size_t) row * chroma;
+      const uint8_t* cr = cb + chromaSamples;
+      for (uint32_t x = 0 ; x < width ; x++)
+        ly[x] = (uint16_t) (y[x] << 2);
+      for (uint32_t x = 0 ; x < chroma ; x++) {
+        lcb[x] = (uint16_t) (cb[x] << 2);
+        lcr[x] = (uint16_t) (cr[x] << 2);
+      }
+    }
+    packLine(pixelFormat, ly, lcb, lcr, width, dest + (size_t) row * rowBytes);
+  }
+}
+
+Y4MWriter::Y4MWriter() : fd_(-1), own_(false), running_(false),
+    pixelFormat_(0), rowBytes_(0), quit_(false) {
+  uv_mutex_init(&lock_);
+  uv_cond_init(&work_);
+  status_ = Status();
+}
+
+Y4MWriter::~Y4MWriter() {
+  close();
+  uv_cond_destroy(&work_);
+  uv_mutex_destroy(&lock_);
+}
+
+bool Y4MWriter::open(int fd, bool own, const Y4MFormat& format,
+    uint32_t pixelFormat, uint32_t queueFrames) {
+  close();
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat, format.width);
+  if (fd < 0 || !isYUV422Format(pixelFormat) || rowBytes == 0 || queueFrames < 2 ||
+      format.height == 0 || (format.depth != 8 && format.depth != 10)) {
+    if (own && fd >= 0) closeFd(fd);
+    return false;
+  }
+  fd_ = fd;
+  own_ = own;
+  format_ = format;
+  pixelFormat_ = pixelFormat;
+  rowBytes_ = rowBytes;
+  slots_.assign(queueFrames, std::vector<uint8_t>((size_t) rowBytes * format.height));
+  free_.clear();
+  for (uint32_t x = 0 ; x < queueFrames ; x++) free_.push_back(x);
+  queue_.clear();
+  status_ = Status();
+  quit_ = false;
+  running_ = true;
+  uv_thread_create(&thread_, writeLoop, this);
+  return true;
+}
+
+void Y4MWriter::close() {
+  if (!running_) return;
+  uv_mutex_lock(&lock_);
+  quit_ = true;
+  uv_cond_signal(&work_);
+  uv_mutex_unlock(&lock_);
+  uv_thread_join(&thread_);
+  if (own_) closeFd(fd_);
+  fd_ = -1;
+  running_ = false;
+}
+
+bool Y4MWriter::push(const uint8_t* frame, uint32_t rowBytes, uint32_t height) {
+  uv_mutex_lock(&lock_);
+  if (quit_ || status_.failed || rowBytes != rowBytes_ || height != format_.height ||
+      free_.empty()) {
+    status_.dropped++;
+    uv_mutex_unlock(&lock_);
+    return false;
+  }
+  uint32_t x = free_.back();
+  free_.pop_back();
+  uv_mutex_unlock(&lock_);
+
+  memcpy(&slots_[x][0], frame, slots_[x].size());
+
+  uv_mutex_lock(&lock_);
+  queue_.push_back(x);
+  uv_cond_signal(&work_);
+  uv_mutex_unlock(&lock_);
+  return true;
+}
+
+Y4MWriter::Status Y4MWriter::status() {
+  uv_mutex_lock(&lock_);
+  Status status = status_;
+  status.queued = (uint32_t) queue_.size();
+  uv_mutex_unlock(&lock_);
+  return status;
+}
+
+// Writes everything, waiting for a pipe to drain. While stopping, gives up
+// if the reader has stopped reading altogether.
+static bool writeAll(int fd, const uint8_t* data, size_t bytes,
+    const std::atomic<bool>& quit,
+    std::string& error) {
+  uint32_t polls = 0;
+  while (bytes > 0) {
+    if (!waitReady(fd, true)) {
+      if (quit && ++polls >= stuckPolls) {
+        error = "Timed out writing Y4M.";
+        return false;
+      }
+      continue;
+    }
+#ifdef WIN32
+    int written = _write(fd, data, (unsigned int) bytes);
+#else
+    ssize_t written = write(fd, data, bytes);
+#endif
+    if (written < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      error = strerror(errno);
+      return false;
+    }
+    polls = 0;
+    data += written;
+    bytes -= (size_t) written;
+  }
+  return true;
+}
+
+void Y4MWriter::writeLoop(void* arg) {
+  Y4MWriter* w = static_cast<Y4MWriter*>(arg);
+  std::string error;
+  std::string header = y4mHeader(w->format_);
+  bool ok = writeAll(w->fd_, (const uint8_t*) header.data(), header.size(), w->quit_, error);
+
+  // FRAME\n and the planes go out in one write
+  size_t lineBytes = sizeof(frameLine) - 1;
+  w->output_.resize(framePad + lineBytes + y4mFrameBytes(w->format_));
+  memcpy(&w->output_[framePad], frameLine, lineBytes);
+  uint8_t* planes = &w->output_[framePad + lineBytes];
+
+  for (;;) {
+    uv_mutex_lock(&w->lock_);
+    if (!ok) {
+      w->status_.failed = true;
+      w->status_.error = error;
+      // Nothing more can be written - release what is queued
+      while (!w->queue_.empty()) {
+        w->free_.push_back(w->queue_.front());
+        w->queue_.pop_front();
+        w->status_.dropped++;
+      }
+    }
+    while (w->queue_.empty() && !w->quit_)
+      uv_cond_wait(&w->work_, &w->lock_);
+    if (w->queue_.empty()) {
+      uv_mutex_unlock(&w->lock_);
+      break;
+    }
+    uint32_t x = w->queue_.front();
+    w->queue_.pop_front();
+    uv_mutex_unlock(&w->lock_);
+
+    packedToY4M(w->pixelFormat_, &w->slots_[x][0], w->rowBytes_, w->format_, planes);
+    ok = writeAll(w->fd_, &w->output_[framePad], w->output_.size() - framePad,
+      w->quit_, error);
+
+    uv_mutex_lock(&w->lock_);
+    if (ok) w->status_.written++;
+    else w->status_.dropped++;
+    w->free_.push_back(x);
+    uv_mutex_unlock(&w->lock_);
+  }
+}
+
+Y4MReader::Y4MReader() : fd_(-1), own_(false), running_(false),
+    waitForWriter_(false), pixelFormat_(0), width_(0), height_(0), rowBytes_(0), quit_(false),
+    inputStart_(0), inputEnd_(0) {
+  uv_mutex_init(&lock_);
+  uv_cond_init(&space_);
+  status_ = Status();
+}
+
+Y4MReader::~Y4MReader() {
+  close();
+  uv_cond_destroy(&space_);
+  uv_mutex_destroy(&lock_);
+}
+
+bool Y4MReader::open(int fd, bool own, uint32_t pixelFormat, uint32_t width,
+    uint32_t height, uint32_t queueFrames) {
+  close();
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat, width);
+  if (fd < 0 || !isYUV422Format(pixelFormat) || rowBytes == 0 || queueFrames < 2) {
+    if (own && fd >= 0) closeFd(fd);
+    return false;
+  }
+  fd_ = fd;
+  own_ = own;
+  pixelFormat_ = pixelFormat;
+  width_ = width;
+  height_ = height;
+  rowBytes_ = rowBytes;
+  slots_.assign(queueFrames, std::vector<uint8_t>((size_t) rowBytes * height));
+  free_.clear();
+  for (uint32_t x = 0 ; x < queueFrames ; x++) free_.push_back(x);
+  ready_.clear();
+  status_ = Status();
+  input_.resize(inputBufferBytes);
+  inputStart_ = inputEnd_ = 0;
+  waitForWriter_ = false;
+#ifndef WIN32
+  struct stat info;
+  waitForWriter_ = fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+#endif
+  quit_ = false;
+  running_ = true;
+  uv_thread_create(&thread_, readLoop, this);
+  return true;
+}
+
+void Y4MReader::close() {
+  if (!running_) return;
+  uv_mutex_lock(&lock_);
+  quit_ = true;
+  uv_cond_signal(&space_);
+  uv_mutex_unlock(&lock_);
+  uv_thread_join(&thread_);
+  if (own_) closeFd(fd_);
+  fd_ = -1;
+  running_ = false;
+}
+
+bool Y4MReader::next(uint8_t* dest) {
+  uv_mutex_lock(&lock_);
+  if (ready_.empty()) {
+    uv_mutex_unlock(&lock_);
+    return false;
+  }
+  uint32_t x = ready_.front();
+  ready_.pop_front();
+  uv_mutex_unlock(&lock_);
+
+  memcpy(dest, &slots_[x][0], slots_[x].size());
+
+  uv_mutex_lock(&lock_);
+  free_.push_back(x);
+  status_.shown++;
+  uv_cond_signal(&space_);
+  uv_mutex_unlock(&lock_);
+  return true;
+}
+
+Y4MReader::Status Y4MReader::status() {
+  uv_mutex_lock(&lock_);
+  Status status = status_;
+  status.queued = (uint32_t) ready_.size();
+  uv_mutex_unlock(&lock_);
+  return status;
+}
+
+// Reader thread. Refills input_ after whatever is left in it. False at the
+// end of the stream, on an error or when stopping.
+bool Y4MReader::fill() {
+  if (inputStart_ > 0) {
+    memmove(&input_[0], &input_[inputStart_], inputEnd_ - inputStart_);
+    inputEnd_ -= inputStart_;
+    inputStart_ = 0;
+  }
+  for (;;) {
+    if (quit_) return false;
+    if (!waitReady(fd_, false)) continue;
+#ifdef WIN32
+    int got = _read(fd_, &input_[inputEnd_], (unsigned int) (input_.size() - inputEnd_));
+#else
+    ssize_t got = read(fd_, &input_[inputEnd_], input_.size() - inputEnd_);
+#endif
+    if (got < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+    if (got < 0) fail(strerror(errno));
+#ifndef WIN32
+    if (got == 0 && waitForWriter_) {
+      poll(NULL, 0, pollMillis);
+      continue;
+    }
+#endif
+    if (got <= 0) return false;
+    inputEnd_ += (size_t) got;
+    return true;
+  }
+}
+
+bool Y4MReader::readExact(uint8_t* dest, size_t bytes) {
+  while (bytes > 0) {
+    if (inputStart_ == inputEnd_ && !fill()) return false;
+    size_t chunk = inputEnd_ - inputStart_;
+    if (chunk > bytes) chunk = bytes;
+    memcpy(dest, &input_[inputStart_], chunk);
+    inputStart_ += chunk;
+    dest += chunk;
+    bytes -= chunk;
+  }
+  return true;
+}
+
+bool Y4MReader::readLine(std::string& line) {
+  line.clear();
+  for (;;) {
+    for (size_t x = inputStart_ ; x < inputEnd_ ; x++) {
+      if (input_[x] == '\n') {
+        line.append((const char*) &input_[inputStart_], x - inputStart_);
+        inputStart_ = x + 1;
+        return true;
+      }
+    }
+    line.append((const char*) &input_[inputStart_], inputEnd_ - inputStart_);
+    inputStart_ = inputEnd_;
+    if (line.size() > 4096 || !fill()) return false;
+  }
+}
+
+void Y4MReader::fail(const std::string& error) {
+  uv_mutex_lock(&lock_);
+  if (!status_.failed) {
+    status_.failed = true;
+    status_.error = error;
+  }
+  uv_mutex_unlock(&lock_);
+}
+
+void Y4MReader::readLoop(void* arg) {
+  Y4MReader* r = static_cast<Y4MReader*>(arg);
+  std::string line;
+  Y4MFormat format;
+  if (!r->readLine(line)) {
+    if (!r->quit_) r->fail("No Y4M header.");
+  } else if (!parseY4MHeader(line, &format)) {
+    r->fail("Not a 4:2:2 Y4M stream: " + line);
+  } else if (format.width != r->width_ || format.height != r->height_) {
+    char error[96];
+    snprintf(error, sizeof(error), "Y4M stream is %ux%u, playback is %ux%u.",
+      format.width, format.height, r->width_, r->height_);
+    r->fail(error);
+  } else {
+    r->waitForWriter_ = false;
+    uv_mutex_lock(&r->lock_);
+    r->status_.started = true;
+    r->status_.format = format;
+    uv_mutex_unlock(&r->lock_);
+    r->planes_.resize(y4mFrameBytes(format));
+
+    while (r->readLine(line)) {
+      if (line.compare(0, 5, "FRAME") != 0) {
+        r->fail("Lost Y4M frame sync.");
+        break;
+      }
+      if (!r->readExact(&r->planes_[0], r->planes_.size())) break;
+
+      uv_mutex_lock(&r->lock_);
+      while (r->free_.empty() && !r->quit_)
+        uv_cond_wait(&r->space_, &r->lock_);
+      if (r->quit_) {
+        uv_mutex_unlock(&r->lock_);
+        break;
+      }
+      uint32_t x = r->free_.back();
+      r->free_.pop_back();
+      uv_mutex_unlock(&r->lock_);
+
+      y4mToPacked(r->pixelFormat_, &r->planes_[0], format, &r->slots_[x][0], r->rowBytes_);
+
+      uv_mutex_lock(&r->lock_);
+      r->ready_.push_back(x);
+      r->status_.read++;
+      uv_mutex_unlock(&r->lock_);
+    }
+  }
+  uv_mutex_lock(&r->lock_);
+  r->status_.ended = true;
+  uv_mutex_unlock(&r->lock_);
+}
+
+} // namespace streampunk
@@ -0,0 +1,166 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef Y4M_H
+#define Y4M_H
+
+#include <uv.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+
+namespace streampunk {
+
+// A YUV4MPEG2 stream of planar 4:2:2, 8-bit (C422) or 10-bit (C422p10, two
+// bytes per sample, little endian) - the raw input and output of ffmpeg.
+struct Y4MFormat {
+  uint32_t width;
+  uint32_t height;
+  uint32_t rateNum;
+  uint32_t rateDen;
+  char interlace;            // 'p', 't' (top field first) or 'b'
+  uint32_t depth;            // 8 or 10
+};
+
+std::string y4mHeader(const Y4MFormat& format);
+// Reads the stream header line, without its newline. Only 4:2:2 is accepted.
+bool parseY4MHeader(const std::string& line, Y4MFormat* format);
+// Bytes of planar samples per frame, after the FRAME line.
+size_t y4mFrameBytes(const Y4MFormat& format);
+
+// Opens a file or FIFO by path without blocking. A FIFO to write to needs its
+// reader running already; one to read from may be opened before its writer.
+// Returns -1 with an error message on failure.
+int openY4MPath(const std::string& path, bool forWrite, std::string& error);
+
+// Between a 2vuy or v210 frame and the three planes of a Y4M frame.
+void packedToY4M(uint32_t pixelFormat, const uint8_t* src, uint32_t rowBytes,
+  const Y4MFormat& format, uint8_t* dest);
+void y4mToPacked(uint32_t pixelFormat, const uint8_t* src,
+  const Y4MFormat& format, uint8_t* dest, uint32_t rowBytes);
+
+// Streams frames to a file, FIFO or pipe as Y4M. Frames are copied into a
+// queue and converted and written on a thread of their own, a whole frame
+// per write. If the reader falls behind, frames are dropped rather than the
+// capture being held up.
+class Y4MWriter {
+public:
+  Y4MWriter();
+  ~Y4MWriter();
+
+  // Takes ownership of the file descriptor if own is true, closing it if
+  // the writer cannot be opened.
+  bool open(int fd, bool own, const Y4MFormat& format, uint32_t pixelFormat,
+    uint32_t queueFrames);
+  // Writes what is queued, then closes.
+  void close();
+
+  // On the capture thread. Returns false if the frame was dropped.
+  bool push(const uint8_t* frame, uint32_t rowBytes, uint32_t height);
+
+  struct Status {
+    uint64_t written;
+    uint64_t dropped;
+    uint32_t queued;
+    bool failed;
+    std::string error;
+  };
+  Status status();
+
+private:
+  static void writeLoop(void* arg);
+
+  int fd_;
+  bool own_;
+  bool running_;
+  Y4MFormat format_;
+  uint32_t pixelFormat_;
+  uint32_t rowBytes_;
+
+  uv_mutex_t lock_;
+  uv_cond_t work_;
+  uv_thread_t thread_;
+  std::atomic<bool> quit_;
+  std::vector<std::vector<uint8_t> > slots_;
+  std::vector<uint32_t> free_;
+  std::deque<uint32_t> queue_;
+  Status status_;
+  std::vector<uint8_t> output_;  // writer thread only
+};
+
+// Reads a Y4M stream, such as a decoder's output, on a thread of its own and
+// converts it to 2vuy or v210 ahead of playout. The thread waits when the
+// queue is full, so a decoder writing into a pipe is paced by playout.
+class Y4MReader {
+public:
+  Y4MReader();
+  ~Y4MReader();
+
+  bool open(int fd, bool own, uint32_t pixelFormat, uint32_t width,
+    uint32_t height, uint32_t queueFrames);
+  void close();
+
+  // Copies the next frame into dest. False if none is ready.
+  bool next(uint8_t* dest);
+
+  struct Status {
+    uint64_t read;
+    uint64_t shown;
+    uint32_t queued;
+    bool started;            // header read
+    bool ended;
+    bool failed;
+    std::string error;
+    Y4MFormat format;
+  };
+  Status status();
+
+private:
+  static void readLoop(void* arg);
+  bool fill();
+  bool readExact(uint8_t* dest, size_t bytes);
+  bool readLine(std::string& line);
+  void fail(const std::string& error);
+
+  int fd_;
+  bool own_;
+  bool running_;
+  bool waitForWriter_;       // a FIFO reads as ended until its writer opens it
+  uint32_t pixelFormat_;
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t rowBytes_;
+
+  uv_mutex_t lock_;
+  uv_cond_t space_;
+  uv_thread_t thread_;
+  std::atomic<bool> quit_;
+  std::vector<std::vector<uint8_t> > slots_;
+  std::vector<uint32_t> free_;
+  std::deque<uint32_t> ready_;
+  Status status_;
+
+  // reader thread only
+  std::vector<uint8_t> input_;
+  size_t inputStart_;
+  size_t inputEnd_;
+  std::vector<uint8_t> planes_;
+};
+
+} // namespace streampunk
+
+#endif
@@ -57,6 +57,17 @@
 
 #include "Capture.h"
 #include "Playback.h"
+#include "Downscale.h"
+#include "Fields.h"
+#include "TestPattern.h"
+#include "Overlay.h"
+#include "Timeshift.h"
+#include "SharedFrames.h"
+#include "FrameRing.h"
+#include "AudioConvert.h"
+#include "Analysis.h"
+#include "Hash.h"
+#include "Quality.h"
 
 using namespace v8;
 
@@ -154,8 +165,23 @@ NAN_METHOD(GetFirstDevice) {
 NAN_MODULE_INIT(Init) {
   Nan::Export(target, "deckLinkVersion", DeckLinkVersion);
   Nan::Export(target, "getFirstDevice", GetFirstDevice);
+  Nan::Export(target, "downscale", streampunk::Downscale);
+  Nan::Export(target, "splitFields", streampunk::SplitFields);
+  Nan::Export(target, "weaveFields", streampunk::WeaveFields);
+  Nan::Export(target, "deinterlace", streampunk::Deinterlace);
+  Nan::Export(target, "testPattern", streampunk::TestPattern);
+  Nan::Export(target, "convertAudio", streampunk::ConvertAudio);
+  Nan::Export(target, "analyseFrame", streampunk::AnalyseFrame);
+  Nan::Export(target, "hashBuffer", streampunk::HashBuffer);
+  Nan::Export(target, "compareFrames", streampunk::CompareFrames);
+  Nan::Export(target, "embedFrameCounter", streampunk::EmbedFrameCounter);
+  Nan::Export(target, "readFrameCounter", streampunk::ReadFrameCounter);
+  Nan::Export(target, "frameRingBytes", streampunk::FrameRingBytes);
   streampunk::Capture::Init(target);
   streampunk::Playback::Init(target);
+  streampunk::Overlay::Init(target);
+  streampunk::Timeshift::Init(target);
+  streampunk::FrameSubscriber::Init(target);
   #ifdef WIN32
   HRESULT result;
   result = CoInitialize(NULL);
@@ -166,4 +192,4 @@ NAN_MODULE_INIT(Init) {
   #endif
 }
 
-NODE_MODULE(macadam, Init);
+NAN_MODULE_WORKER_ENABLED(macadam, Init)
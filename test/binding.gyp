@@ -0,0 +1,37 @@
+{
+  "targets": [{
+    "target_name" : "kernels",
+    "sources" : [ "kernels.cc", "../src/Formats.cc", "../src/TestPattern.cc",
+      "../src/Lossless.cc", "../src/Hash.cc", "../src/Quality.cc",
+      "../src/AudioMeter.cc", "../src/WaveFile.cc", "../src/Y4M.cc" ],
+    "include_dirs" : [
+      "<!(node -e \"require('nan')\")",
+      "../src"
+    ],
+    "conditions": [
+      ['OS=="mac"', {
+        'xcode_settings': {
+          'GCC_ENABLE_CPP_RTTI': 'YES',
+          'MACOSX_DEPLOYMENT_TARGET': '10.7',
+          'OTHER_CPLUSPLUSFLAGS': [
+            '-std=c++11',
+            '-stdlib=libc++'
+          ]
+        },
+        "include_dirs" : [
+          "../decklink/Mac/include"
+        ]
+      }],
+      ['OS=="linux"', {
+        "include_dirs" : [
+          "../decklink/Linux/include"
+        ]
+      }],
+      ['OS=="win"', {
+        "include_dirs" : [
+          "../decklink/Win/include"
+        ]
+      }]
+    ]
+  }]
+}
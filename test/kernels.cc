@@ -0,0 +1,326 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// The processing kernels of the addon, built on their own without the
+// DeckLink library so that they can be tested on a machine with no card.
+// Each method is a thin wrapper around a kernel for test.js.
+
+#include <nan.h>
+#include "Formats.h"
+#include "TestPattern.h"
+#include "Lossless.h"
+#include "Hash.h"
+#include "Quality.h"
+#include "AudioMeter.h"
+#include "WaveFile.h"
+#include "Y4M.h"
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace streampunk {
+
+static std::string stringOption(v8::Local<v8::Object> options, const char* name) {
+  v8::Local<v8::Value> value = Nan::Get(options, Nan::New(name).ToLocalChecked()).ToLocalChecked();
+  if (value->IsUndefined()) return std::string();
+  Nan::Utf8String text(value);
+  return std::string(*text, text.length());
+}
+
+static uint32_t numberOption(v8::Local<v8::Object> options, const char* name) {
+  v8::Local<v8::Value> value = Nan::Get(options, Nan::New(name).ToLocalChecked()).ToLocalChecked();
+  return Nan::To<uint32_t>(value).FromMaybe(0);
+}
+
+static bool frameArgs(const Nan::FunctionCallbackInfo<v8::Value>& info,
+    uint32_t* width, uint32_t* height, uint32_t* pixelFormat) {
+  if (info.Length() < 4 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("Requires a buffer, width, height and pixel format.");
+    return false;
+  }
+  *width = Nan::To<uint32_t>(info[1]).FromMaybe(0);
+  *height = Nan::To<uint32_t>(info[2]).FromMaybe(0);
+  *pixelFormat = Nan::To<uint32_t>(info[3]).FromMaybe(0);
+  return true;
+}
+
+// losslessEncode(frame, width, height, pixelFormat) -> Buffer
+NAN_METHOD(LosslessEncode) {
+  uint32_t width, height, pixelFormat;
+  if (!frameArgs(info, &width, &height, &pixelFormat)) return;
+  if (node::Buffer::Length(info[0]) < (size_t) rowBytesForFormat(pixelFormat, width) * height) {
+    Nan::ThrowRangeError("Buffer is too small for a frame of the given dimensions.");
+    return;
+  }
+  LosslessCodec codec(LosslessCodec::defaultThreads());
+  std::vector<uint8_t> coded;
+  if (!codec.encode(pixelFormat, width, height,
+      (const uint8_t*) node::Buffer::Data(info[0]), coded)) {
+    Nan::ThrowError("Failed to encode frame.");
+    return;
+  }
+  info.GetReturnValue().Set(
+    Nan::CopyBuffer((const char*) &coded[0], (uint32_t) coded.size()).ToLocalChecked());
+}
+
+// losslessDecode(coded, frameBytes) -> Buffer, or null if the data is damaged
+NAN_METHOD(LosslessDecode) {
+  if (info.Length() < 2 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("Requires a buffer and a frame size.");
+    return;
+  }
+  uint32_t frameBytes = Nan::To<uint32_t>(info[1]).FromMaybe(0);
+  v8::Local<v8::Object> frame = Nan::NewBuffer(frameBytes).ToLocalChecked();
+  LosslessCodec codec(LosslessCodec::defaultThreads());
+  if (codec.decode((const uint8_t*) node::Buffer::Data(info[0]),
+      node::Buffer::Length(info[0]), (uint8_t*) node::Buffer::Data(frame), frameBytes))
+    info.GetReturnValue().Set(frame);
+  else
+    info.GetReturnValue().SetNull();
+}
+
+// meterAudio(samples, sampleRate, channels, bytesPerSample, packetFrames)
+//   -> the meters after the last packet
+NAN_METHOD(MeterAudio) {
+  if (info.Length() < 5 || !node::Buffer::HasInstance(info[0])) {
+    Nan::ThrowTypeError("Requires samples, sample rate, channels, bytes per sample and packet frames.");
+    return;
+  }
+  uint32_t sampleRate = Nan::To<uint32_t>(info[1]).FromMaybe(0);
+  uint32_t channels = Nan::To<uint32_t>(info[2]).FromMaybe(0);
+  uint32_t bytesPerSample = Nan::To<uint32_t>(info[3]).FromMaybe(0);
+  uint32_t packetFrames = Nan::To<uint32_t>(info[4]).FromMaybe(0);
+  if (sampleRate == 0 || channels == 0 || packetFrames == 0 ||
+      (bytesPerSample != 2 && bytesPerSample != 4)) {
+    Nan::ThrowRangeError("Unsupported audio format.");
+    return;
+  }
+  AudioMeter meter;
+  meter.configure(sampleRate, channels, bytesPerSample, std::vector<double>());
+  std::vector<double> meters(meterLength(channels));
+  const uint8_t* data = (const uint8_t*) node::Buffer::Data(info[0]);
+  uint32_t frameBytes = channels * bytesPerSample;
+  uint32_t frames = (uint32_t) (node::Buffer::Length(info[0]) / frameBytes);
+  for (uint32_t done = 0 ; done < frames ; done += packetFrames) {
+    uint32_t count = frames - done < packetFrames ? frames - done : packetFrames;
+    meter.process(data + (size_t) done * frameBytes, count, &meters[0]);
+  }
+
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("momentary").ToLocalChecked(), Nan::New(meters[meterMomentary]));
+  Nan::Set(result, Nan::New("shortTerm").ToLocalChecked(), Nan::New(meters[meterShortTerm]));
+  Nan::Set(result, Nan::New("integrated").ToLocalChecked(), Nan::New(meters[meterIntegrated]));
+  Nan::Set(result, Nan::New("sampleFrames").ToLocalChecked(), Nan::New(meters[meterSampleFrames]));
+  v8::Local<v8::Array> perChannel = Nan::New<v8::Array>(channels);
+  for (uint32_t c = 0 ; c < channels ; c++) {
+    const double* m = &meters[meterGlobalFields + c * meterChannelFields];
+    v8::Local<v8::Object> channel = Nan::New<v8::Object>();
+    Nan::Set(channel, Nan::New("peak").ToLocalChecked(), Nan::New(m[meterPeak]));
+    Nan::Set(channel, Nan::New("rms").ToLocalChecked(), Nan::New(m[meterRMS]));
+    Nan::Set(channel, Nan::New("truePeak").ToLocalChecked(), Nan::New(m[meterTruePeak]));
+    Nan::Set(perChannel, c, channel);
+  }
+  Nan::Set(result, Nan::New("channels").ToLocalChecked(), perChannel);
+  info.GetReturnValue().Set(result);
+}
+
+// writeWave(path, samples, channels, bits, sampleRate, bext[, riffLimit])
+//   -> true if the file was closed as RF64
+NAN_METHOD(WriteWave) {
+  if (info.Length() < 6 || !info[0]->IsString() || !node::Buffer::HasInstance(info[1]) ||
+      !info[5]->IsObject()) {
+    Nan::ThrowTypeError("Requires a path, samples, channels, bits, sample rate and bext.");
+    return;
+  }
+  Nan::Utf8String path(info[0]);
+  uint32_t channels = Nan::To<uint32_t>(info[2]).FromMaybe(0);
+  uint32_t bits = Nan::To<uint32_t>(info[3]).FromMaybe(0);
+  uint32_t sampleRate = Nan::To<uint32_t>(info[4]).FromMaybe(0);
+  v8::Local<v8::Object> options = Nan::To<v8::Object>(info[5]).ToLocalChecked();
+  BextInfo bext;
+  bext.description = stringOption(options, "description");
+  bext.originator = stringOption(options, "originator");
+  bext.originatorReference = stringOption(options, "originatorReference");
+  bext.date = stringOption(options, "date");
+  bext.time = stringOption(options, "time");
+  bext.timeReference = numberOption(options, "timeReference");
+  bext.codingHistory = stringOption(options, "codingHistory");
+  uint64_t riffLimit = info[6]->IsNumber() ?
+    (uint64_t) Nan::To<double>(info[6]).FromJust() : 0xffffffffULL;
+
+  WaveWriter writer(riffLimit);
+  // A small buffer, so that the samples are written in several pieces
+  if (!writer.open(*path, channels, bits, sampleRate, bext, 1000) ||
+      !writer.write((const uint8_t*) node::Buffer::Data(info[1]),
+        node::Buffer::Length(info[1])) ||
+      !writer.close()) {
+    Nan::ThrowError("Failed to write wave file.");
+    return;
+  }
+  info.GetReturnValue().Set(writer.isRF64());
+}
+
+static v8::Local<v8::Object> y4mFormatToObject(const Y4MFormat& format) {
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("width").ToLocalChecked(), Nan::New(format.width));
+  Nan::Set(result, Nan::New("height").ToLocalChecked(), Nan::New(format.height));
+  Nan::Set(result, Nan::New("rateNum").ToLocalChecked(), Nan::New(format.rateNum));
+  Nan::Set(result, Nan::New("rateDen").ToLocalChecked(), Nan::New(format.rateDen));
+  Nan::Set(result, Nan::New("interlace").ToLocalChecked(),
+    Nan::New(std::string(1, format.interlace)).ToLocalChecked());
+  Nan::Set(result, Nan::New("depth").ToLocalChecked(), Nan::New(format.depth));
+  Nan::Set(result, Nan::New("frameBytes").ToLocalChecked(),
+    Nan::New((double) y4mFrameBytes(format)));
+  return result;
+}
+
+static Y4MFormat objectToY4MFormat(v8::Local<v8::Object> options) {
+  Y4MFormat format;
+  format.width = numberOption(options, "width");
+  format.height = numberOption(options, "height");
+  format.rateNum = numberOption(options, "rateNum");
+  format.rateDen = numberOption(options, "rateDen");
+  std::string interlace = stringOption(options, "interlace");
+  format.interlace = interlace.empty() ? 'p' : interlace[0];
+  format.depth = numberOption(options, "depth");
+  return format;
+}
+
+// parseY4MHeader(line) -> format, or null if it is not a 4:2:2 stream
+NAN_METHOD(ParseY4MHeader) {
+  if (info.Length() < 1 || !info[0]->IsString()) {
+    Nan::ThrowTypeError("Requires a header line.");
+    return;
+  }
+  Nan::Utf8String line(info[0]);
+  Y4MFormat format;
+  if (parseY4MHeader(std::string(*line, line.length()), &format))
+    info.GetReturnValue().Set(y4mFormatToObject(format));
+  else
+    info.GetReturnValue().SetNull();
+}
+
+// y4mHeader(format) -> header line, with its newline
+NAN_METHOD(Y4MHeader) {
+  if (info.Length() < 1 || !info[0]->IsObject()) {
+    Nan::ThrowTypeError("Requires a format.");
+    return;
+  }
+  Y4MFormat format = objectToY4MFormat(Nan::To<v8::Object>(info[0]).ToLocalChecked());
+  info.GetReturnValue().Set(Nan::New(y4mHeader(format)).ToLocalChecked());
+}
+
+// packedToY4M(frame, width, height, pixelFormat, depth) -> planes
+NAN_METHOD(PackedToY4M) {
+  uint32_t width, height, pixelFormat;
+  if (!frameArgs(info, &width, &height, &pixelFormat)) return;
+  Y4MFormat format = { width, height, 25, 1, 'p', Nan::To<uint32_t>(info[4]).FromMaybe(10) };
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat, width);
+  if (!isYUV422Format(pixelFormat) || (format.depth != 8 && format.depth != 10) ||
+      node::Buffer::Length(info[0]) < (size_t) rowBytes * height) {
+    Nan::ThrowRangeError("Unsupported frame.");
+    return;
+  }
+  v8::Local<v8::Object> planes = Nan::NewBuffer((uint32_t) y4mFrameBytes(format)).ToLocalChecked();
+  packedToY4M(pixelFormat, (const uint8_t*) node::Buffer::Data(info[0]), rowBytes,
+    format, (uint8_t*) node::Buffer::Data(planes));
+  info.GetReturnValue().Set(planes);
+}
+
+// y4mToPacked(planes, width, height, pixelFormat, depth) -> frame
+NAN_METHOD(Y4MToPacked) {
+  uint32_t width, height, pixelFormat;
+  if (!frameArgs(info, &width, &height, &pixelFormat)) return;
+  Y4MFormat format = { width, height, 25, 1, 'p', Nan::To<uint32_t>(info[4]).FromMaybe(10) };
+  uint32_t rowBytes = rowBytesForFormat(pixelFormat, width);
+  if (!isYUV422Format(pixelFormat) || (format.depth != 8 && format.depth != 10) ||
+      node::Buffer::Length(info[0]) < y4mFrameBytes(format)) {
+    Nan::ThrowRangeError("Unsupported frame.");
+    return;
+  }
+  v8::Local<v8::Object> frame = Nan::NewBuffer(rowBytes * height).ToLocalChecked();
+  memset(node::Buffer::Data(frame), 0, rowBytes * height);
+  y4mToPacked(pixelFormat, (const uint8_t*) node::Buffer::Data(info[0]), format,
+    (uint8_t*) node::Buffer::Data(frame), rowBytes);
+  info.GetReturnValue().Set(frame);
+}
+
+// readY4M(path, width, height, pixelFormat) -> { frames, error }, reading the
+// whole stream through a Y4MReader
+NAN_METHOD(ReadY4M) {
+  if (info.Length() < 4 || !info[0]->IsString()) {
+    Nan::ThrowTypeError("Requires a path, width, height and pixel format.");
+    return;
+  }
+  Nan::Utf8String path(info[0]);
+  uint32_t width = Nan::To<uint32_t>(info[1]).FromMaybe(0);
+  uint32_t height = Nan::To<uint32_t>(info[2]).FromMaybe(0);
+  uint32_t pixelFormat = Nan::To<uint32_t>(info[3]).FromMaybe(0);
+  std::string error;
+  int fd = openY4MPath(*path, false, error);
+  Y4MReader reader;
+  if (fd < 0 || !reader.open(fd, true, pixelFormat, width, height, 2)) {
+    Nan::ThrowError(error.empty() ? "Failed to open Y4M stream." : error.c_str());
+    return;
+  }
+  size_t frameBytes = (size_t) rowBytesForFormat(pixelFormat, width) * height;
+  std::vector<uint8_t> frame(frameBytes);
+  v8::Local<v8::Array> frames = Nan::New<v8::Array>();
+  for (;;) {
+    // Frames queued before the end was seen are still to be taken
+    bool ended = reader.status().ended;
+    if (reader.next(&frame[0])) {
+      Nan::Set(frames, frames->Length(),
+        Nan::CopyBuffer((const char*) &frame[0], (uint32_t) frameBytes).ToLocalChecked());
+      continue;
+    }
+    if (ended) break;
+#ifdef WIN32
+    Sleep(1);
+#else
+    usleep(1000);
+#endif
+  }
+  Y4MReader::Status status = reader.status();
+  reader.close();
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  Nan::Set(result, Nan::New("frames").ToLocalChecked(), frames);
+  if (status.failed)
+    Nan::Set(result, Nan::New("error").ToLocalChecked(), Nan::New(status.error).ToLocalChecked());
+  info.GetReturnValue().Set(result);
+}
+
+} // namespace streampunk
+
+NAN_MODULE_INIT(Init) {
+  Nan::Export(target, "testPattern", streampunk::TestPattern);
+  Nan::Export(target, "hashBuffer", streampunk::HashBuffer);
+  Nan::Export(target, "compareFrames", streampunk::CompareFrames);
+  Nan::Export(target, "losslessEncode", streampunk::LosslessEncode);
+  Nan::Export(target, "losslessDecode", streampunk::LosslessDecode);
+  Nan::Export(target, "meterAudio", streampunk::MeterAudio);
+  Nan::Export(target, "writeWave", streampunk::WriteWave);
+  Nan::Export(target, "parseY4MHeader", streampunk::ParseY4MHeader);
+  Nan::Export(target, "y4mHeader", streampunk::Y4MHeader);
+  Nan::Export(target, "packedToY4M", streampunk::PackedToY4M);
+  Nan::Export(target, "y4mToPacked", streampunk::Y4MToPacked);
+  Nan::Export(target, "readY4M", streampunk::ReadY4M);
+}
+
+NAN_MODULE_WORKER_ENABLED(kernels, Init)
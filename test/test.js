@@ -0,0 +1,462 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Tests of the processing kernels that need no card, run with `npm test`.
+// The kernels are built into an addon of their own by test/binding.gyp.
+
+var assert = require('assert');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var kernels = require('bindings')({ bindings: 'kernels', module_root: __dirname });
+
+function bmCodeToInt (s) {
+  return Buffer.from(s.substring(0, 4)).readUInt32BE(0);
+}
+
+var format2vuy = bmCodeToInt('2vuy');
+var formatV210 = bmCodeToInt('v210');
+
+var tests = [];
+
+function test (name, fn) {
+  tests.push({ name: name, fn: fn });
+}
+
+function near (actual, expected, tolerance, what) {
+  assert.ok(Math.abs(actual - expected) <= tolerance,
+    what + ' is ' + actual + ', expected ' + expected + ' +/- ' + tolerance);
+}
+
+// The same noise on every run
+function noise (seed) {
+  var x = seed >>> 0 || 1;
+  return function () {
+    x ^= x << 13; x >>>= 0;
+    x ^= x >>> 17;
+    x ^= x << 5; x >>>= 0;
+    return x;
+  };
+}
+
+function tempPath (name) {
+  return path.join(os.tmpdir(), 'macadam-test-' + process.pid + '-' + name);
+}
+
+// v210 words of random samples, spare bits clear, for widths of whole blocks
+function v210Noise (width, height, seed) {
+  var random = noise(seed);
+  var frame = Buffer.alloc(width / 6 * 16 * height);
+  for (var x = 0 ; x < frame.length ; x += 4)
+    frame.writeUInt32LE(random() & 0x3fffffff, x);
+  return frame;
+}
+
+// A frame of one luma and one chroma value
+function flatFrame (pixelFormat, width, height, y, c) {
+  var frame;
+  if (pixelFormat === format2vuy) {
+    frame = Buffer.alloc(width * 2 * height);
+    for (var x = 0 ; x < frame.length ; x += 2) {
+      frame[x] = c;
+      frame[x + 1] = y;
+    }
+    return frame;
+  }
+  frame = Buffer.alloc(width / 6 * 16 * height);
+  var even = (c | (y << 10) | (c << 20)) >>> 0;
+  var odd = (y | (c << 10) | (y << 20)) >>> 0;
+  for (var w = 0 ; w < frame.length / 4 ; w++)
+    frame.writeUInt32LE(w & 1 ? odd : even, w * 4);
+  return frame;
+}
+
+test('lossless round trip of test patterns', function () {
+  [ [ format2vuy, 1920, 1080 ], [ formatV210, 1920, 1080 ], [ formatV210, 1280, 720 ],
+    [ formatV210, 720, 576 ] ].forEach(function (f) {
+    // Bars code to around a tenth, the busy zone plate to around a half
+    [ [ 'smpte', 0.25 ], [ 'zoneplate', 0.75 ] ].forEach(function (p) {
+      var pattern = p[0];
+      var frame = kernels.testPattern(f[1], f[2], f[0], pattern, 7, true, true);
+      var coded = kernels.losslessEncode(frame, f[1], f[2], f[0]);
+      assert.ok(coded.length < frame.length * p[1], pattern + ' does not compress');
+      var decoded = kernels.losslessDecode(coded, frame.length);
+      assert.ok(decoded !== null && decoded.equals(frame),
+        pattern + ' at ' + f[1] + 'x' + f[2] + ' does not round trip');
+    });
+  });
+});
+
+test('lossless round trip of noise', function () {
+  var random = noise(1);
+  var frame = Buffer.alloc(1920 * 2 * 1080);
+  for (var x = 0 ; x < frame.length ; x++) frame[x] = random() & 0xff;
+  var coded = kernels.losslessEncode(frame, 1920, 1080, format2vuy);
+  assert.ok(kernels.losslessDecode(coded, frame.length).equals(frame), '2vuy noise');
+
+  frame = v210Noise(1920, 1080, 2);
+  coded = kernels.losslessEncode(frame, 1920, 1080, formatV210);
+  assert.ok(kernels.losslessDecode(coded, frame.length).equals(frame), 'v210 noise');
+});
+
+test('lossless decode rejects damaged frames', function () {
+  var frame = kernels.testPattern(1280, 720, formatV210, 'ebu');
+  var coded = kernels.losslessEncode(frame, 1280, 720, formatV210);
+  assert.strictEqual(kernels.losslessDecode(coded.slice(0, coded.length - 1), frame.length), null);
+  assert.strictEqual(kernels.losslessDecode(coded, frame.length - 16), null);
+  assert.strictEqual(kernels.losslessDecode(Buffer.alloc(64), frame.length), null);
+});
+
+// Bitwise CRC32C, to check the table and instruction paths on odd lengths
+function crc32c (buffer) {
+  var crc = 0xffffffff;
+  for (var x = 0 ; x < buffer.length ; x++) {
+    crc ^= buffer[x];
+    for (var b = 0 ; b < 8 ; b++)
+      crc = (crc >>> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+  }
+  return ('0000000' + ((crc ^ 0xffffffff) >>> 0).toString(16)).slice(-8);
+}
+
+test('hash vectors', function () {
+  var ascending = Buffer.alloc(32);
+  var descending = Buffer.alloc(32);
+  for (var x = 0 ; x < 32 ; x++) {
+    ascending[x] = x;
+    descending[x] = 31 - x;
+  }
+  // CRC32C check value and the iSCSI vectors of RFC 3720
+  assert.strictEqual(kernels.hashBuffer(Buffer.from('123456789'), 'crc32c'), 'e3069283');
+  assert.strictEqual(kernels.hashBuffer(Buffer.alloc(32), 'crc32c'), '8a9136aa');
+  assert.strictEqual(kernels.hashBuffer(Buffer.alloc(32, 0xff), 'crc32c'), '62a8ab43');
+  assert.strictEqual(kernels.hashBuffer(ascending, 'crc32c'), '46dd794e');
+  assert.strictEqual(kernels.hashBuffer(descending, 'crc32c'), '113fdb5c');
+
+  var random = noise(3);
+  var data = Buffer.alloc(4099);
+  for (x = 0 ; x < data.length ; x++) data[x] = random() & 0xff;
+  [ 0, 1, 7, 8, 9, 63, 4096 ].forEach(function (length) {
+    var part = data.slice(3, 3 + length);
+    assert.strictEqual(kernels.hashBuffer(part, 'crc32c'), crc32c(part), 'length ' + length);
+  });
+
+  // xxHash64 with seed 0, short and long inputs
+  assert.strictEqual(kernels.hashBuffer(Buffer.alloc(0)), 'ef46db3751d8e999');
+  assert.strictEqual(kernels.hashBuffer(Buffer.from('a'), 'xxh64'), 'd24ec4f1a98c6e5b');
+  assert.strictEqual(kernels.hashBuffer(Buffer.from('abc'), 'xxh64'), '44bc2cf5ad770999');
+  assert.strictEqual(kernels.hashBuffer(Buffer.from('Nobody inspects the spammish repetition'),
+    'xxh64'), 'fbcea83c8a378bf1');
+});
+
+// Interleaved 32-bit sine, on the channels in mask
+function sine (frequency, level, seconds, channels, mask, sampleRate) {
+  var frames = Math.round(seconds * sampleRate);
+  var amplitude = Math.pow(10, level / 20) * 2147483647;
+  var samples = Buffer.alloc(frames * channels * 4);
+  for (var f = 0 ; f < frames ; f++) {
+    var value = Math.round(amplitude * Math.sin(2 * Math.PI * frequency * f / sampleRate));
+    for (var c = 0 ; c < channels ; c++)
+      if (mask & (1 << c))
+        samples.writeInt32LE(value, (f * channels + c) * 4);
+  }
+  return samples;
+}
+
+test('R128 loudness of EBU Tech 3341 tones', function () {
+  // Cases 1 and 2, stereo 1kHz at -23 and -33dBFS
+  [ -23, -33 ].forEach(function (level) {
+    var meters = kernels.meterAudio(sine(1000, level, 20, 2, 3, 48000), 48000, 2, 4, 1920);
+    near(meters.momentary, level, 0.1, 'momentary at ' + level);
+    near(meters.shortTerm, level, 0.1, 'short-term at ' + level);
+    near(meters.integrated, level, 0.1, 'integrated at ' + level);
+  });
+
+  // Case 4, where the gates leave out the quiet parts
+  var meters = kernels.meterAudio(Buffer.concat([ -72, -36, -23, -36, -72 ].map(
+    function (level, x) { return sine(1000, level, x === 2 ? 60 : 10, 2, 3, 48000); })),
+  48000, 2, 4, 1920);
+  near(meters.integrated, -23, 0.1, 'gated integrated');
+
+  // 16-bit samples, which the card delivers as well
+  var samples = sine(1000, -23, 10, 2, 3, 48000);
+  var short = Buffer.alloc(samples.length / 2);
+  for (var x = 0 ; x < short.length / 2 ; x++)
+    short.writeInt16LE(samples.readInt32LE(x * 4) >> 16, x * 2);
+  near(kernels.meterAudio(short, 48000, 2, 2, 1920).integrated, -23, 0.1, '16-bit integrated');
+});
+
+test('levels of a sine', function () {
+  // The RMS meter reads a full scale square wave as 0dB, so a sine is 3dB down
+  var meters = kernels.meterAudio(sine(1000, -20, 2, 2, 1, 48000), 48000, 2, 4, 1920);
+  near(meters.channels[0].peak, -20, 0.01, 'peak');
+  near(meters.channels[0].rms, -23.01, 0.05, 'RMS');
+  near(meters.channels[0].truePeak, -20, 0.1, 'true peak');
+  assert.strictEqual(meters.channels[1].peak, -Infinity);
+  // One channel of two is 3dB below the same tone on both
+  near(meters.integrated, -23.01, 0.1, 'integrated of one channel');
+});
+
+test('PSNR and SSIM of identical frames', function (done) {
+  var frame = kernels.testPattern(1920, 1080, formatV210, 'zoneplate', 3);
+  kernels.compareFrames(frame, Buffer.from(frame), 1920, 1080, formatV210, true, function (err, q) {
+    assert.ifError(err);
+    [ 'y', 'cb', 'cr' ].forEach(function (plane) {
+      assert.strictEqual(q[plane].mse, 0);
+      assert.strictEqual(q[plane].psnr, Infinity);
+      assert.strictEqual(q[plane].ssim, 1);
+    });
+    done();
+  });
+});
+
+test('PSNR and SSIM of a luma offset', function (done) {
+  // Flat planes have no variance, so SSIM is only the luminance term
+  function flatSSIM (a, b, peak) {
+    var c1 = Math.pow(0.01 * peak, 2);
+    return (2 * a * b + c1) / (a * a + b * b + c1);
+  }
+  var a = flatFrame(format2vuy, 1920, 1080, 128, 128);
+  var b = flatFrame(format2vuy, 1920, 1080, 138, 128);
+  kernels.compareFrames(a, b, 1920, 1080, format2vuy, true, function (err, q) {
+    assert.ifError(err);
+    near(q.y.mse, 100, 1e-9, '8-bit MSE');
+    near(q.y.psnr, 10 * Math.log10(255 * 255 / 100), 1e-9, '8-bit PSNR');
+    near(q.y.ssim, flatSSIM(128, 138, 255), 1e-9, '8-bit SSIM');
+    assert.strictEqual(q.cb.psnr, Infinity);
+
+    a = flatFrame(formatV210, 1920, 1080, 512, 512);
+    b = flatFrame(formatV210, 1920, 1080, 516, 500);
+    kernels.compareFrames(a, b, 1920, 1080, formatV210, true, function (err, q) {
+      assert.ifError(err);
+      near(q.y.mse, 16, 1e-9, '10-bit luma MSE');
+      near(q.y.psnr, 10 * Math.log10(1023 * 1023 / 16), 1e-9, '10-bit PSNR');
+      near(q.cr.mse, 144, 1e-9, '10-bit chroma MSE');
+      near(q.cr.ssim, flatSSIM(512, 500, 1023), 1e-9, '10-bit chroma SSIM');
+      done();
+    });
+  });
+});
+
+function chunkAt (file, offset, tag) {
+  assert.strictEqual(file.toString('ascii', offset, offset + 4), tag, tag + ' chunk');
+  return file.readUInt32LE(offset + 4);
+}
+
+function stereoSamples (frames) {
+  var samples = Buffer.alloc(frames * 4);
+  for (var x = 0 ; x < samples.length / 2 ; x++)
+    samples.writeInt16LE((x * 37) % 65536 - 32768, x * 2);
+  return samples;
+}
+
+var bext = {
+  description: 'Tone', originator: 'macadam', originatorReference: 'REF1234',
+  date: '2017-06-01', time: '10:00:00', timeReference: 1728000000,
+  codingHistory: 'A=PCM,F=48000,W=16,M=stereo\r\n'
+};
+
+test('BWF header layout', function () {
+  var name = tempPath('bwf.wav');
+  var samples = stereoSamples(1001);
+  assert.strictEqual(kernels.writeWave(name, samples, 2, 16, 48000, bext), false);
+  var file = fs.readFileSync(name);
+  fs.unlinkSync(name);
+
+  assert.strictEqual(chunkAt(file, 0, 'RIFF'), file.length - 8);
+  assert.strictEqual(file.toString('ascii', 8, 12), 'WAVE');
+  // Room for a ds64 chunk, should the file pass 4GB
+  assert.strictEqual(chunkAt(file, 12, 'JUNK'), 28);
+  assert.ok(file.slice(20, 48).equals(Buffer.alloc(28)));
+
+  assert.strictEqual(chunkAt(file, 48, 'fmt '), 16);
+  assert.strictEqual(file.readUInt16LE(56), 1); // PCM
+  assert.strictEqual(file.readUInt16LE(58), 2);
+  assert.strictEqual(file.readUInt32LE(60), 48000);
+  assert.strictEqual(file.readUInt32LE(64), 192000);
+  assert.strictEqual(file.readUInt16LE(68), 4);
+  assert.strictEqual(file.readUInt16LE(70), 16);
+
+  var history = bext.codingHistory.length;
+  assert.strictEqual(chunkAt(file, 72, 'bext'), 602 + history);
+  assert.strictEqual(file.toString('ascii', 80, 84), 'Tone');
+  assert.strictEqual(file[84], 0);
+  assert.strictEqual(file.toString('ascii', 336, 343), 'macadam');
+  assert.strictEqual(file.toString('ascii', 368, 375), 'REF1234');
+  assert.strictEqual(file.toString('ascii', 400, 410), '2017-06-01');
+  assert.strictEqual(file.toString('ascii', 410, 418), '10:00:00');
+  assert.strictEqual(file.readUInt32LE(418), 1728000000);
+  assert.strictEqual(file.readUInt32LE(422), 0);
+  assert.strictEqual(file.readUInt16LE(426), 1); // version
+  assert.strictEqual(file.toString('ascii', 682, 682 + history), bext.codingHistory);
+
+  // The chunk size leaves out the pad byte after an odd coding history
+  var data = 682 + history + (history & 1);
+  assert.strictEqual(chunkAt(file, data, 'data'), samples.length);
+  assert.ok(file.slice(data + 8).equals(samples));
+});
+
+test('WAVE_FORMAT_EXTENSIBLE and odd data', function () {
+  // More than 16 bits, so extensible, and one sample of three bytes
+  var name = tempPath('extensible.wav');
+  kernels.writeWave(name, Buffer.from([ 1, 2, 3 ]), 1, 24, 48000, {});
+  var file = fs.readFileSync(name);
+  assert.strictEqual(chunkAt(file, 48, 'fmt '), 40);
+  assert.strictEqual(file.readUInt16LE(56), 0xfffe);
+  assert.strictEqual(file.readUInt16LE(58), 1);
+  assert.strictEqual(file.readUInt16LE(68), 3);
+  assert.strictEqual(file.readUInt16LE(70), 24);
+  assert.strictEqual(file.readUInt16LE(72), 22);
+  assert.strictEqual(file.readUInt16LE(74), 24);
+  assert.strictEqual(file.readUInt32LE(76), 0);
+  assert.strictEqual(file.toString('hex', 80, 96), '0100000000001000800000aa00389b71');
+  assert.strictEqual(chunkAt(file, 96, 'bext'), 602);
+  // The data chunk is padded to an even length
+  assert.strictEqual(chunkAt(file, 706, 'data'), 3);
+  assert.strictEqual(file.length, 706 + 8 + 4);
+  assert.strictEqual(file[717], 0);
+  assert.strictEqual(chunkAt(file, 0, 'RIFF'), file.length - 8);
+
+  // More than two channels
+  var samples = Buffer.alloc(6 * 3 * 5, 0x55);
+  kernels.writeWave(name, samples, 6, 24, 48000, {});
+  file = fs.readFileSync(name);
+  fs.unlinkSync(name);
+  assert.strictEqual(file.readUInt16LE(56), 0xfffe);
+  assert.strictEqual(file.readUInt16LE(58), 6);
+  assert.strictEqual(file.readUInt16LE(68), 18);
+  assert.strictEqual(chunkAt(file, 706, 'data'), samples.length);
+});
+
+test('RF64 header layout', function () {
+  // A low limit stands in for 4GB
+  var name = tempPath('rf64.wav');
+  var samples = stereoSamples(1001);
+  assert.strictEqual(kernels.writeWave(name, samples, 2, 16, 48000, bext, 2000), true);
+  var file = fs.readFileSync(name);
+  fs.unlinkSync(name);
+
+  assert.strictEqual(chunkAt(file, 0, 'RF64'), 0xffffffff);
+  assert.strictEqual(file.toString('ascii', 8, 12), 'WAVE');
+  assert.strictEqual(chunkAt(file, 12, 'ds64'), 28);
+  assert.strictEqual(file.readUInt32LE(20), file.length - 8); // RIFF size
+  assert.strictEqual(file.readUInt32LE(24), 0);
+  assert.strictEqual(file.readUInt32LE(28), samples.length); // data size
+  assert.strictEqual(file.readUInt32LE(32), 0);
+  assert.strictEqual(file.readUInt32LE(36), 1001); // sample count
+  assert.strictEqual(file.readUInt32LE(40), 0);
+  assert.strictEqual(file.readUInt32LE(44), 0); // table length
+  var data = 682 + bext.codingHistory.length + (bext.codingHistory.length & 1);
+  assert.strictEqual(chunkAt(file, data, 'data'), 0xffffffff);
+  assert.ok(file.slice(data + 8).equals(samples));
+});
+
+test('Y4M header parse', function () {
+  var format = kernels.parseY4MHeader('YUV4MPEG2 W1920 H1080 F30000:1001 It A1:1 C422p10 XYSCSS=422P10');
+  assert.deepStrictEqual(format, { width: 1920, height: 1080, rateNum: 30000,
+    rateDen: 1001, interlace: 't', depth: 10, frameBytes: 1920 * 1080 * 2 * 2 });
+  format = kernels.parseY4MHeader('YUV4MPEG2 C422 W1279 H720 F50:1');
+  assert.strictEqual(format.depth, 8);
+  assert.strictEqual(format.interlace, 'p');
+  // Odd widths round the chroma planes up
+  assert.strictEqual(format.frameBytes, (1279 + 640 * 2) * 720);
+
+  assert.strictEqual(kernels.parseY4MHeader('YUV4MPEG2 W1920 H1080 F25:1 C420jpeg'), null);
+  assert.strictEqual(kernels.parseY4MHeader('YUV4MPEG2 W1920 H1080 F25:1'), null);
+  assert.strictEqual(kernels.parseY4MHeader('YUV4MPEG2 H1080 C422'), null);
+  assert.strictEqual(kernels.parseY4MHeader('YUV4MPEG W1920 H1080 C422'), null);
+
+  [ { width: 720, height: 576, rateNum: 25, rateDen: 1, interlace: 'b', depth: 10 },
+    { width: 3840, height: 2160, rateNum: 60000, rateDen: 1001, interlace: 'p', depth: 8 } ]
+    .forEach(function (f) {
+      var header = kernels.y4mHeader(f);
+      assert.strictEqual(header[header.length - 1], '\n');
+      var parsed = kernels.parseY4MHeader(header.slice(0, -1));
+      delete parsed.frameBytes;
+      assert.deepStrictEqual(parsed, f);
+    });
+});
+
+test('Y4M planes round trip', function () {
+  [ [ formatV210, 10 ], [ format2vuy, 8 ] ].forEach(function (f) {
+    var frame = kernels.testPattern(1920, 1080, f[0], 'zoneplate', 5, true);
+    var planes = kernels.packedToY4M(frame, 1920, 1080, f[0], f[1]);
+    assert.strictEqual(planes.length, 1920 * 1080 * 2 * (f[1] === 10 ? 2 : 1));
+    assert.ok(kernels.y4mToPacked(planes, 1920, 1080, f[0], f[1]).equals(frame));
+  });
+});
+
+test('Y4M stream read', function () {
+  var name = tempPath('stream.y4m');
+  var frames = [ 1, 2, 3 ].map(function (x) {
+    return kernels.testPattern(1280, 720, formatV210, 'zoneplate', x, true);
+  });
+  fs.writeFileSync(name, Buffer.concat([
+    Buffer.from('YUV4MPEG2 W1280 H720 F50:1 Ip A1:1 C422p10\n') ].concat(
+    frames.map(function (frame, x) {
+      // Frame parameters after FRAME are allowed, and ignored
+      return Buffer.concat([ Buffer.from(x === 1 ? 'FRAME Ixyz\n' : 'FRAME\n'),
+        kernels.packedToY4M(frame, 1280, 720, formatV210, 10) ]);
+    }))));
+  var result = kernels.readY4M(name, 1280, 720, formatV210);
+  assert.strictEqual(result.error, undefined);
+  assert.strictEqual(result.frames.length, 3);
+  result.frames.forEach(function (frame, x) {
+    assert.ok(frame.equals(frames[x]), 'frame ' + x);
+  });
+
+  result = kernels.readY4M(name, 1920, 1080, formatV210);
+  fs.unlinkSync(name);
+  assert.strictEqual(result.frames.length, 0);
+  assert.strictEqual(result.error, 'Y4M stream is 1280x720, playback is 1920x1080.');
+});
+
+var failed = 0;
+
+function run (index) {
+  if (index >= tests.length) {
+    console.log('# ' + (tests.length - failed) + ' of ' + tests.length + ' passed');
+    process.exit(failed > 0 ? 1 : 0);
+  }
+  var t = tests[index];
+  function finish (err) {
+    if (err) {
+      failed++;
+      console.log('not ok ' + (index + 1) + ' - ' + t.name);
+      console.log('  ' + (err.stack || err).toString().split('\n').join('\n  '));
+    } else {
+      console.log('ok ' + (index + 1) + ' - ' + t.name);
+    }
+    setImmediate(run, index + 1);
+  }
+  process.once('uncaughtException', finish);
+  try {
+    if (t.fn.length > 0) {
+      t.fn(function () {
+        process.removeListener('uncaughtException', finish);
+        finish();
+      });
+    } else {
+      t.fn();
+      process.removeListener('uncaughtException', finish);
+      finish();
+    }
+  } catch (err) {
+    process.removeListener('uncaughtException', finish);
+    finish(err);
+  }
+}
+
+console.log('1..' + tests.length);
+run(0);